@@ -10,14 +10,16 @@ import argparse
 import time
 import itertools
 import json
+import hashlib
 import pprint
 import collections
 import threading
 from progressbar import *
-from shutil import copyfile
+from shutil import copyfile, copyfileobj, rmtree
 from string import maketrans
-from multiprocessing import Pool
+from multiprocessing import Pool, cpu_count
 from progress.bar import *
+import cmAdapter
 
 
 #All functions that has options go here
@@ -240,6 +242,9 @@ def build_parser():
     parser.add_argument('--sequence_len', '-l', default='3', help='Number of critical ops in the bugy workload')
     parser.add_argument('--nested', '-n', default='False', help='Add an extra level of nesting?')
     parser.add_argument('--demo', '-d', default='False', help='Create a demo workload set?')
+    parser.add_argument('--jobs', '-j', default=cpu_count(), type=int, help='Number of processes generating workloads. Default = number of cores')
+    parser.add_argument('--shard_len', '-s', default=0, type=int, help='Length of the operation prefix each shard of the workload set starts with. Default = 2 for sequences of 3 or more ops, else 1')
+    parser.add_argument('--dedup', '-u', default='True', help='Drop workloads that only differ from an earlier one by the names of the files they use?')
 
     return parser
 
@@ -250,6 +255,8 @@ def print_setup(parsed_args):
     print '{0:20}  {1}'.format('Sequence length', parsed_args.sequence_len)
     print '{0:20}  {1}'.format('Nested', parsed_args.nested)
     print '{0:20}  {1}'.format('Demo', parsed_args.demo)
+    print '{0:20}  {1}'.format('Jobs', parsed_args.jobs)
+    print '{0:20}  {1}'.format('Dedup', parsed_args.dedup)
     print '\n', '='*48, '\n'
 
 
@@ -333,8 +340,7 @@ def buildTuple(command):
 # Given a restricted list of files, this function builds all combinations of input parameters to persistence operations.
 # Once the parameters to core-ops are picked, it is not required to persist a file totally unrelated to the set of used files in the workload. So we can restrict the set of files for persistence to either related files(includes the parent and siblings of files used in the workload) or further restrict it to strictly pick from the set of used files only.
 # We can optionally add a persistence point after each core-FS op, except for the last one. The last core-op must be followed by a persistence op, so that we don't truncate it to a workload of lower sequence.
-def buildCustomTuple(file_list):
-    global num_ops
+def buildCustomTuple(file_list, num_ops):
     
     d = list(file_list)
     fsync = ('fsync',)
@@ -1045,45 +1051,94 @@ def buildJlang(op_list, length_map):
     return command_str
 
 
+# Map from the names j-lang files use for files to their paths, as listed in the
+# define section of the j-lang file. The test directory is the root, ''.
+def readNameMap(j_lang_file):
+    name_map = {}
+    section = ''
+    with open(j_lang_file) as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith('#'):
+                section = line[1:].strip()
+            elif section == 'define' and line:
+                name_map[line.replace('/', '')] = '' if line == 'test' else line
+    return name_map
+
+
+# Key that identifies a workload up to the names of the files it uses. The files
+# are renamed in the order the workload first uses them, each keeping the same
+# parent directory, so a workload that uses A/foo and one that does the same
+# with B/foo get the same key, while foo and A/foo stay different.
+def canonicalKey(run_lines, name_map):
+    canonical = {'' : 'test'}
+    num_children = collections.defaultdict(int)
+
+    def rename(path):
+        if path not in canonical:
+            parent = path.rsplit('/', 1)[0] if '/' in path else ''
+            parent_name = rename(parent)
+            canonical[path] = parent_name + '/' + str(num_children[parent_name])
+            num_children[parent_name] += 1
+        return canonical[path]
+
+    ops = list()
+    for cur_line in run_lines:
+        for op in cur_line.split('\n'):
+            ops.append(' '.join(rename(name_map[word]) if word in name_map else word for word in op.split()))
+    return hashlib.sha1('\n'.join(ops)).hexdigest()
+
+
+# Everything one shard of the workload set needs to generate its workloads.
+# Each shard numbers its workloads from 1 and keeps them in its own directory
+# until they are merged into the final workload set.
+class ShardState(object):
+    def __init__(self, config, out_dir):
+        self.num_ops = config['num_ops']
+        self.demo = config['demo']
+        self.parameterList = config['parameterList']
+        self.dest_dir = config['dest_dir']
+        self.name_map = config['name_map']
+        self.dedup = config['dedup']
+        self.out_dir = out_dir
+        self.log_file_handle = open(out_dir + '/log', 'w')
+        self.manifest = open(out_dir + '/manifest', 'w')
+        # Skeletons and workloads generated so far
+        self.count = 0
+        self.global_count = 0
+        # Canonical keys of the workloads generated so far, and the number of
+        # workloads dropped because they had the key of an earlier one
+        self.seen = set()
+        self.duplicates = 0
+
+    def close(self):
+        self.log_file_handle.close()
+        self.manifest.close()
+
+
 # Main function that exhaustively generates combinations of ops.
-def doPermutation(perm):
-    
-    global global_count
-    global parameterList
-    global num_ops
-    global nested
-    global demo
-    global syncPermutations
-    global count
-    global permutations
-    global SyncSet
-    global log_file_handle
-    global count_param
-    
-    dest_dir = 'seq'+num_ops
-    
-    if nested:
-        dest_dir += '_nested'
+def doPermutation(perm, state):
     
-    if demo:
-        dest_dir += '_demo'
+    num_ops = state.num_ops
+    demo = state.demo
+    parameterList = state.parameterList
+    log_file_handle = state.log_file_handle
+    dest_dir = state.dest_dir
 
-    
     # Hacks to reduce the workload set (#1):
     # Eliminate workloads of seq-3 in which all three core-ops are write, because we have a write specific workload generator to explore these cases.
     if int(num_ops)==3 and len(set(perm)) == 1 and list(set(perm))[0] == 'write':
         return
 
-    permutations.append(perm)
     log = ', '.join(perm);
-    log = '\n' + `count` + ' : ' + log + '\n'
-    count +=1
+    log = '\n' + `state.count` + ' : ' + log + '\n'
+    state.count +=1
     log_file_handle.write(log)
         
     #Now for each of this permutation of file-system operations, find all possible permutation of paramters
     combination = list()
-    for length in xrange(0,len(permutations[count-1])):
-        combination.append(parameterList[permutations[count-1][length]])
+    for length in xrange(0,len(perm)):
+        combination.append(parameterList[perm[length]])
 
     count_param = 0
 
@@ -1134,9 +1189,9 @@ def doPermutation(perm):
 
         #For lower sequences, let's allow fsync on any related file - sibling/parent
         if int(num_ops) < 3 and not demo:
-            syncPermutationsCustom = buildCustomTuple(file_range(usedFiles))
+            syncPermutationsCustom = buildCustomTuple(file_range(usedFiles), num_ops)
         else:
-            syncPermutationsCustom = buildCustomTuple(usedFiles)
+            syncPermutationsCustom = buildCustomTuple(usedFiles, num_ops)
 
         # Logging the list of used files
         log = '\n\t\tUsed Files = {0}\n'.format(usedFiles)
@@ -1153,9 +1208,8 @@ def doPermutation(perm):
         for insSync in range(0, len(syncPermutationsCustom)):
             if int(num_ops) < 4:
                 log = '{0}'.format(syncPermutationsCustom[insSync]);
-                log = '\n\t\tFile # ' + `global_count` + ' : ' + `count_sync` + ' : ' + log + '\n'
+                log = '\n\t\tFile # ' + `state.global_count` + ' : ' + `count_sync` + ' : ' + log + '\n'
                 log_file_handle.write(log)
-            global_count +=1
             count_sync+=1
             seq = []
             
@@ -1229,69 +1283,109 @@ def doPermutation(perm):
                     modified_pos += 1
 
             #--------------Now build the j-lang file-------------------
-            j_lang_file = 'j-lang' + str(global_count)
+            length_map = {}
+            run_lines = list()
+            for insert in xrange(0, len(modified_sequence)):
+                run_lines.append(buildJlang(modified_sequence[insert], length_map))
+
+            # Drop the workload if it only renames the files of one we already have
+            key = canonicalKey(run_lines, state.name_map)
+            if state.dedup and key in state.seen:
+                state.duplicates += 1
+                log_file_handle.write('\n\t\t\tDuplicate workload dropped\n')
+                continue
+            state.seen.add(key)
+            state.global_count +=1
+
+            j_lang_file = state.out_dir + '/j-lang' + str(state.global_count)
             source_j_lang_file = '../code/tests/' + dest_dir + '/base-j-lang'
             copyfile(source_j_lang_file, j_lang_file)
-            length_map = {}
 
             with open(j_lang_file, 'a') as f:
                 run_line = '\n\n# run\n'
                 f.write(run_line)
 
-                for insert in xrange(0, len(modified_sequence)):
-                    cur_line = buildJlang(modified_sequence[insert], length_map)
+                for cur_line in run_lines:
                     cur_line_log = '{0}'.format(cur_line) + '\n'
                     f.write(cur_line_log)
 
             f.close()
 
-            exec_command = 'python cmAdapter.py -b ../code/tests/' + dest_dir + '/base.cpp -t ' + j_lang_file + ' -p ../code/tests/' + dest_dir + '/ -o ' + str(global_count)
-            subprocess.call(exec_command, shell=True)
+            # Record what this workload was built from
+            state.manifest.write('j-lang' + str(state.global_count) + '\t' + ','.join(perm) + '\t' + '{0}'.format(currentParameterOption) + '\t' + '{0}'.format(syncPermutationsCustom[insSync]) + '\t' + key + '\n')
 
 
             log = '\n\t\t\tModified sequence = {0}\n'.format(modified_sequence);
             log_file_handle.write(log)
 
             # Uncomment only if you want to match the generated workloads to the list of encoded workloads. It could slow down generation!
-            #isBugWorkload(permutations[count-1], j, syncPermutationsCustom[insSync])
+            #isBugWorkload(perm, j, syncPermutationsCustom[insSync])
 
 class SlowBar(FillingCirclesBar):
     suffix = '%(percent).0f%%  (Completed %(index)d skeletons with %(global_count)d workloads)'
-    @property
-    def global_count(self):
-        return global_count
-
-global_count = 0
-parameterList = {}
-SyncSet = list()
-num_ops = 0
-nested = False
-demo = False
-syncPermutations = []
-count = 0
-permutations = []
-log_file_handle = 0
-count_param = 0
+    global_count = 0
+
+
+# Generate every workload whose skeleton starts with the ops in prefix. Shards
+# don't share any state, so they can run in separate processes.
+def generate_shard(task):
+    (shard, prefix, config) = task
+    out_dir = config['dest_path'] + '.shard' + str(shard)
+    if os.path.exists(out_dir):
+        rmtree(out_dir)
+    os.makedirs(out_dir)
+
+    state = ShardState(config, out_dir)
+    skeletons = 0
+    for suffix in itertools.product(config['OperationSet'], repeat=int(config['num_ops']) - len(prefix)):
+        doPermutation(prefix + suffix, state)
+        skeletons += 1
+    state.close()
+    return (shard, skeletons, state.global_count, state.duplicates)
+
+
+# Move the workloads of a finished shard into the workload set, numbering them
+# after the offset workloads already in it. Workloads with the key of one kept
+# from an earlier shard are dropped. Returns the names of the workloads kept.
+def merge_shard(shard, offset, config, seen, manifest, log_file_handle):
+    out_dir = config['dest_path'] + '.shard' + str(shard)
+    kept = list()
+    with open(out_dir + '/manifest') as f:
+        for line in f:
+            (local_name, rest) = line.split('\t', 1)
+            key = rest.rstrip('\n').rsplit('\t', 1)[1]
+            if config['dedup'] and key in seen:
+                continue
+            seen.add(key)
+            name = 'j-lang' + str(offset + len(kept) + 1)
+            os.rename(out_dir + '/' + local_name, config['target_path'] + name)
+            manifest.write(name + '\t' + rest)
+            kept.append(name)
+
+    log_file_handle.write('\n---- Shard ' + `shard` + ' : File # below are offset by ' + `offset` + ' ----\n')
+    with open(out_dir + '/log') as f:
+        copyfileobj(f, log_file_handle)
+    rmtree(out_dir)
+    return kept
+
+
+# Convert a j-lang workload in the workload set into a C++ test case.
+def convert_workload(task):
+    (name, config) = task
+    cmAdapter.convert(config['dest_path'] + 'base.cpp', config['target_path'] + name, config['dest_path'] + name + '.cpp', config['index_map'])
+
 
 def main():
     
-    global global_count
-    global parameterList
-    global num_ops
-    global syncPermutations
-    global count
-    global nested
-    global permutations
-    global SyncSet
-    global demo
-    global log_file_handle
-    global count_param
     global FileOptions
     global SecondFileOptions
     global SecondDirOptions
     global OperationSet
     global FallocOptions
     
+    parameterList = {}
+    SyncSet = list()
+
     #open log file
     log_file = time.strftime('%Y%m%d_%H%M%S') + '-bugWorkloadGen.log'
     log_file_handle = open(log_file, 'w')
@@ -1389,10 +1483,6 @@ def main():
 
     # Workloads can take really long to generate. SO let's create a progress bar.
     
-    # Create all permutations of persistence ops  of given sequence length. This will be merged to the phase-2 workload.
-    for i in itertools.product(SyncSet, repeat=int(num_ops)):
-        syncPermutations.append(i)
-
 
     # This is the number of input operations
     log = 'Total file-system operations tested = ' +  `len(OperationSet)` + '\n'
@@ -1418,21 +1508,63 @@ def main():
     log_file_handle.write(log)
 
     bar.start()
-    for i in itertools.product(OperationSet, repeat=int(num_ops)):
-        doPermutation(i)
-        bar.next()
-
 
+    # Split the workload set into shards by the first shard_len ops of their
+    # skeletons and generate the shards in parallel. Shards are merged in
+    # order, so workloads are numbered just like a sequential run would number
+    # them.
+    shard_len = parsed_args.shard_len
+    if shard_len <= 0:
+        shard_len = 2 if int(num_ops) >= 3 else 1
+    shard_len = min(shard_len, int(num_ops))
+
+    config = {'num_ops' : num_ops, 'demo' : demo,
+              'parameterList' : parameterList, 'dest_dir' : dest_dir,
+              'dest_path' : '../code/tests/' + dest_dir + '/',
+              'target_path' : target_path, 'OperationSet' : OperationSet,
+              'index_map' : cmAdapter.read_index_map(dest_j_lang_cpp),
+              'name_map' : readNameMap(dest_j_lang_file),
+              'dedup' : parsed_args.dedup in ('True', 'true')}
+    tasks = ((shard, prefix, config) for shard, prefix in
+             enumerate(itertools.product(OperationSet, repeat=shard_len)))
+
+    manifest = open(config['dest_path'] + 'manifest', 'w')
+    if parsed_args.jobs > 1:
+        pool = Pool(processes = parsed_args.jobs)
+        results = pool.imap(generate_shard, tasks)
+    else:
+        pool = None
+        results = itertools.imap(generate_shard, tasks)
+
+    # Duplicates are dropped as soon as they are found, so only the workloads
+    # kept are converted to C++ test cases, once all of them are known.
+    global_count = 0
+    duplicates = 0
+    seen = set()
+    names = list()
+    for (shard, skeletons, workloads, shard_duplicates) in results:
+        kept = merge_shard(shard, global_count, config, seen, manifest, log_file_handle)
+        names += kept
+        global_count += len(kept)
+        duplicates += shard_duplicates + workloads - len(kept)
+        bar.global_count = global_count
+        bar.next(skeletons)
+    manifest.close()
+    bar.finish()
 
-    # To parallelize workload generation, we will need to modify how we number the workloads. If we enable this as it is, the threads will overwrite workloads, as they don't see the global_count.
-    #pool = Pool(processes = 4)
-    #pool.map(doPermutation, itertools.permutations(OperationSet, int(num_ops)))
-    #pool.close()
+    tasks = ((name, config) for name in names)
+    if pool is not None:
+        for _ in pool.imap_unordered(convert_workload, tasks, chunksize=64):
+            pass
+        pool.close()
+        pool.join()
+    else:
+        for task in tasks:
+            convert_workload(task)
 
 
     # End timer
     end_time = time.time()
-    bar.finish()
 
 
     # This is the total number of workloads generated
@@ -1440,6 +1572,12 @@ def main():
     print log
     log_file_handle.write(log)
 
+    # Workloads dropped as renamed copies of others
+    if config['dedup']:
+        log = 'Duplicate workloads dropped = ' + `duplicates` + ' (reduction factor ' + '{0:.2f}'.format(float(global_count + duplicates) / max(global_count, 1)) + 'x)\n'
+        print log
+        log_file_handle.write(log)
+
     # Time to create the above workloads
     log = 'Time taken to generate workloads = ' + `round(end_time-start_time,2)` + ' seconds\n'
     if not demo:
@@ -1454,10 +1592,5 @@ def main():
     log_file_handle.close()
 
 
-    # Move the resultant high-level lang files to target directory. We could choose to delete them too. But if we wanted to analyze the core-ops in a workload, looking at this file is an easier way of doing it. Also if you modify the adapter, you can simply supply the directory of j-lang files to convert to cpp. No need to go through the entire generation process.
-    target = 'mv j-lang* ' + target_path
-    subprocess.call(target, shell = True)
-
-
 if __name__ == '__main__':
 	main()
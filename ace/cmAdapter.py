@@ -9,6 +9,7 @@ import subprocess
 import argparse
 import time
 import itertools
+import hashlib
 from shutil import copyfile
 from string import maketrans
 
@@ -449,6 +450,35 @@ def insertWrite(contents, option, line, index_map, method):
 # If the workload has functions with various possible paramter options, the 'permutation' defines the set of
 # paramters to be set in this file.
 
+# Add a setup_key() method to the generated test in 'file' that identifies the
+# body of its setup() method. Generated tests with identical setup() bodies
+# leave identical disk images behind, which lets CrashMonkey reuse the image
+# from an earlier test instead of running setup() again.
+def insertSetupKey(file):
+    with open(file, 'r+') as insert:
+        contents = insert.readlines()
+
+        setup_start = -1
+        run_start = -1
+        for index, line in enumerate(contents):
+            words = line.strip().split(' ')
+            if len(words) > 2 and words[2] == 'setup()':
+                setup_start = index
+            elif len(words) > 2 and words[2] == 'run(':
+                run_start = index
+                break
+        if setup_start < 0 or run_start < 0:
+            return
+
+        key = hashlib.sha1(''.join(contents[setup_start:run_start])).hexdigest()
+        to_insert = '\t\t\tvirtual string setup_key() override {\n\t\t\t\treturn \"' + key + '\";\n\t\t\t}\n\n'
+        contents.insert(run_start, to_insert)
+
+        insert.seek(0)
+        insert.writelines(contents)
+        insert.close()
+
+
 def insertFunctions(line, file, index_map, method):
     with open(file, 'r+') as insert:
         
@@ -593,37 +623,8 @@ def insertFunctions(line, file, index_map, method):
 
 
 
-def main():
-    
-    #open log file
-    #log_file = time.strftime('%Y%m%d_%H%M%S') + '-workloadGen.log'
-    #log_file_handle = open(log_file, 'w')
-
-    #Parse input args
-    parsed_args = build_parser().parse_args()
-
-    #Print the test setup - just for sanity
-    # base_test = '../code/tests/base_test.cpp'
-    # print_setup(parsed_args)
-
-    
-    #check if test file exists
-    if not os.path.exists(parsed_args.test_file) or not os.path.isfile(parsed_args.test_file):
-        print parsed_args.test_file + ' : No such test file\n'
-        exit(1)
-    
-    #Create the target directory
-    create_dir(parsed_args.target_path)
-
-    #Create a pre-populated dictionary of replacable operations
-    operation_map = create_dict()
-
-    #Copy base file to target path
-    base_test = parsed_args.base_file
-    base_file = parsed_args.target_path + "/" + base_test.split('/')[-1]
-    # copyfile(base_test, base_file)
-    test_file = parsed_args.test_file
-
+# Find where the define, setup, run and check_test sections of base_file start.
+def read_index_map(base_file):
     index_map = {'define' : 0, 'setup' : 0, 'run' : 0, 'check' : 0}
     
     #iterate through the base file and populate these values
@@ -646,19 +647,21 @@ def main():
                 if line.split(' ')[0] == 'private:':
                     index_map['define'] = index
     f.close()
+    return index_map
 
 
+# Build the test case new_file from base_file and the J lang file test_file.
+# index_map can be passed in by callers converting many files with the same
+# base file, so it is only read once.
+def convert(base_file, test_file, new_file, index_map=None):
+    if index_map is None:
+        index_map = read_index_map(base_file)
+    # Declarations made for earlier files don't carry over to this one
+    redeclare_map.clear()
 
-
-    val = 0
-    new_file = test_file  + ".cpp"
-    new_file = parsed_args.target_path + new_file
     copyfile(base_file, new_file)
 
     new_index_map = index_map.copy()
-#        log = ' ,'.join(permutation);
-#        log = `val` + ' : ' + log + '\n'
-#        log_file_handle.write(log)
         #Iterate through test file and fill up method by method
     with open(test_file, 'r') as f:
         iter = 0
@@ -687,8 +690,40 @@ def main():
                 insertFunctions(line, new_file, new_index_map, method)
 
     f.close()
-    val += 1
+    insertSetupKey(new_file)
+
+
+def main():
+    
+    #open log file
+    #log_file = time.strftime('%Y%m%d_%H%M%S') + '-workloadGen.log'
+    #log_file_handle = open(log_file, 'w')
+
+    #Parse input args
+    parsed_args = build_parser().parse_args()
+
+    #Print the test setup - just for sanity
+    # base_test = '../code/tests/base_test.cpp'
+    # print_setup(parsed_args)
+
+    
+    #check if test file exists
+    if not os.path.exists(parsed_args.test_file) or not os.path.isfile(parsed_args.test_file):
+        print parsed_args.test_file + ' : No such test file\n'
+        exit(1)
+    
+    #Create the target directory
+    create_dir(parsed_args.target_path)
 
+    #Copy base file to target path
+    base_test = parsed_args.base_file
+    base_file = parsed_args.target_path + "/" + base_test.split('/')[-1]
+    # copyfile(base_test, base_file)
+    test_file = parsed_args.test_file
+
+    new_file = test_file  + ".cpp"
+    new_file = parsed_args.target_path + new_file
+    convert(base_file, test_file, new_file)
 
 #    log_file_handle.close()
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "DiskContents.h"
 
 using std::endl;
@@ -434,6 +436,86 @@ bool DiskContents::compare_file_contents(DiskContents &compare_disk, string path
   return false;
 }
 
+bool DiskContents::compare_file_digests(string path,
+    const std::vector<fs_testing::utils::DiskMod> &mods, ofstream &diff_file) {
+  using fs_testing::utils::DiskMod;
+
+  string base_path = mount_point + path;
+  int fd = open(base_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    diff_file << "Failed opening the file " << base_path << endl;
+    return false;
+  }
+
+  const DiskMod &checked = mods.front();
+  const uint64_t range_start = checked.file_mod_location;
+  const uint64_t range_end = range_start + checked.file_mod_len;
+  // Only one block of the file is held in memory at a time no matter how large
+  // the writes were.
+  std::vector<char> block(DiskMod::kDigestBlockSize);
+  bool retValue = true;
+  for (unsigned int w = 0; w < mods.size() && retValue; ++w) {
+    const DiskMod &write = mods.at(w);
+    if (w > 0 && (write.path != checked.path || !write.HasFileData())) {
+      continue;
+    }
+
+    for (uint64_t block_offset = 0; block_offset < write.file_mod_len;
+        block_offset += DiskMod::kDigestBlockSize) {
+      const uint64_t block_start = write.file_mod_location + block_offset;
+      const uint64_t block_len = std::min((uint64_t) DiskMod::kDigestBlockSize,
+          write.file_mod_len - block_offset);
+      if (block_start >= range_end || block_start + block_len <= range_start) {
+        continue;
+      }
+      // Whatever a later mod did to this block is what the crash state should
+      // have, not what this write left there.
+      bool overwritten = false;
+      for (unsigned int later = w + 1; later < mods.size(); ++later) {
+        if (mods.at(later).MayChangeFileRange(checked.path, block_start,
+              block_len)) {
+          overwritten = true;
+          break;
+        }
+      }
+      if (overwritten) {
+        continue;
+      }
+
+      uint64_t read_len = 0;
+      while (read_len < block_len) {
+        const ssize_t res = pread(fd, block.data() + read_len,
+            block_len - read_len, block_start + read_len);
+        if (res <= 0) {
+          break;
+        }
+        read_len += res;
+      }
+
+      bool matches;
+      if (read_len != block_len) {
+        matches = false;
+      } else if (write.file_mod_data_hashed) {
+        matches = DiskMod::HashData(block.data(), block_len) ==
+          write.file_mod_digests.at(block_offset / DiskMod::kDigestBlockSize);
+      } else {
+        matches = memcmp(block.data(), write.file_mod_data.get() + block_offset,
+            block_len) == 0;
+      }
+      if (!matches) {
+        diff_file << __func__ << " failed" << endl;
+        diff_file << "Content Mismatch of file " << path << " from ";
+        diff_file << block_start << " of length " << block_len << endl;
+        retValue = false;
+        break;
+      }
+    }
+  }
+
+  close(fd);
+  return retValue;
+}
+
 bool isEmptyDirOrFile(string path) {
   DIR *directory = opendir(path.c_str());
   if (directory == NULL) {
@@ -17,6 +17,8 @@
 #include <vector>
 #include <map>
 
+#include "../utils/DiskMod.h"
+
 namespace fs_testing {
 
 class fileAttributes {
@@ -52,6 +54,13 @@ public:
     std::ofstream &diff_file);
   bool compare_file_contents(DiskContents &compare_disk, std::string path,
     int offset, int length, std::ofstream &diff_file);
+  // Checks the data written by mods.front() against the digests it carries
+  // instead of against another disk. The rest of mods are the mods recorded
+  // after it up to the checkpoint, so each block is checked against the last
+  // write that covered it.
+  bool compare_file_digests(std::string path,
+    const std::vector<fs_testing::utils::DiskMod> &mods,
+    std::ofstream &diff_file);
   bool deleteFiles(std::string path, std::ofstream &diff_file);
   bool makeFiles(std::string base_path, std::ofstream &diff_file);
   bool sanity_checks(std::ofstream &diff_file);
@@ -0,0 +1,397 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "SnapshotBackend.h"
+#include "../disk_wrapper_ioctl.h"
+
+#define SILENT              " > /dev/null 2>&1"
+
+#define COW_BRD_MODULE_NAME "../build/cow_brd.ko"
+#define COW_BRD_INSMOD      "insmod " COW_BRD_MODULE_NAME " num_disks="
+#define COW_BRD_INSMOD2      " num_snapshots="
+#define COW_BRD_INSMOD3      " disk_size="
+#define COW_BRD_RMMOD       "rmmod " COW_BRD_MODULE_NAME
+#define NUM_DISKS           "1"
+#define COW_BRD_PATH        "/dev/cow_ram0"
+#define COW_BRD_SNAPSHOT_PATH  "/dev/cow_ram_snapshot"
+
+#define LOOP_CONTROL_PATH   "/dev/loop-control"
+#define LOOP_PATH           "/dev/loop"
+
+namespace fs_testing {
+
+using std::cerr;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::time_point;
+using std::endl;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+
+namespace {
+
+// Another process can grab the loop device LOOP_CTL_GET_FREE handed out before
+// we attach to it, so try a few times.
+const unsigned int kLoopAttachTries = 10;
+const unsigned int kCopyBufSize = 1024 * 1024;
+
+}  // namespace
+
+SnapshotBackend * GetSnapshotBackend(const string &image_dir,
+    const bool verbose) {
+  if (image_dir.empty()) {
+    return new CowBrdSnapshotBackend(verbose);
+  }
+  return new FileSnapshotBackend(image_dir);
+}
+
+/********************************** cow_brd ***********************************/
+CowBrdSnapshotBackend::CowBrdSnapshotBackend(const bool verbose) :
+  verbose_(verbose) { }
+
+int CowBrdSnapshotBackend::Init(const unsigned long device_size,
+    const unsigned int num_snapshots) {
+  if (base_fd_ < 0) {
+    string command(COW_BRD_INSMOD);
+    command += NUM_DISKS;
+    command += COW_BRD_INSMOD2;
+    command += to_string(num_snapshots);
+    command += COW_BRD_INSMOD3;
+    command += to_string(device_size);
+    if (!verbose_) {
+      command += SILENT;
+    }
+    if (system(command.c_str()) != 0) {
+      base_fd_ = -1;
+      return -1;
+    }
+  }
+  inserted_ = true;
+  base_fd_ = open(COW_BRD_PATH, O_RDONLY);
+  if (base_fd_ < 0) {
+    if (system(COW_BRD_RMMOD) != 0) {
+      base_fd_ = -1;
+      inserted_ = false;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int CowBrdSnapshotBackend::Cleanup() {
+  // Sometimes the disk wrapper module takes time to unload.
+  // So retry cow-brd unload for upto a second.
+  milliseconds elapsed;
+  if (inserted_) {
+    if (base_fd_ != -1) {
+      close(base_fd_);
+      base_fd_ = -1;
+      inserted_ = false;
+    }
+    int res;
+    string command = COW_BRD_RMMOD SILENT;
+    time_point<steady_clock> rmmod_start_time = steady_clock::now();
+    do {
+      res = system(command.c_str());
+      time_point<steady_clock> rmmod_end_time = steady_clock::now();
+      elapsed = duration_cast<milliseconds>(rmmod_end_time - rmmod_start_time);
+      if (res != 0) {
+        usleep(500);
+      }
+    } while (res != 0 && elapsed.count() < 1000);
+
+    if (res != 0) {
+      inserted_ = true;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+string CowBrdSnapshotBackend::GetBasePath() {
+  return COW_BRD_PATH;
+}
+
+string CowBrdSnapshotBackend::GetSnapshotPath(const unsigned int snapshot) {
+  return COW_BRD_SNAPSHOT_PATH + to_string(snapshot) + "_0";
+}
+
+int CowBrdSnapshotBackend::GetBaseFd() {
+  return base_fd_;
+}
+
+int CowBrdSnapshotBackend::Snapshot() {
+  return ioctl(base_fd_, COW_BRD_SNAPSHOT);
+}
+
+int CowBrdSnapshotBackend::Unsnapshot() {
+  return ioctl(base_fd_, COW_BRD_UNSNAPSHOT);
+}
+
+int CowBrdSnapshotBackend::Restore(const int snapshot_fd) {
+  return ioctl(snapshot_fd, COW_BRD_RESTORE_SNAPSHOT);
+}
+
+int CowBrdSnapshotBackend::Wipe() {
+  return ioctl(base_fd_, COW_BRD_WIPE);
+}
+
+/******************************** Image files *********************************/
+FileSnapshotBackend::FileSnapshotBackend(const string &image_dir) :
+  image_dir_(image_dir) { }
+
+int FileSnapshotBackend::Init(const unsigned long device_size,
+    const unsigned int num_snapshots) {
+  if (initialized_) {
+    return 0;
+  }
+  image_size_ = device_size * 1024;
+
+  if (AttachImage(image_dir_ + "/base.img", base_) < 0) {
+    return -1;
+  }
+  initialized_ = true;
+  snapshots_.resize(num_snapshots);
+  for (unsigned int i = 0; i < num_snapshots; ++i) {
+    const string path = image_dir_ + "/snapshot" + to_string(i + 1) + ".img";
+    if (AttachImage(path, snapshots_.at(i)) < 0) {
+      snapshots_.resize(i);
+      Cleanup();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int FileSnapshotBackend::AttachImage(const string &image_path,
+    LoopImage &res) {
+  res.image_path = image_path;
+  res.loop_fd = -1;
+  res.stale = false;
+  res.image_fd =
+    open(image_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (res.image_fd < 0) {
+    cerr << "error creating image file " << image_path << endl;
+    return -1;
+  }
+  if (ftruncate(res.image_fd, image_size_) < 0) {
+    cerr << "error sizing image file " << image_path << endl;
+    close(res.image_fd);
+    unlink(image_path.c_str());
+    return -1;
+  }
+
+  const int control_fd = open(LOOP_CONTROL_PATH, O_RDWR);
+  if (control_fd < 0) {
+    cerr << "error opening " << LOOP_CONTROL_PATH << endl;
+    close(res.image_fd);
+    unlink(image_path.c_str());
+    return -1;
+  }
+  for (unsigned int i = 0; i < kLoopAttachTries && res.loop_fd < 0; ++i) {
+    const int loop_num = ioctl(control_fd, LOOP_CTL_GET_FREE);
+    if (loop_num < 0) {
+      break;
+    }
+    res.loop_path = LOOP_PATH + to_string(loop_num);
+    res.loop_fd = open(res.loop_path.c_str(), O_RDWR);
+    if (res.loop_fd < 0) {
+      break;
+    }
+    if (ioctl(res.loop_fd, LOOP_SET_FD, res.image_fd) < 0) {
+      const int err = errno;
+      close(res.loop_fd);
+      res.loop_fd = -1;
+      if (err != EBUSY) {
+        break;
+      }
+    }
+  }
+  close(control_fd);
+
+  struct stat loop_stats;
+  if (res.loop_fd < 0 || fstat(res.loop_fd, &loop_stats) < 0) {
+    cerr << "error attaching " << image_path << " to a loop device" << endl;
+    if (res.loop_fd >= 0) {
+      ioctl(res.loop_fd, LOOP_CLR_FD, 0);
+      close(res.loop_fd);
+    }
+    close(res.image_fd);
+    unlink(image_path.c_str());
+    return -1;
+  }
+  res.loop_dev = loop_stats.st_rdev;
+  return 0;
+}
+
+int FileSnapshotBackend::Cleanup() {
+  if (!initialized_) {
+    return 0;
+  }
+  int res = 0;
+  for (LoopImage &snapshot : snapshots_) {
+    if (ioctl(snapshot.loop_fd, LOOP_CLR_FD, 0) < 0) {
+      res = -1;
+    }
+    close(snapshot.loop_fd);
+    close(snapshot.image_fd);
+    unlink(snapshot.image_path.c_str());
+  }
+  snapshots_.clear();
+  if (ioctl(base_.loop_fd, LOOP_CLR_FD, 0) < 0) {
+    res = -1;
+  }
+  close(base_.loop_fd);
+  close(base_.image_fd);
+  unlink(base_.image_path.c_str());
+  initialized_ = false;
+  return res;
+}
+
+string FileSnapshotBackend::GetBasePath() {
+  return base_.loop_path;
+}
+
+string FileSnapshotBackend::GetSnapshotPath(const unsigned int snapshot) {
+  if (snapshot == 0 || snapshot > snapshots_.size()) {
+    return "";
+  }
+  LoopImage &image = snapshots_.at(snapshot - 1);
+  if (image.stale && RestoreImage(image) < 0) {
+    cerr << "error updating snapshot image " << image.image_path << endl;
+    return "";
+  }
+  return image.loop_path;
+}
+
+int FileSnapshotBackend::GetBaseFd() {
+  return base_.loop_fd;
+}
+
+int FileSnapshotBackend::Snapshot() {
+  // Get everything written through the loop device into the base image.
+  if (fsync(base_.loop_fd) < 0) {
+    return -1;
+  }
+  if (snapshots_.empty()) {
+    return 0;
+  }
+  for (LoopImage &snapshot : snapshots_) {
+    snapshot.stale = true;
+  }
+  // The path of the first snapshot is handed out once at startup, so it can't
+  // wait for the next lookup.
+  return RestoreImage(snapshots_.front());
+}
+
+int FileSnapshotBackend::Unsnapshot() {
+  // Nothing stops writes to the base image in the first place.
+  return 0;
+}
+
+int FileSnapshotBackend::Restore(const int snapshot_fd) {
+  struct stat snapshot_stats;
+  if (fstat(snapshot_fd, &snapshot_stats) < 0) {
+    return -1;
+  }
+  for (LoopImage &snapshot : snapshots_) {
+    if (snapshot.loop_dev == snapshot_stats.st_rdev) {
+      return RestoreImage(snapshot);
+    }
+  }
+  return -1;
+}
+
+int FileSnapshotBackend::RestoreImage(LoopImage &snapshot) {
+  // Write back and drop the pages the loop device caches before changing the
+  // image under it, or they would be written over the restored image later.
+  if (ioctl(snapshot.loop_fd, BLKFLSBUF, 0) < 0) {
+    return -1;
+  }
+  if (ioctl(snapshot.image_fd, FICLONE, base_.image_fd) < 0) {
+    if (!warned_copy_) {
+      cerr << "can't clone images in " << image_dir_ << ", copying them "
+        "instead (use a file system with reflink support)" << endl;
+      warned_copy_ = true;
+    }
+    if (CopyImage(base_.image_fd, snapshot.image_fd) < 0) {
+      return -1;
+    }
+  }
+  // Nothing should have read the snapshot since, but don't rely on it.
+  if (ioctl(snapshot.loop_fd, BLKFLSBUF, 0) < 0) {
+    return -1;
+  }
+  snapshot.stale = false;
+  return 0;
+}
+
+int FileSnapshotBackend::CopyImage(const int from_fd, const int to_fd) {
+  // Truncating drops all the old data, so only the parts of the image that
+  // aren't holes need to be copied.
+  if (ftruncate(to_fd, 0) < 0 || ftruncate(to_fd, image_size_) < 0) {
+    return -1;
+  }
+
+  unique_ptr<char[]> buf(new char[kCopyBufSize]);
+  off_t offset = 0;
+  while (offset < image_size_) {
+    const off_t data_start = lseek(from_fd, offset, SEEK_DATA);
+    if (data_start < 0) {
+      // No data after offset.
+      if (errno == ENXIO) {
+        break;
+      }
+      return -1;
+    }
+    const off_t data_end = lseek(from_fd, data_start, SEEK_HOLE);
+    if (data_end < 0) {
+      return -1;
+    }
+
+    for (off_t pos = data_start; pos < data_end;) {
+      const size_t len = (data_end - pos < kCopyBufSize) ?
+        data_end - pos : kCopyBufSize;
+      const ssize_t bytes = pread(from_fd, buf.get(), len, pos);
+      if (bytes <= 0) {
+        return -1;
+      }
+      for (ssize_t done = 0; done < bytes;) {
+        const ssize_t res =
+          pwrite(to_fd, buf.get() + done, bytes - done, pos + done);
+        if (res < 0) {
+          return -1;
+        }
+        done += res;
+      }
+      pos += bytes;
+    }
+    offset = data_end;
+  }
+  return 0;
+}
+
+int FileSnapshotBackend::Wipe() {
+  if (ioctl(base_.loop_fd, BLKFLSBUF, 0) < 0 ||
+      ftruncate(base_.image_fd, 0) < 0 ||
+      ftruncate(base_.image_fd, image_size_) < 0) {
+    return -1;
+  }
+  return ioctl(base_.loop_fd, BLKFLSBUF, 0);
+}
+
+}  // namespace fs_testing
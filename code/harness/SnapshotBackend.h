@@ -0,0 +1,162 @@
+#ifndef HARNESS_SNAPSHOT_BACKEND_H
+#define HARNESS_SNAPSHOT_BACKEND_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace fs_testing {
+
+/*
+ * Provides the base device the test file system is made on and the snapshots
+ * of it that workloads run on and crash states are written to. After Snapshot
+ * is called, each snapshot reads like the base device did at that time plus
+ * whatever was written to the snapshot since it was last restored.
+ *
+ * Unless noted otherwise, methods return 0 on success and a value < 0 on
+ * failure.
+ */
+class SnapshotBackend {
+ public:
+  virtual ~SnapshotBackend() {};
+
+  /*
+   * Make a base device of device_size KiB and num_snapshots snapshots of it.
+   * Calling Init again with a backend that is already set up does nothing.
+   */
+  virtual int Init(const unsigned long device_size,
+      const unsigned int num_snapshots) = 0;
+
+  /*
+   * Tear down everything Init made. Any file systems on the devices must be
+   * unmounted first.
+   */
+  virtual int Cleanup() = 0;
+
+  /*
+   * Returns the path of the base device.
+   */
+  virtual std::string GetBasePath() = 0;
+
+  /*
+   * Returns the path of a snapshot, numbered starting at 1. Backends may only
+   * bring snapshots other than the first up to date when their path is looked
+   * up, so look it up again after each call to Snapshot.
+   */
+  virtual std::string GetSnapshotPath(const unsigned int snapshot) = 0;
+
+  /*
+   * Returns an open file descriptor for the base device that can be read from
+   * and synced. It stays open until Cleanup.
+   */
+  virtual int GetBaseFd() = 0;
+
+  /*
+   * Make every snapshot match the current contents of the base device (see
+   * GetSnapshotPath) and stop writes to the base device where the backend can.
+   */
+  virtual int Snapshot() = 0;
+
+  /*
+   * Allow writes to the base device again.
+   */
+  virtual int Unsnapshot() = 0;
+
+  /*
+   * Drop everything written to the snapshot open at snapshot_fd since the last
+   * call to Snapshot or Restore for it.
+   */
+  virtual int Restore(const int snapshot_fd) = 0;
+
+  /*
+   * Zero the base device.
+   */
+  virtual int Wipe() = 0;
+};
+
+/*
+ * Snapshots provided by the cow_brd kernel module.
+ */
+class CowBrdSnapshotBackend : public SnapshotBackend {
+ public:
+  CowBrdSnapshotBackend(const bool verbose);
+
+  virtual int Init(const unsigned long device_size,
+      const unsigned int num_snapshots) override;
+  virtual int Cleanup() override;
+  virtual std::string GetBasePath() override;
+  virtual std::string GetSnapshotPath(const unsigned int snapshot) override;
+  virtual int GetBaseFd() override;
+  virtual int Snapshot() override;
+  virtual int Unsnapshot() override;
+  virtual int Restore(const int snapshot_fd) override;
+  virtual int Wipe() override;
+
+ private:
+  const bool verbose_;
+  bool inserted_ = false;
+  int base_fd_ = -1;
+};
+
+/*
+ * Snapshots kept entirely in userspace as image files in a directory, each
+ * attached to a loop device so it can be mounted. Snapshots are made and
+ * restored by cloning the base image with FICLONE where the file system holding
+ * the directory supports it, else by copying the parts of the base image that
+ * aren't holes. Only the first snapshot, which workloads run on, is updated by
+ * Snapshot. The rest are marked stale and updated when their path is looked up
+ * or they are restored, since most runs never touch them. Needs no CrashMonkey
+ * kernel modules, so it can replay saved profiles on any Linux host with loop
+ * devices.
+ */
+class FileSnapshotBackend : public SnapshotBackend {
+ public:
+  FileSnapshotBackend(const std::string &image_dir);
+
+  virtual int Init(const unsigned long device_size,
+      const unsigned int num_snapshots) override;
+  virtual int Cleanup() override;
+  virtual std::string GetBasePath() override;
+  virtual std::string GetSnapshotPath(const unsigned int snapshot) override;
+  virtual int GetBaseFd() override;
+  virtual int Snapshot() override;
+  virtual int Unsnapshot() override;
+  virtual int Restore(const int snapshot_fd) override;
+  virtual int Wipe() override;
+
+ private:
+  // An image file and the loop device it is attached to.
+  struct LoopImage {
+    std::string image_path;
+    std::string loop_path;
+    int image_fd;
+    int loop_fd;
+    dev_t loop_dev;
+    // The image doesn't hold the base image from the last Snapshot yet.
+    bool stale;
+  };
+
+  int AttachImage(const std::string &image_path, LoopImage &res);
+  // Make the image of snapshot a copy of the base image.
+  int RestoreImage(LoopImage &snapshot);
+  int CopyImage(const int from_fd, const int to_fd);
+
+  const std::string image_dir_;
+  off_t image_size_ = 0;
+  bool initialized_ = false;
+  bool warned_copy_ = false;
+  LoopImage base_;
+  std::vector<LoopImage> snapshots_;
+};
+
+/*
+ * Returns the backend to use: cow_brd if image_dir is empty, else image files
+ * in image_dir.
+ */
+SnapshotBackend * GetSnapshotBackend(const std::string &image_dir,
+    const bool verbose);
+
+}  // namespace fs_testing
+
+#endif  // HARNESS_SNAPSHOT_BACKEND_H
@@ -2,6 +2,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -18,16 +20,20 @@
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <utility>
 
 #include "FsSpecific.h"
 #include "Tester.h"
 #include "../disk_wrapper_ioctl.h"
+#include "../utils/ChunkedFile.h"
+#include "../utils/ProfileLog.h"
 #include "DiskContents.h"
 
 #define TEST_CLASS_FACTORY        "test_case_get_instance"
 #define TEST_CLASS_DEFACTORY      "test_case_delete_instance"
+#define TEST_CLASS_NAMED_FACTORY  "test_case_get_named_instance"
 #define PERMUTER_CLASS_FACTORY    "permuter_get_instance"
 #define PERMUTER_CLASS_DEFACTORY  "permuter_delete_instance"
 
@@ -53,14 +59,7 @@
 #define WRAPPER_INSMOD2      " flags_device_path="
 #define WRAPPER_RMMOD       "rmmod " WRAPPER_MODULE_NAME
 
-#define COW_BRD_MODULE_NAME "../build/cow_brd.ko"
-#define COW_BRD_INSMOD      "insmod " COW_BRD_MODULE_NAME " num_disks="
-#define COW_BRD_INSMOD2      " num_snapshots="
-#define COW_BRD_INSMOD3      " disk_size="
-#define COW_BRD_RMMOD       "rmmod " COW_BRD_MODULE_NAME
-#define NUM_DISKS           "1"
-#define NUM_SNAPSHOTS       "20"
-#define COW_BRD_PATH        "/dev/cow_ram0"
+#define NUM_SNAPSHOTS       20
 
 #define DEV_SECTORS_PATH    "/sys/block/"
 #define DEV_SECTORS_PATH_2  "/size"
@@ -90,6 +89,7 @@ using std::to_string;
 using std::vector;
 
 using fs_testing::tests::test_create_t;
+using fs_testing::tests::test_create_named_t;
 using fs_testing::tests::test_destroy_t;
 using fs_testing::permuter::Permuter;
 using fs_testing::permuter::permuter_create_t;
@@ -97,17 +97,29 @@ using fs_testing::permuter::permuter_destroy_t;
 using fs_testing::utils::disk_write;
 using fs_testing::utils::DiskMod;
 using fs_testing::utils::DiskWriteData;
+using fs_testing::utils::LatencyHistogram;
+using fs_testing::utils::PhaseTrace;
+using fs_testing::utils::ChunkedFile;
+using fs_testing::utils::ChunkedFileReader;
+using fs_testing::utils::ChunkedFileWriter;
+using fs_testing::utils::ProfileLog;
 
 Tester::Tester(const unsigned int dev_size, const unsigned int sector_size,
     const bool verbosity)
   : device_size(dev_size), sector_size_(sector_size), verbose(verbosity) {
-  snapshot_path_ = "/dev/cow_ram_snapshot1_0";
 }
 
 Tester::~Tester() {
+  log_profile_save_wait();
   if (fs_specific_ops_ != NULL) {
     delete fs_specific_ops_;
   }
+  // Only frees the backend. Forked children of the harness destroy their copy
+  // of the Tester too, so tearing the devices down is left to
+  // remove_snapshots.
+  if (snapshots_ != NULL) {
+    delete snapshots_;
+  }
 }
 
 void Tester::set_fs_type(const string type) {
@@ -125,6 +137,37 @@ void Tester::set_flag_device(const std::string device_path) {
   flags_device = device_path;
 }
 
+void Tester::set_compress_logs(const bool compress) {
+  compress_logs_ = compress;
+}
+
+void Tester::set_hash_mod_data(const bool hash) {
+  hash_mod_data_ = hash;
+}
+
+void Tester::set_image_cache_dir(const string dir) {
+  image_cache_dir_ = dir;
+}
+
+void Tester::set_snapshot_dir(const string dir) {
+  snapshot_dir_ = dir;
+}
+
+string Tester::get_snapshot_base_path() {
+  return snapshots_->GetBasePath();
+}
+
+void Tester::set_keep_modules(const bool keep) {
+  keep_modules_ = keep;
+}
+
+void Tester::set_checkpoint_range(const unsigned int first,
+    const unsigned int last) {
+  has_checkpoint_range_ = true;
+  first_checkpoint_ = first;
+  last_checkpoint_ = last;
+}
+
 void Tester::StartTestSuite() {
   // Construct a new element at the end of our vector.
   test_results_.emplace_back();
@@ -141,7 +184,7 @@ unsigned int Tester::GetPostRunDelay() {
 
 int Tester::clone_device() {
   std::cout << "cloning device " << device_raw << std::endl;
-  if (ioctl(cow_brd_fd, COW_BRD_SNAPSHOT) < 0) {
+  if (snapshots_->Snapshot() < 0) {
     return DRIVE_CLONE_ERR;
   }
 
@@ -149,7 +192,7 @@ int Tester::clone_device() {
 }
 
 int Tester::clone_device_restore(int snapshot_fd, bool reread) {
-  if (ioctl(snapshot_fd, COW_BRD_RESTORE_SNAPSHOT) < 0) {
+  if (snapshots_->Restore(snapshot_fd) < 0) {
     return DRIVE_CLONE_RESTORE_ERR;
   }
   int res;
@@ -167,6 +210,29 @@ int Tester::clone_device_restore(int snapshot_fd, bool reread) {
   return SUCCESS;
 }
 
+int Tester::reset_devices() {
+  if (snapshots_->Unsnapshot() < 0 || snapshots_->Wipe() < 0) {
+    return DRIVE_CLONE_ERR;
+  }
+  // Automated check tests use one snapshot per checkpoint, so drop the changes
+  // held in all of them.
+  for (int i = 1; i <= NUM_SNAPSHOTS; ++i) {
+    const string path = snapshots_->GetSnapshotPath(i);
+    const int snapshot_fd = open(path.c_str(), O_WRONLY);
+    if (snapshot_fd < 0) {
+      return DRIVE_CLONE_RESTORE_ERR;
+    }
+    const int res = clone_device_restore(snapshot_fd, false);
+    close(snapshot_fd);
+    if (res != SUCCESS) {
+      return res;
+    }
+  }
+  snapshot_path_ = snapshots_->GetSnapshotPath(1);
+  checkpointToSnapshot_.clear();
+  return SUCCESS;
+}
+
 int Tester::mount_device_raw(const char* opts) {
   if (device_mount.empty()) {
     return MNT_BAD_DEV_ERR;
@@ -226,13 +292,7 @@ int Tester::mapCheckpointToSnapshot(int checkpoint) {
 }
 
 int Tester::getNewDiskClone(int checkpoint) {
-  string new_snapshot_path;
-  string path(snapshot_path_);
-  string device_number = path.substr(path.rfind('_'));
-  string snapshot_number = to_string(checkpoint + 2);
-  new_snapshot_path = "/dev/cow_ram_snapshot";
-  new_snapshot_path += snapshot_number;
-  new_snapshot_path += device_number;
+  string new_snapshot_path = snapshots_->GetSnapshotPath(checkpoint + 2);
   // Finally set snapshot_path_ to the new snapshot path
   snapshot_path_ = new_snapshot_path;
   string command = fs_specific_ops_->GetNewUUIDCommand(new_snapshot_path);
@@ -244,63 +304,23 @@ void Tester::getCompleteRunDiskClone() {
   snapshot_path_ = checkpointToSnapshot_[0];
 }
 
-int Tester::insert_cow_brd() {
-  if (cow_brd_fd < 0) {
-    string command(COW_BRD_INSMOD);
-    command += NUM_DISKS;
-    command += COW_BRD_INSMOD2;
-    command += NUM_SNAPSHOTS;
-    command += COW_BRD_INSMOD3;
-    command += std::to_string(device_size);
-    if (!verbose) {
-      command += SILENT;
-    }
-    if (system(command.c_str()) != 0) {
-      cow_brd_fd = -1;
-      return WRAPPER_INSERT_ERR;
-    }
+int Tester::insert_snapshots() {
+  if (snapshots_ == NULL) {
+    snapshots_ = GetSnapshotBackend(snapshot_dir_, verbose);
   }
-  cow_brd_inserted = true;
-  cow_brd_fd = open("/dev/cow_ram0", O_RDONLY);
-  if (cow_brd_fd < 0) {
-    if (system(COW_BRD_RMMOD) != 0) {
-      cow_brd_fd = -1;
-      cow_brd_inserted = false;
-      return WRAPPER_REMOVE_ERR;
-    }
+  if (snapshots_->Init(device_size, NUM_SNAPSHOTS) < 0) {
+    return WRAPPER_INSERT_ERR;
   }
+  snapshot_path_ = snapshots_->GetSnapshotPath(1);
   return SUCCESS;
 }
 
-int Tester::remove_cow_brd() {
-  // Sometimes the disk wrapper module takes time to unload.
-  // So retry cow-brd unload for upto a second.
-  milliseconds elapsed;
-  if (cow_brd_inserted) {
-    if (cow_brd_fd != -1) {
-      close(cow_brd_fd);
-      cow_brd_fd = -1;
-      cow_brd_inserted = false;
-    }
-    int res, num_tries = 0;
-    string command = COW_BRD_RMMOD SILENT;
-    time_point<steady_clock> rmmod_start_time = steady_clock::now();
-    do {
-      res = system(command.c_str());
-      time_point<steady_clock> rmmod_end_time = steady_clock::now();
-      elapsed = duration_cast<milliseconds>(rmmod_end_time - rmmod_start_time);
-      if (res != 0) {
-	usleep(500);
-        num_tries ++;
-      }
-    } while (res != 0 && elapsed.count() < 1000);
-      
-     if (res != 0) {
-        cow_brd_inserted = true;
-        return WRAPPER_REMOVE_ERR;
-      }
-     
-     //cout << "Time to rmmod " << elapsed.count() << " num tries = " << num_tries << endl;
+int Tester::remove_snapshots() {
+  if (keep_modules_ || snapshots_ == NULL) {
+    return SUCCESS;
+  }
+  if (snapshots_->Cleanup() < 0) {
+    return WRAPPER_REMOVE_ERR;
   }
   return SUCCESS;
 }
@@ -309,7 +329,7 @@ int Tester::insert_wrapper() {
   if (!wrapper_inserted) {
     string command(WRAPPER_INSMOD);
     // TODO(ashmrtn): Make this much MUCH cleaner...
-    command += "/dev/cow_ram_snapshot1_0";
+    command += snapshots_->GetSnapshotPath(1);
     command += WRAPPER_INSMOD2;
     command += flags_device;
     if (!verbose) {
@@ -325,6 +345,9 @@ int Tester::insert_wrapper() {
 }
 
 int Tester::remove_wrapper() {
+  if (keep_modules_) {
+    return SUCCESS;
+  }
   milliseconds elapsed;
   if (wrapper_inserted) {
     int res, num_tries = 0;
@@ -394,7 +417,8 @@ int Tester::get_wrapper_log() {
         }
       }
 
-      char* data = new char[meta.size];
+      // Have the wrapper copy the data straight into its final home.
+      char* data = log_arena_.Allocate(meta.size);
       result = ioctl(ioctl_fd, HWM_GET_LOG_DATA, data);
       if (result == -1) {
         if (errno == ENODATA) {
@@ -403,13 +427,11 @@ int Tester::get_wrapper_log() {
           break;
         } else if (errno == EFAULT) {
           cerr << "efault occurred\n";
-          delete[] data;
           log_data.clear();
           return WRAPPER_MEM_ERR;
         }
       }
       log_data.emplace_back(meta, data);
-      delete[] data;
 
       result = ioctl(ioctl_fd, HWM_NEXT_ENT);
       if (result == -1) {
@@ -437,52 +459,41 @@ void Tester::clear_wrapper_log() {
 }
 
 int Tester::GetChangeData(const int fd) {
-  // Need to read a 64-bit value, switch it to big endian to figure out how much
-  // we need to read, read that new data amount, and add it all to a buffer.
-  while (true) {
-    // Get the next DiskMod size.
-    uint64_t buf;
-    const int read_res = read(fd, (void *) &buf, sizeof(uint64_t));
-    if (read_res < 0) {
-      return read_res;
-    } else if (read_res == 0) {
-      // No more data to read.
-      break;
-    }
-
-    uint64_t next_chunk_size = be64toh(buf);
-
-    // Read the next DiskMod.
-    shared_ptr<char> data(new char[next_chunk_size], [](char *c) {delete[] c;});
-    memcpy(data.get(), (void *) &buf, sizeof(uint64_t));
-    unsigned long long int read_data = sizeof(uint64_t);
-    while (read_data < next_chunk_size) {
-      const int res = read(fd, data.get() + read_data,
-          next_chunk_size - read_data);
-      if (res <= 0) {
-        // We shouldn't find a size for a DiskMod without the rest of the
-        // DiskMod.
-        return -1;
-      }
-      read_data += res;
-    }
+  // Map the whole change file and only find where each DiskMod starts here.
+  // DiskMods are deserialized when they are actually needed, and their data is
+  // left in the mapping instead of being copied out.
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    return -1;
+  }
+  const uint64_t file_size = st.st_size;
+  if (file_size == 0) {
+    return SUCCESS;
+  }
+  void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  shared_ptr<char> contents((char *) map,
+      [file_size](char *c) {munmap(c, file_size);});
 
-    DiskMod mod;
-    const int res = DiskMod::Deserialize(data, mod);
-    if (res < 0) {
-      return res;
-    }
+  vector<shared_ptr<char>> all_mods;
+  if (DiskMod::SplitSerialized(contents, file_size, all_mods) < 0) {
+    return -1;
+  }
 
-    if (mod.mod_type == DiskMod::kCheckpointMod) {
+  for (shared_ptr<char> &mod : all_mods) {
+    if (DiskMod::GetSerializedType(mod.get()) == DiskMod::kCheckpointMod) {
       // We found a checkpoint, so switch to a new set of DiskMods.
-      mods_.push_back(vector<DiskMod>());
+      mods_.push_back(vector<shared_ptr<char>>());
     } else {
       if (mods_.empty()) {
         // We're just starting, so give us a place to put the mods.
-        mods_.push_back(vector<DiskMod>());
+        mods_.push_back(vector<shared_ptr<char>>());
       }
-      // Just append this DiskMod to the end of the last set of DiskMods.
-      mods_.back().push_back(mod);
+      // Just append this DiskMod to the end of the last set of DiskMods. Shares
+      // ownership of the mapping.
+      mods_.back().push_back(std::move(mod));
     }
   }
 
@@ -499,7 +510,11 @@ int Tester::CreateCheckpoint() {
   return WRAPPER_DATA_ERR;
 }
 
-int Tester::test_load_class(const char* path) {
+int Tester::test_load_class(const char* path, const char* name) {
+  if (name != NULL) {
+    return test_loader.load_class<test_create_named_t *>(path,
+        TEST_CLASS_NAMED_FACTORY, TEST_CLASS_DEFACTORY, name);
+  }
   return test_loader.load_class<test_create_t *>(path, TEST_CLASS_FACTORY,
       TEST_CLASS_DEFACTORY);
 }
@@ -601,12 +616,114 @@ int Tester::format_drive() {
     return PART_PART_ERR;
   }
   string command = fs_specific_ops_->GetMkfsCommand(device_mount);
+
+  // Images can only be cached when formatting the RAM disk itself since that
+  // is the device we know how to read and write in bulk.
+  string cache_file;
+  if (!image_cache_dir_.empty() &&
+      device_mount == snapshots_->GetBasePath()) {
+    cache_file = image_cache_path(command);
+    if (image_cache_load(cache_file) == SUCCESS) {
+      std::cout << "loaded formatted image from " << cache_file << endl;
+      return SUCCESS;
+    }
+  }
+
   if (!verbose) {
     command += SILENT;
   }
   if (system(command.c_str()) != 0) {
     return FMT_FMT_ERR;
   }
+
+  // Failing to add the image to the cache doesn't affect this run.
+  if (!cache_file.empty() && image_cache_save(cache_file) != SUCCESS) {
+    cerr << "error adding formatted image to cache " << cache_file << endl;
+  }
+  return SUCCESS;
+}
+
+string Tester::image_cache_path(const string &key) {
+  // Everything that changes what ends up on the device goes into the key.
+  const string full_key = fs_type + '\0' + to_string(device_size) + '\0' +
+    key;
+  std::ostringstream path;
+  path << image_cache_dir_ << "/" << fs_type << "-" << device_size << "-"
+    << std::hex << std::setw(16) << std::setfill('0')
+    << DiskMod::HashData(full_key.data(), full_key.size()) << ".img";
+  return path.str();
+}
+
+string Tester::setup_cache_key(const string &mount_opts) {
+  const string setup_key = test_loader.get_instance()->setup_key();
+  if (setup_key.empty()) {
+    return "";
+  }
+  return fs_specific_ops_->GetMkfsCommand(device_mount) + '\0' + mount_opts +
+    '\0' + setup_key;
+}
+
+int Tester::setup_cache_load(const string &mount_opts) {
+  if (image_cache_dir_.empty() || device_mount != snapshots_->GetBasePath()) {
+    return LOG_CLONE_ERR;
+  }
+  const string key = setup_cache_key(mount_opts);
+  if (key.empty()) {
+    return LOG_CLONE_ERR;
+  }
+  const string cache_file = image_cache_path(key);
+  if (image_cache_load(cache_file) != SUCCESS) {
+    return LOG_CLONE_ERR;
+  }
+  std::cout << "loaded post-setup image from " << cache_file << endl;
+  return SUCCESS;
+}
+
+int Tester::setup_cache_save(const string &mount_opts) {
+  if (image_cache_dir_.empty() || device_mount != snapshots_->GetBasePath()) {
+    return LOG_CLONE_ERR;
+  }
+  const string key = setup_cache_key(mount_opts);
+  if (key.empty()) {
+    return LOG_CLONE_ERR;
+  }
+  return image_cache_save(image_cache_path(key));
+}
+
+int Tester::image_cache_load(const string &cache_file) {
+  if (access(cache_file.c_str(), R_OK) < 0) {
+    return LOG_CLONE_ERR;
+  }
+  if (snapshots_->Wipe() < 0) {
+    cerr << "error wiping test device" << endl;
+    return LOG_CLONE_ERR;
+  }
+  // The base device fd from the snapshot backend may be read only.
+  const int device_fd = open(snapshots_->GetBasePath().c_str(), O_WRONLY);
+  if (device_fd < 0) {
+    cerr << "error opening test device" << endl;
+    return LOG_CLONE_ERR;
+  }
+  const int res = log_snapshot_load_chunked(cache_file, device_fd,
+      device_bytes(device_fd));
+  close(device_fd);
+  fsync(snapshots_->GetBaseFd());
+  return res;
+}
+
+int Tester::image_cache_save(const string &cache_file) {
+  // Write somewhere private and rename into place so that concurrent runs
+  // never see a partial image.
+  const string tmp_file = cache_file + ".tmp" + to_string(getpid());
+  if (log_snapshot_save_chunked(tmp_file,
+        device_bytes(snapshots_->GetBaseFd())) != SUCCESS) {
+    unlink(tmp_file.c_str());
+    return LOG_CLONE_ERR;
+  }
+  if (rename(tmp_file.c_str(), cache_file.c_str()) < 0) {
+    unlink(tmp_file.c_str());
+    return LOG_CLONE_ERR;
+  }
   return SUCCESS;
 }
 
@@ -619,7 +736,8 @@ int Tester::test_init_values(string mount_dir, long filesys_size) {
 }
 
 int Tester::test_run(const int change_fd, const int checkpoint) {
-  return test_loader.get_instance()->Run(change_fd, checkpoint);
+  return test_loader.get_instance()->Run(change_fd, checkpoint,
+      hash_mod_data_);
 }
 
 /*
@@ -651,6 +769,8 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
   }
   time_point<steady_clock> mount_end_time = steady_clock::now();
   res.at(2) = duration_cast<milliseconds>(mount_end_time - mount_start_time);
+  phase_trace_.Record(PhaseTrace::kMount, test_info.test_num,
+      mount_start_time, mount_end_time);
 
   // Only run fsck if we failed when mounting the file system above.
   if (test_info.fs_test.GetError() & FileSystemTestResult::kKernelMount) {
@@ -671,6 +791,8 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
       test_info.fs_test.error_description = "error running fsck";
       time_point<steady_clock> fsck_end_time = steady_clock::now();
       res.at(0) = duration_cast<milliseconds>(fsck_end_time - fsck_start_time);
+      phase_trace_.Record(PhaseTrace::kFsck, test_info.test_num,
+          fsck_start_time, fsck_end_time);
       return res;
     }
     while (!feof(pipe)) {
@@ -683,6 +805,8 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
     test_info.fs_test.fs_check_return = pclose(pipe);
     time_point<steady_clock> fsck_end_time = steady_clock::now();
     res.at(0) = duration_cast<milliseconds>(fsck_end_time - fsck_start_time);
+    phase_trace_.Record(PhaseTrace::kFsck, test_info.test_num,
+        fsck_start_time, fsck_end_time);
     // End fsck timing.
 
     if (!WIFEXITED(test_info.fs_test.fs_check_return)) {
@@ -706,10 +830,14 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
     mount_start_time = steady_clock::now();
     if (mount_device(device_path.c_str(), NULL) != SUCCESS) {
       test_info.fs_test.SetError(FileSystemTestResult::kUnmountable);
+      phase_trace_.Record(PhaseTrace::kMount, test_info.test_num,
+          mount_start_time, steady_clock::now());
       return res;
     }
     mount_end_time = steady_clock::now();
     res.at(2) += duration_cast<milliseconds>(mount_end_time - mount_start_time);
+    phase_trace_.Record(PhaseTrace::kMount, test_info.test_num,
+        mount_start_time, mount_end_time);
   }
 
   // Begin test case timing.
@@ -728,6 +856,8 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
   time_point<steady_clock> test_case_end_time = steady_clock::now();
   res.at(1) = duration_cast<milliseconds>(
       test_case_end_time - test_case_start_time);
+  phase_trace_.Record(PhaseTrace::kCheck, test_info.test_num,
+      test_case_start_time, test_case_end_time);
   // End test case timing.
 
   // File system was either mounted at the very start of this segment or after
@@ -746,6 +876,8 @@ vector<milliseconds> Tester::test_fsck_and_user_test(
   } while (umount_res < 0 && err == EBUSY);
   mount_end_time = steady_clock::now();
   res.at(2) += duration_cast<milliseconds>(mount_end_time - mount_start_time);
+  phase_trace_.Record(PhaseTrace::kUmount, test_info.test_num,
+      mount_start_time, mount_end_time);
 
   return res;
 }
@@ -767,7 +899,15 @@ bool Tester::check_disk_and_snapshot_contents(string disk_path, int last_checkpo
   disk1.set_mount_point("/mnt/snapshot");
 
   assert(last_checkpoint < mods_.size() && (last_checkpoint > 0));
-  for (auto i : mods_.at(last_checkpoint-1)) {
+  const vector<shared_ptr<char>> &checkpoint_mods =
+    mods_.at(last_checkpoint-1);
+  for (unsigned int m = 0; m < checkpoint_mods.size(); ++m) {
+    DiskMod i;
+    if (DiskMod::Deserialize(checkpoint_mods.at(m), i) < 0) {
+      std::cout << "ERROR: bad change data at checkpoint " << last_checkpoint
+        << endl;
+      return false;
+    }
     if (i.mod_type == DiskMod::kFsyncMod) {
       string path(i.path);
       path.erase(0, 13);
@@ -793,8 +933,28 @@ bool Tester::check_disk_and_snapshot_contents(string disk_path, int last_checkpo
         i.mod_type == DiskMod::kSyncFileRangeMod) {
       string path(i.path);
       path.erase(0, 13);
-      bool retVal = disk1.compare_file_contents(disk2, path, i.file_mod_location,
-        i.file_mod_len, diff_file);
+      bool retVal;
+      if (i.file_mod_data_hashed) {
+        // Only digests of the written data were recorded, so check the crash
+        // state against those without mounting the snapshot. Later writes
+        // before the checkpoint may cover parts of this one, so they go along
+        // too.
+        vector<DiskMod> writes(1, i);
+        for (unsigned int later = m + 1; later < checkpoint_mods.size();
+            ++later) {
+          writes.emplace_back();
+          if (DiskMod::Deserialize(checkpoint_mods.at(later),
+                writes.back()) < 0) {
+            std::cout << "ERROR: bad change data at checkpoint "
+              << last_checkpoint << endl;
+            return false;
+          }
+        }
+        retVal = disk1.compare_file_digests(path, writes, diff_file);
+      } else {
+        retVal = disk1.compare_file_contents(disk2, path, i.file_mod_location,
+          i.file_mod_len, diff_file);
+      }
       if (retVal && (last_checkpoint == mods_.size()-1)) {
         if (disk1.sanity_checks(diff_file) == false) {
           std::cout << "Failed: Sanity checks on " << disk_path << endl;
@@ -814,7 +974,7 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
   assert(current_test_suite_ != NULL);
   time_point<steady_clock> start_time = steady_clock::now();
   Permuter *p = permuter_loader.get_instance();
-  p->InitDataVector(sector_size_, log_data);
+  p->InitDataVector(sector_size_, log_data, log_first_entry_);
   vector<DiskWriteData> permutes;
   for (int rounds = 0; rounds < num_rounds; ++rounds) {
     // Print status every 1024 iterations.
@@ -841,6 +1001,8 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
     time_point<steady_clock> permute_end_time = steady_clock::now();
     timing_stats[PERMUTE_TIME] +=
         duration_cast<milliseconds>(permute_end_time - permute_start_time);
+    phase_trace_.Record(PhaseTrace::kGenerate, test_info.test_num,
+        permute_start_time, permute_end_time);
     // End permute timing.
 
     if (!new_state) {
@@ -848,48 +1010,48 @@ int Tester::test_check_random_permutations(bool full_bio_replay,
     }
 
     // Restore disk clone.
-    int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
-    if (cow_brd_snapshot_fd < 0) {
+    int snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+    if (snapshot_fd < 0) {
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyReorderingResult(test_info);
+      record_result(ResultSink::kReordering, test_info, log);
       continue;
     }
     // Begin snapshot timing.
     time_point<steady_clock> snapshot_start_time = steady_clock::now();
-    if (clone_device_restore(cow_brd_snapshot_fd, false) != SUCCESS) {
+    if (clone_device_restore(snapshot_fd, false) != SUCCESS) {
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyReorderingResult(test_info);
+      record_result(ResultSink::kReordering, test_info, log);
       continue;
     }
     time_point<steady_clock> snapshot_end_time = steady_clock::now();
     timing_stats[SNAPSHOT_TIME] +=
         duration_cast<milliseconds>(snapshot_end_time - snapshot_start_time);
+    phase_trace_.Record(PhaseTrace::kRestore, test_info.test_num,
+        snapshot_start_time, snapshot_end_time);
     // End snapshot timing.
 
     // Write recorded data out to block device in different orders so that we
     // can if they are all valid or not.
     time_point<steady_clock> bio_write_start_time = steady_clock::now();
     const int write_data_res =
-      test_write_data(cow_brd_snapshot_fd, permutes.begin(), permutes.end());
+      test_write_data(snapshot_fd, permutes.begin(), permutes.end());
     time_point<steady_clock> bio_write_end_time = steady_clock::now();
     timing_stats[BIO_WRITE_TIME] +=
         duration_cast<milliseconds>(bio_write_end_time - bio_write_start_time);
+    phase_trace_.Record(PhaseTrace::kWrite, test_info.test_num,
+        bio_write_start_time, bio_write_end_time);
     if (!write_data_res) {
       test_info.fs_test.SetError(FileSystemTestResult::kBioWrite);
-      close(cow_brd_snapshot_fd);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyReorderingResult(test_info);
+      close(snapshot_fd);
+      record_result(ResultSink::kReordering, test_info, log);
       continue;
     }
-    close(cow_brd_snapshot_fd);
+    close(snapshot_fd);
 
     // Test the crash state that was just written out.
     vector<milliseconds> check_res = test_fsck_and_user_test(snapshot_path_,
         test_info.permute_data.last_checkpoint, test_info, false);
-    test_info.PrintResults(log);
-    current_test_suite_->TallyReorderingResult(test_info);
+    record_result(ResultSink::kReordering, test_info, log);
 
     // Accounting for time it took to run the test.
     if (check_res.at(0).count() > -1) {
@@ -941,7 +1103,9 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
   // Skip the first disk write as it is just the Checkpoint at the start of the
   // log.
   auto log_iter = log_data.begin() + 1;
-  unsigned int last_checkpoint = 0;
+  // Logs loaded for a range of checkpoints start at a later checkpoint.
+  unsigned int last_checkpoint = log_data.front().is_checkpoint() ?
+    log_data.front().metadata.write_sector : 0;
   unsigned int test_num = 1;
   unsigned int op_index = 1;
   vector<DiskWriteData> crash_state;
@@ -982,35 +1146,38 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
     test_info.test_num = test_num++;
 
     // 1. Restore disk clone.
-    int cow_brd_snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
-    if (cow_brd_snapshot_fd < 0) {
+    int snapshot_fd = open(snapshot_path_.c_str(), O_WRONLY);
+    if (snapshot_fd < 0) {
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
+      record_result(ResultSink::kTiming, test_info, log);
       continue;
     }
-    if (clone_device_restore(cow_brd_snapshot_fd, false) != SUCCESS) {
+    time_point<steady_clock> snapshot_start_time = steady_clock::now();
+    if (clone_device_restore(snapshot_fd, false) != SUCCESS) {
       test_info.fs_test.SetError(FileSystemTestResult::kSnapshotRestore);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
+      record_result(ResultSink::kTiming, test_info, log);
       continue;
     }
+    phase_trace_.Record(PhaseTrace::kRestore, test_info.test_num,
+        snapshot_start_time, steady_clock::now());
 
     // 2. Write recorded data out to block device. If the iterator points to the
     // end of the log, we are alright because the function is [begin, end) and
     // the end iterator is a sentinal value. The same logic applies for
     // checkpoints (which we don't really want to replay).
+    time_point<steady_clock> bio_write_start_time = steady_clock::now();
     const int write_data_res =
-      test_write_data(cow_brd_snapshot_fd, crash_state.begin(),
+      test_write_data(snapshot_fd, crash_state.begin(),
           crash_state.end());
+    phase_trace_.Record(PhaseTrace::kWrite, test_info.test_num,
+        bio_write_start_time, steady_clock::now());
     if (!write_data_res) {
       test_info.fs_test.SetError(FileSystemTestResult::kBioWrite);
-      close(cow_brd_snapshot_fd);
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
+      close(snapshot_fd);
+      record_result(ResultSink::kTiming, test_info, log);
       continue;
     }
-    close(cow_brd_snapshot_fd);
+    close(snapshot_fd);
 
     // 3. Check the resulting disk image with fsck and the user test. For now,
     // just ignore the timing data that we can get from this function.
@@ -1018,8 +1185,7 @@ int Tester::test_check_log_replay(std::ofstream& log, bool automate_check_test)
       test_fsck_and_user_test(snapshot_path_,
           test_info.permute_data.last_checkpoint, test_info, automate_check_test);
 
-      test_info.PrintResults(log);
-      current_test_suite_->TallyTimingResult(test_info);
+      record_result(ResultSink::kTiming, test_info, log);
     }
 
     // Exit loop after doing final test.
@@ -1108,7 +1274,7 @@ bool Tester::test_write_data_dw(const int disk_fd,
       return false;
     }
     unsigned int bytes_written = 0;
-    void *data_base_addr = current->get_data().get();
+    const void *data_base_addr = current->get_data();
     while (bytes_written < current->metadata.size) {
       int res = write(disk_fd,
           (void*) ((unsigned long) data_base_addr + bytes_written),
@@ -1135,7 +1301,7 @@ bool Tester::test_write_data(const int disk_fd,
       return false;
     }
     unsigned int bytes_written = 0;
-    void *data_base_addr = current->GetData();
+    const void *data_base_addr = current->GetData();
     while (bytes_written < current->size) {
       int res = write(disk_fd,
           (void*) ((unsigned long) data_base_addr + bytes_written),
@@ -1173,8 +1339,8 @@ void Tester::cleanup_harness() {
     return;
   }
 
-  if (remove_cow_brd() != SUCCESS) {
-    cerr << "Unable to remove cow_brd device" << endl;
+  if (remove_snapshots() != SUCCESS) {
+    cerr << "Unable to remove snapshot devices" << endl;
     permuter_unload_class();
     test_unload_class();
     return;
@@ -1213,18 +1379,82 @@ int Tester::log_profile_save(string log_file) {
   // class specific one that is set at class creation time. That way people
   // don't break our logging system.
   std::cout << "saving " << log_data.size() << " disk operations" << endl;
-  ofstream log(log_file, std::ofstream::trunc | ios::binary);
-  for (const disk_write& dw : log_data) {
-    disk_write::serialize(log, dw);
+  if (ProfileLog::Save(log_file, log_data, compress_logs_) < 0) {
+    int errnum = errno;
+    std::cout << "error " << strerror(errnum) << std::endl;
+    return LOG_CLONE_ERR;
   }
-  log.close();
   return SUCCESS;
 }
 
+int Tester::log_profile_save_async(string log_file) {
+  if (profile_save_thread_.joinable()) {
+    return LOG_CLONE_ERR;
+  }
+  std::cout << "saving " << log_data.size() << " disk operations in the"
+    " background" << endl;
+  profile_save_data_ = log_data;
+  profile_save_res_ = SUCCESS;
+  profile_save_thread_ = std::thread([this, log_file]() {
+    if (ProfileLog::Save(log_file, profile_save_data_, compress_logs_) < 0) {
+      int errnum = errno;
+      cerr << "error saving profile " << strerror(errnum) << endl;
+      profile_save_res_ = LOG_CLONE_ERR;
+    }
+  });
+  return SUCCESS;
+}
+
+int Tester::log_profile_save_wait() {
+  if (profile_save_thread_.joinable()) {
+    profile_save_thread_.join();
+    profile_save_data_.clear();
+  }
+  return profile_save_res_;
+}
+
 int Tester::log_profile_load(string log_file) {
+  if (has_checkpoint_range_) {
+    if (!ProfileLog::IsProfileLog(log_file)) {
+      cerr << "checkpoint ranges require a v2 profile" << endl;
+      return LOG_CLONE_ERR;
+    }
+    vector<disk_write> prefix;
+    if (ProfileLog::LoadRange(log_file, log_arena_, first_checkpoint_,
+          last_checkpoint_, prefix, log_data) < 0) {
+      cerr << "error loading checkpoints " << first_checkpoint_ << " through "
+        << last_checkpoint_ << endl;
+      return LOG_CLONE_ERR;
+    }
+    log_first_entry_ = prefix.size();
+    // The bios before the range are part of every crash state we generate, so
+    // write them into the base image once instead of permuting them.
+    if (!prefix.empty() && log_apply_to_base(prefix) != SUCCESS) {
+      return LOG_CLONE_ERR;
+    }
+    std::cout << "loaded " << log_data.size() << " disk operations for "
+      << "checkpoints " << first_checkpoint_ << " through " << last_checkpoint_
+      << " (" << prefix.size() << " earlier operations applied to base image)"
+      << endl;
+    return SUCCESS;
+  }
+
+  if (ProfileLog::IsProfileLog(log_file)) {
+    // The disk_writes loaded here point into an mmap of the log file instead of
+    // a copy of their data in the arena.
+    if (ProfileLog::Load(log_file, log_arena_, log_data) < 0) {
+      int errnum = errno;
+      std::cout << "error " << strerror(errnum) << std::endl;
+      return LOG_CLONE_ERR;
+    }
+    std::cout << "loaded " << log_data.size() << " disk operations" << endl;
+    return SUCCESS;
+  }
+
+  // Profiles saved before the v2 format was added.
   ifstream log(log_file, ios::binary);
   while (log.peek() != EOF) {
-    log_data.push_back(disk_write::deserialize(log));
+    log_data.push_back(disk_write::deserialize(log, log_arena_));
   }
   bool err = log.fail();
   int errnum = errno;
@@ -1237,28 +1467,66 @@ int Tester::log_profile_load(string log_file) {
   return SUCCESS;
 }
 
+int Tester::log_apply_to_base(vector<disk_write> &log) {
+  if (snapshots_->Unsnapshot() < 0) {
+    cerr << "error making base disk image writable" << endl;
+    return LOG_CLONE_ERR;
+  }
+  // The base device fd from the snapshot backend may be read only.
+  const int device_fd = open(snapshots_->GetBasePath().c_str(), O_WRONLY);
+  if (device_fd < 0) {
+    cerr << "error opening base disk image" << endl;
+    return LOG_CLONE_ERR;
+  }
+  const bool write_res = test_write_data_dw(device_fd, log.begin(), log.end());
+  close(device_fd);
+  if (!write_res) {
+    cerr << "error writing log to base disk image" << endl;
+    return LOG_CLONE_ERR;
+  }
+  fsync(snapshots_->GetBaseFd());
+  if (snapshots_->Snapshot() < 0) {
+    cerr << "error snapshotting base disk image" << endl;
+    return LOG_CLONE_ERR;
+  }
+  return SUCCESS;
+}
+
+uint64_t Tester::device_bytes(const int device_fd) {
+  uint64_t bytes;
+  if (ioctl(device_fd, BLKGETSIZE64, &bytes) == 0) {
+    return bytes;
+  }
+  // device_size happens to be the number of 1k blocks on cow_brd (from original
+  // brd behavior...), so convert it to a number of bytes.
+  return (uint64_t) device_size * 2 * 512;
+}
+
 int Tester::log_snapshot_save(string log_file) {
   // TODO(ashmrtn): What happens if this fails?
   // TODO(ashmrtn): Change device_clone to be an mmap of the disk we need to get
   // stuff on.
-  // device_size happens to be the number of 1k blocks on cow_brd (from original
-  // brd behavior...), so convert it to a number of bytes.
-  unsigned int dev_bytes = device_size * 2 * 512;
-  unsigned int bytes_done = 0;
+  const uint64_t dev_bytes = device_bytes(snapshots_->GetBaseFd());
+  uint64_t bytes_done = 0;
   const unsigned int buf_size = 4096;
   unsigned int buf[buf_size];
+
+  int res = lseek(snapshots_->GetBaseFd(), 0, SEEK_SET);
+  if (res < 0) {
+    cerr << "error seeking to start of test device" << endl;
+    return LOG_CLONE_ERR;
+  }
+
+  if (compress_logs_) {
+    return log_snapshot_save_chunked(log_file, dev_bytes);
+  }
+
   int log_fd =
     open(log_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
   if (log_fd < 0) {
     cerr << "error opening log file" << endl;
     return LOG_CLONE_ERR;
   }
-
-  int res = lseek(cow_brd_fd, 0, SEEK_SET);
-  if (res < 0) {
-    cerr << "error seeking to start of test device" << endl;
-    return LOG_CLONE_ERR;
-  }
   while (bytes_done < dev_bytes) {
     // Read a block of data from the base disk image.
     unsigned int bytes = 0;
@@ -1266,7 +1534,7 @@ int Tester::log_snapshot_save(string log_file) {
                             ? dev_bytes - bytes_done
                             : buf_size;
     do {
-      int res = read(cow_brd_fd, buf + bytes, new_amount - bytes);
+      int res = read(snapshots_->GetBaseFd(), buf + bytes, new_amount - bytes);
       if (res < 0) {
         cerr << "error reading from raw device to log disk snapshot" << endl;
         return LOG_CLONE_ERR;
@@ -1295,27 +1563,41 @@ int Tester::log_snapshot_load(string log_file) {
   // TODO(ashmrtn): What happens if this fails?
   // TODO(ashmrtn): Change device_clone to be an mmap of the disk we need to get
   // stuff on.
-  int res = ioctl(cow_brd_fd, COW_BRD_WIPE);
+  int res = snapshots_->Wipe();
   if (res < 0) {
     cerr << "error wiping old disk snapshot" << endl;
     return LOG_CLONE_ERR;
   }
 
-  // device_size happens to be the number of 1k blocks on cow_brd (from original
-  // brd behavior...), so convert it to a number of bytes.
-  unsigned int dev_bytes = device_size * 2 * 512;
-  unsigned int bytes_done = 0;
+  uint64_t bytes_done = 0;
   const unsigned int buf_size = 4096;
   unsigned int buf[buf_size];
-  int log_fd = open(log_file.c_str(), O_RDONLY);
-  if (log_fd < 0) {
+
+  // The base device fd from the snapshot backend may be read only.
+  int device_path = open(snapshots_->GetBasePath().c_str(), O_WRONLY);
+  if (device_path < 0) {
     cerr << "error opening log file" << endl;
     return LOG_CLONE_ERR;
   }
+  const uint64_t dev_bytes = device_bytes(device_path);
 
-  // cow_brd_fd is RDONLY.
-  int device_path = open(COW_BRD_PATH, O_WRONLY);
-  if (device_path < 0) {
+  if (ChunkedFile::IsChunkedFile(log_file)) {
+    res = log_snapshot_load_chunked(log_file, device_path, dev_bytes);
+    close(device_path);
+    if (res != SUCCESS) {
+      return res;
+    }
+    fsync(snapshots_->GetBaseFd());
+    res = snapshots_->Snapshot();
+    if (res < 0) {
+      cerr << "error restoring snapshot from log" << endl;
+      return LOG_CLONE_ERR;
+    }
+    return SUCCESS;
+  }
+
+  int log_fd = open(log_file.c_str(), O_RDONLY);
+  if (log_fd < 0) {
     cerr << "error opening log file" << endl;
     return LOG_CLONE_ERR;
   }
@@ -1359,8 +1641,8 @@ int Tester::log_snapshot_load(string log_file) {
   }
   close(device_path);
 
-  fsync(cow_brd_fd);
-  res = ioctl(cow_brd_fd, COW_BRD_SNAPSHOT);
+  fsync(snapshots_->GetBaseFd());
+  res = snapshots_->Snapshot();
   if (res < 0) {
     cerr << "error restoring snapshot from log" << endl;
     return LOG_CLONE_ERR;
@@ -1368,6 +1650,89 @@ int Tester::log_snapshot_load(string log_file) {
   return SUCCESS;
 }
 
+int Tester::log_snapshot_save_chunked(const string &log_file,
+    const uint64_t dev_bytes) {
+  uint64_t bytes_done = 0;
+  const unsigned int buf_size = 4096;
+  char buf[buf_size];
+
+  if (lseek(snapshots_->GetBaseFd(), 0, SEEK_SET) < 0) {
+    cerr << "error seeking to start of test device" << endl;
+    return LOG_CLONE_ERR;
+  }
+
+  // Most of a freshly formatted device is zeros, which the chunked writer
+  // turns into holes.
+  ChunkedFileWriter writer;
+  if (writer.Open(log_file) < 0) {
+    cerr << "error opening log file" << endl;
+    return LOG_CLONE_ERR;
+  }
+  while (bytes_done < dev_bytes) {
+    const unsigned int new_amount = (dev_bytes < bytes_done + buf_size)
+                                  ? dev_bytes - bytes_done
+                                  : buf_size;
+    unsigned int bytes = 0;
+    do {
+      int res = read(snapshots_->GetBaseFd(), buf + bytes, new_amount - bytes);
+      if (res <= 0) {
+        cerr << "error reading from raw device to log disk snapshot" << endl;
+        return LOG_CLONE_ERR;
+      }
+      bytes += res;
+    } while (bytes < new_amount);
+    if (writer.Append(buf, new_amount) < 0) {
+      cerr << "error writing compressed disk snapshot" << endl;
+      return LOG_CLONE_ERR;
+    }
+    bytes_done += new_amount;
+  }
+  if (writer.Close() < 0) {
+    cerr << "error writing compressed disk snapshot" << endl;
+    return LOG_CLONE_ERR;
+  }
+  return SUCCESS;
+}
+
+int Tester::log_snapshot_load_chunked(const string &log_file,
+    const int device_fd, const uint64_t dev_bytes) {
+  ChunkedFileReader reader;
+  if (reader.Open(log_file) < 0) {
+    cerr << "error opening log file" << endl;
+    return LOG_CLONE_ERR;
+  }
+  if (reader.GetSize() != dev_bytes) {
+    cerr << "disk snapshot size does not match test device" << endl;
+    return LOG_CLONE_ERR;
+  }
+
+  // The device was just wiped, so holes (all zero chunks) can be skipped
+  // entirely instead of writing zeros back out.
+  vector<char> chunk(reader.GetChunkSize());
+  for (uint64_t i = 0; i < reader.GetNumChunks(); ++i) {
+    if (reader.IsHole(i)) {
+      continue;
+    }
+    const int64_t chunk_bytes = reader.ReadChunk(i, chunk.data());
+    if (chunk_bytes < 0) {
+      cerr << "error decompressing disk snapshot" << endl;
+      return LOG_CLONE_ERR;
+    }
+    const uint64_t dev_offset = i * reader.GetChunkSize();
+    int64_t bytes = 0;
+    do {
+      int res = pwrite(device_fd, chunk.data() + bytes, chunk_bytes - bytes,
+          dev_offset + bytes);
+      if (res < 0) {
+        cerr << "error writing disk snapshot to test device" << endl;
+        return LOG_CLONE_ERR;
+      }
+      bytes += res;
+    } while (bytes < chunk_bytes);
+  }
+  return SUCCESS;
+}
+
 void Tester::log_disk_write_data(std::ostream &log) {
   int digits = log.precision();
   std::ios_base::fmtflags fflags = log.flags();
@@ -1382,6 +1747,14 @@ void Tester::log_disk_write_data(std::ostream &log) {
   log.flags(fflags);
 }
 
+unsigned int Tester::GetNumTestsCompleted() {
+  unsigned int res = 0;
+  for (const auto& suite : test_results_) {
+    res += suite.GetCompleted();
+  }
+  return res;
+}
+
 void Tester::PrintTestStats(std::ostream& os) {
   for (const auto& suite : test_results_) {
     suite.PrintResults(os);
@@ -1392,6 +1765,71 @@ std::chrono::milliseconds Tester::get_timing_stat(time_stats timing_stat) {
   return timing_stats[timing_stat];
 }
 
+int Tester::results_file_open(const string &path) {
+  if (result_sink_.Open(path) < 0) {
+    return TEST_RESULTS_ERR;
+  }
+  return SUCCESS;
+}
+
+int Tester::results_file_close() {
+  if (result_sink_.Close() < 0) {
+    return TEST_RESULTS_ERR;
+  }
+  return SUCCESS;
+}
+
+void Tester::record_result(const ResultSink::Suite suite,
+    SingleTestInfo &test_info, ofstream &log) {
+  if (suite == ResultSink::kReordering) {
+    current_test_suite_->TallyReorderingResult(test_info);
+  } else {
+    current_test_suite_->TallyTimingResult(test_info);
+  }
+
+  if (result_sink_.IsOpen()) {
+    if (result_sink_.Write(suite, test_info) < 0) {
+      cerr << "Error writing test results, logging all of them instead" << endl;
+      result_sink_.Close();
+    } else if (test_info.GetTestResult() == SingleTestInfo::kPassed) {
+      return;
+    }
+  }
+  if (print_results_) {
+    test_info.PrintResults(log);
+  }
+}
+
+void Tester::set_print_results(const bool print) {
+  print_results_ = print;
+}
+
+void Tester::enable_phase_trace(const size_t num_spans) {
+  phase_trace_.SetCapacity(num_spans);
+}
+
+const PhaseTrace & Tester::get_phase_trace() {
+  return phase_trace_;
+}
+
+void Tester::PrintPhaseStats(std::ostream& os) {
+  const double ns_per_ms = 1000000.0;
+  std::ios::fmtflags fflags = os.flags();
+  os << std::fixed << std::setprecision(3);
+  for (unsigned int i = 0; i < PhaseTrace::kNumPhases; ++i) {
+    const PhaseTrace::Phase phase = (PhaseTrace::Phase) i;
+    const LatencyHistogram &histogram = phase_trace_.GetHistogram(phase);
+    if (histogram.Count() == 0) {
+      continue;
+    }
+    os << "\t" << PhaseTrace::PhaseName(phase) << ": " << histogram.Count()
+      << " times, p50 " << histogram.ValueAtPercentile(50) / ns_per_ms
+      << " ms, p99 " << histogram.ValueAtPercentile(99) / ns_per_ms
+      << " ms, max " << histogram.Max() / ns_per_ms << " ms" << endl;
+  }
+  os.flags(fflags);
+}
+
 std::ostream& operator<<(std::ostream& os, Tester::time_stats time) {
   switch (time) {
     case fs_testing::Tester::PERMUTE_TIME:
@@ -4,17 +4,22 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <map>
 
 #include "FsSpecific.h"
+#include "SnapshotBackend.h"
 #include "../permuter/Permuter.h"
+#include "../results/ResultSink.h"
 #include "../results/TestSuiteResult.h"
 #include "../tests/BaseTestCase.h"
 #include "../utils/ClassLoader.h"
 #include "../utils/DiskMod.h"
+#include "../utils/PhaseTrace.h"
 #include "../utils/utils.h"
 
 #define SUCCESS                  0
@@ -35,6 +40,7 @@
 #define WRAPPER_MEM_ERR          -20
 #define CLEAR_CACHE_ERR          -21
 #define PART_PART_ERR            -22
+#define TEST_RESULTS_ERR         -23
 
 #define FMT_EXT4               0
 
@@ -71,6 +77,36 @@ class Tester {
   void set_fs_type(const std::string type);
   void set_device(const std::string device_path);
   void set_flag_device(const std::string device_path);
+  // Save profiles and disk snapshots compressed. Loading detects the format on
+  // its own.
+  void set_compress_logs(const bool compress);
+  // Have the test case record only digests of the data written by each large
+  // write in the change log instead of the data itself. The checker then
+  // verifies crash states against the digests.
+  void set_hash_mod_data(const bool hash);
+  // Only load and test checkpoints first through last (inclusive) of a saved
+  // profile. Everything the workload wrote before first is applied to the
+  // base disk image when the profile is loaded.
+  void set_checkpoint_range(const unsigned int first,
+      const unsigned int last);
+  // Keep freshly formatted images in dir, keyed by file system type, device
+  // size, and mkfs command, and load them instead of running mkfs when an
+  // image with the same key is already there.
+  void set_image_cache_dir(const std::string dir);
+  // Load the image the loaded test case's setup() left behind in an earlier
+  // run with the same setup key and mount options, or save the current one for
+  // later runs. Return SUCCESS only if an image was loaded or saved.
+  int setup_cache_load(const std::string &mount_opts);
+  int setup_cache_save(const std::string &mount_opts);
+  // Keep the base device and its snapshots as image files in dir attached to
+  // loop devices instead of using cow_brd. Must be set before
+  // insert_snapshots.
+  void set_snapshot_dir(const std::string dir);
+  std::string get_snapshot_base_path();
+  // Leave the snapshot devices and the wrapper module loaded when asked to
+  // remove them so a long running harness can test many test cases without
+  // reloading them.
+  void set_keep_modules(const bool keep);
 
   const char* update_dirty_expire_time(const char* time);
 
@@ -79,11 +115,16 @@ class Tester {
   int format_drive();
   int clone_device();
   int clone_device_restore(int snapshot_fd, bool reread);
+  // Make the snapshot devices look like they were just set up again: base
+  // device writable and empty, and no changes held in the snapshots.
+  int reset_devices();
 
   int permuter_load_class(const char* path);
   void permuter_unload_class();
 
-  int test_load_class(const char* path);
+  // Loads the test case named name from path if name is not NULL, else the
+  // only test case in path.
+  int test_load_class(const char* path, const char* name = NULL);
   void test_unload_class();
   int test_setup();
   int test_init_values(std::string mountDir, long filesysSize);
@@ -105,8 +146,8 @@ class Tester {
   int getNewDiskClone(int checkpoint);
   void getCompleteRunDiskClone();
 
-  int insert_cow_brd();
-  int remove_cow_brd();
+  int insert_snapshots();
+  int remove_snapshots();
 
   int insert_wrapper();
   int remove_wrapper();
@@ -125,14 +166,37 @@ class Tester {
   // TODO(ashmrtn): Save the fstype in the log file so that we don't
   // accidentally mix logs of one fs type with mount options for another?
   int log_profile_save(std::string log_file);
+  /*
+   * Save the profile like log_profile_save, but on a background thread so
+   * testing can start right away. log_profile_save_wait returns the result of
+   * the save once it is done. Only one save may be in flight at a time.
+   */
+  int log_profile_save_async(std::string log_file);
+  int log_profile_save_wait();
   int log_profile_load(std::string log_file);
   int log_snapshot_save(std::string log_file);
   int log_snapshot_load(std::string log_file);
   void log_disk_write_data(std::ostream &log);
 
+  // Write a compact record of every crash state tested to path as tests
+  // finish. While it is open, only tests that don't pass are printed to the
+  // log.
+  int results_file_open(const std::string &path);
+  int results_file_close();
+  // Print the result of each test to the log. On by default.
+  void set_print_results(const bool print);
+
   std::chrono::milliseconds get_timing_stat(time_stats timing_stat);
+  // Keep the last num_spans phase timings of crash states so they can be
+  // exported as a trace. Histograms of them are kept either way.
+  void enable_phase_trace(const size_t num_spans);
+  const fs_testing::utils::PhaseTrace & get_phase_trace();
+  // Print the median, tail and max time each phase took per crash state.
+  void PrintPhaseStats(std::ostream& os);
   void PrintTimingStats(std::ostream& os);
   void PrintTestStats(std::ostream& os);
+  // Number of crash states tested in all test suites so far.
+  unsigned int GetNumTestsCompleted();
   void StartTestSuite();
   void EndTestSuite();
 
@@ -155,17 +219,49 @@ class Tester {
   TestSuiteResult *current_test_suite_ = NULL;
 
   bool wrapper_inserted = false;
-  bool cow_brd_inserted = false;
-  int cow_brd_fd = -1;
+  // Where the base device and its snapshots come from.
+  SnapshotBackend *snapshots_ = NULL;
+  std::string snapshot_dir_;
 
   bool disk_mounted = false;
+  bool keep_modules_ = false;
+  bool compress_logs_ = false;
+  bool hash_mod_data_ = false;
+  bool print_results_ = true;
+  bool has_checkpoint_range_ = false;
+  unsigned int first_checkpoint_ = 0;
+  unsigned int last_checkpoint_ = 0;
+  // Index in the profile of the first entry in log_data. Only non-zero if a
+  // checkpoint range was loaded.
+  unsigned int log_first_entry_ = 0;
+  std::string image_cache_dir_;
 
   int ioctl_fd = -1;
   const unsigned int sector_size_;
+  // Holds the data for every bio in log_data. Crash states generated from
+  // log_data refer to this too, so it must outlive all of them.
+  fs_testing::utils::DiskWriteArena log_arena_;
   std::vector<fs_testing::utils::disk_write> log_data;
-  std::vector<std::vector<fs_testing::utils::DiskMod>> mods_;
+  // Background save of the profile. It works on its own copy of log_data (the
+  // data itself stays in log_arena_) so log_data is free for testing.
+  std::thread profile_save_thread_;
+  std::vector<fs_testing::utils::disk_write> profile_save_data_;
+  int profile_save_res_ = SUCCESS;
+  // Serialized DiskMods grouped by checkpoint. Each one points into the mmap-ed
+  // change file and is only deserialized when it is needed.
+  std::vector<std::vector<std::shared_ptr<char>>> mods_;
 
   int mount_device(const char* dev, const char* opts);
+  uint64_t device_bytes(const int device_fd);
+  int log_snapshot_load_chunked(const std::string &log_file,
+      const int device_fd, const uint64_t dev_bytes);
+  int log_snapshot_save_chunked(const std::string &log_file,
+      const uint64_t dev_bytes);
+  int log_apply_to_base(std::vector<fs_testing::utils::disk_write> &log);
+  std::string image_cache_path(const std::string &key);
+  std::string setup_cache_key(const std::string &mount_opts);
+  int image_cache_load(const std::string &cache_file);
+  int image_cache_save(const std::string &cache_file);
 
   bool read_dirty_expire_time(int fd);
   bool write_dirty_expire_time(int fd, const char* time);
@@ -183,9 +279,16 @@ class Tester {
 
   bool check_disk_and_snapshot_contents(std::string disk_path, int last_checkpoint);
 
+  // Count the result of a test in the current test suite and save or print
+  // it.
+  void record_result(const ResultSink::Suite suite,
+      SingleTestInfo &test_info, std::ofstream &log);
+
   std::vector<TestSuiteResult> test_results_;
   std::chrono::milliseconds timing_stats[NUM_TIME] =
       {std::chrono::milliseconds(0)};
+  fs_testing::utils::PhaseTrace phase_trace_;
+  ResultSink result_sink_;
 
   std::map<int, std::string> checkpointToSnapshot_;
   std::string snapshot_path_;
@@ -0,0 +1,169 @@
+#include "WorkloadExecutor.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace fs_testing {
+
+using std::function;
+using std::vector;
+
+namespace {
+
+// Reads and writes of a single int on a pipe are atomic, so a short count
+// only happens if the other end went away.
+int ReadInt(const int fd, int *value) {
+  ssize_t res;
+  do {
+    res = read(fd, value, sizeof(*value));
+  } while (res < 0 && errno == EINTR);
+  return (res == sizeof(*value)) ? 0 : -1;
+}
+
+int WriteInt(const int fd, const int value) {
+  ssize_t res;
+  do {
+    res = write(fd, &value, sizeof(value));
+  } while (res < 0 && errno == EINTR);
+  return (res == sizeof(value)) ? 0 : -1;
+}
+
+// Close every fd but stdin, stdout, stderr, and those in keep_fds.
+void CloseOtherFds(const vector<int> &keep_fds) {
+  DIR *fd_dir = opendir("/proc/self/fd");
+  if (fd_dir == NULL) {
+    return;
+  }
+  // Don't close anything while reading the directory, which has its own fd.
+  vector<int> fds;
+  struct dirent *entry;
+  while ((entry = readdir(fd_dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    const int fd = atoi(entry->d_name);
+    if (fd > STDERR_FILENO && fd != dirfd(fd_dir) &&
+        std::find(keep_fds.begin(), keep_fds.end(), fd) == keep_fds.end()) {
+      fds.push_back(fd);
+    }
+  }
+  closedir(fd_dir);
+  for (const int fd : fds) {
+    close(fd);
+  }
+}
+
+}  // namespace
+
+WorkloadExecutor::~WorkloadExecutor() {
+  Stop();
+}
+
+int WorkloadExecutor::Start(function<int(const int)> run_fn,
+    vector<int> keep_fds) {
+  int request_pipe[2];
+  int done_pipe[2];
+  if (pipe2(request_pipe, O_CLOEXEC) < 0) {
+    return -1;
+  }
+  if (pipe2(done_pipe, O_CLOEXEC) < 0) {
+    close(request_pipe[0]);
+    close(request_pipe[1]);
+    return -1;
+  }
+
+  // Don't let the executor inherit output that the harness hasn't written yet.
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(NULL);
+
+  pid_ = fork();
+  if (pid_ < 0) {
+    close(request_pipe[0]);
+    close(request_pipe[1]);
+    close(done_pipe[0]);
+    close(done_pipe[1]);
+    return -1;
+  } else if (pid_ == 0) {
+    close(request_pipe[1]);
+    close(done_pipe[0]);
+    keep_fds.push_back(request_pipe[0]);
+    keep_fds.push_back(done_pipe[1]);
+    Serve(request_pipe[0], done_pipe[1], keep_fds, run_fn);
+  }
+
+  close(request_pipe[0]);
+  close(done_pipe[1]);
+  request_fd_ = request_pipe[1];
+  done_fd_ = done_pipe[0];
+  return 0;
+}
+
+void WorkloadExecutor::Serve(const int request_fd, const int done_fd,
+    const vector<int> &keep_fds, function<int(const int)> &run_fn) {
+  // Whatever else the harness had open when it forked us, like snapshot
+  // devices and its sockets, would otherwise stay open for as long as we do
+  // and keep the harness from removing kernel modules or socket files.
+  CloseOtherFds(keep_fds);
+
+  int checkpoint;
+  // The harness closing its end of the pipe means we're done.
+  while (ReadInt(request_fd, &checkpoint) == 0) {
+    int status = -1;
+    const pid_t child = fork();
+    if (child == 0) {
+      close(request_fd);
+      close(done_fd);
+      exit(run_fn(checkpoint));
+    } else if (child > 0) {
+      while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+      }
+    }
+    if (WriteInt(done_fd, status) < 0) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
+int WorkloadExecutor::Run(const int checkpoint) {
+  if (request_fd_ < 0) {
+    return -1;
+  }
+  return WriteInt(request_fd_, checkpoint);
+}
+
+int WorkloadExecutor::GetDoneFd() const {
+  return done_fd_;
+}
+
+int WorkloadExecutor::GetStatus(int *status) {
+  if (done_fd_ < 0) {
+    return -1;
+  }
+  return ReadInt(done_fd_, status);
+}
+
+void WorkloadExecutor::Stop() {
+  if (pid_ <= 0) {
+    return;
+  }
+  close(request_fd_);
+  close(done_fd_);
+  request_fd_ = -1;
+  done_fd_ = -1;
+  while (waitpid(pid_, NULL, 0) < 0 && errno == EINTR) {
+  }
+  pid_ = -1;
+}
+
+}  // namespace fs_testing
@@ -0,0 +1,71 @@
+#ifndef HARNESS_WORKLOAD_EXECUTOR_H
+#define HARNESS_WORKLOAD_EXECUTOR_H
+
+#include <sys/types.h>
+
+#include <functional>
+#include <vector>
+
+namespace fs_testing {
+
+/*
+ * Small helper process that runs the workload of a test case on request. It is
+ * forked once, right after the test case is loaded and before the harness
+ * builds up large logs, and then forks a fresh process for every run from its
+ * own small address space instead of the harness'.
+ */
+class WorkloadExecutor {
+ public:
+  ~WorkloadExecutor();
+
+  /*
+   * Fork the executor. Each run calls run_fn with the checkpoint to run to in
+   * a new child of the executor, and the run exits with its return value. The
+   * executor closes every fd it inherits but stdin, stdout, stderr, and those
+   * in keep_fds, so runs only see those. Returns 0 on success, a value < 0 on
+   * failure.
+   */
+  int Start(std::function<int(const int)> run_fn,
+      std::vector<int> keep_fds = std::vector<int>());
+
+  /*
+   * Start running the workload up to checkpoint (0 runs all of it). Returns 0
+   * on success, a value < 0 on failure.
+   */
+  int Run(const int checkpoint);
+
+  /*
+   * File descriptor that becomes readable once the current run is done. Lets
+   * callers wait for the run along with other things.
+   */
+  int GetDoneFd() const;
+
+  /*
+   * Wait for the current run to finish and return its wait status (as from
+   * waitpid) in status. Returns 0 on success, a value < 0 on failure.
+   */
+  int GetStatus(int *status);
+
+  /*
+   * Tell the executor to exit and wait for it to do so.
+   */
+  void Stop();
+
+ private:
+  /*
+   * Body of the executor process. Never returns.
+   */
+  static void Serve(const int request_fd, const int done_fd,
+      const std::vector<int> &keep_fds,
+      std::function<int(const int)> &run_fn);
+
+  pid_t pid_ = -1;
+  // Run requests to the executor.
+  int request_fd_ = -1;
+  // Wait statuses of finished runs from the executor.
+  int done_fd_ = -1;
+};
+
+}  // namespace fs_testing
+
+#endif  // HARNESS_WORKLOAD_EXECUTOR_H
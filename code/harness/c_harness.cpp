@@ -1,12 +1,17 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 #include <wait.h>
 
+#include <chrono>
+#include <climits>
+#include <cstdio>
 #include <ctime>
 
 #include <fstream>
@@ -16,10 +21,12 @@
 #include <vector>
 
 #include "../tests/BaseTestCase.h"
+#include "../tests/JLangTestCase.h"
 #include "../utils/communication/ServerSocket.h"
 #include "../utils/communication/SocketUtils.h"
 #include "../utils/utils.h"
 #include "Tester.h"
+#include "WorkloadExecutor.h"
 
 #define STRINGIFY(x) #x
 #define TO_STRING(x) STRINGIFY(x)
@@ -35,12 +42,17 @@
 #define DIRECTORY_PERMS \
   (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
-#define OPTS_STRING "bd:cf:e:l:m:np:r:s:t:vFIPS:"
+#define OPTS_STRING "bd:cf:e:i:k:l:m:np:r:s:t:vzB:DFHIL:PR:S:T:"
 
 namespace {
 
 static const unsigned int kSocketQueueDepth = 2;
 static constexpr char kChangePath[] = "run_changes";
+// Test case that runs j-lang files, relative to the directory of c_harness.
+static constexpr char kJLangTestCase[] = "tests/JLangTestCase.so";
+// Phase timings kept for the trace. A crash state takes at most 8, so this
+// holds all of them for the default 10K crash states.
+static const size_t kTraceSpans = 1 << 17;
 
 }  // namespace
 
@@ -51,6 +63,8 @@ using std::ofstream;
 using std::string;
 using std::to_string;
 using fs_testing::Tester;
+using fs_testing::WorkloadExecutor;
+using fs_testing::utils::communication::kSocketNameDaemon;
 using fs_testing::utils::communication::kSocketNameOutbound;
 using fs_testing::utils::communication::ServerSocket;
 using fs_testing::utils::communication::SocketError;
@@ -62,6 +76,8 @@ static const option long_options[] = {
   {"test-dev", required_argument, NULL, 'd'},
   {"disk_size", required_argument, NULL, 'e'},
   {"flag-device", required_argument, NULL, 'f'},
+  {"image-cache", required_argument, NULL, 'i'},
+  {"checkpoint-range", required_argument, NULL, 'k'},
   {"log-file", required_argument, NULL, 'l'},
   {"mount-opts", required_argument, NULL, 'm'},
   {"dry-run", no_argument, NULL, 'n'},
@@ -70,13 +86,240 @@ static const option long_options[] = {
   {"iterations", required_argument, NULL, 's'},
   {"fs-type", required_argument, NULL, 't'},
   {"verbose", no_argument, NULL, 'v'},
+  {"compress-logs", no_argument, NULL, 'z'},
+  {"benchmark", required_argument, NULL, 'B'},
+  {"daemon", no_argument, NULL, 'D'},
   {"full-bio-replay", no_argument, NULL, 'F'},
+  {"hash-mod-data", no_argument, NULL, 'H'},
   {"no-in-order-replay", no_argument, NULL, 'I'},
+  {"snapshot-dir", required_argument, NULL, 'L'},
   {"no-permuted-order-replay", no_argument, NULL, 'P'},
+  {"results", required_argument, NULL, 'R'},
   {"sector-size", required_argument, NULL, 'S'},
+  {"trace", required_argument, NULL, 'T'},
   {0, 0, 0, 0},
 };
 
+// Test cases are either compiled .so files or j-lang workload files.
+static bool IsSharedObject(const string &path) {
+  return path.size() > 3 && path.compare(path.size() - 3, 3, ".so") == 0;
+}
+
+/*
+ * Batched builds of generated workloads put many test cases in one .so, and
+ * the one to run is picked with <path to .so>:<test name>. Returns the name of
+ * the test case for paths of that form, else an empty string.
+ */
+static string TestCaseName(const string &path) {
+  const size_t sep = path.rfind(".so:");
+  if (sep == string::npos) {
+    return "";
+  }
+  return path.substr(sep + 4);
+}
+
+// Strips the name of the test case, if any, from path.
+static string TestCaseFile(const string &path) {
+  const size_t sep = path.rfind(".so:");
+  if (sep == string::npos) {
+    return path;
+  }
+  return path.substr(0, sep + 3);
+}
+
+/*
+ * Returns the path of the .so file to load to run the test case at path. j-lang
+ * files run in the JLangTestCase built next to c_harness, which is told which
+ * file to run through kJLangFileEnv.
+ */
+static string TestCaseLibrary(const string &path) {
+  if (IsSharedObject(TestCaseFile(path))) {
+    return TestCaseFile(path);
+  }
+  if (setenv(fs_testing::tests::kJLangFileEnv, path.c_str(), 1) < 0) {
+    cerr << "Error setting environment variable "
+      << fs_testing::tests::kJLangFileEnv << endl;
+  }
+  char exe[PATH_MAX];
+  const ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len < 0) {
+    return kJLangTestCase;
+  }
+  exe[len] = '\0';
+  const string exe_path(exe);
+  return exe_path.substr(0, exe_path.rfind('/') + 1) + kJLangTestCase;
+}
+
+// Name of the log file for a harness run of the test case at path.
+static string LogFileName(const string &path) {
+  // Tests in a batch are named explicitly.
+  if (!TestCaseName(path).empty()) {
+    return LogFileName(TestCaseName(path));
+  }
+  // Get the name of the test being run.
+  int begin = path.rfind('/');
+  // Remove everything before the last /.
+  string test_name = path.substr(begin + 1);
+  // Remove the extension. j-lang files don't have one.
+  if (IsSharedObject(test_name)) {
+    test_name = test_name.substr(0, test_name.length() - 3);
+  }
+  // Get the date and time stamp and format.
+  time_t now = time(0);
+  char time_st[18];
+  strftime(time_st, sizeof(time_st), "%Y%m%d_%H%M%S", localtime(&now));
+  return string(time_st) + "-" + test_name + ".log";
+}
+
+// Quotes str for use as a JSON string.
+static string JsonString(const string &str) {
+  string res("\"");
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      res += '\\';
+      res += c;
+    } else if ((unsigned char) c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      res += escaped;
+    } else {
+      res += c;
+    }
+  }
+  return res + "\"";
+}
+
+/*
+ * Writes a JSON summary of replaying a saved profile to path: how many crash
+ * states were tested per second, percentiles of the time each phase of testing
+ * a crash state took, and peak memory use. Kept as one object with fixed keys
+ * so that summaries from different commits and kernels can be compared
+ * directly. Returns 0 on success, a value < 0 on failure.
+ */
+static int WriteBenchmarkSummary(const string &path, Tester &test_harness,
+    const string &fs_type, const string &test_case, const string &profile,
+    const int iterations, const double seconds) {
+  using fs_testing::utils::LatencyHistogram;
+  using fs_testing::utils::PhaseTrace;
+
+  ofstream out(path, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    return -1;
+  }
+
+  struct utsname host;
+  const string kernel = (uname(&host) == 0) ? host.release : "";
+  struct rusage self_usage;
+  struct rusage child_usage;
+  getrusage(RUSAGE_SELF, &self_usage);
+  getrusage(RUSAGE_CHILDREN, &child_usage);
+  const unsigned int states = test_harness.GetNumTestsCompleted();
+
+  char num[64];
+  out << "{" << endl;
+  out << "  \"fs_type\": " << JsonString(fs_type) << "," << endl;
+  out << "  \"test_case\": " << JsonString(test_case) << "," << endl;
+  out << "  \"profile\": " << JsonString(profile) << "," << endl;
+  out << "  \"kernel\": " << JsonString(kernel) << "," << endl;
+  out << "  \"iterations\": " << iterations << "," << endl;
+  out << "  \"states\": " << states << "," << endl;
+  snprintf(num, sizeof(num), "%.3f", seconds);
+  out << "  \"seconds\": " << num << "," << endl;
+  snprintf(num, sizeof(num), "%.3f", (seconds > 0) ? states / seconds : 0);
+  out << "  \"states_per_second\": " << num << "," << endl;
+  out << "  \"peak_rss_kib\": " << self_usage.ru_maxrss << "," << endl;
+  out << "  \"peak_child_rss_kib\": " << child_usage.ru_maxrss << "," << endl;
+
+  // All times in milliseconds.
+  const double ns_per_ms = 1000000.0;
+  const double percentiles[] = {50, 90, 99, 99.9};
+  const char * const percentile_names[] = {"p50", "p90", "p99", "p999"};
+  const PhaseTrace &trace = test_harness.get_phase_trace();
+  out << "  \"phases_ms\": {" << endl;
+  for (unsigned int i = 0; i < PhaseTrace::kNumPhases; ++i) {
+    const PhaseTrace::Phase phase = (PhaseTrace::Phase) i;
+    const LatencyHistogram &histogram = trace.GetHistogram(phase);
+    out << "    " << JsonString(PhaseTrace::PhaseName(phase)) << ": {"
+      << "\"count\": " << histogram.Count();
+    snprintf(num, sizeof(num), "%.3f", histogram.Mean() / ns_per_ms);
+    out << ", \"mean\": " << num;
+    for (unsigned int j = 0; j < 4; ++j) {
+      snprintf(num, sizeof(num), "%.3f",
+          histogram.ValueAtPercentile(percentiles[j]) / ns_per_ms);
+      out << ", \"" << percentile_names[j] << "\": " << num;
+    }
+    snprintf(num, sizeof(num), "%.3f", histogram.Max() / ns_per_ms);
+    out << ", \"max\": " << num << "}"
+      << ((i + 1 < PhaseTrace::kNumPhases) ? "," : "") << endl;
+  }
+  out << "  }" << endl;
+  out << "}" << endl;
+
+  out.close();
+  return out.fail() ? -1 : 0;
+}
+
+/*
+ * Daemon mode. Run each test case sent to daemon_com in its own child process
+ * while the kernel modules stay loaded. Returns 0 in the child with the path of
+ * the test case it should run in test_path, 1 in the parent once it is told to
+ * shut down, and a value < 0 on error.
+ */
+static int WaitForQueuedTest(Tester &test_harness, ServerSocket *daemon_com,
+    string *test_path) {
+  while (true) {
+    SocketMessage command;
+    if (daemon_com->WaitForMessage(&command) != SocketError::kNone) {
+      cerr << "Error getting message from daemon socket" << endl;
+      return -1;
+    }
+
+    switch (command.type) {
+      case SocketMessage::kQueueTest:
+        {
+          const pid_t child = fork();
+          if (child < 0) {
+            cerr << "Error creating child process to run test case" << endl;
+            return -1;
+          } else if (child == 0) {
+            // Leave the socket for the daemon. Closing our copy of it doesn't
+            // remove it.
+            daemon_com->CloseServer();
+            *test_path = command.string_value;
+            return 0;
+          }
+
+          int status;
+          if (waitpid(child, &status, 0) < 0) {
+            cerr << "Error waiting for test case process" << endl;
+            return -1;
+          }
+          if (test_harness.reset_devices() != SUCCESS) {
+            cerr << "Error resetting test device" << endl;
+            return -1;
+          }
+          SocketMessage done;
+          done.type = SocketMessage::kQueueTestDone;
+          done.int_value = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+          if (daemon_com->SendMessage(done) != SocketError::kNone) {
+            // The user may have given up on this test, but others can still
+            // run.
+            cerr << "Error telling user done with test case" << endl;
+          }
+        }
+        break;
+      case SocketMessage::kShutdown:
+        daemon_com->SendCommand(SocketMessage::kShutdownDone);
+        daemon_com->CloseClient();
+        return 1;
+      default:
+        daemon_com->SendCommand(SocketMessage::kInvalidCommand);
+        break;
+    }
+    daemon_com->CloseClient();
+  }
+}
+
 int main(int argc, char** argv) {
   cout << "running " << argv << endl;
 
@@ -88,11 +331,20 @@ int main(int argc, char** argv) {
   string log_file_save("");
   string log_file_load("");
   string permuter(PERMUTER_SO_PATH "RandomPermuter.so");
+  string checkpoint_range("");
+  string image_cache_dir("");
+  string snapshot_dir("");
+  string trace_prefix("");
+  string results_file("");
+  string benchmark_file("");
   bool background = false;
+  bool daemon = false;
   bool automate_check_test = false;
   bool dry_run = false;
   bool no_lvm = false;
   bool verbose = false;
+  bool compress_logs = false;
+  bool hash_mod_data = false;
   bool in_order_replay = true;
   bool permuted_order_replay = true;
   bool full_bio_replay = false;
@@ -122,6 +374,12 @@ int main(int argc, char** argv) {
       case 'e':
         disk_size = atoi(optarg);
         break;
+      case 'i':
+        image_cache_dir = string(optarg);
+        break;
+      case 'k':
+        checkpoint_range = string(optarg);
+        break;
       case 'l':
         log_file_save = string(optarg);
         break;
@@ -152,18 +410,39 @@ int main(int argc, char** argv) {
       case 'v':
         verbose = true;
         break;
+      case 'z':
+        compress_logs = true;
+        break;
+      case 'B':
+        benchmark_file = string(optarg);
+        break;
+      case 'D':
+        daemon = true;
+        break;
       case 'F':
         full_bio_replay = true;
         break;
+      case 'H':
+        hash_mod_data = true;
+        break;
       case 'I':
         in_order_replay = false;
         break;
+      case 'L':
+        snapshot_dir = string(optarg);
+        break;
       case 'P':
         permuted_order_replay = false;
         break;
+      case 'R':
+        results_file = string(optarg);
+        break;
       case 'S':
         sector_size = atoi(optarg);
         break;
+      case 'T':
+        trace_prefix = string(optarg);
+        break;
       case '?':
       default:
         return -1;
@@ -180,20 +459,9 @@ int main(int argc, char** argv) {
    * 4. load static objects for permuter and test case
    ****************************************************************************/
   const unsigned int test_case_idx = optind;
-  const string path = argv[test_case_idx];
-
-  // Get the name of the test being run.
-  int begin = path.rfind('/');
-  // Remove everything before the last /.
-  string test_name = path.substr(begin + 1);
-  // Remove the extension.
-  test_name = test_name.substr(0, test_name.length() - 3);
-  // Get the date and time stamp and format.
-  time_t now = time(0);
-  char time_st[18];
-  strftime(time_st, sizeof(time_st), "%Y%m%d_%H%M%S", localtime(&now));
-  string s = string(time_st) + "-" + test_name + ".log";
-  ofstream logfile(s);
+  // In daemon mode test cases arrive over a socket later.
+  string test_case_path = (test_case_idx < argc) ? argv[test_case_idx] : "";
+  ofstream logfile(LogFileName(daemon ? "daemon.so" : test_case_path));
 
   // This should be changed in the option is added to mount tests in other
   // directories.
@@ -206,11 +474,24 @@ int main(int argc, char** argv) {
     << endl;
   logfile << "========== PHASE 0: Setting up CrashMonkey basics =========="
     << endl;
-  if (test_case_idx == argc) {
+  if (test_case_path.empty() && !daemon) {
     cerr << "Please give a .so test case to load" << endl;
     return -1;
   }
 
+  if (daemon && (background || !log_file_save.empty() ||
+        !log_file_load.empty())) {
+    cerr << "Daemon mode can't be used with background mode or log files"
+      << endl;
+    return -1;
+  }
+
+  if (!benchmark_file.empty() && log_file_load.empty()) {
+    cerr << "Benchmarks replay a saved profile, please give one with -r"
+      << endl;
+    return -1;
+  }
+
   if (iterations < 0) {
     cerr << "Please give a positive number of iterations to run" << endl;
     return -1;
@@ -227,6 +508,28 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  // Checkpoint ranges are given as either "first-last" or just "first", which
+  // tests from first to the end of the saved profile.
+  int first_checkpoint = 0;
+  int last_checkpoint = -1;
+  if (!checkpoint_range.empty()) {
+    const size_t dash = checkpoint_range.find('-');
+    first_checkpoint = atoi(checkpoint_range.substr(0, dash).c_str());
+    if (dash != string::npos) {
+      last_checkpoint = atoi(checkpoint_range.substr(dash + 1).c_str());
+    }
+    if (log_file_load.empty()) {
+      cerr << "Checkpoint ranges can only be used with a saved profile (-r)"
+        << endl;
+      return -1;
+    }
+    if (first_checkpoint < 0 ||
+        (last_checkpoint >= 0 && last_checkpoint < first_checkpoint)) {
+      cerr << "Please give a valid range of checkpoints" << endl;
+      return -1;
+    }
+  }
+
   // Create a socket to coordinate with the outside world.
   // TODO(ashmrtn): Fix permissions on the socket.
   /*
@@ -275,14 +578,34 @@ int main(int argc, char** argv) {
 
   Tester test_harness(disk_size, sector_size, verbose);
   test_harness.StartTestSuite();
+  if (!trace_prefix.empty()) {
+    test_harness.enable_phase_trace(kTraceSpans);
+  }
 
-  cout << "Inserting RAM disk module" << endl;
-  logfile << "Inserting RAM disk module" << endl;
-  if (test_harness.insert_cow_brd() != SUCCESS) {
-    cerr << "Error inserting RAM disk module" << endl;
+  test_harness.set_snapshot_dir(snapshot_dir);
+  if (snapshot_dir.empty()) {
+    cout << "Inserting RAM disk module" << endl;
+    logfile << "Inserting RAM disk module" << endl;
+  } else {
+    cout << "Creating disk images in " << snapshot_dir << endl;
+    logfile << "Creating disk images in " << snapshot_dir << endl;
+  }
+  if (test_harness.insert_snapshots() != SUCCESS) {
+    cerr << "Error setting up snapshot devices" << endl;
     return -1;
   }
+  // The test device is whatever loop device the base image ended up on.
+  if (!snapshot_dir.empty()) {
+    test_dev = test_harness.get_snapshot_base_path();
+  }
   test_harness.set_fs_type(fs_type);
+  test_harness.set_compress_logs(compress_logs);
+  test_harness.set_hash_mod_data(hash_mod_data);
+  test_harness.set_image_cache_dir(image_cache_dir);
+  if (!checkpoint_range.empty()) {
+    test_harness.set_checkpoint_range(first_checkpoint,
+        (last_checkpoint < 0) ? UINT_MAX : last_checkpoint);
+  }
   test_harness.set_device(test_dev);
   FILE *input;
   char buf[512];
@@ -311,14 +634,99 @@ int main(int argc, char** argv) {
     cerr << "Error setting environment variable FILESYS_SIZE" << endl;
   }
   
+  /*****************************************************************************
+   * Daemon mode. Load the wrapper module now too and keep both modules loaded
+   * across test cases. Each test case then runs the rest of the harness in a
+   * child process with its own log file.
+   ****************************************************************************/
+  if (daemon) {
+    test_harness.set_flag_device(flags_dev);
+    cout << "Inserting wrapper module into kernel" << endl;
+    logfile << "Inserting wrapper module into kernel" << endl;
+    if (test_harness.insert_wrapper() != SUCCESS) {
+      cerr << "Error inserting kernel wrapper module" << endl;
+      test_harness.cleanup_harness();
+      return -1;
+    }
+    test_harness.set_keep_modules(true);
+
+    ServerSocket *daemon_com = new ServerSocket(kSocketNameDaemon);
+    if (daemon_com->Init(kSocketQueueDepth) < 0) {
+      int err_no = errno;
+      cerr << "Error starting daemon socket to listen on " << err_no << endl;
+      delete daemon_com;
+      test_harness.set_keep_modules(false);
+      test_harness.cleanup_harness();
+      return -1;
+    }
+    cout << "+++++ Waiting for test cases on " << kSocketNameDaemon << " +++++"
+      << endl;
+    logfile << "+++++ Waiting for test cases on " << kSocketNameDaemon
+      << " +++++" << endl;
+
+    const int res =
+      WaitForQueuedTest(test_harness, daemon_com, &test_case_path);
+    if (res != 0) {
+      // Only the daemon itself gets here.
+      delete daemon_com;
+      delete background_com;
+      test_harness.set_keep_modules(false);
+      test_harness.cleanup_harness();
+      return (res > 0) ? 0 : -1;
+    }
+
+    logfile.close();
+    logfile.open(LogFileName(test_case_path));
+  }
+
   // Load the class being tested.
   cout << "Loading test case" << endl;
-  if (test_harness.test_load_class(argv[test_case_idx]) != SUCCESS) {
+  const string test_case_name = TestCaseName(test_case_path);
+  if (test_harness.test_load_class(TestCaseLibrary(test_case_path).c_str(),
+        test_case_name.empty() ? NULL : test_case_name.c_str()) != SUCCESS) {
     test_harness.cleanup_harness();
       return -1;
   }
   
-  test_harness.test_init_values(mount_dir, test_dev_size);
+  if (test_harness.test_init_values(mount_dir, test_dev_size) < 0) {
+    cerr << "Error initializing test case" << endl;
+    test_harness.cleanup_harness();
+    return -1;
+  }
+
+  // Fork the process that runs the workload while the harness is still small.
+  // Only standalone runs that record a new profile run the workload.
+  WorkloadExecutor workload_executor;
+  // The workload process has to be gone before the kernel modules can be
+  // removed, so stop it on every way out.
+  auto cleanup = [&test_harness, &workload_executor]() {
+    workload_executor.Stop();
+    test_harness.cleanup_harness();
+  };
+  if (!background && log_file_load.empty()) {
+    const int res = workload_executor.Start(
+        [&test_harness](const int checkpoint) {
+          int change_fd = -1;
+          if (checkpoint == 0) {
+            change_fd = open(kChangePath, O_CREAT | O_WRONLY | O_TRUNC,
+              S_IRUSR | S_IWUSR);
+            if (change_fd < 0) {
+              return change_fd;
+            }
+          }
+          const int res = test_harness.test_run(change_fd, checkpoint);
+
+          if (checkpoint == 0) {
+            close(change_fd);
+          }
+          return res;
+        });
+    if (res < 0) {
+      cerr << "Error starting workload process" << endl;
+      cleanup();
+      return -1;
+    }
+  }
   
   // Load the permuter to use for the test.
   // TODO(ashmrtn): Consider making a line in the test file which specifies the
@@ -326,7 +734,7 @@ int main(int argc, char** argv) {
   cout << "Loading permuter" << endl;
   logfile << "Loading permuter" << endl;
   if (test_harness.permuter_load_class(permuter.c_str()) != SUCCESS) {
-    test_harness.cleanup_harness();
+    cleanup();
       return -1;
   }
 
@@ -339,7 +747,7 @@ int main(int argc, char** argv) {
     test_harness.update_dirty_expire_time(dirty_expire_time_centisecs.c_str());
   if (old_expire_time == NULL) {
     cerr << "Error updating dirty_expire_time_centisecs" << endl;
-    test_harness.cleanup_harness();
+    cleanup();
     return -1;
   }
 
@@ -375,99 +783,116 @@ int main(int argc, char** argv) {
     // Device flags only need set if we are logging requests.
     test_harness.set_flag_device(flags_dev);
 
-    // Format test drive to desired type.
-    cout << "Formatting test drive" << endl;
-    logfile << "Formatting test drive" << endl;
-    if (test_harness.format_drive() != SUCCESS) {
-      cerr << "Error formatting test drive" << endl;
-      test_harness.cleanup_harness();
-      return -1;
-    }
-
-    // Mount test file system for pre-test setup.
-    cout << "Mounting test file system for pre-test setup" << endl;
-    logfile << "Mounting test file system for pre-test setup" << endl;
-    if (test_harness.mount_device_raw(mount_opts.c_str()) != SUCCESS) {
-      cerr << "Error mounting test device" << endl;
-      test_harness.cleanup_harness();
-      return -1;
-    }
-
-    // TODO(ashmrtn): Close startup socket fd here.
+    // Test cases that identify their setup can reuse the disk image an earlier
+    // run with the same setup left behind instead of formatting the drive and
+    // running setup() again. Setup is up to the user in background mode.
+    const bool setup_cached = !background &&
+      test_harness.setup_cache_load(mount_opts) == SUCCESS;
+    if (setup_cached) {
+      cout << "Reusing cached pre-test setup" << endl;
+      logfile << "Reusing cached pre-test setup" << endl;
+    } else {
+      // Format test drive to desired type.
+      cout << "Formatting test drive" << endl;
+      logfile << "Formatting test drive" << endl;
+      if (test_harness.format_drive() != SUCCESS) {
+        cerr << "Error formatting test drive" << endl;
+        cleanup();
+        return -1;
+      }
 
-    if (background) {
-      cout << "+++++ Please run any needed pre-test setup +++++" << endl;
-      logfile << "+++++ Please run any needed pre-test setup +++++" << endl;
-      /*************************************************************************
-       * Background mode user setup. Wait for the user to tell use that they
-       * have finished the pre-test setup phase.
-       ************************************************************************/
-      SocketMessage command;
-      do {
-        if (background_com->WaitForMessage(&command) != SocketError::kNone) {
-          cerr << "Error getting message from socket" << endl;
-          delete background_com;
-          test_harness.cleanup_harness();
-          return -1;
-        }
+      // Mount test file system for pre-test setup.
+      cout << "Mounting test file system for pre-test setup" << endl;
+      logfile << "Mounting test file system for pre-test setup" << endl;
+      if (test_harness.mount_device_raw(mount_opts.c_str()) != SUCCESS) {
+        cerr << "Error mounting test device" << endl;
+        cleanup();
+        return -1;
+      }
 
-        if (command.type != SocketMessage::kBeginLog) {
-          if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
-              SocketError::kNone) {
-            cerr << "Error sending response to client" << endl;
+      // TODO(ashmrtn): Close startup socket fd here.
+
+      if (background) {
+        cout << "+++++ Please run any needed pre-test setup +++++" << endl;
+        logfile << "+++++ Please run any needed pre-test setup +++++" << endl;
+        /***********************************************************************
+         * Background mode user setup. Wait for the user to tell use that they
+         * have finished the pre-test setup phase.
+         **********************************************************************/
+        SocketMessage command;
+        do {
+          if (background_com->WaitForMessage(&command) != SocketError::kNone) {
+            cerr << "Error getting message from socket" << endl;
             delete background_com;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
-          background_com->CloseClient();
-        }
-      } while (command.type != SocketMessage::kBeginLog);
-    } else {
-      /*************************************************************************
-       * Standalone mode user setup. Run the pre-test "setup()" method defined
-       * in the test case. Run as a separate process for the sake of
-       * cleanliness.
-       ************************************************************************/
-      cout << "Running pre-test setup" << endl;
-      logfile << "Running pre-test setup" << endl;
-      {
-        const pid_t child = fork();
-        if (child < 0) {
-          cerr << "Error creating child process to run pre-test setup" << endl;
-          test_harness.cleanup_harness();
-          return -1;
-        } else if (child != 0) {
-          // Parent process should wait for child to terminate before proceeding.
-          pid_t status;
-          wait(&status);
-          if (status != 0) {
-            cerr << "Error in pre-test setup" << endl;
-            test_harness.cleanup_harness();
+
+          if (command.type != SocketMessage::kBeginLog) {
+            if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
+                SocketError::kNone) {
+              cerr << "Error sending response to client" << endl;
+              delete background_com;
+              cleanup();
+              return -1;
+            }
+            background_com->CloseClient();
+          }
+        } while (command.type != SocketMessage::kBeginLog);
+      } else {
+        /***********************************************************************
+         * Standalone mode user setup. Run the pre-test "setup()" method defined
+         * in the test case. Run as a separate process for the sake of
+         * cleanliness.
+         **********************************************************************/
+        cout << "Running pre-test setup" << endl;
+        logfile << "Running pre-test setup" << endl;
+        {
+          const pid_t child = fork();
+          if (child < 0) {
+            cerr << "Error creating child process to run pre-test setup"
+              << endl;
+            cleanup();
             return -1;
+          } else if (child != 0) {
+            // Parent process should wait for child to terminate before
+            // proceeding.
+            pid_t status;
+            wait(&status);
+            if (status != 0) {
+              cerr << "Error in pre-test setup" << endl;
+              cleanup();
+              return -1;
+            }
+          } else {
+            return test_harness.test_setup();
           }
-        } else {
-          return test_harness.test_setup();
         }
       }
-    }
 
-    /***************************************************************************
-     * Pre-test setup complete. Unmount the test file system and snapshot the
-     * disk for use in workload and tests.
-     **************************************************************************/
-    // Unmount the test file system after pre-test setup.
-    cout << "Unmounting test file system after pre-test setup" << endl;
-    logfile << "Unmounting test file system after pre-test setup" << endl;
-    if (test_harness.umount_device() != SUCCESS) {
-      test_harness.cleanup_harness();
-      return -1;
+      /*************************************************************************
+       * Pre-test setup complete. Unmount the test file system and snapshot the
+       * disk for use in workload and tests.
+       ************************************************************************/
+      // Unmount the test file system after pre-test setup.
+      cout << "Unmounting test file system after pre-test setup" << endl;
+      logfile << "Unmounting test file system after pre-test setup" << endl;
+      if (test_harness.umount_device() != SUCCESS) {
+        cleanup();
+        return -1;
+      }
+
+      if (!background && test_harness.setup_cache_save(mount_opts) == SUCCESS) {
+        cout << "Cached pre-test setup" << endl;
+        logfile << "Cached pre-test setup" << endl;
+      }
     }
 
     // Create snapshot of disk for testing.
     cout << "Making new snapshot" << endl;
     logfile << "Making new snapshot" << endl;
     if (test_harness.clone_device() != SUCCESS) {
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
 
@@ -482,7 +907,7 @@ int main(int argc, char** argv) {
       logfile << "Saving snapshot to log file" << endl;
       if (test_harness.log_snapshot_save(log_file_save + "_snap")
           != SUCCESS) {
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
     }
@@ -495,7 +920,7 @@ int main(int argc, char** argv) {
     cout << "Loading saved snapshot" << endl;
     logfile << "Loading saved snapshot" << endl;
     if (test_harness.log_snapshot_load(log_file_load + "_snap") != SUCCESS) {
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
   }
@@ -524,7 +949,7 @@ int main(int argc, char** argv) {
   logfile << "Clearing caches" << endl;
   if (test_harness.clear_caches() != SUCCESS) {
     cerr << "Error clearing caches" << endl;
-    test_harness.cleanup_harness();
+    cleanup();
     return -1;
   }
 
@@ -539,7 +964,7 @@ int main(int argc, char** argv) {
     logfile << "Inserting wrapper module into kernel" << endl;
     if (test_harness.insert_wrapper() != SUCCESS) {
       cerr << "Error inserting kernel wrapper module" << endl;
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
 
@@ -548,7 +973,7 @@ int main(int argc, char** argv) {
     logfile << "Getting wrapper device ioctl fd" << endl;
     if (test_harness.get_wrapper_ioctl() != SUCCESS) {
       cerr << "Error opening device file" << endl;
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
 
@@ -567,7 +992,7 @@ int main(int argc, char** argv) {
     cout << "Mounting wrapper file system" << endl;
     if (test_harness.mount_wrapper_device(mount_opts.c_str()) != SUCCESS) {
       cerr << "Error mounting wrapper file system" << endl;
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
 
@@ -593,7 +1018,7 @@ int main(int argc, char** argv) {
           SocketError::kNone) {
         cerr << "Error telling user ready for workload" << endl;
         delete background_com;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
       background_com->CloseClient();
@@ -608,7 +1033,7 @@ int main(int argc, char** argv) {
         if (background_com->WaitForMessage(&command) != SocketError::kNone) {
           cerr << "Error getting command from socket" << endl;
           delete background_com;
-          test_harness.cleanup_harness();
+          cleanup();
           return -1;
         }
 
@@ -622,7 +1047,7 @@ int main(int argc, char** argv) {
                   SocketError::kNone) {
                 cerr << "Error telling user done with checkpoint" << endl;
                 delete background_com;
-                test_harness.cleanup_harness();
+                cleanup();
                 return -1;
               }
             } else {
@@ -630,18 +1055,18 @@ int main(int argc, char** argv) {
                   != SocketError::kNone) {
                 cerr << "Error telling user checkpoint failed" << endl;
                 delete background_com;
-                test_harness.cleanup_harness();
+                cleanup();
                 return -1;
               }
             }
-            background_com->CloseClient();
+            // Workloads keep their connection open for the next checkpoint.
             break;
           default:
             if (background_com->SendCommand(SocketMessage::kInvalidCommand) !=
                 SocketError::kNone) {
               cerr << "Error sending response to client" << endl;
               delete background_com;
-              test_harness.cleanup_harness();
+              cleanup();
               return -1;
             }
             background_com->CloseClient();
@@ -668,92 +1093,84 @@ int main(int argc, char** argv) {
        ************************************************************************/
       do {
         {
-          const pid_t child = fork();
-          if (child < 0) {
+          if (workload_executor.Run(checkpoint) < 0) {
             cerr << "Error spinning off test process" << endl;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
-          } else if (child != 0) {
-            pid_t status = -1;
-            pid_t wait_res = 0;
-            do {
-              SocketMessage m;
-              SocketError se;
-
-              se = background_com->TryForMessage(&m);
-
-              if (se == SocketError::kNone) {
-                if (m.type == SocketMessage::kCheckpoint) {
-                  if (test_harness.CreateCheckpoint() == SUCCESS) {
-                    if (background_com->SendCommand(
-                            SocketMessage::kCheckpointDone)
-                          != SocketError::kNone) {
-                        // TODO(ashmrtn): Handle better.
-                        cerr << "Error telling user done with checkpoint" << endl;
-                        delete background_com;
-                        test_harness.cleanup_harness();
-                        return -1;
-                    }
-                  } else {
-                    if (background_com->SendCommand(
-                          SocketMessage::kCheckpointFailed)
+          }
+          // Sleep until the workload sends us a message or finishes.
+          int status = -1;
+          bool run_done = false;
+          do {
+            SocketMessage m;
+            SocketError se;
+
+            se = background_com->WaitForMessageOrFd(&m,
+                workload_executor.GetDoneFd());
+
+            if (se == SocketError::kFdReadable) {
+              if (workload_executor.GetStatus(&status) < 0) {
+                cerr << "Error getting test_run process status" << endl;
+                cleanup();
+                return -1;
+              }
+              run_done = true;
+            } else if (se == SocketError::kNone) {
+              if (m.type == SocketMessage::kCheckpoint) {
+                if (test_harness.CreateCheckpoint() == SUCCESS) {
+                  if (background_com->SendCommand(
+                          SocketMessage::kCheckpointDone)
                         != SocketError::kNone) {
                       // TODO(ashmrtn): Handle better.
-                      cerr << "Error telling user checkpoint failed" << endl;
+                      cerr << "Error telling user done with checkpoint" << endl;
                       delete background_com;
-                      test_harness.cleanup_harness();
+                      cleanup();
                       return -1;
-                    }
                   }
                 } else {
                   if (background_com->SendCommand(
-                        SocketMessage::kInvalidCommand)
+                        SocketMessage::kCheckpointFailed)
                       != SocketError::kNone) {
-                    cerr << "Error sending response to client" << endl;
+                    // TODO(ashmrtn): Handle better.
+                    cerr << "Error telling user checkpoint failed" << endl;
                     delete background_com;
-                    test_harness.cleanup_harness();
+                    cleanup();
                     return -1;
                   }
                 }
-                background_com->CloseClient();
-              }
-              wait_res = waitpid(child, &status, WNOHANG);
-            } while (wait_res == 0);
-            if (WIFEXITED(status) == 0) {
-              cerr << "Error terminating test_run process, status: " << status << endl;
-              test_harness.cleanup_harness();
-              return -1;
-            } else {
-              if (WEXITSTATUS(status) == 1) {
-                last_checkpoint = true;
-              } else if (WEXITSTATUS(status) == 0) {
-                if (checkpoint == 0) {
-                  cout << "Completely executed run process" << endl;
-                } else {
-                  cout << "Run process hit checkpoint " << checkpoint << endl;
-                }
               } else {
-                cerr << "Error in test run, exits with status: " << status << endl;
-                test_harness.cleanup_harness();
-                return -1;
+                if (background_com->SendCommand(
+                      SocketMessage::kInvalidCommand)
+                    != SocketError::kNone) {
+                  cerr << "Error sending response to client" << endl;
+                  delete background_com;
+                  cleanup();
+                  return -1;
+                }
+                background_com->CloseClient();
               }
+              // Workloads keep their connection open for the next
+              // checkpoint.
             }
+          } while (!run_done);
+          if (WIFEXITED(status) == 0) {
+            cerr << "Error terminating test_run process, status: " << status << endl;
+            cleanup();
+            return -1;
           } else {
-            // Forked process' stuff.
-            int change_fd;
-            if (checkpoint == 0) {
-              change_fd = open(kChangePath, O_CREAT | O_WRONLY | O_TRUNC,
-                S_IRUSR | S_IWUSR);
-              if (change_fd < 0) {
-                return change_fd;
+            if (WEXITSTATUS(status) == 1) {
+              last_checkpoint = true;
+            } else if (WEXITSTATUS(status) == 0) {
+              if (checkpoint == 0) {
+                cout << "Completely executed run process" << endl;
+              } else {
+                cout << "Run process hit checkpoint " << checkpoint << endl;
               }
+            } else {
+              cerr << "Error in test run, exits with status: " << status << endl;
+              cleanup();
+              return -1;
             }
-            const int res = test_harness.test_run(change_fd, checkpoint);
-
-            if (checkpoint == 0) {
-              close(change_fd);
-            }
-            return res;
           }
         }
         // End wrapper logging for profiling the complete execution of run process
@@ -771,7 +1188,7 @@ int main(int argc, char** argv) {
           cout << "Getting wrapper data" << endl;
           logfile << "Getting wrapper data" << endl;
           if (test_harness.get_wrapper_log() != SUCCESS) {
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
 
@@ -779,7 +1196,7 @@ int main(int argc, char** argv) {
           logfile << "Unmounting wrapper file system after test profiling" << endl;
           if (test_harness.umount_device() != SUCCESS) {
             cerr << "Error unmounting wrapper file system" << endl;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
 
@@ -790,7 +1207,7 @@ int main(int argc, char** argv) {
           logfile << "Removing wrapper module from kernel" << endl;
           if (test_harness.remove_wrapper() != SUCCESS) {
             cerr << "Error cleaning up: remove wrapper module" << endl;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
 
@@ -800,18 +1217,18 @@ int main(int argc, char** argv) {
           const int change_fd = open(kChangePath, O_RDONLY);
           if (change_fd < 0) {
             cerr << "Error reading change data" << endl;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
 
           if (lseek(change_fd, 0, SEEK_SET) < 0) {
             cerr << "Error reading change data" << endl;
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
 
           if (test_harness.GetChangeData(change_fd) != SUCCESS) {
-            test_harness.cleanup_harness();
+            cleanup();
             return -1;
           }
         } 
@@ -821,7 +1238,7 @@ int main(int argc, char** argv) {
           test_harness.mapCheckpointToSnapshot(checkpoint);
           if (checkpoint != 0) {
             if (test_harness.umount_snapshot() != SUCCESS) {
-              test_harness.cleanup_harness();
+              cleanup();
               return -1;
             }
           }
@@ -829,7 +1246,7 @@ int main(int argc, char** argv) {
           test_harness.getNewDiskClone(checkpoint);
           if (!last_checkpoint) {
             if (test_harness.mount_snapshot() != SUCCESS) {
-              test_harness.cleanup_harness();
+              cleanup();
               return -1;
             }
           }
@@ -841,6 +1258,7 @@ int main(int argc, char** argv) {
         // Increment the checkpoint at which run exits
         checkpoint += 1;
       } while (!last_checkpoint && automate_check_test);
+      workload_executor.Stop();
     }
 
     /***************************************************************************
@@ -865,7 +1283,7 @@ int main(int argc, char** argv) {
       cout << "Getting wrapper data" << endl;
       logfile << "Getting wrapper data" << endl;
       if (test_harness.get_wrapper_log() != SUCCESS) {
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
@@ -873,7 +1291,7 @@ int main(int argc, char** argv) {
       logfile << "Unmounting wrapper file system after test profiling" << endl;
       if (test_harness.umount_device() != SUCCESS) {
         cerr << "Error unmounting wrapper file system" << endl;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
@@ -884,7 +1302,7 @@ int main(int argc, char** argv) {
       logfile << "Removing wrapper module from kernel" << endl;
       if (test_harness.remove_wrapper() != SUCCESS) {
         cerr << "Error cleaning up: remove wrapper module" << endl;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
@@ -894,18 +1312,18 @@ int main(int argc, char** argv) {
       const int change_fd = open(kChangePath, O_RDONLY);
       if (change_fd < 0) {
         cerr << "Error reading change data" << endl;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
       if (lseek(change_fd, 0, SEEK_SET) < 0) {
         cerr << "Error reading change data" << endl;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
       if (test_harness.GetChangeData(change_fd) != SUCCESS) {
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
     }
@@ -919,14 +1337,16 @@ int main(int argc, char** argv) {
       /*************************************************************************
        * The -l flag specifies that we should save the information for this
        * harness execution. Therefore, save the series of disk epochs we just
-       * logged so they can be reused later if the -r flag is given.
+       * logged so they can be reused later if the -r flag is given. The save
+       * runs in the background while we test and is waited on at the end.
        ************************************************************************/
       cout << "Saving logged profile data to disk" << endl;
       logfile << "Saving logged profile data to disk" << endl;
-      if (test_harness.log_profile_save(log_file_save + "_profile") != SUCCESS) {
+      if (test_harness.log_profile_save_async(log_file_save + "_profile") !=
+          SUCCESS) {
         cerr << "Error saving logged test file" << endl;
         // TODO(ashmrtn): Remove this in later versions?
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
     }
@@ -941,7 +1361,7 @@ int main(int argc, char** argv) {
           SocketError::kNone) {
         cerr << "Error telling user done logging" << endl;
         delete background_com;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
       background_com->CloseClient();
@@ -955,7 +1375,7 @@ int main(int argc, char** argv) {
     logfile << "Loading logged profile data from disk" << endl;
     if (test_harness.log_profile_load(log_file_load + "_profile") != SUCCESS) {
       cerr << "Error loading logged test file" << endl;
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
   }
@@ -983,7 +1403,7 @@ int main(int argc, char** argv) {
       if (background_com->WaitForMessage(&command) != SocketError::kNone) {
         cerr << "Error getting command from socket" << endl;
         delete background_com;
-        test_harness.cleanup_harness();
+        cleanup();
         return -1;
       }
 
@@ -992,7 +1412,7 @@ int main(int argc, char** argv) {
             SocketError::kNone) {
           cerr << "Error sending response to client" << endl;
           delete background_com;
-          test_harness.cleanup_harness();
+          cleanup();
           return -1;
         }
         background_com->CloseClient();
@@ -1013,6 +1433,21 @@ int main(int argc, char** argv) {
   /***************************************************************************
    * Run tests and print the results of said tests.
    **************************************************************************/
+  if (!benchmark_file.empty()) {
+    test_harness.set_print_results(false);
+  }
+  const std::chrono::steady_clock::time_point test_start_time =
+    std::chrono::steady_clock::now();
+
+  // Opened only now so that no forked child can write out records too.
+  if (!results_file.empty() &&
+      test_harness.results_file_open(results_file) != SUCCESS) {
+    cerr << "Error opening results file " << results_file << endl;
+    delete background_com;
+    cleanup();
+    return -1;
+  }
+
   if (permuted_order_replay) {
     cout << "Writing profiled data to block device and checking with fsck" <<
       endl;
@@ -1037,6 +1472,41 @@ int main(int argc, char** argv) {
     test_harness.test_check_log_replay(logfile, automate_check_test);
   }
 
+  if (!results_file.empty() &&
+      test_harness.results_file_close() != SUCCESS) {
+    cerr << "Error writing results file " << results_file << endl;
+  }
+  const std::chrono::duration<double> test_seconds =
+    std::chrono::steady_clock::now() - test_start_time;
+  if (!benchmark_file.empty()) {
+    if (WriteBenchmarkSummary(benchmark_file, test_harness, fs_type,
+          test_case_path, log_file_load, iterations,
+          test_seconds.count()) < 0) {
+      cerr << "Error writing benchmark summary to " << benchmark_file << endl;
+    } else {
+      cout << "Tested " << test_harness.GetNumTestsCompleted()
+        << " crash states in " << test_seconds.count() << " s, summary in "
+        << benchmark_file << endl;
+    }
+  }
+
+  cout << endl << "Time per crash state for each phase of testing:" << endl;
+  logfile << endl << "Time per crash state for each phase of testing:"
+    << endl;
+  test_harness.PrintPhaseStats(cout);
+  test_harness.PrintPhaseStats(logfile);
+  if (!trace_prefix.empty()) {
+    const fs_testing::utils::PhaseTrace &trace =
+      test_harness.get_phase_trace();
+    if (trace.WriteChromeTrace(trace_prefix + ".json") < 0 ||
+        trace.WriteHistograms(trace_prefix) < 0) {
+      cerr << "Error writing trace to " << trace_prefix << endl;
+    } else if (trace.NumDropped() > 0) {
+      cout << "Trace holds the last " << trace.NumSpans() << " phases, "
+        << trace.NumDropped() << " earlier ones were dropped" << endl;
+    }
+  }
+
   cout << endl;
   logfile << endl;
   test_harness.PrintTestStats(cout);
@@ -1051,20 +1521,25 @@ int main(int argc, char** argv) {
    * We have finished. Clean up the test harness. Tell the user we have finished
    * testing if the -b flag was given and we are running in background mode.
    ****************************************************************************/
+  const int profile_save_res = test_harness.log_profile_save_wait();
+  if (profile_save_res != SUCCESS) {
+    cerr << "Error saving logged test file" << endl;
+    logfile << "Error saving logged test file" << endl;
+  }
   logfile.close();
-  test_harness.remove_cow_brd();
-  test_harness.cleanup_harness();
+  test_harness.remove_snapshots();
+  cleanup();
 
   if (background) {
     if (background_com->SendCommand(SocketMessage::kRunTestsDone) !=
         SocketError::kNone) {
       cerr << "Error telling user done testing" << endl;
       delete background_com;
-      test_harness.cleanup_harness();
+      cleanup();
       return -1;
     }
   }
   delete background_com;
 
-  return 0;
+  return (profile_save_res == SUCCESS) ? 0 : -1;
 }
@@ -114,8 +114,8 @@ bool EpochOpSector::operator!=(const EpochOpSector &other) const {
   return !(*this == other);
 }
 
-void * EpochOpSector::GetData() {
-  return parent->op.get_data().get() + (max_sector_size * parent_sector_index);
+const void * EpochOpSector::GetData() const {
+  return parent->op.get_data() + (max_sector_size * parent_sector_index);
 }
 
 DiskWriteData EpochOpSector::ToWriteData() {
@@ -173,16 +173,18 @@ bool Permuter::FindOverlapsAndInsert(disk_write &dw,
 }
 
 void Permuter::InitDataVector(unsigned int sector_size,
-    vector<disk_write> &data) {
+    vector<disk_write> &data, const unsigned int first_index) {
   sector_size_ = sector_size;
   epochs_.clear();
+  first_checkpoint_ = (!data.empty() && data.front().is_checkpoint()) ?
+    data.front().metadata.write_sector : 0;
   list<pair<unsigned int, unsigned int>> epoch_overlaps;
   struct epoch *current_epoch = NULL;
   // Make sure that the first time we mark a checkpoint epoch, we start at 0 and
   // not 1.
   int curr_checkpoint_epoch = -1;
   // Aligns with the index of the bio in the profile dump, 0 indexed.
-  unsigned int abs_index = 0;
+  unsigned int abs_index = first_index;
 
   auto curr_op = data.begin();
   while (curr_op != data.end()) {
@@ -204,9 +206,11 @@ void Permuter::InitDataVector(unsigned int sector_size,
     while (curr_op != data.end() && !curr_op->is_barrier()) {
       // Checkpoint operations will only be seen once we have switched over
       // epochs, so we need to edit the checkpoint epoch of the current epoch as
-      // well as incrementing the curr_checkpoint_epoch counter.
+      // well as updating the curr_checkpoint_epoch counter. Use the number
+      // stored in the checkpoint instead of counting them so that logs loaded
+      // starting at a later checkpoint are numbered the same as whole logs.
       if (curr_op->is_checkpoint()) {
-        ++curr_checkpoint_epoch;
+        curr_checkpoint_epoch = curr_op->metadata.write_sector;
         current_epoch->checkpoint_epoch = curr_checkpoint_epoch;
         // Checkpoint operations should not appear in the bio stream passed to
         // actual permuters.
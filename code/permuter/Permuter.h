@@ -52,7 +52,7 @@ struct EpochOpSector {
       unsigned int max_sector_size);
   bool operator==(const EpochOpSector &other) const;
   bool operator!=(const EpochOpSector &other) const;
-  void * GetData();
+  const void * GetData() const;
   fs_testing::utils::DiskWriteData ToWriteData();
 
   epoch_op *parent;
@@ -68,8 +68,14 @@ struct EpochOpSector {
 class Permuter {
  public:
   virtual ~Permuter() {};
+  /*
+   * first_index is the index in the profile of the first entry in data, so
+   * that bio indices in crash states match the profile when only part of it
+   * was loaded.
+   */
   void InitDataVector(unsigned int sector_size,
-      std::vector<fs_testing::utils::disk_write> &data);
+      std::vector<fs_testing::utils::disk_write> &data,
+      const unsigned int first_index = 0);
   bool GenerateCrashState(std::vector<fs_testing::utils::DiskWriteData> &res,
       fs_testing::PermuteTestResult &log_data);
   bool GenerateSectorCrashState(
@@ -88,6 +94,9 @@ class Permuter {
       std::vector<EpochOpSector> &sector_list);
 
   unsigned int sector_size_;
+  // Checkpoint the log given to InitDataVector starts at. This is only non-zero
+  // if the log was loaded starting at a later checkpoint.
+  unsigned int first_checkpoint_ = 0;
 
  private:
   virtual void init_data(std::vector<epoch> *data) = 0;
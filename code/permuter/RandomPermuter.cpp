@@ -75,7 +75,8 @@ bool RandomPermuter::gen_one_state(vector<epoch_op>& res,
     prev = &GetEpochs()->at(num_epochs - 2);
   }
   if (num_requests != target->ops.size()) {
-    log_data.last_checkpoint = (prev) ? prev->checkpoint_epoch : 0;
+    log_data.last_checkpoint =
+      (prev) ? prev->checkpoint_epoch : first_checkpoint_;
   } else {
     log_data.last_checkpoint = target->checkpoint_epoch;
   }
@@ -152,7 +153,8 @@ bool RandomPermuter::gen_one_sector_state(vector<DiskWriteData> &res,
     prev = &epochs->at(num_epochs - 2);
   }
   if (num_requests != target->ops.size()) {
-    log_data.last_checkpoint = (prev) ? prev->checkpoint_epoch : 0;
+    log_data.last_checkpoint =
+      (prev) ? prev->checkpoint_epoch : first_checkpoint_;
   } else {
     log_data.last_checkpoint = target->checkpoint_epoch;
   }
@@ -0,0 +1,219 @@
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "ResultSink.h"
+
+namespace fs_testing {
+
+using std::ifstream;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::DiskWriteData;
+
+namespace {
+
+const char kMagic[] = {'C', 'M', 'R', 'S'};
+const unsigned int kHeaderSize = sizeof(kMagic) + sizeof(uint32_t);
+// Write records out once this many bytes of them are buffered.
+const size_t kFlushSize = 64 * 1024;
+
+void PutVarint(vector<unsigned char> &buf, uint64_t val) {
+  while (val >= 0x80) {
+    buf.push_back((val & 0x7f) | 0x80);
+    val >>= 7;
+  }
+  buf.push_back(val);
+}
+
+uint64_t ZigzagEncode(const int64_t val) {
+  return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+int64_t ZigzagDecode(const uint64_t val) {
+  return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+}  // namespace
+
+/******************************** ResultSink *********************************/
+ResultSink::~ResultSink() {
+  Close();
+}
+
+int ResultSink::Open(const string &path) {
+  if (fd_ >= 0) {
+    return -1;
+  }
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ < 0) {
+    return -1;
+  }
+  num_records_ = 0;
+  buf_.clear();
+  buf_.insert(buf_.end(), kMagic, kMagic + sizeof(kMagic));
+  const uint32_t version = htobe32(kVersion);
+  const unsigned char *version_bytes = (const unsigned char *) &version;
+  buf_.insert(buf_.end(), version_bytes, version_bytes + sizeof(version));
+  return 0;
+}
+
+int ResultSink::Write(const Suite suite, const SingleTestInfo &test_info) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  PutVarint(buf_, suite);
+  PutVarint(buf_, test_info.test_num);
+  PutVarint(buf_, test_info.permute_data.last_checkpoint);
+  PutVarint(buf_, test_info.GetTestResult());
+  PutVarint(buf_, test_info.fs_test.GetError());
+  PutVarint(buf_, test_info.data_test.GetError());
+
+  const vector<DiskWriteData> &crash_state =
+    test_info.permute_data.crash_state;
+  PutVarint(buf_, crash_state.size());
+  int64_t prev_index = 0;
+  for (const DiskWriteData &bio : crash_state) {
+    const int64_t delta = (int64_t) bio.bio_index - prev_index;
+    PutVarint(buf_, (ZigzagEncode(delta) << 1) | !bio.full_bio);
+    if (!bio.full_bio) {
+      PutVarint(buf_, bio.bio_sector_index);
+    }
+    prev_index = bio.bio_index;
+  }
+  ++num_records_;
+
+  if (buf_.size() >= kFlushSize) {
+    return Flush();
+  }
+  return 0;
+}
+
+int ResultSink::Flush() {
+  size_t written = 0;
+  while (written < buf_.size()) {
+    const ssize_t res = write(fd_, buf_.data() + written,
+        buf_.size() - written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    written += res;
+  }
+  buf_.clear();
+  return 0;
+}
+
+int ResultSink::Close() {
+  if (fd_ < 0) {
+    return 0;
+  }
+  int res = Flush();
+  if (close(fd_) < 0) {
+    res = -1;
+  }
+  fd_ = -1;
+  return res;
+}
+
+bool ResultSink::IsOpen() const {
+  return fd_ >= 0;
+}
+
+uint64_t ResultSink::GetNumRecords() const {
+  return num_records_;
+}
+
+/******************************* ResultReader ********************************/
+int ResultReader::Open(const string &path) {
+  ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    return -1;
+  }
+  data_.assign(std::istreambuf_iterator<char>(in),
+      std::istreambuf_iterator<char>());
+  if (in.bad() || data_.size() < kHeaderSize ||
+      memcmp(data_.data(), kMagic, sizeof(kMagic)) != 0) {
+    return -1;
+  }
+  uint32_t version;
+  memcpy(&version, data_.data() + sizeof(kMagic), sizeof(version));
+  if (be32toh(version) != ResultSink::kVersion) {
+    return -1;
+  }
+  offset_ = kHeaderSize;
+  return 0;
+}
+
+bool ResultReader::ReadVarint(uint64_t &res) {
+  res = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    if (offset_ >= data_.size()) {
+      return false;
+    }
+    const unsigned char byte = data_[offset_++];
+    res |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int ResultReader::Next(ResultRecord &record) {
+  if (offset_ == data_.size()) {
+    return 0;
+  }
+
+  uint64_t fields[7];
+  for (uint64_t &field : fields) {
+    if (!ReadVarint(field)) {
+      return -1;
+    }
+  }
+  // Every bio takes at least a byte.
+  if (fields[0] > ResultSink::kTiming ||
+      fields[3] > SingleTestInfo::kFailed ||
+      fields[6] > data_.size() - offset_) {
+    return -1;
+  }
+  record.suite = (ResultSink::Suite) fields[0];
+  record.test_num = fields[1];
+  record.last_checkpoint = fields[2];
+  record.result = (SingleTestInfo::ResultType) fields[3];
+  record.fs_errors = fields[4];
+  record.data_errors = fields[5];
+
+  record.crash_state.resize(fields[6]);
+  int64_t prev_index = 0;
+  for (ResultRecord::Bio &bio : record.crash_state) {
+    uint64_t val;
+    if (!ReadVarint(val)) {
+      return -1;
+    }
+    bio.full_bio = !(val & 1);
+    bio.bio_index = prev_index + ZigzagDecode(val >> 1);
+    bio.bio_sector_index = 0;
+    if (!bio.full_bio) {
+      uint64_t sector;
+      if (!ReadVarint(sector)) {
+        return -1;
+      }
+      bio.bio_sector_index = sector;
+    }
+    prev_index = bio.bio_index;
+  }
+  return 1;
+}
+
+}  // namespace fs_testing
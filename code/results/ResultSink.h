@@ -0,0 +1,108 @@
+#ifndef HARNESS_RESULT_SINK_H
+#define HARNESS_RESULT_SINK_H
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "SingleTestInfo.h"
+
+namespace fs_testing {
+
+/*
+ * Streams a compact binary record for each tested crash state to a file as
+ * tests finish, so the results of every test in a long run can be kept without
+ * holding them in memory or writing the full text of each one to the log.
+ *
+ * The file starts with the 4 byte magic "CMRS" and a 4 byte big endian format
+ * version. Records follow back to back. Every field of a record is an unsigned
+ * LEB128 varint:
+ *    * suite the test ran in (see Suite)
+ *    * test number
+ *    * last checkpoint
+ *    * SingleTestInfo::ResultType
+ *    * FileSystemTestResult error bits
+ *    * DataTestResult error bits
+ *    * number of bios/sectors in the crash state
+ *    * for each bio/sector in the crash state, the zigzag encoded difference
+ *      between its bio index and that of the one before it, shifted left by one
+ *      with the low bit set if only one sector of the bio was written. That is
+ *      followed by the index of the sector for single sectors.
+ *
+ * Consecutive bio indices in a crash state are usually close together, so most
+ * of them take a single byte. Records are buffered and written out in blocks,
+ * so the last records may be lost if the harness dies before Close.
+ */
+class ResultSink {
+ public:
+  static const uint32_t kVersion = 1;
+
+  enum Suite {
+    kReordering = 0,
+    kTiming = 1,
+  };
+
+  ~ResultSink();
+
+  /*
+   * All of the below return 0 on success, a value < 0 on failure.
+   */
+  int Open(const std::string &path);
+  int Write(const Suite suite, const SingleTestInfo &test_info);
+  int Close();
+
+  bool IsOpen() const;
+  uint64_t GetNumRecords() const;
+
+ private:
+  int Flush();
+
+  int fd_ = -1;
+  uint64_t num_records_ = 0;
+  std::vector<unsigned char> buf_;
+};
+
+/*
+ * A record read back from a file written by ResultSink.
+ */
+struct ResultRecord {
+  struct Bio {
+    bool full_bio;
+    unsigned int bio_index;
+    unsigned int bio_sector_index;
+  };
+
+  ResultSink::Suite suite;
+  unsigned int test_num;
+  unsigned int last_checkpoint;
+  SingleTestInfo::ResultType result;
+  unsigned int fs_errors;
+  unsigned int data_errors;
+  std::vector<Bio> crash_state;
+};
+
+class ResultReader {
+ public:
+  /*
+   * Reads in the whole file. Returns 0 on success, a value < 0 if the file
+   * can't be read or isn't a result file.
+   */
+  int Open(const std::string &path);
+
+  /*
+   * Returns 1 and fills in record if there was another record, 0 at the end of
+   * the file, and a value < 0 if the record is truncated or corrupt.
+   */
+  int Next(ResultRecord &record);
+
+ private:
+  bool ReadVarint(uint64_t &res);
+
+  std::vector<unsigned char> data_;
+  size_t offset_ = 0;
+};
+
+}  // namespace fs_testing
+
+#endif  // HARNESS_RESULT_SINK_H
@@ -16,9 +16,14 @@ int BaseTestCase::init_values(string mount_dir, long filesys_size) {
   return 0;
 }
 
-int BaseTestCase::Run(const int change_fd, const int checkpoint) {
+string BaseTestCase::setup_key() {
+  return "";
+}
+
+int BaseTestCase::Run(const int change_fd, const int checkpoint,
+    const bool hash_mod_data) {
   DefaultFsFns default_fns;
-  RecordCmFsOps cm(&default_fns);
+  RecordCmFsOps cm(&default_fns, change_fd, hash_mod_data);
   PassthroughCmFsOps pcm(&default_fns);
   if (checkpoint == 0) {
     cm_ = &cm;
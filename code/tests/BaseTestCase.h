@@ -13,11 +13,25 @@ class BaseTestCase {
  public:
   virtual ~BaseTestCase() {};
   virtual int setup() = 0;
-  int Run(const int change_fd, const int checkpoint);
+  /*
+   * Run the test case. When checkpoint is 0, every change the test makes is
+   * streamed to change_fd as it happens. hash_mod_data has those changes carry
+   * only digests of the data written instead of the data itself.
+   */
+  int Run(const int change_fd, const int checkpoint,
+      const bool hash_mod_data = false);
   virtual int run(const int checkpoint) = 0;
   virtual int check_test(unsigned int last_checkpoint,
       DataTestResult *test_result) = 0;
   virtual int init_values(std::string mount_dir, long filesys_size);
+  /*
+   * Returns a string that identifies everything setup() does. Test cases that
+   * return the same non-empty key must leave identical file systems behind, so
+   * the harness may reuse the disk image from an earlier run with that key
+   * instead of formatting and calling setup() again. The default empty key
+   * turns this off.
+   */
+  virtual std::string setup_key();
 
  protected:
   std::string mnt_dir_;
@@ -26,6 +40,9 @@ class BaseTestCase {
 };
 
 typedef BaseTestCase *test_create_t();
+// Factory for shared objects that hold several test cases, see
+// TestCaseRegistry.h.
+typedef BaseTestCase *test_create_named_t(const char *name);
 typedef void test_destroy_t(BaseTestCase *instance);
 
 }  // namespace tests
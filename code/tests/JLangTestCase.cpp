@@ -0,0 +1,559 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Header file was changed in 4.15 kernel.
+#ifdef NEW_XATTR_INC
+#include <sys/xattr.h>
+#else
+#include <attr/xattr.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "JLangTestCase.h"
+#include "../user_tools/api/workload.h"
+#include "../user_tools/api/wrapper.h"
+#include "../utils/DiskMod.h"
+
+#define TEST_FILE_PERMS  ((mode_t) (S_IRWXU | S_IRWXG | S_IRWXO))
+
+namespace fs_testing {
+namespace tests {
+
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::istringstream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+using fs_testing::user_tools::api::DefaultFsFns;
+using fs_testing::user_tools::api::PassthroughCmFsOps;
+using fs_testing::user_tools::api::WriteData;
+using fs_testing::utils::DiskMod;
+
+namespace {
+
+// Data written by direct and mmap writes. These match what the test cases
+// cmAdapter.py generates write. Plain writes use WriteData like they do.
+const char kDWriteText[] = "ddddddddddklmnopqrstuvwxyz123456";
+const char kMmapWriteText[] = "mmmmmmmmmmklmnopqrstuvwxyz123456";
+const unsigned int kTextSize = sizeof(kDWriteText) - 1;
+
+const char kXattrName[] = "user.xattr1";
+const char kXattrValue[] = "val1 ";
+
+struct Symbol {
+  const char *name;
+  int value;
+};
+
+// Constants that may show up in the flags and modes of j-lang ops.
+const Symbol kSymbols[] = {
+  {"O_RDONLY", O_RDONLY},
+  {"O_WRONLY", O_WRONLY},
+  {"O_RDWR", O_RDWR},
+  {"O_CREAT", O_CREAT},
+  {"O_EXCL", O_EXCL},
+  {"O_TRUNC", O_TRUNC},
+  {"O_APPEND", O_APPEND},
+  {"O_DIRECT", O_DIRECT},
+  {"O_SYNC", O_SYNC},
+  {"O_DSYNC", O_DSYNC},
+  {"O_DIRECTORY", O_DIRECTORY},
+  {"FALLOC_FL_KEEP_SIZE", FALLOC_FL_KEEP_SIZE},
+  {"FALLOC_FL_PUNCH_HOLE", FALLOC_FL_PUNCH_HOLE},
+  {"FALLOC_FL_COLLAPSE_RANGE", FALLOC_FL_COLLAPSE_RANGE},
+  {"FALLOC_FL_ZERO_RANGE", FALLOC_FL_ZERO_RANGE},
+  {"FALLOC_FL_INSERT_RANGE", FALLOC_FL_INSERT_RANGE},
+  {"S_IFREG", S_IFREG},
+  {"S_IFCHR", S_IFCHR},
+  {"S_IFBLK", S_IFBLK},
+  {"S_IFIFO", S_IFIFO},
+  {"TEST_FILE_PERMS", TEST_FILE_PERMS},
+};
+
+/*
+ * Parse an expression like O_RDWR|O_CREAT or 0777 into res. Returns 0 on
+ * success, a value < 0 on failure.
+ */
+int ParseFlags(const string &expr, int &res) {
+  res = 0;
+  stringstream tokens(expr);
+  string token;
+  while (getline(tokens, token, '|')) {
+    if (token.empty()) {
+      return -1;
+    }
+    char *end;
+    const long val = strtol(token.c_str(), &end, 0);
+    if (*end == '\0') {
+      res |= val;
+      continue;
+    }
+    bool found = false;
+    for (const Symbol &sym : kSymbols) {
+      if (token == sym.name) {
+        res |= sym.value;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ParseNum(const string &word, uint64_t &res) {
+  char *end;
+  res = strtoull(word.c_str(), &end, 10);
+  return (word.empty() || *end != '\0') ? -1 : 0;
+}
+
+/*
+ * Fill buf with text repeated.
+ */
+void FillText(char *buf, const uint64_t len, const char *text) {
+  for (uint64_t i = 0; i < len; ++i) {
+    buf[i] = text[i % kTextSize];
+  }
+}
+
+}  // namespace
+
+int JLangTestCase::init_values(string mount_dir, long filesys_size) {
+  BaseTestCase::init_values(mount_dir, filesys_size);
+
+  const char *path = getenv(kJLangFileEnv);
+  if (path == NULL) {
+    cerr << "No j-lang file given in " << kJLangFileEnv << endl;
+    return -1;
+  }
+  ifstream file(path);
+  if (!file.is_open()) {
+    cerr << "Unable to open j-lang file " << path << endl;
+    return -1;
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  if (Parse(contents.str()) < 0) {
+    cerr << "Unable to parse j-lang file " << path << endl;
+    return -1;
+  }
+  return 0;
+}
+
+int JLangTestCase::Parse(const string &contents) {
+  files_.clear();
+  names_.clear();
+  setup_ops_.clear();
+  run_ops_.clear();
+  setup_text_.clear();
+
+  istringstream lines(contents);
+  string line;
+  string section;
+  unsigned int line_num = 0;
+  while (getline(lines, line)) {
+    ++line_num;
+    istringstream line_words(line);
+    vector<string> words;
+    string word;
+    while (line_words >> word) {
+      words.push_back(word);
+    }
+    if (words.empty()) {
+      continue;
+    }
+
+    // Lines starting with # name the section the lines after them are in.
+    if (words.front() == "#") {
+      section = words.back();
+      continue;
+    }
+
+    if (section == "define") {
+      string name = words.front();
+      name.erase(std::remove(name.begin(), name.end(), '/'), name.end());
+      files_.push_back((name == "test") ? "" : words.front());
+      names_.push_back(name);
+      setup_text_ += line + "\n";
+    } else if (section == "declare") {
+      // Only declares local_checkpoint, which run() always keeps.
+      continue;
+    } else if (section == "setup" || section == "run") {
+      JLangOp op;
+      if (ParseOp(words, op) < 0) {
+        cerr << "Bad j-lang op on line " << line_num << ": " << line << endl;
+        return -1;
+      }
+      if (section == "setup") {
+        setup_ops_.push_back(op);
+        setup_text_ += line + "\n";
+        continue;
+      }
+      run_ops_.push_back(op);
+
+      // cmAdapter.py also adds these fallocate calls to the end of setup.
+      if (op.type == kFalloc && words.size() == 7 &&
+          words.at(5) == "addToSetup") {
+        if (ParseFile(words.at(6), op.file) < 0) {
+          cerr << "Bad j-lang op on line " << line_num << ": " << line << endl;
+          return -1;
+        }
+        setup_ops_.push_back(op);
+        setup_text_ += line + "\n";
+      }
+    } else {
+      cerr << "Unknown j-lang section on line " << line_num << ": " << line
+        << endl;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int JLangTestCase::ParseFile(const string &name, unsigned int &res) {
+  for (unsigned int i = 0; i < names_.size(); ++i) {
+    if (names_.at(i) == name) {
+      res = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int JLangTestCase::ParseOp(const vector<string> &words, JLangOp &res) {
+  memset(&res, 0, sizeof(JLangOp));
+  const string &op = words.front();
+  const unsigned int num_args = words.size() - 1;
+  int mode;
+
+  if (op == "open" && num_args == 3) {
+    res.type = kOpen;
+    if (ParseFlags(words.at(2), res.flags) < 0 ||
+        ParseFlags(words.at(3), mode) < 0) {
+      return -1;
+    }
+    res.mode = mode;
+  } else if (op == "opendir" && num_args == 2) {
+    res.type = kOpenDir;
+    res.flags = O_DIRECTORY;
+    if (ParseFlags(words.at(2), mode) < 0) {
+      return -1;
+    }
+    res.mode = mode;
+  } else if (op == "mkdir" && num_args == 2) {
+    res.type = kMkdir;
+    if (ParseFlags(words.at(2), mode) < 0) {
+      return -1;
+    }
+    res.mode = mode;
+  } else if (op == "mknod" && num_args == 3) {
+    res.type = kMknod;
+    if (ParseFlags(words.at(2), mode) < 0 ||
+        ParseNum(words.at(3), res.offset) < 0) {
+      return -1;
+    }
+    res.mode = mode;
+  } else if (op == "close" && num_args == 1) {
+    res.type = kClose;
+  } else if (op == "rmdir" && num_args == 1) {
+    res.type = kRmdir;
+  } else if (op == "unlink" && num_args == 1) {
+    res.type = kUnlink;
+  } else if (op == "remove" && num_args == 1) {
+    res.type = kRemove;
+  } else if (op == "truncate" && num_args == 2) {
+    res.type = kTruncate;
+    if (ParseNum(words.at(2), res.len) < 0) {
+      return -1;
+    }
+  } else if (op == "falloc" && (num_args == 4 || num_args == 6)) {
+    res.type = kFalloc;
+    if (ParseFlags(words.at(2), res.flags) < 0 ||
+        ParseNum(words.at(3), res.offset) < 0 ||
+        ParseNum(words.at(4), res.len) < 0) {
+      return -1;
+    }
+  } else if ((op == "write" || op == "dwrite" || op == "mmapwrite") &&
+      num_args == 3) {
+    res.type = (op == "write") ? kWrite :
+      ((op == "dwrite") ? kDWrite : kMmapWrite);
+    if (ParseNum(words.at(2), res.offset) < 0 ||
+        ParseNum(words.at(3), res.len) < 0) {
+      return -1;
+    }
+  } else if ((op == "link" || op == "symlink" || op == "rename") &&
+      num_args == 2) {
+    res.type = (op == "link") ? kLink :
+      ((op == "symlink") ? kSymlink : kRename);
+    if (ParseFile(words.at(2), res.file2) < 0) {
+      return -1;
+    }
+  } else if (op == "fsetxattr" && num_args == 1) {
+    res.type = kFsetxattr;
+  } else if (op == "removexattr" && num_args == 1) {
+    res.type = kRemovexattr;
+  } else if (op == "fsync" && num_args == 1) {
+    res.type = kFsync;
+  } else if (op == "fdatasync" && num_args == 1) {
+    res.type = kFdatasync;
+  } else if (op == "sync" && num_args == 0) {
+    res.type = kSync;
+    return 0;
+  } else if (op == "none" && num_args == 0) {
+    res.type = kNone;
+    return 0;
+  } else if (op == "checkpoint" && num_args == 1) {
+    res.type = kCheckpoint;
+    uint64_t ret;
+    if (ParseNum(words.at(1), ret) < 0) {
+      return -1;
+    }
+    res.ret = ret;
+    return 0;
+  } else {
+    return -1;
+  }
+
+  // Everything left acts on the file given as the first argument.
+  return ParseFile(words.at(1), res.file);
+}
+
+void JLangTestCase::SetPaths() {
+  paths_.clear();
+  for (const string &file : files_) {
+    paths_.push_back(file.empty() ? mnt_dir_ : mnt_dir_ + "/" + file);
+  }
+}
+
+int JLangTestCase::setup() {
+  // The harness only hands test cases a CmFsOps while they run, and nothing
+  // done during setup needs to be recorded.
+  DefaultFsFns default_fns;
+  PassthroughCmFsOps pcm(&default_fns);
+  cm_ = &pcm;
+  SetPaths();
+  const int res = RunOps(setup_ops_, 0);
+  cm_ = NULL;
+  return res;
+}
+
+int JLangTestCase::run(const int checkpoint) {
+  SetPaths();
+  return RunOps(run_ops_, checkpoint);
+}
+
+int JLangTestCase::check_test(unsigned int /* last_checkpoint */,
+    DataTestResult * /* test_result */) {
+  return 0;
+}
+
+string JLangTestCase::setup_key() {
+  stringstream key;
+  // Keys outlive the process, so the hash has to be the same in every build.
+  key << "jlang-" << std::hex
+    << DiskMod::HashData(setup_text_.data(), setup_text_.size());
+  return key.str();
+}
+
+int JLangTestCase::RunOps(const vector<JLangOp> &ops, const int checkpoint) {
+  vector<int> fds(paths_.size(), -1);
+  int local_checkpoint = 0;
+  // Stands in for the file of ops that don't take one, like sync.
+  const string no_path;
+  int no_fd = -1;
+
+  for (const JLangOp &op : ops) {
+    const bool has_file = op.file < paths_.size();
+    const char *path = (has_file ? paths_.at(op.file) : no_path).c_str();
+    const char *path2 =
+      (op.file2 < paths_.size() ? paths_.at(op.file2) : no_path).c_str();
+    int &fd = has_file ? fds.at(op.file) : no_fd;
+    int res = 0;
+
+    switch (op.type) {
+      case kOpen:
+      case kOpenDir:
+        fd = cm_->CmOpen(path, op.flags, op.mode);
+        if (fd < 0) {
+          return errno;
+        }
+        break;
+      case kMkdir:
+        res = mkdir(path, op.mode);
+        break;
+      case kMknod:
+        res = mknod(path, op.mode, op.offset);
+        break;
+      case kClose:
+        res = cm_->CmClose(fd);
+        break;
+      case kRmdir:
+        res = rmdir(path);
+        break;
+      case kUnlink:
+        res = cm_->CmUnlink(path);
+        break;
+      case kRemove:
+        res = cm_->CmRemove(path);
+        break;
+      case kTruncate:
+        res = truncate(path, op.len);
+        break;
+      case kFalloc:
+        if (fallocate(fd, op.flags, op.offset, op.len) < 0) {
+          const int err = errno;
+          cm_->CmClose(fd);
+          return err;
+        }
+        break;
+      case kWrite:
+        res = RunWrite(op, fds);
+        if (res != 0) {
+          return res;
+        }
+        break;
+      case kDWrite:
+        res = RunDWrite(op, fds);
+        if (res != 0) {
+          return res;
+        }
+        break;
+      case kMmapWrite:
+        res = RunMmapWrite(op, fds);
+        if (res != 0) {
+          return res;
+        }
+        break;
+      case kLink:
+        res = link(path, path2);
+        break;
+      case kSymlink:
+        res = symlink(path, path2);
+        break;
+      case kRename:
+        res = cm_->CmRename(path, path2);
+        break;
+      case kFsetxattr:
+        res = fsetxattr(fd, kXattrName, kXattrValue, 4, 0);
+        break;
+      case kRemovexattr:
+        res = removexattr(path, kXattrName);
+        break;
+      case kFsync:
+        res = cm_->CmFsync(fd);
+        break;
+      case kFdatasync:
+        res = cm_->CmFdatasync(fd);
+        break;
+      case kSync:
+        cm_->CmSync();
+        break;
+      case kCheckpoint:
+        if (cm_->CmCheckpoint() < 0) {
+          return -1;
+        }
+        ++local_checkpoint;
+        if (local_checkpoint == checkpoint) {
+          return op.ret;
+        }
+        break;
+      case kNone:
+        break;
+    }
+
+    if (res < 0) {
+      return errno;
+    }
+  }
+  return 0;
+}
+
+int JLangTestCase::RunWrite(const JLangOp &op, vector<int> &fds) {
+  const int fd = fds.at(op.file);
+  if (WriteData(fd, op.offset, op.len) < 0) {
+    const int err = errno;
+    cm_->CmClose(fd);
+    return err;
+  }
+  return 0;
+}
+
+int JLangTestCase::RunDWrite(const JLangOp &op, vector<int> &fds) {
+  int &fd = fds.at(op.file);
+  cm_->CmClose(fd);
+  fd = cm_->CmOpen(paths_.at(op.file), O_RDWR | O_DIRECT | O_SYNC, 0777);
+  if (fd < 0) {
+    return errno;
+  }
+
+  void *data;
+  const int res = posix_memalign(&data, 4096, op.len);
+  if (res != 0) {
+    return res;
+  }
+  FillText((char *) data, op.len, kDWriteText);
+
+  if (pwrite(fd, data, op.len, op.offset) < 0) {
+    const int err = errno;
+    free(data);
+    cm_->CmClose(fd);
+    return err;
+  }
+  free(data);
+  // The generated test cases leave the file closed after a direct write.
+  cm_->CmClose(fd);
+  return 0;
+}
+
+int JLangTestCase::RunMmapWrite(const JLangOp &op, vector<int> &fds) {
+  const int fd = fds.at(op.file);
+  if (fallocate(fd, 0, op.offset, op.len) < 0) {
+    const int err = errno;
+    cm_->CmClose(fd);
+    return err;
+  }
+
+  const size_t map_len = op.offset + op.len;
+  char *filep = (char *) cm_->CmMmap(NULL, map_len, PROT_WRITE | PROT_READ,
+      MAP_SHARED, fd, 0);
+  if (filep == MAP_FAILED) {
+    return -1;
+  }
+  FillText(filep + op.offset, op.len, kMmapWriteText);
+
+  if (cm_->CmMsync(filep + op.offset, 8192, MS_SYNC) < 0) {
+    cm_->CmMunmap(filep, map_len);
+    return -1;
+  }
+  cm_->CmMunmap(filep, map_len);
+  return 0;
+}
+
+}  // namespace tests
+}  // namespace fs_testing
+
+extern "C" fs_testing::tests::BaseTestCase *test_case_get_instance() {
+  return new fs_testing::tests::JLangTestCase;
+}
+
+extern "C" void test_case_delete_instance(
+    fs_testing::tests::BaseTestCase *tc) {
+  delete tc;
+}
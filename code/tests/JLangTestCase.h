@@ -0,0 +1,126 @@
+#ifndef JLANG_TEST_CASE_H
+#define JLANG_TEST_CASE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BaseTestCase.h"
+
+namespace fs_testing {
+namespace tests {
+
+// Environment variable c_harness uses to tell JLangTestCase which j-lang file
+// to run.
+static constexpr char kJLangFileEnv[] = "JLANG_FILE";
+
+/*
+ * A test case that runs the j-lang workload files ACE generates directly,
+ * instead of having cmAdapter.py turn each of them into a C++ test case that
+ * must be compiled first. The file is parsed once when the test case is
+ * initialized, and setup() and run() then just walk the parsed ops. Each op
+ * makes the same calls as the code cmAdapter.py generates for it, including
+ * which of them go through cm_, so the harness records the same DiskMods.
+ */
+class JLangTestCase : public BaseTestCase {
+ public:
+  enum JLangOpType {
+    kOpen,
+    kOpenDir,
+    kMkdir,
+    kMknod,
+    kClose,
+    kRmdir,
+    kUnlink,
+    kRemove,
+    kTruncate,
+    kFalloc,
+    kWrite,
+    kDWrite,
+    kMmapWrite,
+    kLink,
+    kSymlink,
+    kRename,
+    kFsetxattr,
+    kRemovexattr,
+    kFsync,
+    kFdatasync,
+    kSync,
+    kCheckpoint,
+    kNone,
+  };
+
+  struct JLangOp {
+    JLangOpType type;
+    // Indices into the files defined by the workload.
+    unsigned int file;
+    unsigned int file2;
+    // Open flags, fallocate mode or mknod mode.
+    int flags;
+    mode_t mode;
+    uint64_t offset;
+    uint64_t len;
+    // Value run() returns if it stops at this checkpoint.
+    int ret;
+  };
+
+  /*
+   * Parse the j-lang file named by kJLangFileEnv. Returns 0 on success, a
+   * value < 0 if the file can't be read or parsed.
+   */
+  virtual int init_values(std::string mount_dir, long filesys_size) override;
+
+  /*
+   * Parse the j-lang workload in contents. Returns 0 on success, a value < 0
+   * on failure.
+   */
+  int Parse(const std::string &contents);
+
+  virtual int setup() override;
+  virtual int run(const int checkpoint) override;
+  virtual int check_test(unsigned int last_checkpoint,
+      DataTestResult *test_result) override;
+  virtual std::string setup_key() override;
+
+  const std::vector<JLangOp> & setup_ops() const { return setup_ops_; }
+  const std::vector<JLangOp> & run_ops() const { return run_ops_; }
+
+ private:
+  /*
+   * Parse a single line of the setup or run section into res. Returns 0 on
+   * success, a value < 0 on failure.
+   */
+  int ParseOp(const std::vector<std::string> &words, JLangOp &res);
+  int ParseFile(const std::string &name, unsigned int &res);
+
+  /*
+   * Fill in paths_ with the full path of each defined file.
+   */
+  void SetPaths();
+
+  /*
+   * Run ops with cm_, stopping at checkpoint if it is not 0. Returns what the
+   * test case cmAdapter.py generates for the same ops would have returned.
+   */
+  int RunOps(const std::vector<JLangOp> &ops, const int checkpoint);
+  int RunWrite(const JLangOp &op, std::vector<int> &fds);
+  int RunDWrite(const JLangOp &op, std::vector<int> &fds);
+  int RunMmapWrite(const JLangOp &op, std::vector<int> &fds);
+
+  // Files the workload defines, relative to the mount point, and the names
+  // ops refer to them by (the path without any '/').
+  std::vector<std::string> files_;
+  std::vector<std::string> names_;
+  std::vector<std::string> paths_;
+  std::vector<JLangOp> setup_ops_;
+  std::vector<JLangOp> run_ops_;
+  // The define and setup sections, which identify what setup() does.
+  std::string setup_text_;
+};
+
+}  // namespace tests
+}  // namespace fs_testing
+
+#endif
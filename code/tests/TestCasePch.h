@@ -0,0 +1,32 @@
+#ifndef TEST_CASE_PCH_H
+#define TEST_CASE_PCH_H
+
+/*
+ * Headers every generated workload includes. Batched builds of the ACE suites
+ * precompile this once and force it into each batch with -include, so the
+ * STL and test case headers aren't parsed again for every batch.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef NEW_XATTR_INC
+#include <sys/xattr.h>
+#else
+#include <attr/xattr.h>
+#endif
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "BaseTestCase.h"
+#include "TestCaseRegistry.h"
+#include "../user_tools/api/actions.h"
+#include "../user_tools/api/wrapper.h"
+#include "../user_tools/api/workload.h"
+
+#endif
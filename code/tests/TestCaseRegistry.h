@@ -0,0 +1,38 @@
+#ifndef TEST_CASE_REGISTRY_H
+#define TEST_CASE_REGISTRY_H
+
+#include <cstddef>
+#include <cstring>
+
+#include "BaseTestCase.h"
+
+namespace fs_testing {
+namespace tests {
+
+/*
+ * Shared objects built from a batch of test cases (see make_unity.sh) can't
+ * export one test_case_get_instance per test case. Instead they keep a table of
+ * the factories of the test cases they hold, keyed by the name of the source
+ * file each came from, and export test_case_get_named_instance to pick one.
+ */
+struct NamedTestCase {
+  const char *name;
+  test_create_t *factory;
+};
+
+// Returns a new instance of the test case called name in cases, or NULL if
+// there is no such test case.
+inline BaseTestCase * CreateNamedTestCase(const NamedTestCase *cases,
+    const size_t num_cases, const char *name) {
+  for (size_t i = 0; i < num_cases; ++i) {
+    if (strcmp(cases[i].name, name) == 0) {
+      return cases[i].factory();
+    }
+  }
+  return NULL;
+}
+
+}  // namespace tests
+}  // namespace fs_testing
+
+#endif
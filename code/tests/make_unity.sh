@@ -0,0 +1,56 @@
+#!/bin/sh
+# Write a single source file that compiles all the given test cases, so a batch
+# of generated workloads can be built into one shared object. Each test case
+# gets its own class and factory names, and the batch exports
+# test_case_get_named_instance (see TestCaseRegistry.h) to pick between them by
+# the name of the file they came from. The names of the test cases in the batch
+# are also written, one per line, to the output file with a .tests extension.
+#
+# usage: make_unity.sh <output .cpp> <test case .cpp>...
+
+out=$1
+shift
+list="${out%.cpp}.tests"
+registry="$(cd "$(dirname "$0")" && pwd)/TestCaseRegistry.h"
+
+{
+  echo "// Generated by make_unity.sh, do not edit."
+  echo "#include \"$registry\""
+  echo
+  i=0
+  for src in "$@"; do
+    echo "#define testName cm_unity_test_$i"
+    echo "#define test_case_get_instance cm_unity_get_instance_$i"
+    echo "#define test_case_delete_instance cm_unity_delete_instance_$i"
+    echo "#include \"$src\""
+    echo "#undef testName"
+    echo "#undef test_case_get_instance"
+    echo "#undef test_case_delete_instance"
+    echo
+    i=$((i + 1))
+  done
+
+  echo "static const fs_testing::tests::NamedTestCase cm_unity_test_cases[] = {"
+  i=0
+  for src in "$@"; do
+    name=$(basename "$src" .cpp)
+    echo "  {\"$name\", cm_unity_get_instance_$i},"
+    i=$((i + 1))
+  done
+  echo "};"
+  echo
+  echo "extern \"C\" fs_testing::tests::BaseTestCase *"
+  echo "test_case_get_named_instance(const char *name) {"
+  echo "  return fs_testing::tests::CreateNamedTestCase(cm_unity_test_cases,"
+  echo "      sizeof(cm_unity_test_cases) / sizeof(cm_unity_test_cases[0]), name);"
+  echo "}"
+  echo
+  echo "extern \"C\" void"
+  echo "test_case_delete_instance(fs_testing::tests::BaseTestCase *tc) {"
+  echo "  delete tc;"
+  echo "}"
+} > "$out"
+
+for src in "$@"; do
+  basename "$src" .cpp
+done > "$list"
@@ -47,6 +47,7 @@ class FsFns {
   virtual int FnRemove(const std::string &pathname) = 0;
 
   virtual int FnStat(const std::string &pathname, struct stat *buf) = 0;
+  virtual int FnFstat(const int fd, struct stat *buf) = 0;
   virtual bool FnPathExists(const std::string &pathname) = 0;
 
   virtual int FnFsync(const int fd) = 0;
@@ -84,6 +85,7 @@ class DefaultFsFns : public FsFns {
   virtual int FnRemove(const std::string &pathname) override;
 
   virtual int FnStat(const std::string &pathname, struct stat *buf) override;
+  virtual int FnFstat(const int fd, struct stat *buf) override;
   virtual bool FnPathExists(const std::string &pathname) override;
 
   virtual int FnFsync(const int fd) override;
@@ -141,6 +143,14 @@ class CmFsOps {
 class RecordCmFsOps : public CmFsOps {
  public:
   RecordCmFsOps(FsFns *functions);
+  /*
+   * Write each DiskMod to change_fd as soon as it is recorded instead of
+   * holding all of them until Serialize is called. Data written by the user is
+   * streamed out without being copied. If hash_data is set, mods for writes
+   * larger than DiskMod::kInlineDataThreshold carry only per-block digests of
+   * the data instead of the data itself.
+   */
+  RecordCmFsOps(FsFns *functions, const int change_fd, const bool hash_data);
   virtual ~RecordCmFsOps() {};
 
   int CmMknod(const std::string &pathname, const mode_t mode, const dev_t dev);
@@ -176,8 +186,17 @@ class RecordCmFsOps : public CmFsOps {
 
   // Protected for testing purposes.
  protected:
-  // So that things that require fd can be mapped to pathnames.
-  std::unordered_map<int, std::string> fd_map_;
+  // What is known about each open file descriptor, so that recording ops on it
+  // takes as few extra system calls as possible.
+  struct OpenFile {
+    // So that things that require fd can be mapped to pathnames.
+    std::string path;
+    // Where the next CmWrite goes. Only CmLseek and CmWrite move it, so file
+    // descriptors written with CmWrite must not be moved any other way.
+    off_t offset;
+    bool append;
+  };
+  std::unordered_map<int, OpenFile> fd_map_;
 
   // So that mmap pointers can be mapped to pathnames and mmap offset and
   // length.
@@ -198,11 +217,20 @@ class RecordCmFsOps : public CmFsOps {
       const bool exists, const int flags);
 
   /*
-   * Write data out to the given file descriptor. Automatically retires until
-   * all the requested data is written.
+   * Record a DiskMod. data, if not NULL, holds the file data for the mod. It is
+   * only copied if the mod is held in mods_ rather than streamed out.
    */
-  int WriteWhole(const int fd, const unsigned long long size,
-      std::shared_ptr<char> data);
+  void AddMod(fs_testing::utils::DiskMod &mod, const char *data = NULL);
+
+  // Where to stream DiskMods to, or -1 if they are held in mods_.
+  int change_fd_ = -1;
+  bool hash_data_ = false;
+  // First error seen while streaming DiskMods, returned by Serialize.
+  int stream_err_ = 0;
+  // Serialized mods without file data that haven't been written to change_fd_
+  // yet. They go out with the next mod that has file data, once they pass
+  // kPendingFlushSize bytes, or in Serialize.
+  std::vector<char> pending_;
 };
 
 /*
@@ -0,0 +1,45 @@
+#include <iostream>
+#include <string>
+
+#include "../utils/communication/ClientSocket.h"
+#include "../utils/communication/SocketUtils.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+using fs_testing::utils::communication::ClientSocket;
+using fs_testing::utils::communication::kSocketNameDaemon;
+using fs_testing::utils::communication::SocketError;
+using fs_testing::utils::communication::SocketMessage;
+
+/*
+ * Hand a test case to a c_harness running in daemon mode and wait for it to
+ * finish. Exits with the status of the harness run for the test, or a value < 0
+ * if the daemon couldn't be reached.
+ */
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " <test case .so>" << endl;
+    return -1;
+  }
+
+  ClientSocket conn(kSocketNameDaemon);
+  if (conn.Init() < 0) {
+    return -1;
+  }
+
+  SocketMessage m;
+  m.type = SocketMessage::kQueueTest;
+  m.string_value = string(argv[1]);
+  if (conn.SendMessage(m) != SocketError::kNone) {
+    return -2;
+  }
+
+  SocketMessage ret;
+  if (conn.WaitForMessage(&ret) != SocketError::kNone ||
+      ret.type != SocketMessage::kQueueTestDone) {
+    return -3;
+  }
+  return ret.int_value;
+}
@@ -1,19 +1,74 @@
 #include "../api/actions.h"
 
-#include "../../utils/communication/ClientCommandSender.h"
+#include <unistd.h>
+
+#include "../../utils/communication/ClientSocket.h"
 
 namespace fs_testing {
 namespace user_tools {
 namespace api {
 
-using fs_testing::utils::communication::ClientCommandSender;
+using fs_testing::utils::communication::ClientSocket;
 using fs_testing::utils::communication::kSocketNameOutbound;
+using fs_testing::utils::communication::SocketError;
 using fs_testing::utils::communication::SocketMessage;
 
+namespace {
+
+// Connection to the harness shared by all checkpoints in this process. Opened
+// on the first checkpoint instead of once per checkpoint since workloads often
+// checkpoint after every operation.
+ClientSocket *harness_conn = NULL;
+// Process that opened harness_conn. Children forked after it was opened need
+// their own so replies don't go to the wrong process.
+pid_t harness_conn_pid = -1;
+
+void CloseHarnessConn() {
+  delete harness_conn;
+  harness_conn = NULL;
+}
+
+int SendCheckpoint() {
+  if (harness_conn != NULL && harness_conn_pid != getpid()) {
+    // Only closes our copy of the parent's connection.
+    CloseHarnessConn();
+  }
+  if (harness_conn == NULL) {
+    harness_conn = new ClientSocket(kSocketNameOutbound);
+    if (harness_conn->Init() < 0) {
+      CloseHarnessConn();
+      return -1;
+    }
+    harness_conn_pid = getpid();
+  }
+
+  if (harness_conn->SendCommand(SocketMessage::kCheckpoint) !=
+      SocketError::kNone) {
+    CloseHarnessConn();
+    return -2;
+  }
+
+  SocketMessage ret;
+  if (harness_conn->WaitForMessage(&ret) != SocketError::kNone) {
+    CloseHarnessConn();
+    return -3;
+  }
+  return !(ret.type == SocketMessage::kCheckpointDone);
+}
+
+}  // namespace
+
 int Checkpoint() {
-  ClientCommandSender c(kSocketNameOutbound, SocketMessage::kCheckpoint,
-      SocketMessage::kCheckpointDone);
-  return c.Run();
+  const bool reused = harness_conn != NULL && harness_conn_pid == getpid();
+  int res = SendCheckpoint();
+  if (res == -2 && reused) {
+    // The harness may have hung up on the old connection since our last
+    // checkpoint, so try again with a new one. Once the command went out
+    // (-3), the harness may have already recorded the checkpoint, and sending
+    // it again would record it twice.
+    res = SendCheckpoint();
+  }
+  return res;
 }
 
 } // fs_testing
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <utility>
 
 
@@ -28,6 +29,13 @@ using std::vector;
 
 using fs_testing::utils::DiskMod;
 
+namespace {
+
+// Bytes of serialized mods without file data to batch before writing them to
+// the change file.
+const unsigned int kPendingFlushSize = 64 * 1024;
+
+}  // namespace
 
 int DefaultFsFns::FnMknod(const std::string &pathname, mode_t mode, dev_t dev) {
   return mknod(pathname.c_str(), mode, dev);
@@ -96,6 +104,10 @@ int DefaultFsFns::FnStat(const std::string &pathname, struct stat *buf) {
   return stat(pathname.c_str(), buf);
 }
 
+int DefaultFsFns::FnFstat(const int fd, struct stat *buf) {
+  return fstat(fd, buf);
+}
+
 bool DefaultFsFns::FnPathExists(const std::string &pathname) {
   const int res = access(pathname.c_str(), F_OK);
   // TODO(ashmrtn): Should probably have some better way to handle errors.
@@ -136,6 +148,49 @@ RecordCmFsOps::RecordCmFsOps(FsFns *functions) {
   fns_ = functions;
 }
 
+RecordCmFsOps::RecordCmFsOps(FsFns *functions, const int change_fd,
+    const bool hash_data) : change_fd_(change_fd), hash_data_(hash_data) {
+  fns_ = functions;
+}
+
+void RecordCmFsOps::AddMod(DiskMod &mod, const char *data) {
+  // Small writes keep their data since their digests wouldn't be much smaller.
+  if (data != NULL && mod.file_mod_len > DiskMod::kInlineDataThreshold &&
+      hash_data_) {
+    mod.SetDigests(data);
+    data = NULL;
+  }
+
+  if (change_fd_ < 0) {
+    if (data != NULL && mod.file_mod_len > 0) {
+      mod.file_mod_data.reset(new char[mod.file_mod_len],
+          [](char* c) {delete[] c;});
+      memcpy(mod.file_mod_data.get(), data, mod.file_mod_len);
+    }
+    mods_.push_back(mod);
+    return;
+  }
+
+  if (stream_err_ != 0) {
+    return;
+  }
+  // File data has to go out now since the caller's buffer may change once we
+  // return. Everything else is batched to save system calls.
+  const int64_t data_size = DiskMod::AppendSerializedMetadata(pending_, mod);
+  if (data_size < 0) {
+    stream_err_ = -1;
+    return;
+  }
+  if (data_size > 0 && data == NULL) {
+    data = mod.file_mod_data.get();
+  }
+  if (data_size > 0 || pending_.size() >= kPendingFlushSize) {
+    if (DiskMod::FlushSerialized(change_fd_, pending_, data, data_size) < 0) {
+      stream_err_ = -1;
+    }
+  }
+}
+
 int RecordCmFsOps::CmMknod(const string &pathname, const mode_t mode,
     const dev_t dev) {
   return fns_->FnMknod(pathname.c_str(), mode, dev);
@@ -153,14 +208,14 @@ int RecordCmFsOps::CmMkdir(const string &pathname, const mode_t mode) {
   mod.mod_type = DiskMod::kCreateMod;
   mod.mod_opts = DiskMod::kNoneOpt;
 
-  mods_.push_back(mod);
+  AddMod(mod);
 
   return res;
 }
 
 void RecordCmFsOps::CmOpenCommon(const int fd, const string &pathname,
     const bool exists, const int flags) {
-  fd_map_.insert({fd, pathname});
+  fd_map_.insert({fd, {pathname, 0, (flags & O_APPEND) != 0}});
 
   if (!exists || (flags & O_TRUNC)) {
     // We only want to record this op if we changed something on the file
@@ -170,8 +225,7 @@ void RecordCmFsOps::CmOpenCommon(const int fd, const string &pathname,
 
     // Need something like stat() because umask could affect the file
     // permissions.
-    const int post_stat_res = fns_->FnStat(pathname.c_str(),
-        &mod.post_mod_stats);
+    const int post_stat_res = fns_->FnFstat(fd, &mod.post_mod_stats);
     if (post_stat_res < 0) {
       // TODO(ashmrtn): Some sort of warning here?
       return;
@@ -189,7 +243,7 @@ void RecordCmFsOps::CmOpenCommon(const int fd, const string &pathname,
 
     mod.path = pathname;
 
-    mods_.push_back(mod);
+    AddMod(mod);
   }
 }
 
@@ -224,59 +278,59 @@ int RecordCmFsOps::CmOpen(const string &pathname, const int flags,
 
 off_t RecordCmFsOps::CmLseek(const int fd, const off_t offset,
     const int whence) {
-  return fns_->FnLseek(fd, offset, whence);
+  const off_t res = fns_->FnLseek(fd, offset, whence);
+  if (res < 0) {
+    return res;
+  }
+
+  const auto open_file = fd_map_.find(fd);
+  if (open_file != fd_map_.end()) {
+    open_file->second.offset = res;
+  }
+
+  return res;
 }
 
 int RecordCmFsOps::CmWrite(const int fd, const void *buf, const size_t count) {
+  OpenFile &open_file = fd_map_.at(fd);
   DiskMod mod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  // Get current file position and size. If stat fails, then assume lseek will
-  // fail too and just bail out.
-  struct stat pre_stat_buf;
-  // This could be an fstat(), but I don't see a reason to add another call that
-  // does only reads to the already large interface of FsFns.
-  int res = fns_->FnStat(fd_map_.at(fd), &pre_stat_buf);
+  // The file size before the write is the only thing we need to ask the file
+  // system for. The offset is tracked, and the size after the write follows
+  // from where the write landed. If fstat fails, assume write would fail too
+  // and just bail out.
+  int res = fns_->FnFstat(fd, &mod.post_mod_stats);
   if (res < 0) {
     return res;
   }
+  const off_t pre_size = mod.post_mod_stats.st_size;
 
-  mod.file_mod_location = fns_->FnLseek(fd, 0, SEEK_CUR);
-  if (mod.file_mod_location < 0) {
-    return mod.file_mod_location;
-  }
+  mod.file_mod_location = open_file.append ? pre_size : open_file.offset;
 
   const int write_res = fns_->FnWrite(fd, buf, count);
   if (write_res < 0) {
     return write_res;
   }
+  open_file.offset = mod.file_mod_location + write_res;
 
-  mod.directory_mod = S_ISDIR(pre_stat_buf.st_mode);
+  mod.directory_mod = S_ISDIR(mod.post_mod_stats.st_mode);
 
   // TODO(ashmrtn): Support calling write directly on a directory.
   if (!mod.directory_mod) {
     // Copy over as much data as was written and see what the new file size is.
     // This will determine how we set the type of the DiskMod.
     mod.file_mod_len = write_res;
-    mod.path = fd_map_.at(fd);
+    mod.path = open_file.path;
+    mod.post_mod_stats.st_size = std::max(pre_size, open_file.offset);
 
-    res = fns_->FnStat(fd_map_.at(fd), &mod.post_mod_stats);
-    if (res < 0) {
-      return write_res;
-    }
-
-    if (pre_stat_buf.st_size != mod.post_mod_stats.st_size) {
+    if (pre_size != mod.post_mod_stats.st_size) {
       mod.mod_type = DiskMod::kDataMetadataMod;
     } else {
       mod.mod_type = DiskMod::kDataMod;
     }
-
-    if (write_res > 0) {
-      mod.file_mod_data.reset(new char[write_res], [](char* c) {delete[] c;});
-      memcpy(mod.file_mod_data.get(), buf, write_res);
-    }
   }
 
-  mods_.push_back(mod);
+  AddMod(mod, (const char *) buf);
 
   return write_res;
 }
@@ -285,22 +339,19 @@ ssize_t RecordCmFsOps::CmPwrite(const int fd, const void *buf,
     const size_t count, const off_t offset) {
   DiskMod mod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  // Get current file position and size. If stat fails, then assume lseek will
-  // fail too and just bail out.
-  struct stat pre_stat_buf;
-  // This could be an fstat(), but I don't see a reason to add another call that
-  // does only reads to the already large interface of FsFns.
-  int res = fns_->FnStat(fd_map_.at(fd), &pre_stat_buf);
+  // Same as CmWrite, except the caller gives the offset.
+  int res = fns_->FnFstat(fd, &mod.post_mod_stats);
   if (res < 0) {
     return res;
   }
+  const off_t pre_size = mod.post_mod_stats.st_size;
 
   const int write_res = fns_->FnPwrite(fd, buf, count, offset);
   if (write_res < 0) {
     return write_res;
   }
 
-  mod.directory_mod = S_ISDIR(pre_stat_buf.st_mode);
+  mod.directory_mod = S_ISDIR(mod.post_mod_stats.st_mode);
 
   // TODO(ashmrtn): Support calling write directly on a directory.
   if (!mod.directory_mod) {
@@ -308,29 +359,20 @@ ssize_t RecordCmFsOps::CmPwrite(const int fd, const void *buf,
     // This will determine how we set the type of the DiskMod.
     mod.file_mod_location = offset;
     mod.file_mod_len = write_res;
-    mod.path = fd_map_.at(fd);
-
-    res = fns_->FnStat(fd_map_.at(fd), &mod.post_mod_stats);
-    if (res < 0) {
-      return write_res;
-    }
+    mod.path = fd_map_.at(fd).path;
+    mod.post_mod_stats.st_size = std::max(pre_size,
+        (off_t) (offset + write_res));
 
-    if (pre_stat_buf.st_size != mod.post_mod_stats.st_size) {
+    if (pre_size != mod.post_mod_stats.st_size) {
       mod.mod_type = DiskMod::kDataMetadataMod;
     } else {
       mod.mod_type = DiskMod::kDataMod;
     }
-
-    if (write_res > 0) {
-      mod.file_mod_data.reset(new char[write_res], [](char* c) {delete[] c;});
-      memcpy(mod.file_mod_data.get(), buf, write_res);
-    }
   }
 
-  mods_.push_back(mod);
+  AddMod(mod, (const char *) buf);
 
   return write_res;
-  return fns_->FnPwrite(fd, buf, count, offset);
 }
 
 void * RecordCmFsOps::CmMmap(void *addr, const size_t length, const int prot,
@@ -352,7 +394,7 @@ void * RecordCmFsOps::CmMmap(void *addr, const size_t length, const int prot,
   // this region.
   mmap_map_.insert({(long long) res,
       tuple<string, unsigned int, unsigned int>(
-          fd_map_.at(fd), offset, length)});
+          fd_map_.at(fd).path, offset, length)});
   return res;
 }
 
@@ -380,12 +422,9 @@ int RecordCmFsOps::CmMsync(void *addr, const size_t length, const int flags) {
         std::get<1>(kv.second) + ((long long) addr - kv.first);
       mod.file_mod_len = length;
 
-      // Copy over the data that is being sync-ed. We don't know how it is
+      // Record the data that is being sync-ed. We don't know how it is
       // different than what was there to start with, but we'll have it!
-      mod.file_mod_data.reset(new char[length], [](char* c) {delete[] c;});
-      memcpy(mod.file_mod_data.get(), addr, length);
-
-      mods_.push_back(mod);
+      AddMod(mod, (const char *) addr);
       break;
     }
   }
@@ -411,7 +450,7 @@ int RecordCmFsOps::CmMunmap(void *addr, const size_t length) {
 int RecordCmFsOps::CmFallocate(const int fd, const int mode, const off_t offset,
     off_t len) {
   struct stat pre_stat;
-  const int pre_stat_res = fns_->FnStat(fd_map_[fd].c_str(), &pre_stat);
+  const int pre_stat_res = fns_->FnFstat(fd, &pre_stat);
   if (pre_stat_res < 0) {
     return pre_stat_res;
   }
@@ -422,7 +461,7 @@ int RecordCmFsOps::CmFallocate(const int fd, const int mode, const off_t offset,
   }
 
   struct stat post_stat;
-  const int post_stat_res = fns_->FnStat(fd_map_[fd].c_str(), &post_stat);
+  const int post_stat_res = fns_->FnFstat(fd, &post_stat);
   if (post_stat_res < 0) {
     return post_stat_res;
   }
@@ -436,7 +475,7 @@ int RecordCmFsOps::CmFallocate(const int fd, const int mode, const off_t offset,
     mod.mod_type = DiskMod::kDataMod;
   }
 
-  mod.path = fd_map_[fd];
+  mod.path = fd_map_[fd].path;
   mod.file_mod_location = offset;
   mod.file_mod_len = len;
 
@@ -465,7 +504,7 @@ int RecordCmFsOps::CmFallocate(const int fd, const int mode, const off_t offset,
     mod.mod_opts = DiskMod::kFallocateOpt;
   }
 
-  mods_.push_back(mod);
+  AddMod(mod);
 
   return res;
 }
@@ -486,16 +525,16 @@ int RecordCmFsOps::CmRename(const string &old_path, const string &new_path) {
   // check if there are any open files with the old path
   // change the file descriptors to point to the new path
   for (auto it = fd_map_.begin(); it != fd_map_.end(); it++) {
-    string& open_fd_old_path = it->second;
+    string& open_fd_old_path = it->second.path;
     if (open_fd_old_path.compare(old_path) == 0) {
-      fd_map_[it->first] = new_path;
+      open_fd_old_path = new_path;
       continue;
     }
     // if we are renaming a directory that is open; we want to
     // change the mapping of the open files in that directory
     auto found = open_fd_old_path.find(old_path);
     if ( found != std::string::npos) {
-      fd_map_[it->first].replace(found, old_path.length(), new_path);
+      open_fd_old_path.replace(found, old_path.length(), new_path);
     }
   }
   return fns_->FnRename(old_path, new_path);
@@ -511,7 +550,7 @@ int RecordCmFsOps::CmUnlink(const string &pathname) {
   mod.mod_type = DiskMod::kRemoveMod;
   mod.mod_opts = DiskMod::kNoneOpt;
   mod.path = pathname;
-  mods_.push_back(mod);
+  AddMod(mod);
 
   return res;
 }
@@ -526,7 +565,7 @@ int RecordCmFsOps::CmRemove(const string &pathname) {
   mod.mod_type = DiskMod::kRemoveMod;
   mod.mod_opts = DiskMod::kNoneOpt;
   mod.path = pathname;
-  mods_.push_back(mod);
+  AddMod(mod);
 
   return res;
 }
@@ -540,8 +579,8 @@ int RecordCmFsOps::CmFsync(const int fd) {
   DiskMod mod;
   mod.mod_type = DiskMod::kFsyncMod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  mod.path = fd_map_.at(fd);
-  mods_.push_back(mod);
+  mod.path = fd_map_.at(fd).path;
+  AddMod(mod);
 
   return res;
 }
@@ -555,8 +594,8 @@ int RecordCmFsOps::CmFdatasync(const int fd) {
   DiskMod mod;
   mod.mod_type = DiskMod::kFsyncMod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  mod.path = fd_map_.at(fd);
-  mods_.push_back(mod);
+  mod.path = fd_map_.at(fd).path;
+  AddMod(mod);
 
   return res;
 }
@@ -567,7 +606,7 @@ void RecordCmFsOps::CmSync() {
   DiskMod mod;
   mod.mod_type = DiskMod::kSyncMod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  mods_.push_back(mod);
+  AddMod(mod);
 }
 
 // int RecordCmFsOps::CmSyncfs(const int fd) {
@@ -596,15 +635,15 @@ int RecordCmFsOps::CmSyncFileRange(const int fd, size_t offset, size_t nbytes,
   DiskMod mod;
   mod.mod_type = DiskMod::kSyncFileRangeMod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  mod.path = fd_map_.at(fd);
-  const int post_stat_res = fns_->FnStat(fd_map_.at(fd), &mod.post_mod_stats);
+  mod.path = fd_map_.at(fd).path;
+  const int post_stat_res = fns_->FnFstat(fd, &mod.post_mod_stats);
   if (post_stat_res < 0) {
     // TODO(ashmrtn): Some sort of warning here?
     return post_stat_res;
   }
   mod.file_mod_location = offset;
   mod.file_mod_len = nbytes;
-  mods_.push_back(mod);
+  AddMod(mod);
   return res;
 }
 
@@ -617,40 +656,23 @@ int RecordCmFsOps::CmCheckpoint() {
   DiskMod mod;
   mod.mod_type = DiskMod::kCheckpointMod;
   mod.mod_opts = DiskMod::kNoneOpt;
-  mods_.push_back(mod);
+  AddMod(mod);
 
   return res;
 }
 
-int RecordCmFsOps::WriteWhole(const int fd, const unsigned long long size,
-    shared_ptr<char> data) {
-  unsigned long long written = 0;
-  while (written < size) {
-    const int res = write(fd, data.get() + written, size - written);
-    if (res < 0) {
-      return res;
-    }
-    written += res;
-  }
-
-  return 0;
-}
-
 int RecordCmFsOps::Serialize(const int fd) {
-  for (auto &mod : mods_) {
-    unsigned long long size;
-    shared_ptr<char> serial_mod = DiskMod::Serialize(mod, &size);
-    if (serial_mod == nullptr) {
-      return -1;
-    }
-
-    const int res = WriteWhole(fd, size, serial_mod);
-    if (res < 0) {
-      return -1;
+  if (change_fd_ >= 0) {
+    // Everything but the last batch was already written out as it was
+    // recorded.
+    if (stream_err_ == 0 && !pending_.empty() &&
+        DiskMod::FlushSerialized(change_fd_, pending_, NULL, 0) < 0) {
+      stream_err_ = -1;
     }
+    return stream_err_;
   }
 
-  return 0;
+  return DiskMod::SerializeAllToFd(fd, mods_);
 }
 
 
@@ -0,0 +1,396 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ChunkedFile.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::memcpy;
+using std::min;
+using std::string;
+using std::vector;
+
+namespace {
+
+static constexpr char kMagic[] = "CMCHUNK1";
+static const unsigned int kMagicSize = 8;
+static const uint32_t kVersion = 1;
+static const unsigned int kIndexEntrySize = sizeof(uint64_t) +
+  (2 * sizeof(uint32_t));
+// Favor speed over ratio; most of what we store is either zeros or file data
+// written by the workload, both of which compress well even at low levels.
+static const int kCompressionLevel = 1;
+
+/*
+ * Header layout:
+ *    * 8-byte magic string (not null terminated)
+ *    * uint32_t format version
+ *    * uint32_t chunk size
+ *    * uint64_t size of the original, uncompressed data
+ *    * uint64_t number of chunks
+ *    * uint64_t file offset of the chunk index
+ *
+ * Index entry layout:
+ *    * uint64_t file offset of the chunk
+ *    * uint32_t number of bytes stored for the chunk
+ *    * uint32_t ChunkType of the chunk
+ */
+
+void PutU64(char *buf, uint64_t *offset, const uint64_t val) {
+  const uint64_t be = htobe64(val);
+  memcpy(buf + *offset, &be, sizeof(uint64_t));
+  *offset += sizeof(uint64_t);
+}
+
+uint64_t GetU64(const char *buf, uint64_t *offset) {
+  uint64_t be;
+  memcpy(&be, buf + *offset, sizeof(uint64_t));
+  *offset += sizeof(uint64_t);
+  return be64toh(be);
+}
+
+void PutU32(char *buf, uint64_t *offset, const uint32_t val) {
+  const uint32_t be = htobe32(val);
+  memcpy(buf + *offset, &be, sizeof(uint32_t));
+  *offset += sizeof(uint32_t);
+}
+
+uint32_t GetU32(const char *buf, uint64_t *offset) {
+  uint32_t be;
+  memcpy(&be, buf + *offset, sizeof(uint32_t));
+  *offset += sizeof(uint32_t);
+  return be32toh(be);
+}
+
+int PreadWhole(const int fd, char *data, const uint64_t size,
+    const uint64_t offset) {
+  uint64_t done = 0;
+  while (done < size) {
+    const ssize_t res = pread(fd, data + done, size - done, offset + done);
+    if (res <= 0) {
+      return -1;
+    }
+    done += res;
+  }
+  return 0;
+}
+
+bool IsZero(const char *data, const uint64_t size) {
+  if (size == 0) {
+    return true;
+  }
+  // Compare the buffer against itself shifted by one byte once the first byte
+  // is known to be zero.
+  return data[0] == 0 && memcmp(data, data + 1, size - 1) == 0;
+}
+
+}  // namespace
+
+bool ChunkedFile::IsChunkedFile(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char magic[kMagicSize];
+  const ssize_t res = read(fd, magic, kMagicSize);
+  close(fd);
+  return res == kMagicSize && memcmp(magic, kMagic, kMagicSize) == 0;
+}
+
+ChunkedFileWriter::ChunkedFileWriter(unsigned int chunk_size)
+    : chunk_size_(chunk_size) {
+  chunk_.reserve(chunk_size_);
+  compressed_.resize(compressBound(chunk_size_));
+}
+
+ChunkedFileWriter::~ChunkedFileWriter() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+int ChunkedFileWriter::Open(const string &path) {
+  if (fd_ >= 0 || chunk_size_ == 0) {
+    return -1;
+  }
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      S_IRUSR | S_IWUSR);
+  if (fd_ < 0) {
+    return -1;
+  }
+  chunk_.clear();
+  index_.clear();
+  total_size_ = 0;
+  // The real header is written in Close once the index location is known.
+  char header[ChunkedFile::kHeaderSize] = {0};
+  file_offset_ = 0;
+  return WriteWhole(header, ChunkedFile::kHeaderSize);
+}
+
+int ChunkedFileWriter::Append(const char *data, uint64_t size) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  total_size_ += size;
+  while (size > 0) {
+    const uint64_t to_copy = min((uint64_t) (chunk_size_ - chunk_.size()),
+        size);
+    chunk_.insert(chunk_.end(), data, data + to_copy);
+    data += to_copy;
+    size -= to_copy;
+    if (chunk_.size() == chunk_size_ && FlushChunk() < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ChunkedFileWriter::Close() {
+  if (fd_ < 0) {
+    return -1;
+  }
+  int res = 0;
+  if (!chunk_.empty()) {
+    res = FlushChunk();
+  }
+
+  const uint64_t index_offset = file_offset_;
+  if (res == 0) {
+    vector<char> index(index_.size() * kIndexEntrySize);
+    uint64_t offset = 0;
+    for (const IndexEntry &e : index_) {
+      PutU64(index.data(), &offset, e.offset);
+      PutU32(index.data(), &offset, e.length);
+      PutU32(index.data(), &offset, e.type);
+    }
+    res = WriteWhole(index.data(), index.size());
+  }
+
+  if (res == 0) {
+    char header[ChunkedFile::kHeaderSize];
+    memcpy(header, kMagic, kMagicSize);
+    uint64_t offset = kMagicSize;
+    PutU32(header, &offset, kVersion);
+    PutU32(header, &offset, chunk_size_);
+    PutU64(header, &offset, total_size_);
+    PutU64(header, &offset, index_.size());
+    PutU64(header, &offset, index_offset);
+    if (pwrite(fd_, header, ChunkedFile::kHeaderSize, 0)
+        != ChunkedFile::kHeaderSize) {
+      res = -1;
+    }
+  }
+
+  if (close(fd_) < 0) {
+    res = -1;
+  }
+  fd_ = -1;
+  return res;
+}
+
+int ChunkedFileWriter::FlushChunk() {
+  IndexEntry e;
+  e.offset = file_offset_;
+  if (IsZero(chunk_.data(), chunk_.size())) {
+    e.length = 0;
+    e.type = ChunkedFile::kHoleChunk;
+    index_.push_back(e);
+    chunk_.clear();
+    return 0;
+  }
+
+  uLongf compressed_len = compressed_.size();
+  const int z_res = compress2(compressed_.data(), &compressed_len,
+      (const Bytef *) chunk_.data(), chunk_.size(), kCompressionLevel);
+  int res;
+  if (z_res == Z_OK && compressed_len < chunk_.size()) {
+    e.length = compressed_len;
+    e.type = ChunkedFile::kZlibChunk;
+    res = WriteWhole((const char *) compressed_.data(), compressed_len);
+  } else {
+    e.length = chunk_.size();
+    e.type = ChunkedFile::kRawChunk;
+    res = WriteWhole(chunk_.data(), chunk_.size());
+  }
+  index_.push_back(e);
+  chunk_.clear();
+  return res;
+}
+
+int ChunkedFileWriter::WriteWhole(const char *data, uint64_t size) {
+  uint64_t written = 0;
+  while (written < size) {
+    const ssize_t res = write(fd_, data + written, size - written);
+    if (res < 0) {
+      return -1;
+    }
+    written += res;
+  }
+  file_offset_ += size;
+  return 0;
+}
+
+ChunkedFileReader::ChunkedFileReader() { }
+
+ChunkedFileReader::~ChunkedFileReader() {
+  Close();
+}
+
+int ChunkedFileReader::Open(const string &path) {
+  if (fd_ >= 0) {
+    return -1;
+  }
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    return -1;
+  }
+  struct stat st;
+  char header[ChunkedFile::kHeaderSize];
+  if (fstat(fd_, &st) < 0 ||
+      PreadWhole(fd_, header, ChunkedFile::kHeaderSize, 0) < 0 ||
+      memcmp(header, kMagic, kMagicSize) != 0) {
+    Close();
+    return -1;
+  }
+  const uint64_t file_size = st.st_size;
+
+  uint64_t offset = kMagicSize;
+  const uint32_t version = GetU32(header, &offset);
+  chunk_size_ = GetU32(header, &offset);
+  total_size_ = GetU64(header, &offset);
+  const uint64_t num_chunks = GetU64(header, &offset);
+  const uint64_t index_offset = GetU64(header, &offset);
+  // Written so that none of the checks can overflow on a corrupt header.
+  if (version != kVersion || chunk_size_ == 0 ||
+      num_chunks != (total_size_ / chunk_size_) +
+        (total_size_ % chunk_size_ != 0) ||
+      index_offset > file_size ||
+      num_chunks > (file_size - index_offset) / kIndexEntrySize) {
+    Close();
+    return -1;
+  }
+
+  vector<char> index(num_chunks * kIndexEntrySize);
+  if (PreadWhole(fd_, index.data(), index.size(), index_offset) < 0) {
+    Close();
+    return -1;
+  }
+  index_.resize(num_chunks);
+  offset = 0;
+  for (IndexEntry &e : index_) {
+    e.offset = GetU64(index.data(), &offset);
+    e.length = GetU32(index.data(), &offset);
+    e.type = GetU32(index.data(), &offset);
+    if (e.offset > index_offset || e.length > index_offset - e.offset ||
+        e.length > chunk_size_ ||
+        e.type > ChunkedFile::kZlibChunk) {
+      Close();
+      return -1;
+    }
+  }
+  compressed_.resize(chunk_size_);
+  scratch_.resize(chunk_size_);
+  return 0;
+}
+
+void ChunkedFileReader::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = -1;
+  index_.clear();
+}
+
+uint64_t ChunkedFileReader::GetSize() const {
+  return total_size_;
+}
+
+unsigned int ChunkedFileReader::GetChunkSize() const {
+  return chunk_size_;
+}
+
+uint64_t ChunkedFileReader::GetNumChunks() const {
+  return index_.size();
+}
+
+bool ChunkedFileReader::IsHole(uint64_t chunk) const {
+  return chunk < index_.size() &&
+    index_.at(chunk).type == ChunkedFile::kHoleChunk;
+}
+
+int64_t ChunkedFileReader::ReadChunk(uint64_t chunk, char *buf) {
+  if (fd_ < 0 || chunk >= index_.size()) {
+    return -1;
+  }
+  const IndexEntry &e = index_.at(chunk);
+  const uint64_t start = chunk * chunk_size_;
+  const uint64_t chunk_len = min((uint64_t) chunk_size_, total_size_ - start);
+
+  switch (e.type) {
+    case ChunkedFile::kHoleChunk:
+      memset(buf, 0, chunk_len);
+      break;
+    case ChunkedFile::kRawChunk:
+      if (e.length != chunk_len ||
+          PreadWhole(fd_, buf, chunk_len, e.offset) < 0) {
+        return -1;
+      }
+      break;
+    case ChunkedFile::kZlibChunk: {
+      if (PreadWhole(fd_, (char *) compressed_.data(), e.length, e.offset)
+          < 0) {
+        return -1;
+      }
+      uLongf out_len = chunk_len;
+      if (uncompress((Bytef *) buf, &out_len, compressed_.data(), e.length)
+          != Z_OK || out_len != chunk_len) {
+        return -1;
+      }
+      break;
+    }
+    default:
+      return -1;
+  }
+  return chunk_len;
+}
+
+int ChunkedFileReader::Read(uint64_t offset, char *buf, uint64_t len) {
+  if (fd_ < 0 || offset > total_size_ || len > total_size_ - offset) {
+    return -1;
+  }
+  while (len > 0) {
+    const uint64_t chunk = offset / chunk_size_;
+    const uint64_t chunk_off = offset % chunk_size_;
+    const uint64_t to_copy = min((uint64_t) chunk_size_ - chunk_off, len);
+    if (chunk_off == 0 && to_copy == chunk_size_) {
+      // Whole chunk, decompress straight into the caller's buffer.
+      if (ReadChunk(chunk, buf) < 0) {
+        return -1;
+      }
+    } else {
+      if (ReadChunk(chunk, scratch_.data()) < 0) {
+        return -1;
+      }
+      memcpy(buf, scratch_.data() + chunk_off, to_copy);
+    }
+    buf += to_copy;
+    offset += to_copy;
+    len -= to_copy;
+  }
+  return 0;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
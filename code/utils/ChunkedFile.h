@@ -0,0 +1,133 @@
+#ifndef UTILS_CHUNKED_FILE_H
+#define UTILS_CHUNKED_FILE_H
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Container format for large artifacts (saved profiles and disk snapshots)
+ * that compresses its contents in independent, fixed-size chunks. Because
+ * every chunk is compressed on its own, any byte range of the original data can
+ * be read back by decompressing only the chunks that cover it. Chunks that are
+ * entirely zero are not stored at all and are recorded as holes in the index.
+ *
+ * The layout of a chunked file is as follows:
+ *    * header (see kHeaderSize and the comments in ChunkedFile.cpp)
+ *    * compressed chunks, back to back, in order
+ *    * index, one entry per chunk giving its file offset, stored length, and
+ *      how it is stored (hole, raw, or compressed)
+ *
+ * All multi-byte fields outside the chunk data use big endian encoding.
+ */
+class ChunkedFile {
+ public:
+  static const unsigned int kHeaderSize = 40;
+  static const unsigned int kDefaultChunkSize = 64 * 1024;
+
+  enum ChunkType {
+    kHoleChunk = 0,   // All zeros, nothing stored.
+    kRawChunk,        // Stored uncompressed because compression didn't help.
+    kZlibChunk,       // Stored compressed with zlib.
+  };
+
+  /*
+   * Returns true if the file at the given path starts with a chunked file
+   * header.
+   */
+  static bool IsChunkedFile(const std::string &path);
+};
+
+/*
+ * Streams data into a new chunked file. Data passed to Append is buffered until
+ * a whole chunk is available, so callers can append in whatever sizes are
+ * convenient. Close must be called to flush the final chunk and the index.
+ */
+class ChunkedFileWriter {
+ public:
+  ChunkedFileWriter(unsigned int chunk_size = ChunkedFile::kDefaultChunkSize);
+  ~ChunkedFileWriter();
+
+  /*
+   * All of the below return 0 on success, a value < 0 on failure.
+   */
+  int Open(const std::string &path);
+  int Append(const char *data, uint64_t size);
+  int Close();
+
+ private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t type;
+  };
+
+  int FlushChunk();
+  int WriteWhole(const char *data, uint64_t size);
+
+  const unsigned int chunk_size_;
+  int fd_ = -1;
+  uint64_t file_offset_ = 0;
+  uint64_t total_size_ = 0;
+  std::vector<char> chunk_;
+  std::vector<unsigned char> compressed_;
+  std::vector<IndexEntry> index_;
+};
+
+/*
+ * Random access reader for a chunked file.
+ */
+class ChunkedFileReader {
+ public:
+  ChunkedFileReader();
+  ~ChunkedFileReader();
+
+  /*
+   * Returns 0 on success, a value < 0 on failure (including if the file is not
+   * a chunked file).
+   */
+  int Open(const std::string &path);
+  void Close();
+
+  // Size of the original, uncompressed data.
+  uint64_t GetSize() const;
+  unsigned int GetChunkSize() const;
+  uint64_t GetNumChunks() const;
+  bool IsHole(uint64_t chunk) const;
+
+  /*
+   * Decompress a single chunk into buf, which must hold at least
+   * GetChunkSize() bytes. Returns the number of bytes in the chunk (the final
+   * chunk may be short) or a value < 0 on failure.
+   */
+  int64_t ReadChunk(uint64_t chunk, char *buf);
+
+  /*
+   * Read len bytes of the original data starting at offset into buf. Returns 0
+   * on success, a value < 0 on failure.
+   */
+  int Read(uint64_t offset, char *buf, uint64_t len);
+
+ private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t type;
+  };
+
+  int fd_ = -1;
+  unsigned int chunk_size_ = 0;
+  uint64_t total_size_ = 0;
+  std::vector<IndexEntry> index_;
+  std::vector<unsigned char> compressed_;
+  std::vector<char> scratch_;
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_CHUNKED_FILE_H
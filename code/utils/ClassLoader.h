@@ -26,9 +26,12 @@ class ClassLoader {
   // loaded classes to having a default constructor. Then the class must also
   // provide a method to load data if needed, but that seems like the cleanest
   // solution here...
-  template<typename F>
+  //
+  // Any trailing args are passed to the factory, which lets a single shared
+  // object hold several classes that the factory picks between by name.
+  template<typename F, typename... Args>
   int load_class(const char *path, const char *factory_name,
-      const char *defactory_name) {
+      const char *defactory_name, Args... args) {
     const char* dl_error = NULL;
 
     loader_handle = dlopen(path, RTLD_LAZY);
@@ -59,7 +62,16 @@ class ClassLoader {
       loader_handle = NULL;
       return CASE_DEST_ERR;
     }
-    instance = ((F)(factory))();
+    instance = ((F)(factory))(args...);
+    if (instance == NULL) {
+      std::cerr << "Factory method in " << path << " returned no instance"
+        << std::endl;
+      dlclose(loader_handle);
+      factory = NULL;
+      defactory = NULL;
+      loader_handle = NULL;
+      return CASE_INIT_ERR;
+    }
     return SUCCESS;
   };
 
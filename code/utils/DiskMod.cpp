@@ -2,7 +2,12 @@
 
 #include <assert.h>
 #include <endian.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
 
 namespace fs_testing {
 namespace utils {
@@ -10,6 +15,98 @@ namespace utils {
 using std::shared_ptr;
 using std::vector;
 
+namespace {
+
+static const uint8_t kDirectoryModFlag = 1 << 0;
+static const uint8_t kDataHashedFlag = 1 << 1;
+
+// 64-bit FNV-1a parameters. Data is mixed in a word at a time instead of a byte
+// at a time since this runs over every byte a workload writes.
+static const uint64_t kHashOffsetBasis = 0xcbf29ce484222325ULL;
+static const uint64_t kHashPrime = 0x100000001b3ULL;
+
+/*
+ * Mods that record the offset and length of a range in a file, but no data
+ * for it.
+ */
+bool IsRangeOnly(const DiskMod &dm) {
+  return dm.mod_type == DiskMod::kSyncFileRangeMod ||
+      dm.mod_opts == DiskMod::kFallocateOpt ||
+      dm.mod_opts == DiskMod::kFallocateKeepSizeOpt ||
+      dm.mod_opts == DiskMod::kPunchHoleKeepSizeOpt ||
+      dm.mod_opts == DiskMod::kCollapseRangeOpt ||
+      dm.mod_opts == DiskMod::kZeroRangeOpt ||
+      dm.mod_opts == DiskMod::kZeroRangeKeepSizeOpt ||
+      dm.mod_opts == DiskMod::kInsertRangeOpt;
+}
+
+int WritevWhole(const int fd, struct iovec *iov, int iov_cnt) {
+  while (iov_cnt > 0) {
+    ssize_t res = writev(fd, iov, iov_cnt);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    // Skip past everything that was written.
+    while (iov_cnt > 0 && (size_t) res >= iov->iov_len) {
+      res -= iov->iov_len;
+      ++iov;
+      --iov_cnt;
+    }
+    if (iov_cnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + res;
+      iov->iov_len -= res;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+uint64_t DiskMod::HashData(const char *data, const uint64_t len) {
+  uint64_t hash = kHashOffsetBasis;
+  uint64_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(uint64_t));
+    hash = (hash ^ word) * kHashPrime;
+  }
+  for (; i < len; ++i) {
+    hash = (hash ^ (uint8_t) data[i]) * kHashPrime;
+  }
+  return hash;
+}
+
+uint64_t DiskMod::GetSerializedSize(const char *data) {
+  uint64_t size;
+  memcpy(&size, data, sizeof(uint64_t));
+  return be64toh(size);
+}
+
+DiskMod::ModType DiskMod::GetSerializedType(const char *data) {
+  uint16_t mod_type;
+  memcpy(&mod_type, data + sizeof(uint64_t), sizeof(uint16_t));
+  return (DiskMod::ModType) be16toh(mod_type);
+}
+
+bool DiskMod::HasSerializedData() {
+  if (mod_type == DiskMod::kCheckpointMod || mod_type == DiskMod::kSyncMod ||
+      mod_type == DiskMod::kFsyncMod || mod_type == DiskMod::kRemoveMod ||
+      mod_type == DiskMod::kCreateMod) {
+    return false;
+  }
+  return !directory_mod && !IsRangeOnly(*this);
+}
+
+uint64_t DiskMod::GetSerializedDataSize() {
+  if (HasSerializedData() && !file_mod_data_hashed) {
+    return file_mod_len;
+  }
+  return 0;
+}
+
 uint64_t DiskMod::GetSerializeSize() {
   // mod_type, mod_opts, and a uint64_t for the size of the serialized mod.
   uint64_t res = (2 * sizeof(uint16_t)) + sizeof(uint64_t);
@@ -28,24 +125,20 @@ uint64_t DiskMod::GetSerializeSize() {
     return res;
   }
 
-  if (mod_type == DiskMod::kSyncFileRangeMod ||
-      mod_opts == DiskMod::kFallocateOpt ||
-      mod_opts == DiskMod::kFallocateKeepSizeOpt ||
-      mod_opts == DiskMod::kPunchHoleKeepSizeOpt ||
-      mod_opts == DiskMod::kCollapseRangeOpt ||
-      mod_opts == DiskMod::kZeroRangeOpt ||
-      mod_opts == DiskMod::kZeroRangeKeepSizeOpt ||
-      mod_opts == DiskMod::kInsertRangeOpt) {
+  if (IsRangeOnly(*this)) {
     // Do not contain the data for the range, just the offset and length.
     res += 2 * sizeof(uint64_t);
     return res;
   }
-  
+
   if (directory_mod) {
     res += directory_added_entry.size() + 1;  // Path changed in directory.
   } else {
     // Data changed, location of change, length of change.
     res += 2 * sizeof(uint64_t);
+    if (file_mod_data_hashed) {
+      return res + (GetNumDigests(file_mod_len) * sizeof(uint64_t));
+    }
     return res + file_mod_len;
   }
 
@@ -59,11 +152,12 @@ uint64_t DiskMod::GetSerializeSize() {
  *    * uint16_t mod_opts
  *    ~~~~~~~~~~~~~~~~~~~~    <-- End of entry if kCheckpointMod.
  *    * null-terminated string for path the mod refers to (ex. file path)
- *    * 1-byte directory_mod boolean
+ *    * 1-byte flags, bit 0 is directory_mod, bit 1 is file_mod_data_hashed
  *    ~~~~~~~~~~~~~~~~~~~~    <-- End of ChangeHeader function data.
  *    * uint64_t file_mod_location
  *    * uint64_t file_mod_len
- *    * <file_mod_len>-bytes of file mod data
+ *    * <file_mod_len>-bytes of file mod data, or if file_mod_data_hashed is
+ *      set, one uint64_t digest per kDigestBlockSize bytes of file mod data
  *
  * The final three lines of this layout are specific only to modifications on
  * files. Modifications to directories are not yet supported, though there are
@@ -94,51 +188,143 @@ shared_ptr<char> DiskMod::Serialize(DiskMod &dm, unsigned long long *size) {
     return res_ptr;
   }
 
+  const int res = SerializeMetadata(buf, mod_size, dm);
+  if (res < 0) {
+    return shared_ptr<char>(nullptr);
+  }
+
+  if (dm.HasSerializedData() && !dm.file_mod_data_hashed) {
+    // Add file_mod_data (non-null terminated).
+    memcpy(buf + res, dm.file_mod_data.get(), dm.file_mod_len);
+  }
+
+  return res_ptr;
+}
+
+int DiskMod::SerializeToFd(const int fd, DiskMod &dm, const char *data) {
+  // Only the (small) front of the mod is built in memory. The file data is
+  // written directly from wherever it already lives.
+  vector<char> buf;
+  const int64_t data_size = AppendSerializedMetadata(buf, dm);
+  if (data_size < 0) {
+    return -1;
+  }
+  if (data_size > 0 && data == NULL) {
+    data = dm.file_mod_data.get();
+  }
+  return FlushSerialized(fd, buf, data, data_size);
+}
+
+int DiskMod::SerializeAllToFd(const int fd, vector<DiskMod> &mods) {
+  // Size everything up front so that the metadata for all mods fits in one
+  // buffer that never moves while we point iovecs into it.
+  uint64_t metadata_size = 0;
+  for (DiskMod &dm : mods) {
+    metadata_size += dm.GetSerializeSize() - dm.GetSerializedDataSize();
+  }
+  vector<char> buf;
+  buf.reserve(metadata_size);
+
+  // Metadata of mods without file data is merged into a single iovec with the
+  // metadata of the mods around it.
+  vector<struct iovec> iov;
+  bool last_is_metadata = false;
+  for (DiskMod &dm : mods) {
+    const uint64_t start = buf.size();
+    const int64_t data_size = AppendSerializedMetadata(buf, dm);
+    if (data_size < 0) {
+      return -1;
+    }
+    if (last_is_metadata) {
+      iov.back().iov_len += buf.size() - start;
+    } else {
+      iov.push_back({buf.data() + start, buf.size() - start});
+    }
+    last_is_metadata = data_size == 0;
+    if (data_size > 0) {
+      iov.push_back({dm.file_mod_data.get(), (size_t) data_size});
+    }
+  }
+  assert(buf.size() == metadata_size);
+
+  for (uint64_t i = 0; i < iov.size(); i += IOV_MAX) {
+    const int iov_cnt = std::min((uint64_t) IOV_MAX, iov.size() - i);
+    if (WritevWhole(fd, iov.data() + i, iov_cnt) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int64_t DiskMod::AppendSerializedMetadata(vector<char> &buf, DiskMod &dm) {
+  const uint64_t mod_size = dm.GetSerializeSize();
+  const uint64_t data_size = dm.GetSerializedDataSize();
+  const uint64_t start = buf.size();
+  buf.resize(start + mod_size - data_size);
+  const int res = SerializeMetadata(buf.data() + start, mod_size, dm);
+  if (res < 0 || (uint64_t) res != mod_size - data_size) {
+    buf.resize(start);
+    return -1;
+  }
+  return data_size;
+}
+
+int DiskMod::FlushSerialized(const int fd, vector<char> &buf,
+    const char *data, const uint64_t data_size) {
+  struct iovec iov[2];
+  iov[0].iov_base = buf.data();
+  iov[0].iov_len = buf.size();
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = data_size;
+  const int res = WritevWhole(fd, iov, (data_size > 0) ? 2 : 1);
+  buf.clear();
+  return res;
+}
+
+int DiskMod::SerializeMetadata(char *buf, const uint64_t mod_size,
+    DiskMod &dm) {
   const uint64_t mod_size_be = htobe64(mod_size);
   memcpy(buf, &mod_size_be, sizeof(uint64_t));
   unsigned int buf_offset = sizeof(uint64_t);
 
   int res = SerializeHeader(buf, buf_offset, dm);
   if (res < 0) {
-    return shared_ptr<char>(nullptr);
+    return res;
   }
   buf_offset += res;
 
   // kCheckpointMod and kSyncMod don't need anything done after the type.
-  if (!(dm.mod_type == DiskMod::kCheckpointMod ||
-      dm.mod_type == DiskMod::kSyncMod)) {
-    res = SerializeChangeHeader(buf, buf_offset, dm);
-    if (res < 0) {
-      return shared_ptr<char>(nullptr);
-    }
+  if (dm.mod_type == DiskMod::kCheckpointMod ||
+      dm.mod_type == DiskMod::kSyncMod) {
+    return buf_offset;
+  }
 
-    if (dm.mod_type == DiskMod::kFsyncMod ||
-        dm.mod_type == DiskMod::kCreateMod) {
-      return res_ptr;
-    }
+  res = SerializeChangeHeader(buf, buf_offset, dm);
+  if (res < 0) {
+    return res;
+  }
+  buf_offset += res;
 
-    buf_offset += res;
-    if (dm.directory_mod) {
-      // We changed a directory, only put that down.
-      res = SerializeDirectoryMod(buf, buf_offset, dm);
-      if (res < 0) {
-        return shared_ptr<char>(nullptr);
-      }
-      buf_offset += res;
-    } else {
-      // TODO(ashmrtn): *Technically* fallocate and friends can be called on a
-      // directory file descriptor. The current code will not play well with
-      // that.
-      // We changed a file, only put that down.
-      res = SerializeDataRange(buf, buf_offset, dm);
-      if (res < 0) {
-        return shared_ptr<char>(nullptr);
-      }
-      buf_offset += res;
-    }
+  if (dm.mod_type == DiskMod::kFsyncMod ||
+      dm.mod_type == DiskMod::kRemoveMod ||
+      dm.mod_type == DiskMod::kCreateMod) {
+    return buf_offset;
   }
 
-  return res_ptr;
+  if (dm.directory_mod) {
+    // We changed a directory, only put that down.
+    res = SerializeDirectoryMod(buf, buf_offset, dm);
+  } else {
+    // TODO(ashmrtn): *Technically* fallocate and friends can be called on a
+    // directory file descriptor. The current code will not play well with
+    // that.
+    // We changed a file, only put that down.
+    res = SerializeDataRange(buf, buf_offset, dm);
+  }
+  if (res < 0) {
+    return res;
+  }
+  return buf_offset + res;
 }
 
 int DiskMod::SerializeHeader(char *buf, const unsigned int buf_offset,
@@ -163,9 +349,15 @@ int DiskMod::SerializeChangeHeader(char *buf,
   memcpy(buf, dm.path.c_str(), size);
   buf += size;
 
-  // Add directory_mod to buffer.
-  uint8_t mod_directory_mod = dm.directory_mod;
-  memcpy(buf, &mod_directory_mod, sizeof(uint8_t));
+  // Add directory_mod and whether the data is hashed to buffer.
+  uint8_t mod_flags = 0;
+  if (dm.directory_mod) {
+    mod_flags |= kDirectoryModFlag;
+  }
+  if (dm.file_mod_data_hashed) {
+    mod_flags |= kDataHashedFlag;
+  }
+  memcpy(buf, &mod_flags, sizeof(uint8_t));
 
   return size + sizeof(uint8_t);
 }
@@ -183,23 +375,26 @@ int DiskMod::SerializeDataRange(char *buf, const unsigned int buf_offset,
   memcpy(buf, &file_mod_len, sizeof(uint64_t));
   buf += sizeof(uint64_t);
 
-  if (dm.mod_type == DiskMod::kSyncFileRangeMod ||
-      dm.mod_opts == DiskMod::kFallocateOpt ||
-      dm.mod_opts == DiskMod::kFallocateKeepSizeOpt ||
-      dm.mod_opts == DiskMod::kPunchHoleKeepSizeOpt ||
-      dm.mod_opts == DiskMod::kCollapseRangeOpt ||
-      dm.mod_opts == DiskMod::kZeroRangeOpt ||
-      dm.mod_opts == DiskMod::kZeroRangeKeepSizeOpt ||
-      dm.mod_opts == DiskMod::kInsertRangeOpt) {
+  if (IsRangeOnly(dm)) {
     // kSyncFileRangeMod does not contain the data range, just the offset and
     // length.
     return 2 * sizeof(uint64_t);
   }
 
-  // Add file_mod_data (non-null terminated).
-  memcpy(buf, dm.file_mod_data.get(), dm.file_mod_len);
+  if (dm.file_mod_data_hashed) {
+    if (dm.file_mod_digests.size() != GetNumDigests(dm.file_mod_len)) {
+      return -1;
+    }
+    for (const uint64_t digest : dm.file_mod_digests) {
+      const uint64_t digest_be = htobe64(digest);
+      memcpy(buf, &digest_be, sizeof(uint64_t));
+      buf += sizeof(uint64_t);
+    }
+    return (2 + dm.file_mod_digests.size()) * sizeof(uint64_t);
+  }
 
-  return (2 * sizeof(uint64_t)) + dm.file_mod_len;
+  // The file data itself is added by the caller.
+  return 2 * sizeof(uint64_t);
 }
 
 int DiskMod::SerializeDirectoryMod(char *buf, const unsigned int buf_offset,
@@ -258,10 +453,13 @@ int DiskMod::Deserialize(shared_ptr<char> data, DiskMod &res) {
   // Move past the null terminating character.
   ++data_ptr;
 
-  res.directory_mod = (bool) data_ptr[0];
+  const uint8_t mod_flags = data_ptr[0];
+  res.directory_mod = !!(mod_flags & kDirectoryModFlag);
+  res.file_mod_data_hashed = !!(mod_flags & kDataHashedFlag);
   ++data_ptr;
 
   if (res.mod_type == DiskMod::kFsyncMod ||
+      res.mod_type == DiskMod::kRemoveMod ||
       res.mod_type == DiskMod::kCreateMod) {
     return 0;
   }
@@ -280,30 +478,49 @@ int DiskMod::Deserialize(shared_ptr<char> data, DiskMod &res) {
 
   // Some mods have file length and location, but no actual data associated with
   // them.
-  if (res.mod_type == DiskMod::kSyncFileRangeMod ||
-      res.mod_opts == DiskMod::kFallocateOpt ||
-      res.mod_opts == DiskMod::kFallocateKeepSizeOpt ||
-      res.mod_opts == DiskMod::kPunchHoleKeepSizeOpt ||
-      res.mod_opts == DiskMod::kCollapseRangeOpt ||
-      res.mod_opts == DiskMod::kZeroRangeOpt ||
-      res.mod_opts == DiskMod::kZeroRangeKeepSizeOpt ||
-      res.mod_opts == DiskMod::kInsertRangeOpt) {
+  if (IsRangeOnly(res)) {
     return 0;
   }
 
-  if (res.file_mod_len > 0) {
-    // Read the data for this mod.
-    res.file_mod_data.reset(new (std::nothrow) char[res.file_mod_len],
-        [](char *c) {delete[] c;});
-    if (res.file_mod_data.get() == nullptr) {
-      return -1;
+  if (res.file_mod_data_hashed) {
+    const uint64_t num_digests = GetNumDigests(res.file_mod_len);
+    res.file_mod_digests.resize(num_digests);
+    for (uint64_t i = 0; i < num_digests; ++i) {
+      uint64_t digest;
+      memcpy(&digest, data_ptr, sizeof(uint64_t));
+      data_ptr += sizeof(uint64_t);
+      res.file_mod_digests.at(i) = be64toh(digest);
     }
-    memcpy(res.file_mod_data.get(), data_ptr, res.file_mod_len);
+  } else if (res.file_mod_len > 0) {
+    // Point at the data for this mod instead of copying it out. Shares
+    // ownership of whatever buffer data is part of.
+    res.file_mod_data = shared_ptr<char>(data, data_ptr);
   }
 
   return 0;
 }
 
+int DiskMod::SplitSerialized(shared_ptr<char> data, const uint64_t size,
+    vector<shared_ptr<char>> &res) {
+  // Size of the smallest possible DiskMod (kCheckpointMod).
+  const uint64_t min_mod_size = sizeof(uint64_t) + (2 * sizeof(uint16_t));
+  uint64_t offset = 0;
+  while (offset < size) {
+    if (size - offset < min_mod_size) {
+      return -1;
+    }
+    const uint64_t mod_size = GetSerializedSize(data.get() + offset);
+    if (mod_size < min_mod_size || mod_size > size - offset) {
+      // We shouldn't find a size for a DiskMod without the rest of the
+      // DiskMod.
+      return -1;
+    }
+    res.push_back(shared_ptr<char>(data, data.get() + offset));
+    offset += mod_size;
+  }
+  return 0;
+}
+
 DiskMod::DiskMod() {
   Reset();
 }
@@ -317,8 +534,61 @@ void DiskMod::Reset() {
   file_mod_data.reset();
   file_mod_location = 0;
   file_mod_len = 0;
+  file_mod_data_hashed = false;
+  file_mod_digests.clear();
   directory_added_entry.clear();
 }
 
+void DiskMod::SetDigests(const char *data) {
+  file_mod_data.reset();
+  file_mod_data_hashed = true;
+  file_mod_digests.resize(GetNumDigests(file_mod_len));
+  for (uint64_t i = 0; i < file_mod_digests.size(); ++i) {
+    const uint64_t offset = i * kDigestBlockSize;
+    const uint64_t len = std::min((uint64_t) kDigestBlockSize,
+        file_mod_len - offset);
+    file_mod_digests.at(i) = HashData(data + offset, len);
+  }
+}
+
+uint64_t DiskMod::GetNumDigests(const uint64_t len) {
+  return (len + kDigestBlockSize - 1) / kDigestBlockSize;
+}
+
+bool DiskMod::HasFileData() const {
+  return (mod_type == kDataMod || mod_type == kDataMetadataMod) &&
+    !directory_mod && file_mod_len > 0 &&
+    (file_mod_data_hashed || file_mod_data != nullptr);
+}
+
+bool DiskMod::MayChangeFileRange(const std::string &file_path,
+    const uint64_t offset, const uint64_t len) const {
+  if (path != file_path) {
+    return false;
+  }
+
+  switch (mod_type) {
+    case kCreateMod:
+    case kRemoveMod:
+      return true;
+    case kDataMod:
+    case kDataMetadataMod:
+    case kDataMmapMod:
+      break;
+    default:
+      return false;
+  }
+
+  switch (mod_opts) {
+    case kTruncateOpt:
+    case kCollapseRangeOpt:
+    case kInsertRangeOpt:
+      return true;
+    default:
+      return file_mod_location < offset + len &&
+        offset < file_mod_location + file_mod_len;
+  }
+}
+
 }  // namespace utils
 }  // namespace fs_testing
@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cstdint>
+
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,12 +23,57 @@ class DiskMod {
    */
   static std::shared_ptr<char> Serialize(DiskMod &dm, unsigned long long *size);
 
+  /*
+   * Serialize a single DiskMod straight to fd with writev. If data is not NULL,
+   * it is used as the file data for the mod in place of file_mod_data so that
+   * callers don't need to make a copy of data they already have. Returns 0 on
+   * success, a value < 0 on failure.
+   */
+  static int SerializeToFd(const int fd, DiskMod &dm,
+      const char *data = NULL);
+
+  /*
+   * Serialize all of mods straight to fd. The metadata of every mod is laid out
+   * in a single buffer and written, along with the file data of each mod, with
+   * as few writev calls as possible. Returns 0 on success, a value < 0 on
+   * failure.
+   */
+  static int SerializeAllToFd(const int fd, std::vector<DiskMod> &mods);
+
+  /*
+   * Append everything but the file data of dm in serialized form to buf.
+   * Returns the number of bytes of file data that must follow in the
+   * serialized form of dm, or a value < 0 on failure.
+   */
+  static int64_t AppendSerializedMetadata(std::vector<char> &buf,
+      DiskMod &dm);
+
+  /*
+   * Write the serialized metadata in buf followed by data_size bytes of file
+   * data to fd with a single writev and clear buf. This lets callers batch the
+   * metadata of several mods together with the data of the last one. Returns 0
+   * on success, a value < 0 on failure.
+   */
+  static int FlushSerialized(const int fd, std::vector<char> &buf,
+      const char *data, const uint64_t data_size);
+
   /*
    * Deserialize a single DiskMod. Returns 0 on success, a value < 0 on failure.
    * On success, the DiskMod res is also populated with the deserialized values.
+   * The file_mod_data of res points into data instead of being copied out of
+   * it, so data may be (part of) a larger buffer like an mmap-ed change file.
    */
   static int Deserialize(std::shared_ptr<char> data, DiskMod &res);
 
+  /*
+   * Find each of the back to back serialized DiskMods in the size bytes at
+   * data and append a pointer to the start of each to res. The pointers share
+   * ownership of data, and can be passed to Deserialize later. Returns 0 on
+   * success, a value < 0 if data does not hold whole DiskMods.
+   */
+  static int SplitSerialized(std::shared_ptr<char> data, const uint64_t size,
+      std::vector<std::shared_ptr<char>> &res);
+
   enum ModType {
     // Changes to directories are implicitly tracked by noting which mods are
     // kCreateMod mods. Since kCreateMod means a new file or directory was made,
@@ -66,6 +113,26 @@ class DiskMod {
     kMsSyncOpt,             // Waits for sync to complete so ok.
   };
 
+  /*
+   * Returns the size and type of the serialized DiskMod at data without
+   * deserializing the rest of it.
+   */
+  static uint64_t GetSerializedSize(const char *data);
+  static ModType GetSerializedType(const char *data);
+
+  /*
+   * Returns the digest of len bytes of data. Each entry of file_mod_digests is
+   * HashData run over one kDigestBlockSize slice of the written data (the last
+   * slice may be short).
+   */
+  static uint64_t HashData(const char *data, const uint64_t len);
+
+  // Granularity of the digests kept for a write in place of its data.
+  static const unsigned int kDigestBlockSize = 4096;
+  // Writes of at most this many bytes always keep their data inline since the
+  // digests would save little space.
+  static const unsigned int kInlineDataThreshold = 512;
+
   std::string path;
   ModType mod_type;
   ModOpts mod_opts;
@@ -77,6 +144,11 @@ class DiskMod {
   std::shared_ptr<char> file_mod_data;
   uint64_t file_mod_location;
   uint64_t file_mod_len;
+  // If set, only per-block digests of the file data (plus file_mod_len) are
+  // kept instead of the data itself. This keeps change logs for write heavy
+  // workloads small when nothing needs the written data back.
+  bool file_mod_data_hashed;
+  std::vector<uint64_t> file_mod_digests;
   std::string directory_added_entry;
 
   DiskMod();
@@ -86,12 +158,57 @@ class DiskMod {
    */
   void Reset();
 
+  /*
+   * Replace the file data of this DiskMod with digests of the file_mod_len
+   * bytes at data and mark it as hashed.
+   */
+  void SetDigests(const char *data);
+
+  /*
+   * Returns the number of digests kept for len bytes of file data.
+   */
+  static uint64_t GetNumDigests(const uint64_t len);
+
+  /*
+   * Returns true if this mod is a write that kept its file data, or digests of
+   * it, so that what it wrote can be checked later.
+   */
+  bool HasFileData() const;
+
+  /*
+   * Returns true if this mod may have changed any of the len bytes at offset in
+   * the file at file_path. Mods that can move or drop data anywhere in the file
+   * (ex. truncate, collapse range, remove) count as changing all of it.
+   */
+  bool MayChangeFileRange(const std::string &file_path, const uint64_t offset,
+      const uint64_t len) const;
+
  private:
   /*
    * Returns the number of bytes in the DiskMod in serialized form.
    */
   uint64_t GetSerializeSize();
 
+  /*
+   * Returns true if the serialized form of this DiskMod ends with
+   * file_mod_len bytes of file data.
+   */
+  bool HasSerializedData();
+
+  /*
+   * Returns the number of bytes of file data at the end of the serialized form
+   * of this DiskMod.
+   */
+  uint64_t GetSerializedDataSize();
+
+  /*
+   * Serialize everything but the file data at the end of the DiskMod (if any)
+   * into buf. Returns the number of bytes written to buf or a value < 0 on
+   * failure.
+   */
+  static int SerializeMetadata(char *buf, const uint64_t mod_size,
+      DiskMod &dm);
+
   /*
    * Serialize various parts of a DiskMod. The SerializeHeader method only
    * serializes the mod_type and mod_opts fields as that is the only thing
@@ -0,0 +1,287 @@
+#include <inttypes.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include "PhaseTrace.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::endl;
+using std::ofstream;
+using std::ostream;
+using std::string;
+
+namespace {
+
+// Values below kSubBuckets are recorded exactly. Each power of 2 above that is
+// split into kSubBuckets / 2 buckets.
+const unsigned int kSubBucketBits = 8;
+const uint64_t kSubBuckets = 1 << kSubBucketBits;
+const uint64_t kHalfSubBuckets = kSubBuckets / 2;
+const unsigned int kNumBuckets =
+  kSubBuckets + (64 - kSubBucketBits) * kHalfSubBuckets;
+
+const double kNsPerMs = 1000000.0;
+
+const char * const kPhaseNames[] = {
+  "generate",
+  "restore",
+  "write",
+  "mount",
+  "fsck",
+  "check",
+  "umount",
+};
+
+// Prints ns as microseconds, which Chrome traces use, without losing
+// precision.
+void PrintMicros(ostream &os, const uint64_t ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+  os << buf;
+}
+
+}  // namespace
+
+/***************************** LatencyHistogram ******************************/
+LatencyHistogram::LatencyHistogram() : counts_(kNumBuckets, 0) { }
+
+unsigned int LatencyHistogram::BucketIndex(const uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+  // Shift value so it lands in the upper half of the sub-buckets.
+  const unsigned int shift =
+    63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+  return kSubBuckets + (shift - 1) * kHalfSubBuckets +
+    ((value >> shift) - kHalfSubBuckets);
+}
+
+uint64_t LatencyHistogram::BucketHighest(const unsigned int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  const unsigned int shift = (index - kSubBuckets) / kHalfSubBuckets + 1;
+  const uint64_t sub = (index - kSubBuckets) % kHalfSubBuckets +
+    kHalfSubBuckets;
+  // Wraps to UINT64_MAX for the very last bucket.
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(const uint64_t value) {
+  ++counts_[BucketIndex(value)];
+  ++total_;
+  if (value < min_) {
+    min_ = value;
+  }
+  if (value > max_) {
+    max_ = value;
+  }
+  sum_ += value;
+  sum_squares_ += (double) value * value;
+}
+
+void LatencyHistogram::Reset() {
+  counts_.assign(kNumBuckets, 0);
+  total_ = 0;
+  min_ = UINT64_MAX;
+  max_ = 0;
+  sum_ = 0;
+  sum_squares_ = 0;
+}
+
+uint64_t LatencyHistogram::Count() const {
+  return total_;
+}
+
+uint64_t LatencyHistogram::Min() const {
+  return (total_ == 0) ? 0 : min_;
+}
+
+uint64_t LatencyHistogram::Max() const {
+  return max_;
+}
+
+double LatencyHistogram::Mean() const {
+  return (total_ == 0) ? 0 : sum_ / total_;
+}
+
+uint64_t LatencyHistogram::ValueAtPercentile(const double percentile) const {
+  if (total_ == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t) std::ceil(percentile / 100.0 * total_);
+  if (target == 0) {
+    target = 1;
+  } else if (target > total_) {
+    target = total_;
+  }
+
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < kNumBuckets; ++i) {
+    seen += counts_[i];
+    if (seen >= target) {
+      const uint64_t highest = BucketHighest(i);
+      return (highest < max_) ? highest : max_;
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::PrintPercentiles(ostream &os,
+    const double unit_ratio) const {
+  char line[128];
+  snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n", "Value",
+      "Percentile", "TotalCount", "1/(1-Percentile)");
+  os << line;
+
+  uint64_t seen = 0;
+  unsigned int used_buckets = 0;
+  for (unsigned int i = 0; i < kNumBuckets; ++i) {
+    if (counts_[i] == 0) {
+      continue;
+    }
+    used_buckets = i + 1;
+    seen += counts_[i];
+    const uint64_t highest = BucketHighest(i);
+    const double value = ((highest < max_) ? highest : max_) / unit_ratio;
+    const double fraction = (double) seen / total_;
+    if (seen < total_) {
+      snprintf(line, sizeof(line), "%12.3f %2.12f %10" PRIu64 " %14.2f\n",
+          value, fraction, seen, 1 / (1 - fraction));
+    } else {
+      snprintf(line, sizeof(line), "%12.3f %2.12f %10" PRIu64 "\n",
+          value, fraction, seen);
+    }
+    os << line;
+  }
+
+  const double mean = Mean();
+  double variance = (total_ == 0) ? 0 : sum_squares_ / total_ - mean * mean;
+  if (variance < 0) {
+    variance = 0;
+  }
+  snprintf(line, sizeof(line),
+      "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+      mean / unit_ratio, std::sqrt(variance) / unit_ratio);
+  os << line;
+  snprintf(line, sizeof(line),
+      "#[Max     = %12.3f, Total count    = %12" PRIu64 "]\n",
+      max_ / unit_ratio, total_);
+  os << line;
+  snprintf(line, sizeof(line),
+      "#[Buckets = %12u, SubBuckets     = %12" PRIu64 "]\n",
+      used_buckets, kSubBuckets);
+  os << line;
+}
+
+/******************************** PhaseTrace *********************************/
+const char * PhaseTrace::PhaseName(const Phase phase) {
+  if (phase >= kNumPhases) {
+    return "unknown";
+  }
+  return kPhaseNames[phase];
+}
+
+PhaseTrace::PhaseTrace() : origin_(steady_clock::now()) { }
+
+void PhaseTrace::SetCapacity(const size_t capacity) {
+  spans_.clear();
+  spans_.shrink_to_fit();
+  spans_.resize(capacity);
+  next_span_ = 0;
+  num_recorded_ = 0;
+}
+
+void PhaseTrace::Reset() {
+  origin_ = steady_clock::now();
+  next_span_ = 0;
+  num_recorded_ = 0;
+  for (LatencyHistogram &histogram : histograms_) {
+    histogram.Reset();
+  }
+}
+
+void PhaseTrace::Record(const Phase phase, const unsigned int crash_state,
+    const steady_clock::time_point start, const steady_clock::time_point end) {
+  const uint64_t duration = duration_cast<nanoseconds>(end - start).count();
+  histograms_[phase].Record(duration);
+
+  if (spans_.empty()) {
+    return;
+  }
+  Span &span = spans_[next_span_];
+  span.start = (start < origin_) ?
+    0 : duration_cast<nanoseconds>(start - origin_).count();
+  span.duration = duration;
+  span.crash_state = crash_state;
+  span.phase = phase;
+  next_span_ = (next_span_ + 1) % spans_.size();
+  ++num_recorded_;
+}
+
+const LatencyHistogram & PhaseTrace::GetHistogram(const Phase phase) const {
+  return histograms_[phase];
+}
+
+size_t PhaseTrace::NumSpans() const {
+  return (num_recorded_ < spans_.size()) ? num_recorded_ : spans_.size();
+}
+
+uint64_t PhaseTrace::NumDropped() const {
+  return num_recorded_ - NumSpans();
+}
+
+int PhaseTrace::WriteChromeTrace(const string &path) const {
+  ofstream out(path, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    return -1;
+  }
+  out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_spans\":"
+    << NumDropped() << "},\"traceEvents\":[" << endl;
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+    << "\"args\":{\"name\":\"c_harness\"}}";
+
+  // Once the ring buffer wraps, the oldest span is the next one to overwrite.
+  const size_t num_spans = NumSpans();
+  const size_t first = (num_recorded_ > spans_.size()) ? next_span_ : 0;
+  for (size_t i = 0; i < num_spans; ++i) {
+    const Span &span = spans_[(first + i) % spans_.size()];
+    out << "," << endl << "{\"name\":\"" << PhaseName((Phase) span.phase)
+      << "\",\"cat\":\"crash_state\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":";
+    PrintMicros(out, span.start);
+    out << ",\"dur\":";
+    PrintMicros(out, span.duration);
+    out << ",\"args\":{\"crash_state\":" << span.crash_state << "}}";
+  }
+  out << endl << "]}" << endl;
+
+  out.close();
+  return out.fail() ? -1 : 0;
+}
+
+int PhaseTrace::WriteHistograms(const string &path_prefix) const {
+  for (unsigned int i = 0; i < kNumPhases; ++i) {
+    const string path =
+      path_prefix + "." + PhaseName((Phase) i) + ".hgrm";
+    ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+      return -1;
+    }
+    histograms_[i].PrintPercentiles(out, kNsPerMs);
+    out.close();
+    if (out.fail()) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
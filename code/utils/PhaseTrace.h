@@ -0,0 +1,133 @@
+#ifndef UTILS_PHASE_TRACE_H
+#define UTILS_PHASE_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Latency histogram laid out like HdrHistogram with 2 significant digits:
+ * values below 256 get a bucket each, and every power of 2 above that is split
+ * into 128 equal buckets, so any recorded value is known to within 1%. Memory
+ * use is fixed no matter how many values are recorded.
+ */
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Record(const uint64_t value);
+  void Reset();
+
+  uint64_t Count() const;
+  uint64_t Min() const;
+  uint64_t Max() const;
+  double Mean() const;
+
+  /*
+   * Returns the largest value that can't be told apart from the value at or
+   * below which percentile percent of the recorded values fall. Returns 0 if
+   * nothing was recorded.
+   */
+  uint64_t ValueAtPercentile(const double percentile) const;
+
+  /*
+   * Prints the distribution in the percentile format HdrHistogram's tools
+   * produce and plot, with values divided by unit_ratio.
+   */
+  void PrintPercentiles(std::ostream &os, const double unit_ratio) const;
+
+ private:
+  static unsigned int BucketIndex(const uint64_t value);
+  static uint64_t BucketHighest(const unsigned int index);
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+  double sum_ = 0;
+  double sum_squares_ = 0;
+};
+
+/*
+ * Timings of the phases of testing each crash state. Every span recorded goes
+ * into a histogram for its phase. Spans are also kept, with when they started,
+ * in a ring buffer of fixed size so the most recent ones can be exported as a
+ * Chrome trace that chrome://tracing and Perfetto can open. The ring buffer is
+ * empty and nothing is kept in it unless SetCapacity is called.
+ */
+class PhaseTrace {
+ public:
+  enum Phase {
+    kGenerate,
+    kRestore,
+    kWrite,
+    kMount,
+    kFsck,
+    kCheck,
+    kUmount,
+    kNumPhases,
+  };
+
+  static const char * PhaseName(const Phase phase);
+
+  PhaseTrace();
+
+  /*
+   * Keep the last capacity spans recorded. Drops any spans already kept.
+   */
+  void SetCapacity(const size_t capacity);
+
+  /*
+   * Drop all spans and histogram data and start trace timestamps from now.
+   */
+  void Reset();
+
+  void Record(const Phase phase, const unsigned int crash_state,
+      const std::chrono::steady_clock::time_point start,
+      const std::chrono::steady_clock::time_point end);
+
+  const LatencyHistogram & GetHistogram(const Phase phase) const;
+  // Number of spans held in the ring buffer.
+  size_t NumSpans() const;
+  // Number of spans overwritten because the ring buffer was full.
+  uint64_t NumDropped() const;
+
+  /*
+   * Write the spans in the ring buffer, oldest first, as Chrome trace JSON.
+   * Return 0 on success, a value < 0 on failure.
+   */
+  int WriteChromeTrace(const std::string &path) const;
+
+  /*
+   * Write the histogram of each phase to <path_prefix>.<phase name>.hgrm in
+   * HdrHistogram's percentile format, with values in milliseconds. Return 0 on
+   * success, a value < 0 on failure.
+   */
+  int WriteHistograms(const std::string &path_prefix) const;
+
+ private:
+  struct Span {
+    // Nanoseconds since origin_.
+    uint64_t start;
+    uint64_t duration;
+    uint32_t crash_state;
+    uint32_t phase;
+  };
+
+  std::chrono::steady_clock::time_point origin_;
+  std::vector<Span> spans_;
+  size_t next_span_ = 0;
+  uint64_t num_recorded_ = 0;
+  LatencyHistogram histograms_[kNumPhases];
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_PHASE_TRACE_H
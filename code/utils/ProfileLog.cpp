@@ -0,0 +1,420 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "ChunkedFile.h"
+#include "ProfileLog.h"
+
+namespace fs_testing {
+namespace utils {
+
+using std::memcpy;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+static constexpr char kMagic[] = "CMPROFIL";
+static const unsigned int kMagicSize = 8;
+static const uint64_t kAllCheckpoints = UINT64_MAX;
+
+/*
+ * Header layout:
+ *    * 8-byte magic string (not null terminated)
+ *    * uint32_t format version
+ *    * uint32_t size of a single metadata table entry
+ *    * uint64_t number of log entries
+ *    * uint64_t file offset of the metadata table
+ *    * uint64_t file offset of the checkpoint index
+ *    * uint64_t number of entries in the checkpoint index
+ *    * uint64_t file offset of the data region
+ *    * uint64_t size of the data region
+ *
+ * Metadata table entry layout:
+ *    * uint64_t bi_flags
+ *    * uint64_t bi_rw
+ *    * uint64_t write_sector
+ *    * uint64_t size
+ *    * uint64_t time_ns
+ *    * uint64_t offset of this entry's data from the start of the data region
+ */
+struct Header {
+  uint32_t version;
+  uint32_t meta_entry_size;
+  uint64_t num_entries;
+  uint64_t meta_offset;
+  uint64_t index_offset;
+  uint64_t num_index_entries;
+  uint64_t data_offset;
+  uint64_t data_size;
+};
+
+void PutU64(char *buf, uint64_t *offset, const uint64_t val) {
+  const uint64_t be = htobe64(val);
+  memcpy(buf + *offset, &be, sizeof(uint64_t));
+  *offset += sizeof(uint64_t);
+}
+
+uint64_t GetU64(const char *buf, uint64_t *offset) {
+  uint64_t be;
+  memcpy(&be, buf + *offset, sizeof(uint64_t));
+  *offset += sizeof(uint64_t);
+  return be64toh(be);
+}
+
+void PutU32(char *buf, uint64_t *offset, const uint32_t val) {
+  const uint32_t be = htobe32(val);
+  memcpy(buf + *offset, &be, sizeof(uint32_t));
+  *offset += sizeof(uint32_t);
+}
+
+uint32_t GetU32(const char *buf, uint64_t *offset) {
+  uint32_t be;
+  memcpy(&be, buf + *offset, sizeof(uint32_t));
+  *offset += sizeof(uint32_t);
+  return be32toh(be);
+}
+
+int WriteWhole(const int fd, const char *data, const uint64_t size) {
+  uint64_t written = 0;
+  while (written < size) {
+    const ssize_t res = write(fd, data + written, size - written);
+    if (res < 0) {
+      return -1;
+    }
+    written += res;
+  }
+  return 0;
+}
+
+bool ReadHeader(const char *buf, Header &h) {
+  if (memcmp(buf, kMagic, kMagicSize) != 0) {
+    return false;
+  }
+  uint64_t offset = kMagicSize;
+  h.version = GetU32(buf, &offset);
+  h.meta_entry_size = GetU32(buf, &offset);
+  h.num_entries = GetU64(buf, &offset);
+  h.meta_offset = GetU64(buf, &offset);
+  h.index_offset = GetU64(buf, &offset);
+  h.num_index_entries = GetU64(buf, &offset);
+  h.data_offset = GetU64(buf, &offset);
+  h.data_size = GetU64(buf, &offset);
+  return true;
+}
+
+}  // namespace
+
+bool ProfileLog::IsProfileLog(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char magic[kMagicSize];
+  const ssize_t res = read(fd, magic, kMagicSize);
+  close(fd);
+  if (res == kMagicSize && memcmp(magic, kMagic, kMagicSize) == 0) {
+    return true;
+  }
+  // Compressed profiles are the only chunked files the harness writes in place
+  // of a profile.
+  return ChunkedFile::IsChunkedFile(path);
+}
+
+int ProfileLog::Save(const string &path, const vector<disk_write> &log,
+    const bool compress) {
+  // Lay out the header, metadata table, and index in memory first since they
+  // are small compared to the data region.
+  vector<uint64_t> checkpoints;
+  for (unsigned int i = 0; i < log.size(); ++i) {
+    if (log.at(i).metadata.bi_rw & HWM_CHECKPOINT_FLAG) {
+      checkpoints.push_back(i);
+    }
+  }
+
+  Header h;
+  h.version = kVersion;
+  h.meta_entry_size = kMetaEntrySize;
+  h.num_entries = log.size();
+  h.meta_offset = kHeaderSize;
+  h.index_offset = h.meta_offset + (h.num_entries * kMetaEntrySize);
+  h.num_index_entries = checkpoints.size();
+  const uint64_t index_end =
+    h.index_offset + (h.num_index_entries * sizeof(uint64_t));
+  h.data_offset =
+    (index_end + (kDataAlignment - 1)) & ~((uint64_t) kDataAlignment - 1);
+  h.data_size = 0;
+  for (const disk_write &dw : log) {
+    if (dw.metadata.size > 0 && dw.get_data() != NULL) {
+      h.data_size += dw.metadata.size;
+    }
+  }
+
+  vector<char> front(h.data_offset, 0);
+  char *buf = front.data();
+  memcpy(buf, kMagic, kMagicSize);
+  uint64_t offset = kMagicSize;
+  PutU32(buf, &offset, h.version);
+  PutU32(buf, &offset, h.meta_entry_size);
+  PutU64(buf, &offset, h.num_entries);
+  PutU64(buf, &offset, h.meta_offset);
+  PutU64(buf, &offset, h.index_offset);
+  PutU64(buf, &offset, h.num_index_entries);
+  PutU64(buf, &offset, h.data_offset);
+  PutU64(buf, &offset, h.data_size);
+
+  offset = h.meta_offset;
+  uint64_t data_pos = 0;
+  for (const disk_write &dw : log) {
+    const bool has_data = dw.metadata.size > 0 && dw.get_data() != NULL;
+    PutU64(buf, &offset, dw.metadata.bi_flags);
+    PutU64(buf, &offset, dw.metadata.bi_rw);
+    PutU64(buf, &offset, dw.metadata.write_sector);
+    PutU64(buf, &offset, dw.metadata.size);
+    PutU64(buf, &offset, dw.metadata.time_ns);
+    PutU64(buf, &offset, data_pos);
+    if (has_data) {
+      data_pos += dw.metadata.size;
+    }
+  }
+  for (const uint64_t cp : checkpoints) {
+    PutU64(buf, &offset, cp);
+  }
+
+  if (compress) {
+    // Same bytes as an uncompressed profile, just run through the chunked
+    // compressor. Loading inflates them back into memory.
+    ChunkedFileWriter writer;
+    if (writer.Open(path) < 0 || writer.Append(buf, front.size()) < 0) {
+      return -1;
+    }
+    for (const disk_write &dw : log) {
+      if (dw.metadata.size == 0 || dw.get_data() == NULL) {
+        continue;
+      }
+      if (writer.Append(dw.get_data(), dw.metadata.size) < 0) {
+        return -1;
+      }
+    }
+    return writer.Close();
+  }
+
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return -1;
+  }
+  if (WriteWhole(fd, buf, front.size()) < 0) {
+    close(fd);
+    return -1;
+  }
+  for (const disk_write &dw : log) {
+    if (dw.metadata.size == 0 || dw.get_data() == NULL) {
+      continue;
+    }
+    if (WriteWhole(fd, dw.get_data(), dw.metadata.size) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  return close(fd);
+}
+
+int ProfileLog::Load(const string &path, DiskWriteArena &arena,
+    vector<disk_write> &res, vector<uint64_t> *checkpoints) {
+  return LoadEntries(path, arena, 0, kAllCheckpoints, NULL, res, checkpoints);
+}
+
+int ProfileLog::LoadRange(const string &path, DiskWriteArena &arena,
+    const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+    vector<disk_write> &prefix, vector<disk_write> &res) {
+  if (first_checkpoint > last_checkpoint) {
+    return -1;
+  }
+  return LoadEntries(path, arena, first_checkpoint, last_checkpoint, &prefix,
+      res, NULL);
+}
+
+int ProfileLog::LoadEntries(const string &path, DiskWriteArena &arena,
+    const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+    vector<disk_write> *prefix, vector<disk_write> &res,
+    vector<uint64_t> *checkpoints) {
+  if (ChunkedFile::IsChunkedFile(path)) {
+    ChunkedFileReader reader;
+    if (reader.Open(path) < 0) {
+      return -1;
+    }
+    // Inflate everything before the data region first. Parse checks the rest
+    // of the header.
+    const uint64_t size = reader.GetSize();
+    char header[kHeaderSize];
+    Header h;
+    if (size < kHeaderSize || reader.Read(0, header, kHeaderSize) < 0 ||
+        !ReadHeader(header, h) || h.data_offset < kHeaderSize ||
+        h.data_offset > size) {
+      return -1;
+    }
+    std::unique_ptr<char[]> front(new (std::nothrow) char[h.data_offset]);
+    if (!front || reader.Read(0, front.get(), h.data_offset) < 0) {
+      return -1;
+    }
+
+    auto get_data = [&reader, &arena](const uint64_t start,
+        const uint64_t end) -> const char * {
+      // Always allocate something so entries get a valid pointer.
+      shared_ptr<char> data(new (std::nothrow) char[end - start + 1],
+          [](char *c) {delete[] c;});
+      if (!data || reader.Read(start, data.get(), end - start) < 0) {
+        return NULL;
+      }
+      arena.Adopt(data);
+      return data.get();
+    };
+    return Parse(front.get(), h.data_offset, size, get_data,
+        first_checkpoint, last_checkpoint, prefix, res, checkpoints);
+  }
+
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < kHeaderSize) {
+    close(fd);
+    return -1;
+  }
+  const uint64_t file_size = st.st_size;
+  void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file.
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  shared_ptr<char> contents((char *) map,
+      [file_size](char *c) {munmap(c, file_size);});
+
+  // The disk_writes we hand out point into the mapping, so it lives as long as
+  // the arena does.
+  auto get_data = [&contents, &arena](const uint64_t start,
+      const uint64_t) -> const char * {
+    arena.Adopt(contents);
+    return contents.get() + start;
+  };
+  return Parse(contents.get(), file_size, file_size, get_data,
+      first_checkpoint, last_checkpoint, prefix, res, checkpoints);
+}
+
+int ProfileLog::Parse(const char *front, const uint64_t front_size,
+    const uint64_t size,
+    const std::function<const char *(uint64_t, uint64_t)> &get_data,
+    const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+    vector<disk_write> *prefix, vector<disk_write> &res,
+    vector<uint64_t> *checkpoints) {
+  // Bounds are checked against the space left after each offset so that
+  // corrupt headers can't wrap the sums around. The metadata table and index
+  // have to be in front.
+  Header h;
+  if (front_size < kHeaderSize || front_size > size || !ReadHeader(front, h) ||
+      h.version != kVersion || h.meta_entry_size != kMetaEntrySize ||
+      h.meta_offset > front_size ||
+      h.num_entries > (front_size - h.meta_offset) / kMetaEntrySize ||
+      h.index_offset > front_size ||
+      h.num_index_entries > (front_size - h.index_offset) / sizeof(uint64_t) ||
+      h.data_offset > size ||
+      h.data_size > size - h.data_offset) {
+    return -1;
+  }
+
+  // Find the entries that make up the requested checkpoints. Loading from the
+  // first checkpoint always starts at the front of the log so that logs which
+  // don't start with a checkpoint still load whole.
+  uint64_t begin = 0;
+  uint64_t end = h.num_entries;
+  if (first_checkpoint > 0) {
+    if (first_checkpoint >= h.num_index_entries) {
+      return -1;
+    }
+    uint64_t offset = h.index_offset + (first_checkpoint * sizeof(uint64_t));
+    begin = GetU64(front, &offset);
+  }
+  if (h.num_index_entries > 0 &&
+      last_checkpoint < h.num_index_entries - 1) {
+    uint64_t offset =
+      h.index_offset + ((last_checkpoint + 1) * sizeof(uint64_t));
+    end = GetU64(front, &offset);
+  }
+  if (begin > end || end > h.num_entries) {
+    return -1;
+  }
+
+  // Read the metadata of the entries being loaded first so that only the part
+  // of the data region they cover has to be fetched.
+  const uint64_t first = (prefix == NULL) ? begin : 0;
+  vector<disk_write_op_meta> metas(end - first);
+  vector<uint64_t> data_pos(end - first);
+  uint64_t lo = h.data_size;
+  uint64_t hi = 0;
+  uint64_t offset = h.meta_offset + (first * kMetaEntrySize);
+  for (uint64_t i = 0; i < end - first; ++i) {
+    disk_write_op_meta &meta = metas.at(i);
+    meta.bi_flags = GetU64(front, &offset);
+    meta.bi_rw = GetU64(front, &offset);
+    meta.write_sector = GetU64(front, &offset);
+    meta.size = GetU64(front, &offset);
+    meta.time_ns = GetU64(front, &offset);
+    data_pos.at(i) = GetU64(front, &offset);
+    if (data_pos.at(i) > h.data_size ||
+        meta.size > h.data_size - data_pos.at(i)) {
+      return -1;
+    }
+    if (meta.size > 0) {
+      lo = std::min(lo, data_pos.at(i));
+      hi = std::max(hi, data_pos.at(i) + meta.size);
+    }
+  }
+  if (lo > hi) {
+    lo = hi = 0;
+  }
+
+  const char *data = get_data(h.data_offset + lo, h.data_offset + hi);
+  if (data == NULL) {
+    return -1;
+  }
+  if (prefix != NULL) {
+    prefix->reserve(prefix->size() + begin);
+  }
+  res.reserve(res.size() + (end - begin));
+  for (uint64_t i = first; i < end; ++i) {
+    vector<disk_write> &dest = (i < begin) ? *prefix : res;
+    const disk_write_op_meta &meta = metas.at(i - first);
+    // disk_write drops the pointer of entries without data.
+    dest.emplace_back(meta,
+        (meta.size > 0) ? data + (data_pos.at(i - first) - lo) : data);
+  }
+
+  if (checkpoints != NULL) {
+    offset = h.index_offset;
+    for (uint64_t i = 0; i < h.num_index_entries; ++i) {
+      checkpoints->push_back(GetU64(front, &offset));
+    }
+  }
+
+  return 0;
+}
+
+}  // namespace utils
+}  // namespace fs_testing
@@ -0,0 +1,123 @@
+#ifndef UTILS_PROFILE_LOG_H
+#define UTILS_PROFILE_LOG_H
+
+#include <cstdint>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace fs_testing {
+namespace utils {
+
+/*
+ * Reads and writes the v2 on-disk format for the bio log recorded during
+ * profiling (the "_profile" file).
+ *
+ * The v1 format, produced by disk_write::serialize, pads every log entry's
+ * metadata out to a full 4K block and rounds every entry's data up to a
+ * multiple of 4K. The v2 format instead stores the metadata of all log entries
+ * in a single packed table and all bio data in one contiguous, page-aligned
+ * region at the end of the file so that the file can be mmap-ed and the loaded
+ * disk_writes can point directly into the mapping.
+ *
+ * The layout of a v2 profile is as follows:
+ *    * header (see kHeaderSize and the comments in ProfileLog.cpp)
+ *    * packed metadata table, one kMetaEntrySize entry per log entry
+ *    * index, one uint64_t per checkpoint in the log giving the position of
+ *      that checkpoint in the metadata table
+ *    ~~~~~~~~~~~~~~~~~~~~    <-- Padding up to kDataAlignment.
+ *    * bio data for all log entries, back to back, in log order
+ *
+ * All multi-byte fields outside the data region use big endian encoding.
+ *
+ * A profile may also be saved compressed, in which case the bytes above are
+ * wrapped in a ChunkedFile. Compressed profiles can't be mmap-ed, so loading
+ * one inflates the front of the profile, then the data of the loaded entries
+ * into a heap buffer that they point into. Nothing else is held in memory.
+ */
+class ProfileLog {
+ public:
+  static const uint32_t kVersion = 2;
+  static const unsigned int kHeaderSize = 64;
+  static const unsigned int kMetaEntrySize = 6 * sizeof(uint64_t);
+  static const unsigned int kDataAlignment = 4096;
+
+  /*
+   * Returns true if the file at the given path starts with a v2 profile
+   * header or is a compressed v2 profile. Anything else is assumed to be a v1
+   * profile.
+   */
+  static bool IsProfileLog(const std::string &path);
+
+  /*
+   * Write the given log out to the given path, compressing it if compress is
+   * set. Returns 0 on success, a value < 0 on failure.
+   */
+  static int Save(const std::string &path,
+      const std::vector<disk_write> &log, const bool compress = false);
+
+  /*
+   * mmap the profile at the given path and append one disk_write per log entry
+   * to res. The data of each disk_write points into the mapping (or for
+   * compressed profiles, a buffer of the inflated data), which is handed to
+   * arena to keep alive. If checkpoints is not NULL, the index of
+   * checkpoint entries is also appended to it. Returns 0 on success, a value
+   * < 0 on failure.
+   */
+  static int Load(const std::string &path, DiskWriteArena &arena,
+      std::vector<disk_write> &res,
+      std::vector<uint64_t> *checkpoints = NULL);
+
+  /*
+   * Like Load, but use the checkpoint index to only load the part of the log
+   * from checkpoint first_checkpoint up to (but not including) checkpoint
+   * last_checkpoint + 1 into res. Checkpoints are numbered by their position
+   * in the index, which matches the number the workload passed to
+   * Checkpoint(). res starts with the entry for first_checkpoint itself so it
+   * looks like a whole log to the rest of the harness. Everything in the log
+   * before first_checkpoint is placed in prefix so that it can be applied to
+   * the base disk image. For compressed profiles, the data of entries after
+   * last_checkpoint is never inflated. Returns 0 on success, a value < 0 on
+   * failure (including if first_checkpoint is not in the log).
+   */
+  static int LoadRange(const std::string &path, DiskWriteArena &arena,
+      const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+      std::vector<disk_write> &prefix, std::vector<disk_write> &res);
+
+ private:
+  /*
+   * Load the entries of the profile at path from checkpoint first_checkpoint
+   * through checkpoint last_checkpoint into res and the entries before that
+   * into prefix (if not NULL). Uncompressed profiles are mmap-ed. Compressed
+   * ones are read through a ChunkedFileReader, so only the chunks holding the
+   * header, metadata table, index, and loaded data are inflated. Either way,
+   * the memory the loaded disk_writes point into is adopted by arena.
+   */
+  static int LoadEntries(const std::string &path, DiskWriteArena &arena,
+      const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+      std::vector<disk_write> *prefix, std::vector<disk_write> &res,
+      std::vector<uint64_t> *checkpoints);
+
+  /*
+   * Parse the entries of a v2 profile of size bytes. front holds the first
+   * front_size bytes of it, which must cover everything before the data
+   * region. get_data is called once with the range of profile offsets the
+   * loaded entries need data from and returns where the first of those bytes
+   * is in memory, or NULL on failure.
+   */
+  static int Parse(const char *front, const uint64_t front_size,
+      const uint64_t size,
+      const std::function<const char *(uint64_t, uint64_t)> &get_data,
+      const uint64_t first_checkpoint, const uint64_t last_checkpoint,
+      std::vector<disk_write> *prefix, std::vector<disk_write> &res,
+      std::vector<uint64_t> *checkpoints);
+};
+
+}  // namespace utils
+}  // namespace fs_testing
+
+#endif  // UTILS_PROFILE_LOG_H
@@ -16,6 +16,13 @@ using std::memset;
 using std::string;
 using std::strncpy;
 
+namespace {
+
+// Strings are read onto the stack, so don't trust senders with their size.
+const int kMaxStringSize = 4096;
+
+}  // namespace
+
 int BaseSocket::ReadMessageFromSocket(int socket, SocketMessage *m) {
   // What sort of message are we dealing with and how big is it?
   // TODO(ashmrtn): Improve error checking/recoverability.
@@ -43,11 +50,38 @@ int BaseSocket::ReadMessageFromSocket(int socket, SocketMessage *m) {
     case SocketMessage::kCheckpoint:
     case SocketMessage::kCheckpointDone:
     case SocketMessage::kCheckpointFailed:
+    case SocketMessage::kShutdown:
+    case SocketMessage::kShutdownDone:
       // Somebody sent us extra data anyway. Gobble it up and throw it away.
       if (m->size != 0) {
         res = GobbleData(socket, m->size);
       }
       break;
+    // These messages contain a single string.
+    case SocketMessage::kQueueTest:
+      {
+        int len;
+        if (m->size < sizeof(uint32_t)) {
+          return -1;
+        }
+        res = ReadIntFromSocket(socket, &len);
+        if (res < 0) {
+          return res;
+        }
+        if (len <= 0 || len > kMaxStringSize ||
+            len + sizeof(uint32_t) != m->size) {
+          return -1;
+        }
+        res = ReadStringFromSocket(socket, len, &m->string_value);
+      }
+      break;
+    // These messages contain a single int.
+    case SocketMessage::kQueueTestDone:
+      if (m->size != sizeof(uint32_t)) {
+        return -1;
+      }
+      res = ReadIntFromSocket(socket, &m->int_value);
+      break;
     default:
       res = -1;
   }
@@ -77,6 +111,8 @@ int BaseSocket::WriteMessageToSocket(int socket, SocketMessage &m) {
     case SocketMessage::kCheckpoint:
     case SocketMessage::kCheckpointDone:
     case SocketMessage::kCheckpointFailed:
+    case SocketMessage::kShutdown:
+    case SocketMessage::kShutdownDone:
       // By default, always send the proper size of the message and no other,
       // extra data.
       res = WriteIntToSocket(socket, 0);
@@ -84,6 +120,22 @@ int BaseSocket::WriteMessageToSocket(int socket, SocketMessage &m) {
         return res;
       }
       break;
+    case SocketMessage::kQueueTest:
+      // Size of the string plus the length sent in front of it.
+      res = WriteIntToSocket(socket,
+          sizeof(uint32_t) + GetStringSize(m.string_value));
+      if (res < 0) {
+        return res;
+      }
+      res = WriteStringToSocket(socket, m.string_value);
+      break;
+    case SocketMessage::kQueueTestDone:
+      res = WriteIntToSocket(socket, sizeof(uint32_t));
+      if (res < 0) {
+        return res;
+      }
+      res = WriteIntToSocket(socket, m.int_value);
+      break;
     default:
       res = -1;
   }
@@ -95,7 +147,7 @@ int BaseSocket::GobbleData(int socket, unsigned int len) {
   char tmp[len];
   do {
     int res = recv(socket, tmp + bytes_read, sizeof(tmp) - bytes_read, 0);
-    if (res < 0) {
+    if (res <= 0) {
       return -1;
     }
     bytes_read += res;
@@ -108,7 +160,8 @@ int BaseSocket::ReadIntFromSocket(int socket, int* data) {
   int32_t d;
   do {
     int res = recv(socket, (char*) &d + bytes_read, sizeof(d) - bytes_read, 0);
-    if (res < 0) {
+    // recv returns 0 once the other end hangs up.
+    if (res <= 0) {
       return -1;
     }
     bytes_read += res;
@@ -124,7 +177,7 @@ int BaseSocket::WriteIntToSocket(int socket, int data) {
   int bytes_written = 0;
   do {
     int res = send(socket, (char*) &d + bytes_written,
-        sizeof(d) - bytes_written, 0);
+        sizeof(d) - bytes_written, MSG_NOSIGNAL);
     if (res < 0) {
       return -1;
     }
@@ -147,7 +200,7 @@ int BaseSocket::ReadStringFromSocket(int socket, unsigned int len,
   char read_string[len];
   do {
     int res = recv(socket, read_string + bytes_read, len - bytes_read, 0);
-    if (res < 0) {
+    if (res <= 0) {
       return -1;
     }
     bytes_read += res;
@@ -162,12 +215,17 @@ int BaseSocket::ReadStringFromSocket(int socket, unsigned int len,
   return 0;
 }
 
+unsigned int BaseSocket::GetStringSize(const string &data) {
+  // Always leave room for the terminating NUL so the reader doesn't need to
+  // add one.
+  return (data.size() + sizeof(uint32_t)) & ~(sizeof(uint32_t) - 1);
+}
+
 // Assume all messages are sent in network endian. Furthermore, strings are
 // rounded up to the nearest multiple of sizeof(uint32_t) bytes.
 int BaseSocket::WriteStringToSocket(int socket, string &data) {
   // Some prep work so we can send everything one after the other.
-  const int len =
-    (data.size() + (sizeof(uint32_t) - 1)) & ~(sizeof(uint32_t) - 1);
+  const int len = GetStringSize(data);
 
   char send_data[len];
   memset(send_data, 0, len);
@@ -186,7 +244,8 @@ int BaseSocket::WriteStringToSocket(int socket, string &data) {
   // Send string itself.
   int bytes_written = 0;
   do {
-    int res = send(socket, send_data + bytes_written, len - bytes_written, 0);
+    int res = send(socket, send_data + bytes_written, len - bytes_written,
+        MSG_NOSIGNAL);
     if (res < 0) {
       return -1;
     }
@@ -1,6 +1,8 @@
 #ifndef UTILS_COMMUNICATION_BASE_SOCKET_H
 #define UTILS_COMMUNICATION_BASE_SOCKET_H
 
+#include <string>
+
 #include "SocketUtils.h"
 
 namespace fs_testing {
@@ -19,6 +21,8 @@ class BaseSocket {
   static int ReadStringFromSocket(int socket, unsigned int len,
       std::string *data);
   static int WriteStringToSocket(int socket, std::string &data);
+  // Number of bytes data takes up on the wire, not counting its length.
+  static unsigned int GetStringSize(const std::string &data);
 };
 
 }  // namespace communication
@@ -4,7 +4,9 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "ServerSocket.h"
 
@@ -13,6 +15,7 @@ namespace utils {
 namespace communication {
 
 using std::string;
+using std::vector;
 
 namespace {
   const unsigned int kNonBlockPollTimeout = 25;
@@ -21,14 +24,16 @@ namespace {
 ServerSocket::ServerSocket(string address): socket_address(address) {};
 
 ServerSocket::~ServerSocket() {
-  // If we try to close an invalid file descriptor then oh well, nothing bad
-  // should happen (famous last words...).
-  close(client_socket);
-  close(server_socket);
-  unlink(socket_address.c_str());
+  CloseServer();
+  if (owner_pid == getpid()) {
+    unlink(socket_address.c_str());
+  }
 }
 
 int ServerSocket::Init(unsigned int queue_depth) {
+  // Set before binding so a failed Init still removes a stale socket file when
+  // this is destroyed.
+  owner_pid = getpid();
   server_socket =
     socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
   if (server_socket < 0) {
@@ -55,7 +60,7 @@ SocketError ServerSocket::SendCommand(SocketMessage::CmCommand c) {
 }
 
 SocketError ServerSocket::SendMessage(SocketMessage &m) {
-  if (server_socket < 0) {
+  if (server_socket < 0 || client_socket < 0) {
     return SocketError::kNotConnected;
   }
 
@@ -66,76 +71,101 @@ SocketError ServerSocket::SendMessage(SocketMessage &m) {
 }
 
 SocketError ServerSocket::WaitForMessage(SocketMessage *m) {
-  // We're already connected to something.
-  if (client_socket >= 0) {
-    return SocketError::kAlreadyConnected;
-  }
-  // Block until we can call accept without blocking.
-  struct pollfd pfd;
-  pfd.fd = server_socket;
-  pfd.events = POLLIN;
-
-  int res = poll(&pfd, 1, -1);
-
-  if (res == -1) {
-    return SocketError::kSyscall;
-  } else if (res == 0) {
-    return SocketError::kTimeout;
-  } else if (!(pfd.revents & POLLIN)) {
-    return SocketError::kOther;
-  }
-
-  // For now, don't care about getting the client address.
-  client_socket = accept(server_socket, NULL, NULL);
-  if (client_socket < 0) {
-    return SocketError::kSyscall;
-  }
-
-  if (BaseSocket::ReadMessageFromSocket(client_socket, m)) {
-    return SocketError::kSyscall;
-  }
-  return SocketError::kNone;
+  return GetMessage(m, -1, -1);
 }
 
 SocketError ServerSocket::TryForMessage(SocketMessage *m) {
-  // We're already connected to something.
-  if (client_socket >= 0) {
-    return SocketError::kAlreadyConnected;
-  }
-  // Block until we can call accept without blocking.
-  struct pollfd pfd;
-  pfd.fd = server_socket;
-  pfd.events = POLLIN;
-
-  int res = poll(&pfd, 1, kNonBlockPollTimeout);
+  return GetMessage(m, kNonBlockPollTimeout, -1);
+}
 
-  if (res == -1) {
-    return SocketError::kSyscall;
-  } else if (res == 0) {
-    return SocketError::kTimeout;
-  } else if (!(pfd.revents & POLLIN)) {
-    return SocketError::kOther;
-  }
+SocketError ServerSocket::WaitForMessageOrFd(SocketMessage *m, const int fd) {
+  return GetMessage(m, -1, fd);
+}
 
-  // For now, don't care about getting the client address.
-  client_socket = accept(server_socket, NULL, NULL);
-  if (client_socket < 0) {
-    return SocketError::kSyscall;
+SocketError ServerSocket::GetMessage(SocketMessage *m, const int timeout,
+    const int wake_fd) {
+  while (true) {
+    // Watch for new clients and for more messages from the ones we have. poll
+    // ignores wake_fd if it is < 0.
+    vector<struct pollfd> pfds(open_clients.size() + 2);
+    pfds.at(0).fd = server_socket;
+    pfds.at(0).events = POLLIN;
+    pfds.at(1).fd = wake_fd;
+    pfds.at(1).events = POLLIN;
+    for (unsigned int i = 0; i < open_clients.size(); ++i) {
+      pfds.at(i + 2).fd = open_clients.at(i);
+      pfds.at(i + 2).events = POLLIN;
+    }
+
+    int res = poll(pfds.data(), pfds.size(), timeout);
+
+    if (res == -1) {
+      return SocketError::kSyscall;
+    } else if (res == 0) {
+      return SocketError::kTimeout;
+    }
+
+    for (unsigned int i = 2; i < pfds.size(); ++i) {
+      if (pfds.at(i).revents == 0) {
+        continue;
+      }
+      if (BaseSocket::ReadMessageFromSocket(pfds.at(i).fd, m) < 0) {
+        // The client hung up (or sent us garbage). Either way we're done with
+        // it.
+        DropClient(pfds.at(i).fd);
+        continue;
+      }
+      client_socket = pfds.at(i).fd;
+      return SocketError::kNone;
+    }
+
+    if (pfds.at(0).revents == 0) {
+      if (pfds.at(1).revents != 0) {
+        return SocketError::kFdReadable;
+      }
+      // Only heard from clients that hung up. Keep waiting.
+      continue;
+    } else if (!(pfds.at(0).revents & POLLIN)) {
+      return SocketError::kOther;
+    }
+
+    // For now, don't care about getting the client address.
+    const int client = accept4(server_socket, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) {
+      return SocketError::kSyscall;
+    }
+    open_clients.push_back(client);
+
+    if (BaseSocket::ReadMessageFromSocket(client, m)) {
+      DropClient(client);
+      return SocketError::kSyscall;
+    }
+    client_socket = client;
+    return SocketError::kNone;
   }
+}
 
-  if (BaseSocket::ReadMessageFromSocket(client_socket, m)) {
-    return SocketError::kSyscall;
+void ServerSocket::DropClient(const int client) {
+  close(client);
+  open_clients.erase(
+      std::remove(open_clients.begin(), open_clients.end(), client),
+      open_clients.end());
+  if (client_socket == client) {
+    client_socket = -1;
   }
-  return SocketError::kNone;
 }
 
 void ServerSocket::CloseClient() {
-  close(client_socket);
-  client_socket = -1;
+  if (client_socket >= 0) {
+    DropClient(client_socket);
+  }
 }
 
 void ServerSocket::CloseServer() {
-  close(client_socket);
+  for (const int client : open_clients) {
+    close(client);
+  }
+  open_clients.clear();
   client_socket = -1;
   close(server_socket);
   server_socket = -1;
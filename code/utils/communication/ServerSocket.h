@@ -1,6 +1,8 @@
 #ifndef UTILS_COMMUNICATION_SERVER_SOCKET_H
 #define UTILS_COMMUNICATION_SERVER_SOCKET_H
 
+#include <sys/types.h>
+
 #include <string>
 #include <vector>
 
@@ -12,7 +14,8 @@ namespace utils {
 namespace communication {
 
 // Simple class that acts as a server for a socket by receiving and replying to
-// messages.
+// messages. Clients may keep their connection open to send more messages
+// later, and replies always go to the client the last message came from.
 // *** This is not a thread-safe class. ***
 class ServerSocket {
  public:
@@ -24,12 +27,28 @@ class ServerSocket {
   SocketError SendMessage(SocketMessage &m);
   SocketError WaitForMessage(SocketMessage *m);
   SocketError TryForMessage(SocketMessage *m);
+  // Block until a message arrives (kNone) or fd becomes readable
+  // (kFdReadable), whichever happens first. Lets callers sleep on both the
+  // socket and something else, like a signalfd.
+  SocketError WaitForMessageOrFd(SocketMessage *m, const int fd);
+  // Hang up on the client the last message came from.
   void CloseClient();
   void CloseServer();
  private:
+  SocketError GetMessage(SocketMessage *m, const int timeout,
+      const int wake_fd);
+  void DropClient(const int client);
+
   int server_socket = -1;
+  // Client the last message came from.
   int client_socket = -1;
+  // All clients that haven't hung up yet, including client_socket.
+  std::vector<int> open_clients;
   const std::string socket_address;
+  // Process that called Init. Only it removes socket_address when done, so
+  // forked children that inherit this object don't unlink the address out
+  // from under it.
+  pid_t owner_pid = -1;
 };
 
 }  // namespace communication
@@ -13,6 +13,10 @@ const char kSocketDir[] = "/tmp";
 // make sure that the path below matches the path above (with the exception of
 // the appended "crash_monkey_harness" part).
 const char kSocketNameOutbound[] = "/tmp/crash_monkey_harness";
+// Where a c_harness running in daemon mode (-D) takes test cases to run. Kept
+// separate from kSocketNameOutbound since running tests use that one for
+// checkpoints.
+const char kSocketNameDaemon[] = "/tmp/crash_monkey_daemon";
 
 /*******************************************************************************
  * Basic information about the layout of messages sent and received by
@@ -56,6 +60,13 @@ struct SocketMessage {
     kCheckpoint,
     kCheckpointDone,
     kCheckpointFailed,
+    // Daemon mode. kQueueTest carries the path of a test case .so in
+    // string_value and kQueueTestDone carries the exit status of the harness
+    // run for it in int_value.
+    kQueueTest,
+    kQueueTestDone,
+    kShutdown,
+    kShutdownDone,
   };
 
   CmCommand type;
@@ -82,6 +93,9 @@ enum SocketError {
   kNotConnected,
   kTimeout,
   kOther,
+  // The extra file descriptor given to WaitForMessageOrFd became readable
+  // before a message arrived.
+  kFdReadable,
 };
 
 }  // namespace communication
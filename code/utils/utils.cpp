@@ -48,6 +48,48 @@ static const char* const flag_names[] = {
 
 static char const checkpoint_name[] = "checkpoint";
 
+// Keep arena allocations 8-byte aligned.
+const uint64_t kArenaAlignment = 8;
+
+}
+
+DiskWriteArena::DiskWriteArena(const uint64_t block_size) :
+    block_size_(block_size) { }
+
+char * DiskWriteArena::Allocate(const uint64_t size) {
+  const uint64_t aligned =
+    (size + (kArenaAlignment - 1)) & ~(kArenaAlignment - 1);
+  if (aligned > block_size_ / 4) {
+    // Big allocations get their own block so they don't waste the rest of the
+    // current one.
+    blocks_.emplace_back(new char[aligned]);
+    bytes_allocated_ += aligned;
+    return blocks_.back().get();
+  }
+  if (aligned > remaining_) {
+    blocks_.emplace_back(new char[block_size_]);
+    next_ = blocks_.back().get();
+    remaining_ = block_size_;
+  }
+  char *res = next_;
+  next_ += aligned;
+  remaining_ -= aligned;
+  bytes_allocated_ += aligned;
+  return res;
+}
+
+char * DiskWriteArena::Copy(const char *data, const uint64_t size) {
+  char *res = Allocate(size);
+  memcpy(res, data, size);
+  return res;
+}
+
+void DiskWriteArena::Adopt(shared_ptr<char> region) {
+  adopted_.push_back(region);
+}
+
+uint64_t DiskWriteArena::GetBytesAllocated() const {
+  return bytes_allocated_;
 }
 
 bool disk_write::is_async_write() {
@@ -83,15 +125,13 @@ disk_write::disk_write() {
   metadata.write_sector = 0;
   metadata.size = 0;
   metadata.time_ns = 0;
-  data.reset();
+  data = NULL;
 }
 
 disk_write::disk_write(const struct disk_write_op_meta& m,
-    const char *d) {
-  metadata = m;
-  if (metadata.size > 0 && d != NULL) {
-    data.reset(new char[metadata.size], [](char* c) {delete[] c;});
-    memcpy(data.get(), d, metadata.size);
+    const char *d) : metadata(m), data(d) {
+  if (metadata.size == 0) {
+    data = NULL;
   }
 }
 
@@ -100,13 +140,13 @@ bool operator==(const disk_write& a, const disk_write& b) {
         a.metadata.size) ==
       tie(b.metadata.bi_flags, b.metadata.bi_rw, b.metadata.write_sector,
         b.metadata.size)) {
-    if ((a.data.get() == NULL && b.data.get() != NULL) ||
-        (a.data.get() != NULL && b.data.get() == NULL)) {
+    if ((a.data == NULL && b.data != NULL) ||
+        (a.data != NULL && b.data == NULL)) {
       return false;
-    } else if (a.data.get() == NULL && b.data.get() == NULL) {
+    } else if (a.data == NULL && b.data == NULL) {
       return true;
     }
-    if (memcmp(a.data.get(), b.data.get(), a.metadata.size) == 0) {
+    if (memcmp(a.data, b.data, a.metadata.size) == 0) {
       return true;
     }
   }
@@ -150,7 +190,7 @@ void disk_write::serialize(std::ofstream& fs, const disk_write& dw) {
 
   // Write out the actual data for this log entry. Data could be larger than
   // buf_size so loop through this.
-  const char *data = (char *) dw.data.get();
+  const char *data = dw.data;
   for (unsigned int i = 0; i < dw.metadata.size; i += kSerializeBufSize) {
     const unsigned int copy_amount =
       ((i + kSerializeBufSize) > dw.metadata.size)
@@ -168,7 +208,7 @@ void disk_write::serialize(std::ofstream& fs, const disk_write& dw) {
 }
 
 // Assumes binary file stream provided.
-disk_write disk_write::deserialize(ifstream& is) {
+disk_write disk_write::deserialize(ifstream& is, DiskWriteArena &arena) {
   char buffer[kSerializeBufSize];
   memset(buffer, 0, kSerializeBufSize);
 
@@ -200,7 +240,7 @@ disk_write disk_write::deserialize(ifstream& is) {
   meta.size = be64toh(write_size);
   meta.time_ns = be64toh(time_ns);
 
-  char *data = new char[meta.size];
+  char *data = (meta.size > 0) ? arena.Allocate(meta.size) : NULL;
   for (unsigned int i = 0; i < meta.size; i += kSerializeBufSize) {
     const unsigned int read_amount =
       ((i + kSerializeBufSize) > meta.size)
@@ -212,9 +252,7 @@ disk_write disk_write::deserialize(ifstream& is) {
     memcpy(data + i, buffer, read_amount);
   }
 
-  disk_write res(meta, data);
-  delete[] data;
-  return res;
+  return disk_write(meta, data);
 }
 
 std::string disk_write::flags_to_string(long long flags) {
@@ -277,41 +315,36 @@ void disk_write::clear_flush_seq_flag() {
   metadata.bi_rw = (metadata.bi_rw & ~(HWM_FLUSH_SEQ_FLAG));
 }
 
-shared_ptr<char> disk_write::set_data(const char *d) {
+const char * disk_write::set_data(DiskWriteArena &arena, const char *d) {
   if (metadata.size > 0 && d != NULL) {
-    data.reset(new char[metadata.size], [](char* c) {delete[] c;});
-    memcpy(data.get(), d, metadata.size);
+    data = arena.Copy(d, metadata.size);
   }
   return data;
 }
 
-shared_ptr<char> disk_write::get_data() {
+const char * disk_write::get_data() const {
   return data;
 }
 
 void disk_write::clear_data() {
-  data.reset();
+  data = NULL;
 }
 
 
 DiskWriteData::DiskWriteData() :
       full_bio(false), bio_index(0), bio_sector_index(0), disk_offset(0),
-      size(0), data_offset_(0) {
-  data_base_.reset();
-}
+      size(0), data_base_(NULL), data_offset_(0) { }
 
 DiskWriteData::DiskWriteData(bool full_bio, unsigned int bio_index,
     unsigned int bio_sector_index ,unsigned int disk_offset,
-    unsigned int size, std::shared_ptr<char> data_base,
+    unsigned int size, const char *data_base,
     unsigned int data_offset) :
       full_bio(full_bio), bio_index(bio_index),
       bio_sector_index(bio_sector_index), disk_offset(disk_offset),
-      size(size), data_offset_(data_offset) {
-  data_base_ = data_base;
-}
+      size(size), data_base_(data_base), data_offset_(data_offset) { }
 
-void * DiskWriteData::GetData() {
-  return (void*) (data_base_.get() + data_offset_);
+const void * DiskWriteData::GetData() const {
+  return (const void *) (data_base_ + data_offset_);
 }
 
 }  // namespace utils
@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
+
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -12,9 +14,50 @@
 namespace fs_testing {
 namespace utils {
 
+/*
+ * Append-only storage for bio data. Data copied into the arena stays at the
+ * same address until the arena is destroyed, so everything that refers to bio
+ * data (disk_write, DiskWriteData, EpochOpSector, crash states) can hold plain
+ * pointers into it instead of reference counted ones. This makes copying those
+ * structs free of allocations and atomic operations.
+ *
+ * The harness keeps a single arena alive for the entire run. Memory is only
+ * released when the arena is destroyed.
+ */
+class DiskWriteArena {
+ public:
+  static const uint64_t kDefaultBlockSize = 4 * 1024 * 1024;
+
+  DiskWriteArena(const uint64_t block_size = kDefaultBlockSize);
+  DiskWriteArena(const DiskWriteArena &other) = delete;
+  DiskWriteArena& operator=(const DiskWriteArena &other) = delete;
+
+  // Returns uninitialized space for size bytes of data.
+  char * Allocate(const uint64_t size);
+  // Returns a copy of size bytes of data.
+  char * Copy(const char *data, const uint64_t size);
+  // Keep region (ex. an mmap-ed log file) alive for the life of the arena so
+  // that pointers into it can be handed out like any other arena data.
+  void Adopt(std::shared_ptr<char> region);
+
+  uint64_t GetBytesAllocated() const;
+
+ private:
+  const uint64_t block_size_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  std::vector<std::shared_ptr<char>> adopted_;
+  // Free space left at the end of the last block in blocks_.
+  char *next_ = NULL;
+  uint64_t remaining_ = 0;
+  uint64_t bytes_allocated_ = 0;
+};
+
 class disk_write {
  public:
   disk_write();
+  // Does not copy the data. d must stay valid as long as this disk_write (and
+  // any copies of it) are used, which normally means it lives in a
+  // DiskWriteArena.
   disk_write(const struct disk_write_op_meta& m, const char *d);
 
   struct disk_write_op_meta metadata;
@@ -38,21 +81,20 @@ class disk_write {
 
   static std::string flags_to_string(long long flags);
   static void serialize(std::ofstream& fs, const disk_write& dw);
-  static disk_write deserialize(std::ifstream& is);
-
-  // Returns a pointer to the data which was assigned or NULL if data could not
-  // be assigned. Pointer is valid only as long as the object exists. The user
-  // should not call free on this pointer or otherwise attempt memory management
-  // of it.
-  std::shared_ptr<char> set_data(const char *data);
+  // The data of the returned disk_write is placed in arena.
+  static disk_write deserialize(std::ifstream& is, DiskWriteArena &arena);
+
+  // Copies metadata.size bytes of data into arena and returns a pointer to the
+  // copy, or NULL if data could not be assigned. Pointer is valid only as long
+  // as the arena exists. The user should not call free on this pointer or
+  // otherwise attempt memory management of it.
+  const char * set_data(DiskWriteArena &arena, const char *data);
   // Returns a pointer to the data field or NULL if data has not been assigned.
-  // Pointer is valid only as long as the object exists or otherwise attempt
-  // memory management of it.
-  std::shared_ptr<char> get_data();
+  const char * get_data() const;
   void clear_data();
 
  private:
-  std::shared_ptr<char> data;
+  const char *data;
 };
 
 
@@ -73,10 +115,10 @@ struct DiskWriteData {
   DiskWriteData();
   DiskWriteData(bool full_bio, unsigned int bio_index,
       unsigned int bio_sector_index ,unsigned int disk_offset,
-      unsigned int size, std::shared_ptr<char> data_base,
+      unsigned int size, const char *data_base,
       unsigned int data_offset);
 
-  void * GetData();
+  const void * GetData() const;
   // Denotes whether or not this represents the entire epoch_op and not just one
   // sector in it.
   bool full_bio;
@@ -88,13 +130,11 @@ struct DiskWriteData {
   unsigned int size;
 
  private:
-  // Pointer to the start of the data region for this data. There could still be
-  // an offset added to this to get to the actual data that this struct
-  // describes. However, to reduces copies and simplify pointer management, a
-  // single shared_ptr describes all the data in a bio, meaning that if we want
-  // to ensure our pointer is valid at all times we also need a shared_ptr to
-  // all the data in the bio.
-  std::shared_ptr<char> data_base_;
+  // Pointer to the start of the data region for the bio this data is part of.
+  // There could still be an offset added to this to get to the actual data that
+  // this struct describes. The data itself is owned by the DiskWriteArena the
+  // bio was loaded into.
+  const char *data_base_;
   unsigned int data_offset_;
 };
 
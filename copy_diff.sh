@@ -2,6 +2,8 @@
 _file="$1"
 _target="$2"
 _demo=${3:-0}
+#Directory the diff files of the test were left in
+_dir=${4:-build}
 
 #Let's set color codes for passed and failed tests
 red=`tput setaf 1`
@@ -22,11 +24,11 @@ then
 	then
 		source find_diff.sh $_file
 	fi
-	rm build/diff*
+	rm $_dir/diff*
 else
-	if [ -e build/diff* ]
+	if [ -e $_dir/diff* ]
 	then
-   		rm build/diff*
+   		rm $_dir/diff*
 		echo -e "${green}${bold} : Passed test${reset}"
 	else	
 		echo -e "${yellow}${bold} : Could not run test${reset}"
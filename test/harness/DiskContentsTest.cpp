@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/harness/DiskContents.h"
+#include "../../code/utils/DiskMod.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::DiskMod;
+
+namespace {
+
+const char kFileName[] = "/file";
+
+DiskMod HashedWrite(const uint64_t offset, const vector<char> &data) {
+  DiskMod mod;
+  mod.mod_type = DiskMod::kDataMod;
+  mod.mod_opts = DiskMod::kNoneOpt;
+  mod.path = string("/mnt/snapshot") + kFileName;
+  mod.file_mod_location = offset;
+  mod.file_mod_len = data.size();
+  mod.SetDigests(data.data());
+  return mod;
+}
+
+DiskMod Fsync() {
+  DiskMod mod;
+  mod.mod_type = DiskMod::kFsyncMod;
+  mod.mod_opts = DiskMod::kNoneOpt;
+  mod.path = string("/mnt/snapshot") + kFileName;
+  return mod;
+}
+
+/*
+ * Stands in for a mounted crash state. The file in it holds what the workload
+ * left behind after all of its writes.
+ */
+class DiskContentsDigests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/disk_contentsXXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    dir_ = dir;
+    diff_file_.open(dir_ + "/diff");
+  }
+
+  virtual void TearDown() {
+    diff_file_.close();
+    unlink((dir_ + kFileName).c_str());
+    unlink((dir_ + "/diff").c_str());
+    rmdir(dir_.c_str());
+  }
+
+  void WriteFile(const vector<char> &contents) {
+    ofstream file(dir_ + kFileName, std::ios::binary);
+    file.write(contents.data(), contents.size());
+  }
+
+  bool Check(const vector<DiskMod> &mods) {
+    DiskContents disk("/dev/null", "ext4");
+    disk.set_mount_point(dir_);
+    return disk.compare_file_digests(kFileName, mods, diff_file_);
+  }
+
+  string dir_;
+  ofstream diff_file_;
+};
+
+}  // namespace
+
+/*
+ * Two overlapping writes before one fsync. The crash state has the data of the
+ * second write where they overlap, which must not be reported as a mismatch
+ * against the digests of the first write.
+ */
+TEST_F(DiskContentsDigests, OverlappingWritesBeforeFsync) {
+  const vector<char> first(3 * DiskMod::kDigestBlockSize, 'a');
+  const vector<char> second(DiskMod::kDigestBlockSize + 100, 'b');
+  const uint64_t second_offset = DiskMod::kDigestBlockSize + 10;
+
+  vector<char> contents(first);
+  memcpy(contents.data() + second_offset, second.data(), second.size());
+  WriteFile(contents);
+
+  const vector<DiskMod> mods = {HashedWrite(0, first),
+    HashedWrite(second_offset, second), Fsync()};
+  EXPECT_TRUE(Check(mods));
+
+  // Without the second write only the first one's digests can be used.
+  EXPECT_FALSE(Check({mods.at(0), mods.at(2)}));
+}
+
+/*
+ * Blocks covered by only one of the writes are still checked.
+ */
+TEST_F(DiskContentsDigests, OverlappingWritesMismatch) {
+  const vector<char> first(3 * DiskMod::kDigestBlockSize, 'a');
+  const vector<char> second(DiskMod::kDigestBlockSize + 100, 'b');
+  const uint64_t second_offset = DiskMod::kDigestBlockSize + 10;
+  const vector<DiskMod> mods = {HashedWrite(0, first),
+    HashedWrite(second_offset, second), Fsync()};
+
+  vector<char> contents(first);
+  memcpy(contents.data() + second_offset, second.data(), second.size());
+  // Lost part of the second write.
+  contents.at(second_offset + DiskMod::kDigestBlockSize) = 'a';
+  WriteFile(contents);
+  EXPECT_FALSE(Check(mods));
+
+  memcpy(contents.data() + second_offset, second.data(), second.size());
+  // Lost part of the first write.
+  contents.at(0) = 'c';
+  WriteFile(contents);
+  EXPECT_FALSE(Check(mods));
+
+  // Lost the second write entirely.
+  WriteFile(first);
+  EXPECT_FALSE(Check(mods));
+}
+
+/*
+ * Blocks a later truncate could have changed aren't checked against the write.
+ */
+TEST_F(DiskContentsDigests, SkipsBlocksAfterTruncate) {
+  const vector<char> first(2 * DiskMod::kDigestBlockSize, 'a');
+  DiskMod truncate;
+  truncate.mod_type = DiskMod::kDataMetadataMod;
+  truncate.mod_opts = DiskMod::kTruncateOpt;
+  truncate.path = string("/mnt/snapshot") + kFileName;
+
+  WriteFile(vector<char>());
+  EXPECT_FALSE(Check({HashedWrite(0, first), Fsync()}));
+  EXPECT_TRUE(Check({HashedWrite(0, first), truncate, Fsync()}));
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,94 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../code/harness/WorkloadExecutor.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+/*
+ * Test that each run happens in its own process with the checkpoint it was
+ * given and reports back how that process exited.
+ */
+TEST(WorkloadExecutor, RunsEachRequest) {
+  const pid_t harness_pid = getpid();
+  WorkloadExecutor executor;
+  ASSERT_EQ(0, executor.Start([harness_pid](const int checkpoint) {
+        // Runs must not happen in the harness or the executor itself.
+        if (getpid() == harness_pid || getppid() == harness_pid) {
+          return 100;
+        }
+        return checkpoint;
+      }));
+
+  for (int checkpoint = 0; checkpoint < 3; ++checkpoint) {
+    ASSERT_EQ(0, executor.Run(checkpoint));
+    int status;
+    ASSERT_EQ(0, executor.GetStatus(&status));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(checkpoint, WEXITSTATUS(status));
+  }
+  executor.Stop();
+  EXPECT_GT(0, executor.Run(0));
+}
+
+/*
+ * Test that the done fd only becomes readable once the run is over.
+ */
+TEST(WorkloadExecutor, DoneFdSignalsEndOfRun) {
+  int gate[2];
+  ASSERT_EQ(0, pipe(gate));
+  WorkloadExecutor executor;
+  ASSERT_EQ(0, executor.Start([&gate](const int) {
+        char c;
+        return (read(gate[0], &c, 1) == 1) ? 0 : 1;
+      }, {gate[0]}));
+  close(gate[0]);
+
+  ASSERT_EQ(0, executor.Run(0));
+  struct pollfd pfd;
+  pfd.fd = executor.GetDoneFd();
+  pfd.events = POLLIN;
+  EXPECT_EQ(0, poll(&pfd, 1, 50));
+
+  ASSERT_EQ(1, write(gate[1], "x", 1));
+  EXPECT_EQ(1, poll(&pfd, 1, 5000));
+  int status;
+  ASSERT_EQ(0, executor.GetStatus(&status));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  close(gate[1]);
+}
+
+/*
+ * Test that runs don't inherit the fds the harness had open when the executor
+ * was started, except the ones asked for.
+ */
+TEST(WorkloadExecutor, ClosesInheritedFds) {
+  int kept[2];
+  int dropped[2];
+  ASSERT_EQ(0, pipe(kept));
+  ASSERT_EQ(0, pipe(dropped));
+  WorkloadExecutor executor;
+  ASSERT_EQ(0, executor.Start([&kept, &dropped](const int) {
+        return (fcntl(kept[1], F_GETFD) >= 0) +
+          ((fcntl(dropped[1], F_GETFD) >= 0) << 1);
+      }, {kept[1]}));
+
+  ASSERT_EQ(0, executor.Run(0));
+  int status;
+  ASSERT_EQ(0, executor.GetStatus(&status));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(1, WEXITSTATUS(status));
+  executor.Stop();
+  close(kept[0]);
+  close(kept[1]);
+  close(dropped[0]);
+  close(dropped[1]);
+}
+
+}  // namespace test
+}  // namespace fs_testing
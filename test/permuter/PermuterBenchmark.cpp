@@ -0,0 +1,172 @@
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../../code/permuter/Permuter.h"
+#include "../../code/permuter/RandomPermuter.h"
+#include "../../code/results/PermuteTestResult.h"
+#include "../../code/utils/utils.h"
+#include "../utils/BenchmarkUtils.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::unique_ptr;
+using std::vector;
+
+using fs_testing::permuter::epoch;
+using fs_testing::permuter::EpochOpSector;
+using fs_testing::permuter::RandomPermuter;
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteArena;
+using fs_testing::utils::DiskWriteData;
+
+/*
+ * Measures the permuter on synthetic logs. Every benchmark takes the same
+ * arguments describing the log:
+ *    0. number of writes in the log
+ *    1. number of writes per epoch
+ *    2. percent of writes in an epoch that overlap an earlier one
+ */
+
+namespace {
+
+const unsigned int kSectorSize = 512;
+const unsigned int kWriteSize = 4096;
+const unsigned int kCheckpointEvery = 4;
+
+class BenchPermuter : public RandomPermuter {
+ public:
+  BenchPermuter() : RandomPermuter(NULL) {};
+
+  vector<EpochOpSector> Coalesce(vector<EpochOpSector> &sectors) {
+    return CoalesceSectors(sectors);
+  }
+
+  vector<epoch>* GetInternalEpochs() {
+    return GetEpochs();
+  }
+};
+
+class PermuterFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    SyntheticLogShape shape;
+    shape.num_writes = state.range(0);
+    shape.epoch_size = state.range(1);
+    shape.overlap_percent = state.range(2);
+    shape.write_size = kWriteSize;
+    shape.checkpoint_every = kCheckpointEvery;
+    arena_.reset(new DiskWriteArena());
+    log_ = MakeSyntheticLog(shape, *arena_);
+  }
+
+  void TearDown(const benchmark::State &) override {
+    log_.clear();
+    arena_.reset();
+  }
+
+ protected:
+  // A permuter with log_ loaded into it.
+  unique_ptr<BenchPermuter> NewPermuter() {
+    unique_ptr<BenchPermuter> res(new BenchPermuter());
+    res->InitDataVector(kSectorSize, log_);
+    return res;
+  }
+
+  unique_ptr<DiskWriteArena> arena_;
+  vector<disk_write> log_;
+};
+
+void LogArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"writes", "epoch", "overlap%"});
+  for (const int writes : {1000, 10000}) {
+    for (const int epoch_size : {8, 64}) {
+      for (const int overlap : {0, 25}) {
+        b->Args({writes, epoch_size, overlap});
+      }
+    }
+  }
+}
+
+}  // namespace
+
+BENCHMARK_DEFINE_F(PermuterFixture, InitDataVector)(benchmark::State &state) {
+  BenchPermuter permuter;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    permuter.InitDataVector(kSectorSize, log_);
+    benchmark::DoNotOptimize(permuter.GetInternalEpochs()->data());
+  }
+  ReportMemory(state, allocs);
+  state.SetItemsProcessed(state.iterations() * log_.size());
+}
+
+/*
+ * Crash state generation slows down as unique states get harder to find, so
+ * start over with a new permuter (untimed) when one runs out of them.
+ */
+BENCHMARK_DEFINE_F(PermuterFixture, GenerateCrashState)(
+    benchmark::State &state) {
+  unique_ptr<BenchPermuter> permuter = NewPermuter();
+  vector<DiskWriteData> res;
+  PermuteTestResult log_data;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    if (!permuter->GenerateCrashState(res, log_data)) {
+      state.PauseTiming();
+      permuter = NewPermuter();
+      state.ResumeTiming();
+    }
+  }
+  ReportMemory(state, allocs);
+}
+
+BENCHMARK_DEFINE_F(PermuterFixture, GenerateSectorCrashState)(
+    benchmark::State &state) {
+  unique_ptr<BenchPermuter> permuter = NewPermuter();
+  vector<DiskWriteData> res;
+  PermuteTestResult log_data;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    if (!permuter->GenerateSectorCrashState(res, log_data)) {
+      state.PauseTiming();
+      permuter = NewPermuter();
+      state.ResumeTiming();
+    }
+  }
+  ReportMemory(state, allocs);
+}
+
+BENCHMARK_DEFINE_F(PermuterFixture, CoalesceSectors)(benchmark::State &state) {
+  unique_ptr<BenchPermuter> permuter = NewPermuter();
+  // All the sectors of the log, in order, as a crash state that kept every
+  // write would have them.
+  vector<EpochOpSector> sectors;
+  for (epoch &e : *permuter->GetInternalEpochs()) {
+    for (auto &op : e.ops) {
+      vector<EpochOpSector> op_sectors = op.ToSectors(kSectorSize);
+      sectors.insert(sectors.end(), op_sectors.begin(), op_sectors.end());
+    }
+  }
+
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    vector<EpochOpSector> res = permuter->Coalesce(sectors);
+    benchmark::DoNotOptimize(res.data());
+  }
+  ReportMemory(state, allocs);
+  state.SetItemsProcessed(state.iterations() * sectors.size());
+}
+
+BENCHMARK_REGISTER_F(PermuterFixture, InitDataVector)->Apply(LogArgs);
+BENCHMARK_REGISTER_F(PermuterFixture, GenerateCrashState)->Apply(LogArgs);
+BENCHMARK_REGISTER_F(PermuterFixture, GenerateSectorCrashState)
+  ->Apply(LogArgs);
+BENCHMARK_REGISTER_F(PermuterFixture, CoalesceSectors)->Apply(LogArgs);
+
+}  // namespace test
+}  // namespace fs_testing
+
+BENCHMARK_MAIN();
@@ -16,6 +16,7 @@ using fs_testing::permuter::epoch_op;
 using fs_testing::permuter::EpochOpSector;
 using fs_testing::permuter::Permuter;
 using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteData;
 
 class TestPermuter : public Permuter {
  public:
@@ -26,7 +27,7 @@ class TestPermuter : public Permuter {
       PermuteTestResult &log_data) {
     return false;
   }
-  bool gen_one_sector_state(std::vector<EpochOpSector>& res,
+  bool gen_one_sector_state(std::vector<DiskWriteData>& res,
       PermuteTestResult &log_data) {
     return false;
   }
@@ -602,6 +603,46 @@ TEST(Permuter, InitDataVectorCheckpointSkip) {
       HWM_FLUSH_FLAG | HWM_WRITE_FLAG);
 }
 
+/*
+ * Test that a log loaded starting at a later checkpoint keeps the bio indices
+ * of the whole profile when given the index of its first entry.
+ */
+TEST(Permuter, InitDataVectorCheckpointRange) {
+  const unsigned int first_index = 40;
+  vector<disk_write> test_epoch;
+
+  // The log starts at checkpoint 3 instead of 0.
+  disk_write checkpoint;
+  checkpoint.metadata.write_sector = 3;
+  checkpoint.metadata.bi_flags = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.bi_rw = HWM_CHECKPOINT_FLAG;
+  checkpoint.metadata.size = 0;
+  checkpoint.metadata.time_ns = 0;
+  test_epoch.push_back(checkpoint);
+
+  disk_write write;
+  write.metadata.bi_rw = HWM_WRITE_FLAG;
+  write.metadata.write_sector = 512;
+  write.metadata.size = 512;
+  test_epoch.push_back(write);
+
+  disk_write barrier;
+  barrier.metadata.bi_rw = HWM_FLUSH_FLAG | HWM_WRITE_FLAG;
+  barrier.metadata.write_sector = 1024;
+  barrier.metadata.size = 0;
+  test_epoch.push_back(barrier);
+
+  TestPermuter tp;
+  const unsigned int sector_size = 512;
+  tp.InitDataVector(sector_size, test_epoch, first_index);
+  vector<epoch> *internal = tp.GetInternalEpochs();
+
+  ASSERT_EQ(internal->size(), 1);
+  EXPECT_EQ(internal->front().checkpoint_epoch, 3);
+  VerifyEpoch(internal->front(), test_epoch.begin() + 1, test_epoch.end(),
+      first_index + 1);
+}
+
 /*
  * Test that nothing bad happens if you have a barrier operation immediately
  * followed by a checkpoint at the very end of the log (i.e. the checkpoint is
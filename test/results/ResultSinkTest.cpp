@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/results/ResultSink.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::FileSystemTestResult;
+using fs_testing::ResultReader;
+using fs_testing::ResultRecord;
+using fs_testing::ResultSink;
+using fs_testing::SingleTestInfo;
+using fs_testing::tests::DataTestResult;
+using fs_testing::utils::DiskWriteData;
+
+namespace {
+
+string TempFile() {
+  char *temp_file = strdup("/tmp/result_sinkXXXXXX");
+  int temp_fd = mkstemp(temp_file);
+  EXPECT_TRUE(temp_fd > 0);
+  close(temp_fd);
+  string res(temp_file);
+  free(temp_file);
+  return res;
+}
+
+DiskWriteData Bio(const unsigned int index) {
+  return DiskWriteData(true, index, 0, 0, 0, NULL, 0);
+}
+
+DiskWriteData Sector(const unsigned int index, const unsigned int sector) {
+  return DiskWriteData(false, index, sector, 0, 0, NULL, 0);
+}
+
+}  // namespace
+
+TEST(ResultSink, RoundTrip) {
+  const string path = TempFile();
+
+  SingleTestInfo passed;
+  passed.test_num = 1;
+  passed.permute_data.last_checkpoint = 2;
+  passed.fs_test.SetError(FileSystemTestResult::kClean);
+  passed.permute_data.crash_state = {Bio(1), Bio(2), Bio(700), Bio(3)};
+
+  SingleTestInfo failed;
+  failed.test_num = 100000;
+  failed.permute_data.last_checkpoint = 0;
+  failed.fs_test.SetError(FileSystemTestResult::kCheck);
+  failed.data_test.SetError(DataTestResult::kFileMissing);
+  failed.permute_data.crash_state = {Sector(5, 0), Sector(5, 7), Bio(4)};
+
+  SingleTestInfo empty;
+  empty.test_num = 3;
+  empty.permute_data.last_checkpoint = 1;
+
+  ResultSink sink;
+  ASSERT_EQ(sink.Open(path), 0);
+  EXPECT_TRUE(sink.IsOpen());
+  ASSERT_EQ(sink.Write(ResultSink::kReordering, passed), 0);
+  ASSERT_EQ(sink.Write(ResultSink::kReordering, failed), 0);
+  ASSERT_EQ(sink.Write(ResultSink::kTiming, empty), 0);
+  EXPECT_EQ(sink.GetNumRecords(), 3);
+  ASSERT_EQ(sink.Close(), 0);
+  EXPECT_FALSE(sink.IsOpen());
+
+  ResultReader reader;
+  ASSERT_EQ(reader.Open(path), 0);
+  unlink(path.c_str());
+
+  ResultRecord record;
+  ASSERT_EQ(reader.Next(record), 1);
+  EXPECT_EQ(record.suite, ResultSink::kReordering);
+  EXPECT_EQ(record.test_num, 1);
+  EXPECT_EQ(record.last_checkpoint, 2);
+  EXPECT_EQ(record.result, SingleTestInfo::kPassed);
+  EXPECT_EQ(record.fs_errors, FileSystemTestResult::kClean);
+  EXPECT_EQ(record.data_errors, DataTestResult::kClean);
+  ASSERT_EQ(record.crash_state.size(), 4);
+  const unsigned int indices[] = {1, 2, 700, 3};
+  for (unsigned int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(record.crash_state.at(i).full_bio);
+    EXPECT_EQ(record.crash_state.at(i).bio_index, indices[i]);
+  }
+
+  ASSERT_EQ(reader.Next(record), 1);
+  EXPECT_EQ(record.test_num, 100000);
+  EXPECT_EQ(record.result, SingleTestInfo::kFailed);
+  EXPECT_EQ(record.fs_errors, FileSystemTestResult::kCheck);
+  EXPECT_EQ(record.data_errors, DataTestResult::kFileMissing);
+  ASSERT_EQ(record.crash_state.size(), 3);
+  EXPECT_FALSE(record.crash_state.at(0).full_bio);
+  EXPECT_EQ(record.crash_state.at(0).bio_index, 5);
+  EXPECT_EQ(record.crash_state.at(0).bio_sector_index, 0);
+  EXPECT_FALSE(record.crash_state.at(1).full_bio);
+  EXPECT_EQ(record.crash_state.at(1).bio_index, 5);
+  EXPECT_EQ(record.crash_state.at(1).bio_sector_index, 7);
+  EXPECT_TRUE(record.crash_state.at(2).full_bio);
+  EXPECT_EQ(record.crash_state.at(2).bio_index, 4);
+
+  ASSERT_EQ(reader.Next(record), 1);
+  EXPECT_EQ(record.suite, ResultSink::kTiming);
+  EXPECT_EQ(record.test_num, 3);
+  EXPECT_TRUE(record.crash_state.empty());
+
+  EXPECT_EQ(reader.Next(record), 0);
+}
+
+TEST(ResultSink, CompactCrashStates) {
+  const string path = TempFile();
+  SingleTestInfo test_info;
+  test_info.test_num = 1;
+  test_info.permute_data.last_checkpoint = 1;
+  for (unsigned int i = 0; i < 1000; ++i) {
+    test_info.permute_data.crash_state.push_back(Bio(i));
+  }
+
+  ResultSink sink;
+  ASSERT_EQ(sink.Open(path), 0);
+  ASSERT_EQ(sink.Write(ResultSink::kReordering, test_info), 0);
+  ASSERT_EQ(sink.Close(), 0);
+
+  // A byte per bio, a few for the rest of the record and the header.
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  EXPECT_LT(in.tellg(), 1000 + 32);
+  unlink(path.c_str());
+}
+
+TEST(ResultSink, RejectsBadFiles) {
+  const string path = TempFile();
+  ResultReader reader;
+  EXPECT_LT(reader.Open(path), 0);
+
+  {
+    ofstream out(path, std::ios::binary);
+    out << "not a result file";
+  }
+  EXPECT_LT(reader.Open(path), 0);
+
+  SingleTestInfo test_info;
+  test_info.test_num = 1;
+  test_info.permute_data.last_checkpoint = 1;
+  test_info.permute_data.crash_state = {Bio(1), Bio(2)};
+  ResultSink sink;
+  ASSERT_EQ(sink.Open(path), 0);
+  ASSERT_EQ(sink.Write(ResultSink::kReordering, test_info), 0);
+  ASSERT_EQ(sink.Close(), 0);
+  // Cut off the last bio.
+  ASSERT_EQ(truncate(path.c_str(), 8 + 7 + 1), 0);
+
+  ASSERT_EQ(reader.Open(path), 0);
+  ResultRecord record;
+  EXPECT_LT(reader.Next(record), 0);
+  unlink(path.c_str());
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,334 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/tests/JLangTestCase.h"
+#include "../../code/user_tools/api/workload.h"
+#include "../../code/user_tools/api/wrapper.h"
+#include "../../code/utils/DiskMod.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::tests::BaseTestCase;
+using fs_testing::tests::DataTestResult;
+using fs_testing::tests::JLangTestCase;
+using fs_testing::user_tools::api::CmFsOps;
+using fs_testing::user_tools::api::DefaultFsFns;
+using fs_testing::user_tools::api::FsFns;
+using fs_testing::user_tools::api::PassthroughCmFsOps;
+using fs_testing::user_tools::api::RecordCmFsOps;
+using fs_testing::user_tools::api::WriteData;
+using fs_testing::utils::DiskMod;
+
+namespace {
+
+const char kDefines[] =
+  "# define\n"
+  "test\n"
+  "A\n"
+  "foo\n"
+  "A/foo\n"
+  "\n"
+  "# declare\n"
+  "local_checkpoint\n"
+  "\n";
+
+const char kWorkload[] =
+  "# setup\n"
+  "mkdir A 0777\n"
+  "\n"
+  "# run\n"
+  "open Afoo O_RDWR|O_CREAT 0777\n"
+  "write Afoo 0 32768\n"
+  "falloc Afoo FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE 4096 4096\n"
+  "fsync Afoo\n"
+  "checkpoint 0\n"
+  "rename Afoo foo\n"
+  "sync\n"
+  "checkpoint 1\n"
+  "close Afoo\n";
+
+// Checkpoints always succeed without a harness to talk to.
+class NoHarnessFsFns : public DefaultFsFns {
+ public:
+  virtual int CmCheckpoint() override {
+    return 0;
+  }
+};
+
+// Lets tests run the workload with their own CmFsOps.
+class TestJLangTestCase : public JLangTestCase {
+ public:
+  void set_cm(CmFsOps *cm) {
+    cm_ = cm;
+  }
+};
+
+// Lets tests see the DiskMods recorded for a workload.
+class TestRecordCmFsOps : public RecordCmFsOps {
+ public:
+  TestRecordCmFsOps(FsFns *functions) : RecordCmFsOps(functions) { }
+
+  const vector<DiskMod> & mods() {
+    return mods_;
+  }
+};
+
+const char kRecordedWorkload[] =
+  "# define\n"
+  "test\n"
+  "A\n"
+  "B\n"
+  "A/foo\n"
+  "\n"
+  "# declare\n"
+  "local_checkpoint\n"
+  "\n"
+  "# setup\n"
+  "mkdir A 0777\n"
+  "\n"
+  "# run\n"
+  "mkdir B 0777\n"
+  "open Afoo O_RDWR|O_CREAT 0777\n"
+  "write Afoo 0 32768\n"
+  "falloc Afoo FALLOC_FL_KEEP_SIZE 32768 4096\n"
+  "fsync Afoo\n"
+  "checkpoint 1\n"
+  "close Afoo\n";
+
+// The run() cmAdapter.py generates for kRecordedWorkload.
+class GeneratedTestCase : public BaseTestCase {
+ public:
+  void set_cm(CmFsOps *cm) {
+    cm_ = cm;
+  }
+
+  virtual int setup() override {
+    return mkdir((mnt_dir_ + "/A").c_str(), 0777);
+  }
+
+  virtual int run(const int checkpoint) override {
+    const string B_path = mnt_dir_ + "/B";
+    const string Afoo_path = mnt_dir_ + "/A/foo";
+    int local_checkpoint = 0;
+
+    if (mkdir(B_path.c_str(), 0777) < 0) {
+      return errno;
+    }
+    int fd_Afoo = cm_->CmOpen(Afoo_path.c_str(), O_RDWR | O_CREAT, 0777);
+    if (fd_Afoo < 0) {
+      cm_->CmClose(fd_Afoo);
+      return errno;
+    }
+    if (WriteData(fd_Afoo, 0, 32768) < 0) {
+      cm_->CmClose(fd_Afoo);
+      return errno;
+    }
+    if (fallocate(fd_Afoo, FALLOC_FL_KEEP_SIZE, 32768, 4096) < 0) {
+      cm_->CmClose(fd_Afoo);
+      return errno;
+    }
+    if (cm_->CmFsync(fd_Afoo) < 0) {
+      return errno;
+    }
+    if (cm_->CmCheckpoint() < 0) {
+      return -1;
+    }
+    local_checkpoint += 1;
+    if (local_checkpoint == checkpoint) {
+      return 1;
+    }
+    if (cm_->CmClose(fd_Afoo) < 0) {
+      return errno;
+    }
+    return 0;
+  }
+
+  virtual int check_test(unsigned int /* last_checkpoint */,
+      DataTestResult * /* test_result */) override {
+    return 0;
+  }
+};
+
+// Checkpoints have no path.
+string RelativePath(const string &path, const string &dir) {
+  return (path.compare(0, dir.size(), dir) == 0) ?
+    path.substr(dir.size()) : path;
+}
+
+string TempDir() {
+  char *temp_dir = strdup("/tmp/jlang_testXXXXXX");
+  EXPECT_TRUE(mkdtemp(temp_dir) != NULL);
+  string res(temp_dir);
+  free(temp_dir);
+  return res;
+}
+
+}  // namespace
+
+TEST(JLangTestCase, ParsesOps) {
+  JLangTestCase tc;
+  ASSERT_EQ(0, tc.Parse(string(kDefines) + kWorkload));
+
+  ASSERT_EQ(1, tc.setup_ops().size());
+  EXPECT_EQ(JLangTestCase::kMkdir, tc.setup_ops().at(0).type);
+  EXPECT_EQ(0777, tc.setup_ops().at(0).mode);
+
+  ASSERT_EQ(9, tc.run_ops().size());
+  const JLangTestCase::JLangOp &open = tc.run_ops().at(0);
+  EXPECT_EQ(JLangTestCase::kOpen, open.type);
+  EXPECT_EQ(3, open.file);
+  EXPECT_EQ(O_RDWR | O_CREAT, open.flags);
+  EXPECT_EQ(0777, open.mode);
+
+  const JLangTestCase::JLangOp &falloc = tc.run_ops().at(2);
+  EXPECT_EQ(JLangTestCase::kFalloc, falloc.type);
+  EXPECT_EQ(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, falloc.flags);
+  EXPECT_EQ(4096, falloc.offset);
+  EXPECT_EQ(4096, falloc.len);
+
+  const JLangTestCase::JLangOp &rename = tc.run_ops().at(5);
+  EXPECT_EQ(JLangTestCase::kRename, rename.type);
+  EXPECT_EQ(3, rename.file);
+  EXPECT_EQ(2, rename.file2);
+
+  EXPECT_EQ(JLangTestCase::kCheckpoint, tc.run_ops().at(7).type);
+  EXPECT_EQ(1, tc.run_ops().at(7).ret);
+}
+
+TEST(JLangTestCase, RejectsBadOps) {
+  JLangTestCase tc;
+  // Unknown op.
+  EXPECT_GT(0, tc.Parse(string(kDefines) + "# run\nfrobnicate foo\n"));
+  // File that isn't defined.
+  EXPECT_GT(0, tc.Parse(string(kDefines) + "# run\nclose Bfoo\n"));
+  // Unknown flag.
+  EXPECT_GT(0, tc.Parse(string(kDefines) + "# run\nopen foo O_BOGUS 0777\n"));
+  // Wrong number of arguments.
+  EXPECT_GT(0, tc.Parse(string(kDefines) + "# run\nwrite foo 0\n"));
+}
+
+TEST(JLangTestCase, SetupKey) {
+  JLangTestCase tc1;
+  ASSERT_EQ(0, tc1.Parse(string(kDefines) + kWorkload));
+  JLangTestCase tc2;
+  ASSERT_EQ(0, tc2.Parse(string(kDefines) + "# setup\nmkdir A 0777\n"
+        "# run\nsync\ncheckpoint 1\n"));
+  JLangTestCase tc3;
+  ASSERT_EQ(0, tc3.Parse(string(kDefines) + "# run\nsync\ncheckpoint 1\n"));
+
+  // Only the setup section matters.
+  EXPECT_EQ(tc1.setup_key(), tc2.setup_key());
+  EXPECT_NE(tc1.setup_key(), tc3.setup_key());
+}
+
+TEST(JLangTestCase, RunsWorkload) {
+  const string mnt_dir = TempDir();
+  const string path = mnt_dir + "/workload";
+  {
+    ofstream workload(path);
+    workload << kDefines << kWorkload;
+  }
+  ASSERT_EQ(0, setenv(fs_testing::tests::kJLangFileEnv, path.c_str(), 1));
+
+  TestJLangTestCase tc;
+  ASSERT_EQ(0, tc.init_values(mnt_dir, 0));
+  ASSERT_EQ(0, tc.setup());
+
+  NoHarnessFsFns fns;
+  PassthroughCmFsOps cm(&fns);
+  tc.set_cm(&cm);
+  // Stops at the second checkpoint and returns its value.
+  EXPECT_EQ(1, tc.run(2));
+
+  struct stat st;
+  ASSERT_EQ(0, stat((mnt_dir + "/foo").c_str(), &st));
+  EXPECT_EQ(32768, st.st_size);
+  EXPECT_NE(0, stat((mnt_dir + "/A/foo").c_str(), &st));
+
+  // Same data the generated test cases write, with a hole punched in it.
+  char buf[32];
+  const int fd = open((mnt_dir + "/foo").c_str(), O_RDONLY);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ(sizeof(buf), pread(fd, buf, sizeof(buf), 8192 + 5));
+  EXPECT_EQ(0, memcmp(buf, "fghijklmnopqrstuvwxyz123456abcde", sizeof(buf)));
+  ASSERT_EQ(1, pread(fd, buf, 1, 4096 + 5));
+  EXPECT_EQ(0, buf[0]);
+  close(fd);
+
+  // The directory comes from setup, so run alone fails at the first open.
+  unlink((mnt_dir + "/foo").c_str());
+  rmdir((mnt_dir + "/A").c_str());
+  EXPECT_EQ(ENOENT, tc.run(0));
+
+  unlink(path.c_str());
+  rmdir(mnt_dir.c_str());
+}
+
+/*
+ * The harness checks crash states against the DiskMods a workload records, so
+ * running a j-lang file must record exactly what its generated test case does.
+ */
+TEST(JLangTestCase, RecordsSameModsAsGenerated) {
+  NoHarnessFsFns fns;
+
+  const string jlang_dir = TempDir();
+  const string path = jlang_dir + "/workload";
+  {
+    ofstream workload(path);
+    workload << kRecordedWorkload;
+  }
+  ASSERT_EQ(0, setenv(fs_testing::tests::kJLangFileEnv, path.c_str(), 1));
+  TestJLangTestCase jlang;
+  ASSERT_EQ(0, jlang.init_values(jlang_dir, 0));
+  ASSERT_EQ(0, jlang.setup());
+  TestRecordCmFsOps jlang_cm(&fns);
+  jlang.set_cm(&jlang_cm);
+  ASSERT_EQ(0, jlang.run(0));
+
+  const string generated_dir = TempDir();
+  GeneratedTestCase generated;
+  ASSERT_EQ(0, generated.init_values(generated_dir, 0));
+  ASSERT_EQ(0, generated.setup());
+  TestRecordCmFsOps generated_cm(&fns);
+  generated.set_cm(&generated_cm);
+  ASSERT_EQ(0, generated.run(0));
+
+  const vector<DiskMod> &expected = generated_cm.mods();
+  const vector<DiskMod> &actual = jlang_cm.mods();
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(expected.size(), actual.size());
+  for (unsigned int i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected.at(i).mod_type, actual.at(i).mod_type) << i;
+    EXPECT_EQ(expected.at(i).mod_opts, actual.at(i).mod_opts) << i;
+    EXPECT_EQ(RelativePath(expected.at(i).path, generated_dir),
+        RelativePath(actual.at(i).path, jlang_dir)) << i;
+    EXPECT_EQ(expected.at(i).file_mod_location,
+        actual.at(i).file_mod_location) << i;
+    EXPECT_EQ(expected.at(i).file_mod_len, actual.at(i).file_mod_len) << i;
+  }
+
+  for (const string &dir : {jlang_dir, generated_dir}) {
+    unlink((dir + "/A/foo").c_str());
+    rmdir((dir + "/A").c_str());
+    rmdir((dir + "/B").c_str());
+  }
+  unlink(path.c_str());
+  rmdir(jlang_dir.c_str());
+  rmdir(generated_dir.c_str());
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "../../code/user_tools/api/wrapper.h"
+#include "../utils/BenchmarkUtils.h"
+
+namespace fs_testing {
+namespace user_tools {
+namespace test {
+
+using std::string;
+using std::unique_ptr;
+
+using fs_testing::test::GetNumAllocations;
+using fs_testing::test::ReportMemory;
+
+using fs_testing::user_tools::api::CmFsOps;
+using fs_testing::user_tools::api::DefaultFsFns;
+using fs_testing::user_tools::api::PassthroughCmFsOps;
+using fs_testing::user_tools::api::RecordCmFsOps;
+
+/*
+ * Measures what recording adds to each file system operation a workload makes
+ * by running the same operations through RecordCmFsOps and PassthroughCmFsOps
+ * on a file in /tmp. Recorded mods are streamed to /dev/null so memory use
+ * stays flat however long the benchmark runs.
+ */
+
+namespace {
+
+// Writes cycle over this much of the file so it doesn't grow without bound.
+const off_t kFileSpan = 1024 * 1024;
+const int kRecord = 0;
+const int kPassthrough = 1;
+
+class CmFsOpsFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    char path[] = "/tmp/CmFsOpsBenchmark.XXXXXX";
+    const int tmp = mkstemp(path);
+    if (tmp >= 0) {
+      close(tmp);
+    }
+    path_ = path;
+    null_fd_ = open("/dev/null", O_WRONLY);
+
+    if (state.range(0) == kRecord) {
+      ops_.reset(new RecordCmFsOps(&fns_, null_fd_, false));
+    } else {
+      ops_.reset(new PassthroughCmFsOps(&fns_));
+    }
+    fd_ = ops_->CmOpen(path_, O_RDWR);
+    buf_ = string(state.range(1), 'a');
+  }
+
+  void TearDown(const benchmark::State &) override {
+    ops_->CmClose(fd_);
+    ops_.reset();
+    close(null_fd_);
+    unlink(path_.c_str());
+  }
+
+ protected:
+  DefaultFsFns fns_;
+  unique_ptr<CmFsOps> ops_;
+  string path_;
+  string buf_;
+  int fd_ = -1;
+  int null_fd_ = -1;
+};
+
+void ModeLabel(benchmark::State &state) {
+  state.SetLabel(state.range(0) == kRecord ? "record" : "passthrough");
+}
+
+}  // namespace
+
+BENCHMARK_DEFINE_F(CmFsOpsFixture, Pwrite)(benchmark::State &state) {
+  const size_t len = buf_.size();
+  off_t offset = 0;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ops_->CmPwrite(fd_, buf_.data(), len, offset));
+    offset = (offset + len) % kFileSpan;
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+  ReportMemory(state, allocs);
+  ModeLabel(state);
+}
+
+BENCHMARK_DEFINE_F(CmFsOpsFixture, Write)(benchmark::State &state) {
+  const size_t len = buf_.size();
+  off_t offset = 0;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ops_->CmWrite(fd_, buf_.data(), len));
+    offset += len;
+    if (offset >= kFileSpan) {
+      // Untimed so that only writes are measured.
+      state.PauseTiming();
+      ops_->CmLseek(fd_, 0, SEEK_SET);
+      offset = 0;
+      state.ResumeTiming();
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+  ReportMemory(state, allocs);
+  ModeLabel(state);
+}
+
+BENCHMARK_DEFINE_F(CmFsOpsFixture, Fallocate)(benchmark::State &state) {
+  const off_t len = state.range(1);
+  off_t offset = 0;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ops_->CmFallocate(fd_, 0, offset, len));
+    offset = (offset + len) % kFileSpan;
+  }
+  ReportMemory(state, allocs);
+  ModeLabel(state);
+}
+
+BENCHMARK_REGISTER_F(CmFsOpsFixture, Pwrite)
+  ->ArgsProduct({{kRecord, kPassthrough}, {64, 4096, 65536}});
+BENCHMARK_REGISTER_F(CmFsOpsFixture, Write)
+  ->ArgsProduct({{kRecord, kPassthrough}, {64, 4096, 65536}});
+BENCHMARK_REGISTER_F(CmFsOpsFixture, Fallocate)
+  ->ArgsProduct({{kRecord, kPassthrough}, {4096}});
+
+}  // namespace test
+}  // namespace user_tools
+}  // namespace fs_testing
+
+BENCHMARK_MAIN();
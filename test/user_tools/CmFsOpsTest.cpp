@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -99,6 +100,10 @@ class FakeFsFns : public FsFns {
 	}
 
   virtual int FnStat(const string &pathname, struct stat *buf) override {
+    return FnFstat(-1, buf);
+  }
+
+  virtual int FnFstat(const int fd, struct stat *buf) override {
     // Clear buffer since the user may have left junk in it.
     memset(buf, 0, sizeof(struct stat));
 
@@ -168,6 +173,7 @@ class MockFsFns : public FsFns {
   MOCK_METHOD1(FnRemove, int(const std::string &pathname));
 
   MOCK_METHOD2(FnStat, int(const std::string &pathname, struct stat *buf));
+  MOCK_METHOD2(FnFstat, int(const int fd, struct stat *buf));
   MOCK_METHOD1(FnPathExists, bool(const std::string &pathname));
 
   MOCK_METHOD1(FnFsync, int(const int fd));
@@ -181,6 +187,8 @@ class MockFsFns : public FsFns {
   void DelegateToFake() {
     ON_CALL(*this, FnStat(::testing::_, NotNull()))
       .WillByDefault(Invoke(&fake, &FakeFsFns::FnStat));
+    ON_CALL(*this, FnFstat(::testing::_, NotNull()))
+      .WillByDefault(Invoke(&fake, &FakeFsFns::FnFstat));
   }
 
   FakeFsFns fake;
@@ -189,13 +197,26 @@ class MockFsFns : public FsFns {
 class TestCmFsOps : public RecordCmFsOps {
  public:
   TestCmFsOps(FsFns *functions) : RecordCmFsOps(functions) { }
+  TestCmFsOps(FsFns *functions, const int change_fd, const bool hash_data) :
+    RecordCmFsOps(functions, change_fd, hash_data) { }
 
   vector<DiskMod> * GetMods() {
     return &mods_;
   }
 
-  unordered_map<int, string> * GetFdMap() {
-    return &fd_map_;
+  /*
+   * Paths of the open file descriptors.
+   */
+  unordered_map<int, string> GetFdMap() {
+    unordered_map<int, string> res;
+    for (const auto &kv : fd_map_) {
+      res.insert({kv.first, kv.second.path});
+    }
+    return res;
+  }
+
+  off_t GetOffset(const int fd) {
+    return fd_map_.at(fd).offset;
   }
 
   unordered_map<long long,
@@ -207,8 +228,9 @@ class TestCmFsOps : public RecordCmFsOps {
    * Add a fake fd->pathname mapping so the code can use this for things like
    * stat operations.
    */
-  void AddFdMapping(const int fd, const string &pathname) {
-    fd_map_.insert({fd, pathname});
+  void AddFdMapping(const int fd, const string &pathname,
+      const off_t offset = 0, const bool append = false) {
+    fd_map_.insert({fd, {pathname, offset, append}});
   }
 
   /*
@@ -252,16 +274,16 @@ TEST(CmFsOps, OpenTrunc) {
   MockFsFns mock;
   EXPECT_CALL(mock, FnPathExists(pathname.c_str())).WillOnce(Return(true));
   EXPECT_CALL(mock, FnOpen(pathname, flags)).WillOnce(Return(expected_fd));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull()));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
 
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, expected_fd);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_EQ(fd_map->size(), 1);
-  EXPECT_EQ(fd_map->at(fd), pathname);
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_EQ(fd_map.size(), 1);
+  EXPECT_EQ(fd_map.at(fd), pathname);
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_EQ(mods->size(), 1);
@@ -289,8 +311,8 @@ TEST(CmFsOps, OpenTruncNoFile) {
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, -1);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_TRUE(fd_map->empty());
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_TRUE(fd_map.empty());
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_TRUE(mods->empty());
@@ -316,9 +338,9 @@ TEST(CmFsOps, OpenCreatExists) {
 
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, expected_fd);
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_EQ(fd_map->size(), 1);
-  EXPECT_EQ(fd_map->at(fd), pathname);
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_EQ(fd_map.size(), 1);
+  EXPECT_EQ(fd_map.at(fd), pathname);
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_TRUE(mods->empty());
@@ -338,16 +360,16 @@ TEST(CmFsOps, OpenCreatNew) {
   MockFsFns mock;
   EXPECT_CALL(mock, FnPathExists(pathname.c_str())).WillOnce(Return(false));
   EXPECT_CALL(mock, FnOpen(pathname, flags)).WillOnce(Return(expected_fd));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull()));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
 
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, expected_fd);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_EQ(fd_map->size(), 1);
-  EXPECT_EQ(fd_map->at(fd), pathname);
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_EQ(fd_map.size(), 1);
+  EXPECT_EQ(fd_map.at(fd), pathname);
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_EQ(mods->size(), 1);
@@ -370,16 +392,16 @@ TEST(CmFsOps, OpenCreatTruncNew) {
   MockFsFns mock;
   EXPECT_CALL(mock, FnPathExists(pathname.c_str())).WillOnce(Return(false));
   EXPECT_CALL(mock, FnOpen(pathname, flags)).WillOnce(Return(expected_fd));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull()));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
 
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, expected_fd);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_EQ(fd_map->size(), 1);
-  EXPECT_EQ(fd_map->at(fd), pathname);
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_EQ(fd_map.size(), 1);
+  EXPECT_EQ(fd_map.at(fd), pathname);
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_EQ(mods->size(), 1);
@@ -402,16 +424,16 @@ TEST(CmFsOps, OpenCreatTrunc) {
   MockFsFns mock;
   EXPECT_CALL(mock, FnPathExists(pathname.c_str())).WillOnce(Return(true));
   EXPECT_CALL(mock, FnOpen(pathname, flags)).WillOnce(Return(expected_fd));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull()));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
 
   const int fd = ops.CmOpen(pathname, flags);
   EXPECT_EQ(fd, expected_fd);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_EQ(fd_map->size(), 1);
-  EXPECT_EQ(fd_map->at(fd), pathname);
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_EQ(fd_map.size(), 1);
+  EXPECT_EQ(fd_map.at(fd), pathname);
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_EQ(mods->size(), 1);
@@ -437,8 +459,8 @@ TEST(CmFsOps, CloseGoodFd) {
   const int close_res = ops.CmClose(expected_fd);
   EXPECT_EQ(close_res, 0);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_TRUE(fd_map->empty());
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_TRUE(fd_map.empty());
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_TRUE(mods->empty());
@@ -459,8 +481,8 @@ TEST(CmFsOps, CloseBadFd) {
   const int close_res = ops.CmClose(expected_fd);
   EXPECT_EQ(close_res, -1);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_TRUE(fd_map->empty());
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_TRUE(fd_map.empty());
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_TRUE(mods->empty());
@@ -479,13 +501,11 @@ TEST(CmFsOps, WriteNoData) {
   MockFsFns mock;
   mock.DelegateToFake();
 
-  mock.fake.file_sizes.emplace_back(write_size >> 1);
   mock.fake.file_sizes.emplace_back(write_size >> 1);
 
-  EXPECT_CALL(mock, FnLseek(expected_fd, 0, SEEK_CUR)).WillOnce(Return(0));
   EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
     .WillOnce(Return(0));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull())).Times(2);
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
   ops.AddFdMapping(expected_fd, pathname);
@@ -516,8 +536,8 @@ TEST(CmFsOps, CheckpointGood) {
   const int checkpoint_res = ops.CmCheckpoint();
   EXPECT_EQ(checkpoint_res, 0);
 
-  unordered_map<int, string> *fd_map = ops.GetFdMap();
-  EXPECT_TRUE(fd_map->empty());
+  const unordered_map<int, string> fd_map = ops.GetFdMap();
+  EXPECT_TRUE(fd_map.empty());
 
   vector<DiskMod> *mods = ops.GetMods();
   EXPECT_EQ(mods->size(), 1);
@@ -688,12 +708,10 @@ TEST_P(TestCmFsOpsParameterized, WriteFileExtendZeroOffset) {
   mock.DelegateToFake();
 
   mock.fake.file_sizes.emplace_back(0);
-  mock.fake.file_sizes.emplace_back(write_size);
 
-  EXPECT_CALL(mock, FnLseek(expected_fd, 0, SEEK_CUR)).WillOnce(Return(0));
   EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
     .WillOnce(Return(write_size));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull())).Times(2);
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
   ops.AddFdMapping(expected_fd, pathname);
@@ -725,13 +743,11 @@ TEST_P(TestCmFsOpsParameterized, WriteFileNoExtendZeroOffset) {
   MockFsFns mock;
   mock.DelegateToFake();
 
-  mock.fake.file_sizes.emplace_back(kTestDataSize + (kTestDataSize >> 1));
   mock.fake.file_sizes.emplace_back(kTestDataSize + (kTestDataSize >> 1));
 
-  EXPECT_CALL(mock, FnLseek(expected_fd, 0, SEEK_CUR)).WillOnce(Return(0));
   EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
     .WillOnce(Return(write_size));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull())).Times(2);
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
   ops.AddFdMapping(expected_fd, pathname);
@@ -765,16 +781,13 @@ TEST_P(TestCmFsOpsParameterized, WriteFileExtendNonZeroOffset) {
   mock.DelegateToFake();
 
   mock.fake.file_sizes.emplace_back(start_offset);
-  mock.fake.file_sizes.emplace_back(start_offset + write_size);
 
-  EXPECT_CALL(mock, FnLseek(expected_fd, 0, SEEK_CUR))
-    .WillOnce(Return(start_offset));
   EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
     .WillOnce(Return(write_size));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull())).Times(2);
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
-  ops.AddFdMapping(expected_fd, pathname);
+  ops.AddFdMapping(expected_fd, pathname, start_offset);
 
   ops.CmWrite(expected_fd, kTestData, kTestDataSize);
 
@@ -804,17 +817,14 @@ TEST_P(TestCmFsOpsParameterized, WriteFileNoExtendNonZeroOffset) {
   MockFsFns mock;
   mock.DelegateToFake();
 
-  mock.fake.file_sizes.emplace_back(kTestDataSize << 1);
-  mock.fake.file_sizes.emplace_back(kTestDataSize << 1);
+  mock.fake.file_sizes.emplace_back(kTestDataSize << 2);
 
-  EXPECT_CALL(mock, FnLseek(expected_fd, 0, SEEK_CUR))
-    .WillOnce(Return(start_offset));
   EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
     .WillOnce(Return(write_size));
-  EXPECT_CALL(mock, FnStat(pathname, NotNull())).Times(2);
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
 
   TestCmFsOps ops(&mock);
-  ops.AddFdMapping(expected_fd, pathname);
+  ops.AddFdMapping(expected_fd, pathname, start_offset);
 
   ops.CmWrite(expected_fd, kTestData, kTestDataSize);
 
@@ -829,6 +839,77 @@ TEST_P(TestCmFsOpsParameterized, WriteFileNoExtendNonZeroOffset) {
   EXPECT_FALSE(strncmp(mods->at(0).file_mod_data.get(), kTestData, write_size));
 }
 
+/*
+ * Test that consecutive writes results in
+ *    - each DiskMod starting where the last write or lseek left the file offset
+ *    - no calls to lseek other than the one the user made
+ */
+TEST(CmFsOps, WriteTracksOffset) {
+  const string pathname = "/mnt/snapshot/bleh";
+  const unsigned int expected_fd = 1;
+  const off_t seek_offset = 100;
+
+  MockFsFns mock;
+  mock.DelegateToFake();
+  mock.fake.file_sizes.emplace_back(0);
+  mock.fake.file_sizes.emplace_back(seek_offset + kTestDataSize);
+
+  EXPECT_CALL(mock, FnLseek(expected_fd, seek_offset, SEEK_SET))
+    .WillOnce(Return(seek_offset));
+  EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
+    .Times(2)
+    .WillRepeatedly(Return(kTestDataSize));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull())).Times(2);
+
+  TestCmFsOps ops(&mock);
+  ops.AddFdMapping(expected_fd, pathname);
+
+  EXPECT_EQ(seek_offset, ops.CmLseek(expected_fd, seek_offset, SEEK_SET));
+  ops.CmWrite(expected_fd, kTestData, kTestDataSize);
+  ops.CmWrite(expected_fd, kTestData, kTestDataSize);
+  EXPECT_EQ(seek_offset + 2 * kTestDataSize, ops.GetOffset(expected_fd));
+
+  vector<DiskMod> *mods = ops.GetMods();
+  ASSERT_EQ(mods->size(), 2);
+  EXPECT_EQ(mods->at(0).mod_type, DiskMod::kDataMetadataMod);
+  EXPECT_EQ(mods->at(0).file_mod_location, seek_offset);
+  EXPECT_EQ(mods->at(0).post_mod_stats.st_size, seek_offset + kTestDataSize);
+  EXPECT_EQ(mods->at(1).mod_type, DiskMod::kDataMetadataMod);
+  EXPECT_EQ(mods->at(1).file_mod_location, seek_offset + kTestDataSize);
+  EXPECT_EQ(mods->at(1).post_mod_stats.st_size,
+      seek_offset + 2 * kTestDataSize);
+}
+
+/*
+ * Test that writing to a file opened with O_APPEND results in
+ *    - a DiskMod starting at the end of the file, wherever the offset was
+ */
+TEST(CmFsOps, WriteAppend) {
+  const string pathname = "/mnt/snapshot/bleh";
+  const unsigned int expected_fd = 1;
+  const unsigned int file_size = 4096;
+
+  MockFsFns mock;
+  mock.DelegateToFake();
+  mock.fake.file_sizes.emplace_back(file_size);
+
+  EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
+    .WillOnce(Return(kTestDataSize));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
+
+  TestCmFsOps ops(&mock);
+  ops.AddFdMapping(expected_fd, pathname, 0, true);
+
+  ops.CmWrite(expected_fd, kTestData, kTestDataSize);
+  EXPECT_EQ(file_size + kTestDataSize, ops.GetOffset(expected_fd));
+
+  vector<DiskMod> *mods = ops.GetMods();
+  ASSERT_EQ(mods->size(), 1);
+  EXPECT_EQ(mods->at(0).mod_type, DiskMod::kDataMetadataMod);
+  EXPECT_EQ(mods->at(0).file_mod_location, file_size);
+  EXPECT_EQ(mods->at(0).file_mod_len, kTestDataSize);
+}
+
 /*
  * Test that calling mmap with PROT_WRITE and one of the flags that make it not
  * write changes back to disk causes
@@ -900,6 +981,173 @@ TEST_P(TestCmFsOpsMmapAdd, ShouldStore) {
   EXPECT_EQ(std::get<2>(mmap_value), length);
 }
 
+/*
+ * Reads back everything written to a change file by a RecordCmFsOps that
+ * streams its DiskMods.
+ */
+vector<DiskMod> ReadChangeFile(const int fd) {
+  vector<DiskMod> res;
+  const off_t size = lseek(fd, 0, SEEK_END);
+  EXPECT_GE(size, 0);
+  shared_ptr<char> contents(new char[size], [](char *c) {delete[] c;});
+  EXPECT_EQ(size, pread(fd, contents.get(), size, 0));
+
+  off_t offset = 0;
+  while (offset < size) {
+    const uint64_t mod_size =
+      DiskMod::GetSerializedSize(contents.get() + offset);
+    EXPECT_LE(offset + mod_size, size);
+    res.emplace_back();
+    EXPECT_EQ(0, DiskMod::Deserialize(
+          shared_ptr<char>(contents, contents.get() + offset), res.back()));
+    offset += mod_size;
+  }
+  return res;
+}
+
+int TempChangeFile() {
+  char *temp_file = strdup("/tmp/cm_changesXXXXXX");
+  const int fd = mkstemp(temp_file);
+  EXPECT_GE(fd, 0);
+  unlink(temp_file);
+  free(temp_file);
+  return fd;
+}
+
+/*
+ * Test that a RecordCmFsOps given a change file writes DiskMods to it as they
+ * happen instead of holding onto them.
+ */
+TEST(TestCmFsOpsStream, StreamsMods) {
+  const string pathname = "/mnt/snapshot/bleh";
+  const unsigned int expected_fd = 1;
+  const int change_fd = TempChangeFile();
+
+  MockFsFns mock;
+  mock.DelegateToFake();
+  mock.fake.file_sizes.emplace_back(0);
+
+  EXPECT_CALL(mock, FnWrite(expected_fd, kTestData, kTestDataSize))
+    .WillOnce(Return(kTestDataSize));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
+
+  TestCmFsOps ops(&mock, change_fd, false);
+  ops.AddFdMapping(expected_fd, pathname);
+  ops.CmWrite(expected_fd, kTestData, kTestDataSize);
+  ops.CmSync();
+
+  EXPECT_TRUE(ops.GetMods()->empty());
+  EXPECT_EQ(0, ops.Serialize(change_fd));
+
+  const vector<DiskMod> mods = ReadChangeFile(change_fd);
+  close(change_fd);
+  ASSERT_EQ(2, mods.size());
+  EXPECT_EQ(DiskMod::kDataMetadataMod, mods.at(0).mod_type);
+  EXPECT_EQ(pathname, mods.at(0).path);
+  EXPECT_EQ(kTestDataSize, mods.at(0).file_mod_len);
+  EXPECT_FALSE(mods.at(0).file_mod_data_hashed);
+  EXPECT_EQ(0,
+      memcmp(mods.at(0).file_mod_data.get(), kTestData, kTestDataSize));
+  EXPECT_EQ(DiskMod::kSyncMod, mods.at(1).mod_type);
+}
+
+/*
+ * Test that hashing mod data replaces the data of large writes with per-block
+ * digests in the streamed DiskMod while small writes keep their data.
+ */
+TEST(TestCmFsOpsStream, HashesModData) {
+  const string pathname = "/mnt/snapshot/bleh";
+  const unsigned int expected_fd = 1;
+  const unsigned int large_size = (2 * DiskMod::kDigestBlockSize) + 100;
+  const int change_fd = TempChangeFile();
+  vector<char> large_data(large_size);
+  for (unsigned int i = 0; i < large_size; ++i) {
+    large_data.at(i) = i % 251;
+  }
+
+  MockFsFns mock;
+  mock.DelegateToFake();
+  mock.fake.file_sizes.emplace_back(large_size);
+  mock.fake.file_sizes.emplace_back(large_size);
+
+  EXPECT_CALL(mock, FnPwrite(expected_fd, kTestData, kTestDataSize, 0))
+    .WillOnce(Return(kTestDataSize));
+  EXPECT_CALL(mock, FnPwrite(expected_fd, large_data.data(), large_size, 0))
+    .WillOnce(Return(large_size));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull())).Times(2);
+
+  TestCmFsOps ops(&mock, change_fd, true);
+  ops.AddFdMapping(expected_fd, pathname);
+  ops.CmPwrite(expected_fd, kTestData, kTestDataSize, 0);
+  ops.CmPwrite(expected_fd, large_data.data(), large_size, 0);
+  EXPECT_EQ(0, ops.Serialize(change_fd));
+
+  const vector<DiskMod> mods = ReadChangeFile(change_fd);
+  close(change_fd);
+  ASSERT_EQ(2, mods.size());
+
+  EXPECT_EQ(DiskMod::kDataMod, mods.at(0).mod_type);
+  EXPECT_EQ(kTestDataSize, mods.at(0).file_mod_len);
+  EXPECT_FALSE(mods.at(0).file_mod_data_hashed);
+  EXPECT_EQ(0,
+      memcmp(mods.at(0).file_mod_data.get(), kTestData, kTestDataSize));
+
+  EXPECT_EQ(DiskMod::kDataMod, mods.at(1).mod_type);
+  EXPECT_EQ(large_size, mods.at(1).file_mod_len);
+  EXPECT_TRUE(mods.at(1).file_mod_data_hashed);
+  EXPECT_EQ(nullptr, mods.at(1).file_mod_data.get());
+  ASSERT_EQ(3, mods.at(1).file_mod_digests.size());
+  EXPECT_EQ(DiskMod::HashData(large_data.data(), DiskMod::kDigestBlockSize),
+      mods.at(1).file_mod_digests.at(0));
+  EXPECT_EQ(DiskMod::HashData(
+        large_data.data() + DiskMod::kDigestBlockSize,
+        DiskMod::kDigestBlockSize),
+      mods.at(1).file_mod_digests.at(1));
+  EXPECT_EQ(DiskMod::HashData(
+        large_data.data() + (2 * DiskMod::kDigestBlockSize), 100),
+      mods.at(1).file_mod_digests.at(2));
+}
+
+/*
+ * Test that mods without file data are held back and written in one batch
+ * with the next mod that has file data, or by Serialize.
+ */
+TEST(TestCmFsOpsStream, BatchesModsWithoutData) {
+  const string pathname = "/mnt/snapshot/bleh";
+  const unsigned int expected_fd = 1;
+  const int change_fd = TempChangeFile();
+
+  MockFsFns mock;
+  mock.DelegateToFake();
+  mock.fake.file_sizes.emplace_back(kTestDataSize);
+
+  EXPECT_CALL(mock, FnPwrite(expected_fd, kTestData, kTestDataSize, 0))
+    .WillOnce(Return(kTestDataSize));
+  EXPECT_CALL(mock, FnFstat(expected_fd, NotNull()));
+
+  TestCmFsOps ops(&mock, change_fd, false);
+  ops.AddFdMapping(expected_fd, pathname);
+  ops.CmSync();
+  ops.CmSync();
+  EXPECT_EQ(0, lseek(change_fd, 0, SEEK_END));
+
+  ops.CmPwrite(expected_fd, kTestData, kTestDataSize, 0);
+  ops.CmSync();
+  vector<DiskMod> mods = ReadChangeFile(change_fd);
+  ASSERT_EQ(3, mods.size());
+  EXPECT_EQ(DiskMod::kSyncMod, mods.at(0).mod_type);
+  EXPECT_EQ(DiskMod::kSyncMod, mods.at(1).mod_type);
+  EXPECT_EQ(DiskMod::kDataMod, mods.at(2).mod_type);
+  EXPECT_EQ(0,
+      memcmp(mods.at(2).file_mod_data.get(), kTestData, kTestDataSize));
+
+  EXPECT_EQ(0, ops.Serialize(change_fd));
+  mods = ReadChangeFile(change_fd);
+  close(change_fd);
+  ASSERT_EQ(4, mods.size());
+  EXPECT_EQ(DiskMod::kSyncMod, mods.at(3).mod_type);
+}
+
 INSTANTIATE_TEST_CASE_P(WriteSizes, TestCmFsOpsParameterized,
     ::testing::Values(
       kTestDataSize,
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "../../code/disk_wrapper_ioctl.h"
+
+namespace {
+
+std::atomic<uint64_t> num_allocations(0);
+
+void * CountedAlloc(const std::size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  // malloc(0) may return NULL, which operator new isn't allowed to.
+  return malloc(size == 0 ? 1 : size);
+}
+
+}  // namespace
+
+void * operator new(std::size_t size) {
+  void *res = CountedAlloc(size);
+  if (res == NULL) {
+    throw std::bad_alloc();
+  }
+  return res;
+}
+
+void * operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return CountedAlloc(size);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return CountedAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  free(ptr);
+}
+
+namespace fs_testing {
+namespace test {
+
+using std::mt19937;
+using std::uniform_int_distribution;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteArena;
+
+namespace {
+
+const unsigned int kKernelSectorSize = 512;
+
+}  // namespace
+
+uint64_t GetNumAllocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
+void ReportMemory(benchmark::State &state, const uint64_t allocs_before) {
+  state.counters["allocs/op"] = benchmark::Counter(
+      GetNumAllocations() - allocs_before, benchmark::Counter::kAvgIterations);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    // ru_maxrss is in KiB on Linux.
+    state.counters["peak_rss_MiB"] = usage.ru_maxrss / 1024.0;
+  }
+}
+
+vector<disk_write> MakeSyntheticLog(const SyntheticLogShape &shape,
+    DiskWriteArena &arena) {
+  vector<disk_write> res;
+  res.reserve(shape.num_writes +
+      shape.num_writes / (shape.epoch_size * shape.checkpoint_every) + 1);
+
+  // Every write shares the same data. Only the size of it matters to the code
+  // being measured.
+  char *data = arena.Allocate(shape.write_size);
+  memset(data, 'a', shape.write_size);
+
+  mt19937 rand(42);
+  uniform_int_distribution<unsigned int> percent(0, 99);
+  const unsigned int sectors_per_write =
+    (shape.write_size + kKernelSectorSize - 1) / kKernelSectorSize;
+
+  // Sectors written so far in the current epoch, to pick overlaps from.
+  vector<unsigned long> epoch_sectors;
+  unsigned long next_sector = 0;
+  unsigned int num_epochs = 0;
+  unsigned int num_checkpoints = 0;
+
+  for (unsigned int i = 0; i < shape.num_writes; ++i) {
+    disk_write_op_meta meta;
+    meta.bi_flags = 0;
+    meta.bi_rw = HWM_WRITE_FLAG;
+    meta.size = shape.write_size;
+    meta.time_ns = i;
+
+    if (!epoch_sectors.empty() && percent(rand) < shape.overlap_percent) {
+      uniform_int_distribution<unsigned int> pick(0, epoch_sectors.size() - 1);
+      meta.write_sector = epoch_sectors.at(pick(rand));
+    } else {
+      meta.write_sector = next_sector;
+      next_sector += sectors_per_write;
+    }
+    epoch_sectors.push_back(meta.write_sector);
+
+    const bool ends_epoch = (i + 1) % shape.epoch_size == 0;
+    if (ends_epoch) {
+      meta.bi_rw |= HWM_FLUSH_FLAG | HWM_FUA_FLAG;
+    }
+    res.emplace_back(meta, data);
+
+    if (!ends_epoch) {
+      continue;
+    }
+    epoch_sectors.clear();
+    ++num_epochs;
+    if (shape.checkpoint_every > 0 &&
+        num_epochs % shape.checkpoint_every == 0) {
+      disk_write_op_meta checkpoint;
+      checkpoint.bi_flags = 0;
+      checkpoint.bi_rw = HWM_CHECKPOINT_FLAG;
+      checkpoint.write_sector = ++num_checkpoints;
+      checkpoint.size = 0;
+      checkpoint.time_ns = i;
+      res.emplace_back(checkpoint, (const char *) NULL);
+    }
+  }
+
+  return res;
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,55 @@
+#ifndef TEST_UTILS_BENCHMARK_UTILS_H
+#define TEST_UTILS_BENCHMARK_UTILS_H
+
+#include <cstdint>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../../code/utils/utils.h"
+
+namespace fs_testing {
+namespace test {
+
+/*
+ * Helpers shared by the Google Benchmark suites. Linking BenchmarkUtils.cpp
+ * into a benchmark replaces the global operator new and delete with versions
+ * that count allocations, so each benchmark can report allocations per
+ * iteration alongside its timing.
+ */
+
+// Number of calls to operator new (any form) since the program started.
+uint64_t GetNumAllocations();
+
+/*
+ * Set the allocs/op and peak_rss_MiB counters of state. allocs_before is what
+ * GetNumAllocations returned before the benchmark loop started. Peak RSS is
+ * for the whole process, so it only grows across the benchmarks in a run.
+ */
+void ReportMemory(benchmark::State &state, const uint64_t allocs_before);
+
+/*
+ * Shape of a synthetic block IO log like the ones the disk wrapper records.
+ * Writes are grouped into epochs of epoch_size writes, the last of which
+ * carries a flush. overlap_percent of the writes in each epoch go to a sector
+ * already written in that epoch, the rest go to new sectors following the
+ * previous write. Every checkpoint_every epochs a checkpoint is added.
+ */
+struct SyntheticLogShape {
+  unsigned int num_writes;
+  unsigned int epoch_size;
+  unsigned int overlap_percent;
+  unsigned int write_size;
+  unsigned int checkpoint_every;
+};
+
+// Build a log of the given shape with data placed in arena. The same shape
+// always gives the same log.
+std::vector<fs_testing::utils::disk_write> MakeSyntheticLog(
+    const SyntheticLogShape &shape, fs_testing::utils::DiskWriteArena &arena);
+
+}  // namespace test
+}  // namespace fs_testing
+
+#endif  // TEST_UTILS_BENCHMARK_UTILS_H
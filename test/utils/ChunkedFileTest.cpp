@@ -0,0 +1,211 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/utils/ChunkedFile.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::string;
+using std::vector;
+
+using fs_testing::utils::ChunkedFile;
+using fs_testing::utils::ChunkedFileReader;
+using fs_testing::utils::ChunkedFileWriter;
+
+namespace {
+
+static const unsigned int kTestChunkSize = 4096;
+
+string TempFile() {
+  char *temp_file = strdup("/tmp/chunked_fileXXXXXX");
+  int temp_fd = mkstemp(temp_file);
+  EXPECT_TRUE(temp_fd > 0);
+  close(temp_fd);
+  string res(temp_file);
+  free(temp_file);
+  return res;
+}
+
+/*
+ * Three full chunks of data with a chunk of zeros in the middle and a short
+ * final chunk.
+ */
+vector<char> MakeData() {
+  vector<char> data((4 * kTestChunkSize) + 100, 0);
+  for (unsigned int i = 0; i < kTestChunkSize; ++i) {
+    data.at(i) = i % 7;
+  }
+  // Incompressible-ish data so at least one chunk is stored raw.
+  unsigned int seed = 42;
+  for (unsigned int i = 2 * kTestChunkSize; i < 3 * kTestChunkSize; ++i) {
+    data.at(i) = rand_r(&seed);
+  }
+  for (unsigned int i = 4 * kTestChunkSize; i < data.size(); ++i) {
+    data.at(i) = 'a';
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST(ChunkedFile, RoundTrip) {
+  const vector<char> data = MakeData();
+  const string path = TempFile();
+
+  ChunkedFileWriter writer(kTestChunkSize);
+  ASSERT_EQ(0, writer.Open(path));
+  // Append in pieces that don't line up with chunk boundaries.
+  ASSERT_EQ(0, writer.Append(data.data(), 1000));
+  ASSERT_EQ(0, writer.Append(data.data() + 1000, data.size() - 1000));
+  ASSERT_EQ(0, writer.Close());
+  EXPECT_TRUE(ChunkedFile::IsChunkedFile(path));
+
+  ChunkedFileReader reader;
+  ASSERT_EQ(0, reader.Open(path));
+  EXPECT_EQ(data.size(), reader.GetSize());
+  EXPECT_EQ(5, reader.GetNumChunks());
+  EXPECT_FALSE(reader.IsHole(0));
+  EXPECT_TRUE(reader.IsHole(1));
+  EXPECT_TRUE(reader.IsHole(3));
+  EXPECT_FALSE(reader.IsHole(4));
+
+  vector<char> read(data.size());
+  ASSERT_EQ(0, reader.Read(0, read.data(), read.size()));
+  EXPECT_EQ(data, read);
+
+  vector<char> last(kTestChunkSize);
+  EXPECT_EQ(100, reader.ReadChunk(4, last.data()));
+  EXPECT_EQ('a', last.at(99));
+  unlink(path.c_str());
+}
+
+TEST(ChunkedFile, ReadAcrossChunks) {
+  const vector<char> data = MakeData();
+  const string path = TempFile();
+
+  ChunkedFileWriter writer(kTestChunkSize);
+  ASSERT_EQ(0, writer.Open(path));
+  ASSERT_EQ(0, writer.Append(data.data(), data.size()));
+  ASSERT_EQ(0, writer.Close());
+
+  ChunkedFileReader reader;
+  ASSERT_EQ(0, reader.Open(path));
+  const uint64_t start = kTestChunkSize - 10;
+  const uint64_t len = (2 * kTestChunkSize) + 20;
+  vector<char> read(len);
+  ASSERT_EQ(0, reader.Read(start, read.data(), len));
+  EXPECT_TRUE(std::equal(read.begin(), read.end(), data.begin() + start));
+
+  // Reading past the end fails.
+  EXPECT_GT(0, reader.Read(data.size() - 10, read.data(), 20));
+  unlink(path.c_str());
+}
+
+TEST(ChunkedFile, ZerosAreHoles) {
+  const vector<char> zeros(64 * kTestChunkSize, 0);
+  const string path = TempFile();
+
+  ChunkedFileWriter writer(kTestChunkSize);
+  ASSERT_EQ(0, writer.Open(path));
+  ASSERT_EQ(0, writer.Append(zeros.data(), zeros.size()));
+  ASSERT_EQ(0, writer.Close());
+
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  // Only the header and index are stored.
+  EXPECT_GT(zeros.size() / 64, st.st_size);
+
+  ChunkedFileReader reader;
+  ASSERT_EQ(0, reader.Open(path));
+  vector<char> read(zeros.size(), 1);
+  ASSERT_EQ(0, reader.Read(0, read.data(), read.size()));
+  EXPECT_EQ(zeros, read);
+  unlink(path.c_str());
+}
+
+/*
+ * Test that headers and indices whose sizes and offsets would wrap around when
+ * added up are rejected.
+ */
+TEST(ChunkedFile, CorruptHeaderFails) {
+  const string path = TempFile();
+  // Claims almost 2^64 bytes of data in no chunks at all.
+  char header[ChunkedFile::kHeaderSize];
+  memcpy(header, "CMCHUNK1", 8);
+  const uint32_t version = htobe32(1);
+  const uint32_t chunk_size = htobe32(64 * 1024);
+  const uint64_t total_size = htobe64(UINT64_MAX);
+  const uint64_t num_chunks = htobe64(0);
+  const uint64_t index_offset = htobe64(ChunkedFile::kHeaderSize);
+  memcpy(header + 8, &version, sizeof(version));
+  memcpy(header + 12, &chunk_size, sizeof(chunk_size));
+  memcpy(header + 16, &total_size, sizeof(total_size));
+  memcpy(header + 24, &num_chunks, sizeof(num_chunks));
+  memcpy(header + 32, &index_offset, sizeof(index_offset));
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(header, sizeof(header));
+  }
+  ChunkedFileReader reader;
+  EXPECT_GT(0, reader.Open(path));
+
+  // Enough chunks for the size, but an index that would run far past the end
+  // of the file.
+  const uint64_t many_chunks = htobe64(UINT64_MAX / 16 + 1);
+  const uint64_t big_size = htobe64((UINT64_MAX / 16) * kTestChunkSize);
+  const uint32_t test_chunk_size = htobe32(kTestChunkSize);
+  memcpy(header + 12, &test_chunk_size, sizeof(test_chunk_size));
+  memcpy(header + 16, &big_size, sizeof(big_size));
+  memcpy(header + 24, &many_chunks, sizeof(many_chunks));
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(header, sizeof(header));
+  }
+  EXPECT_GT(0, reader.Open(path));
+
+  // A valid file with an index entry whose offset plus length wraps.
+  const vector<char> data = MakeData();
+  ChunkedFileWriter writer(kTestChunkSize);
+  ASSERT_EQ(0, writer.Open(path));
+  ASSERT_EQ(0, writer.Append(data.data(), data.size()));
+  ASSERT_EQ(0, writer.Close());
+  ASSERT_EQ(0, reader.Open(path));
+  reader.Close();
+
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  const int fd = open(path.c_str(), O_WRONLY);
+  ASSERT_LE(0, fd);
+  // The index is at the end of the file, 16 bytes per chunk.
+  const uint64_t chunks = (data.size() + kTestChunkSize - 1) / kTestChunkSize;
+  const uint64_t index_start = st.st_size - (chunks * 16);
+  const uint64_t wrapping_offset = htobe64(UINT64_MAX - 10);
+  ASSERT_EQ(sizeof(wrapping_offset), pwrite(fd, &wrapping_offset,
+        sizeof(wrapping_offset), index_start));
+  close(fd);
+  EXPECT_GT(0, reader.Open(path));
+  unlink(path.c_str());
+}
+
+TEST(ChunkedFile, NotChunked) {
+  const string path = TempFile();
+  EXPECT_FALSE(ChunkedFile::IsChunkedFile(path));
+  ChunkedFileReader reader;
+  EXPECT_GT(0, reader.Open(path));
+  unlink(path.c_str());
+}
+
+}  // namespace test
+}  // namespace fs_testing
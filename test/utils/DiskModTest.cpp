@@ -1,9 +1,12 @@
 #include <endian.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "../../code/utils/DiskMod.h"
 
@@ -494,6 +497,105 @@ TEST_P(TestDiskModParameterizedFalloc, SerializeDeserializeFalloc) {
   EXPECT_STREQ(new_mod.path.c_str(), mod_path.c_str());
 }
 
+/*
+ * Test that a kDataMod DiskMod carrying digests instead of data
+ *    - serializes only one uint64_t per kDigestBlockSize bytes of data
+ *    - deserializes back into the same digests with no file data
+ */
+TEST_P(TestDiskModParameterized, SerializeDeserializeFileDataModDigests) {
+  const string mod_path = GetParam();
+  const uint64_t mod_len = (3 * DiskMod::kDigestBlockSize) + 1;
+  std::vector<char> data(mod_len, 'x');
+  DiskMod start;
+
+  start.mod_type = DiskMod::kDataMod;
+  start.path = mod_path;
+  start.file_mod_len = mod_len;
+  start.file_mod_location = 4096;
+  start.SetDigests(data.data());
+  ASSERT_TRUE(start.file_mod_data_hashed);
+  ASSERT_EQ(4, start.file_mod_digests.size());
+  EXPECT_EQ(DiskMod::HashData(data.data(), 1), start.file_mod_digests.at(3));
+
+  unsigned long long size;
+  shared_ptr<char> serialized = DiskMod::Serialize(start, &size);
+  ASSERT_NE(nullptr, serialized.get());
+  EXPECT_EQ(size, ((2 + 4) * sizeof(uint64_t)) + sizeof(uint64_t) +
+      (2 * sizeof(uint16_t)) + 1 + mod_path.size() + 1);
+  EXPECT_EQ(size, DiskMod::GetSerializedSize(serialized.get()));
+
+  DiskMod new_mod;
+  EXPECT_EQ(0, DiskMod::Deserialize(serialized, new_mod));
+
+  EXPECT_EQ(new_mod.mod_type, DiskMod::kDataMod);
+  EXPECT_EQ(new_mod.file_mod_location, 4096);
+  EXPECT_EQ(new_mod.file_mod_len, mod_len);
+  EXPECT_TRUE(new_mod.file_mod_data_hashed);
+  EXPECT_EQ(new_mod.file_mod_data.get(), nullptr);
+  EXPECT_EQ(new_mod.file_mod_digests, start.file_mod_digests);
+  EXPECT_STREQ(new_mod.path.c_str(), mod_path.c_str());
+}
+
+/*
+ * Test that serializing many DiskMods at once results in
+ *    - the same bytes as serializing each DiskMod on its own
+ *    - a buffer that splits back into one pointer per DiskMod
+ */
+TEST(DiskMod, SerializeAllSplit) {
+  std::vector<DiskMod> mods(5);
+  mods.at(0).mod_type = DiskMod::kCheckpointMod;
+  mods.at(1).mod_type = DiskMod::kDataMod;
+  mods.at(1).path = "/mnt/snapshot/bleh";
+  mods.at(1).file_mod_location = 4096;
+  mods.at(1).file_mod_len = kTestDataSize;
+  mods.at(1).file_mod_data.reset(new char[kTestDataSize],
+      [](char *c) {delete[] c;});
+  memcpy(mods.at(1).file_mod_data.get(), kTestData, kTestDataSize);
+  mods.at(2).mod_type = DiskMod::kSyncMod;
+  mods.at(3).mod_type = DiskMod::kFsyncMod;
+  mods.at(3).path = "/mnt/snapshot/bleh";
+  mods.at(4).mod_type = DiskMod::kCheckpointMod;
+
+  char *temp_file = strdup("/tmp/disk_modXXXXXX");
+  const int fd = mkstemp(temp_file);
+  ASSERT_GE(fd, 0);
+  unlink(temp_file);
+  free(temp_file);
+  ASSERT_EQ(0, DiskMod::SerializeAllToFd(fd, mods));
+
+  std::vector<char> expected;
+  for (DiskMod &mod : mods) {
+    unsigned long long size;
+    shared_ptr<char> serialized = DiskMod::Serialize(mod, &size);
+    ASSERT_NE(nullptr, serialized.get());
+    expected.insert(expected.end(), serialized.get(),
+        serialized.get() + size);
+  }
+  const off_t size = lseek(fd, 0, SEEK_END);
+  ASSERT_EQ(expected.size(), size);
+  shared_ptr<char> contents(new char[size], [](char *c) {delete[] c;});
+  ASSERT_EQ(size, pread(fd, contents.get(), size, 0));
+  close(fd);
+  EXPECT_EQ(0, memcmp(expected.data(), contents.get(), size));
+
+  std::vector<shared_ptr<char>> split;
+  ASSERT_EQ(0, DiskMod::SplitSerialized(contents, size, split));
+  ASSERT_EQ(mods.size(), split.size());
+  for (unsigned int i = 0; i < mods.size(); ++i) {
+    DiskMod new_mod;
+    EXPECT_EQ(0, DiskMod::Deserialize(split.at(i), new_mod));
+    EXPECT_EQ(mods.at(i).mod_type, new_mod.mod_type);
+    EXPECT_EQ(mods.at(i).path, new_mod.path);
+  }
+  EXPECT_EQ(0,
+      memcmp(split.at(1).get() + DiskMod::GetSerializedSize(split.at(1).get())
+        - kTestDataSize, kTestData, kTestDataSize));
+
+  // A buffer cut off in the middle of a DiskMod doesn't split.
+  split.clear();
+  EXPECT_GT(0, DiskMod::SplitSerialized(contents, size - 1, split));
+}
+
 // Test with a file path that is larger than the tmp buffer used in
 // DiskMod::Deserialize.
 INSTANTIATE_TEST_CASE_P(PathNames, TestDiskModParameterized,
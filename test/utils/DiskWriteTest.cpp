@@ -21,8 +21,10 @@ using std::ofstream;
 using std::vector;
 
 using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteArena;
 
 TEST(DiskWrite, Serialize_Deserialize) {
+  DiskWriteArena arena;
   disk_write test_write;
 
   test_write.metadata.write_sector = 50;
@@ -35,7 +37,7 @@ TEST(DiskWrite, Serialize_Deserialize) {
   for (unsigned int i = 0; i < test_write.metadata.size; ++i) {
     data[i] = 0x20;
   }
-  test_write.set_data(data);
+  test_write.set_data(arena, data);
 
   // Get a temp file to write and read to/from.
   char *temp_file = strdup("/tmp/disk_write_serializeXXXXXX");
@@ -54,7 +56,7 @@ TEST(DiskWrite, Serialize_Deserialize) {
   ifstream input(temp_file);
   free(temp_file);
   input >> std::hex;
-  disk_write read = disk_write::deserialize(input);
+  disk_write read = disk_write::deserialize(input, arena);
   input >> std::dec;
   input.close();
 
@@ -63,11 +65,12 @@ TEST(DiskWrite, Serialize_Deserialize) {
   EXPECT_EQ(test_write.metadata.bi_flags, read.metadata.bi_flags);
   EXPECT_EQ(test_write.metadata.bi_rw, read.metadata.bi_rw);
   EXPECT_EQ(0,
-      memcmp(test_write.get_data().get(), read.get_data().get(),
+      memcmp(test_write.get_data(), read.get_data(),
           test_write.metadata.size));
 }
 
 TEST(DiskWrite, Serialize_Deserialize_Epoch) {
+  DiskWriteArena arena;
   vector<disk_write> epoch;
   disk_write test_write;
 
@@ -81,7 +84,7 @@ TEST(DiskWrite, Serialize_Deserialize_Epoch) {
   for (unsigned int i = 0; i < test_write.metadata.size; ++i) {
     data[i] = 0x20;
   }
-  test_write.set_data(data);
+  test_write.set_data(arena, data);
   epoch.push_back(test_write);
 
   test_write.metadata.write_sector = 50;
@@ -94,7 +97,7 @@ TEST(DiskWrite, Serialize_Deserialize_Epoch) {
   for (unsigned int i = 0; i < test_write.metadata.size; ++i) {
     data2[i] = 0x0A;
   }
-  test_write.set_data(data2);
+  test_write.set_data(arena, data2);
   epoch.push_back(test_write);
 
   // Get a temp file to write and read to/from.
@@ -119,7 +122,7 @@ TEST(DiskWrite, Serialize_Deserialize_Epoch) {
   input >> std::hex;
 
   while (input.peek() != EOF) {
-    read.push_back(disk_write::deserialize(input));
+    read.push_back(disk_write::deserialize(input, arena));
     std::cout << "next character is 0x" << std::hex << input.peek() << std::dec << std::endl;
   }
 
@@ -133,10 +136,32 @@ TEST(DiskWrite, Serialize_Deserialize_Epoch) {
     EXPECT_EQ(epoch.at(i).metadata.bi_flags, read.at(i).metadata.bi_flags);
     EXPECT_EQ(epoch.at(i).metadata.bi_rw, read.at(i).metadata.bi_rw);
     EXPECT_EQ(0,
-        memcmp(epoch.at(i).get_data().get(), read.at(i).get_data().get(),
+        memcmp(epoch.at(i).get_data(), read.at(i).get_data(),
             epoch.at(i).metadata.size));
   }
 }
 
+TEST(DiskWrite, ArenaDataIsStable) {
+  DiskWriteArena arena(4096);
+  vector<disk_write> writes;
+  // Mix of small writes that share blocks and large ones that get their own.
+  for (unsigned int i = 0; i < 64; ++i) {
+    disk_write dw;
+    dw.metadata.size = (i % 8 == 0) ? 8192 : 100 + i;
+    vector<char> data(dw.metadata.size, (char) i);
+    const char *copy = dw.set_data(arena, data.data());
+    EXPECT_EQ(copy, dw.get_data());
+    writes.push_back(dw);
+  }
+
+  for (unsigned int i = 0; i < writes.size(); ++i) {
+    const disk_write copy = writes.at(i);
+    EXPECT_EQ(writes.at(i).get_data(), copy.get_data());
+    vector<char> expected(copy.metadata.size, (char) i);
+    EXPECT_EQ(0,
+        memcmp(expected.data(), copy.get_data(), copy.metadata.size));
+  }
+}
+
 }  // namespace test
 }  // namespace fs_testing
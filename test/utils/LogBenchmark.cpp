@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../../code/utils/DiskMod.h"
+#include "../../code/utils/utils.h"
+#include "BenchmarkUtils.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ifstream;
+using std::ofstream;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskMod;
+using fs_testing::utils::DiskWriteArena;
+
+/*
+ * Measures writing out and reading back the logs CrashMonkey records: the
+ * block IO log (disk_write) and the log of file system changes (DiskMod).
+ */
+
+namespace {
+
+const unsigned int kLogWrites = 1024;
+
+string MakeTempPath() {
+  char path[] = "/tmp/LogBenchmark.XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd >= 0) {
+    close(fd);
+  }
+  return path;
+}
+
+SyntheticLogShape LogShape(const unsigned int write_size) {
+  SyntheticLogShape shape;
+  shape.num_writes = kLogWrites;
+  shape.epoch_size = 16;
+  shape.overlap_percent = 10;
+  shape.write_size = write_size;
+  shape.checkpoint_every = 4;
+  return shape;
+}
+
+}  // namespace
+
+/*
+ * Argument 0 is the size of each write in the log. Each iteration handles one
+ * disk_write.
+ */
+static void BM_DiskWriteSerialize(benchmark::State &state) {
+  DiskWriteArena arena;
+  const vector<disk_write> log = MakeSyntheticLog(LogShape(state.range(0)),
+      arena);
+  const string path = MakeTempPath();
+  ofstream out(path, std::ios::binary);
+
+  unsigned int i = 0;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    disk_write::serialize(out, log.at(i));
+    if (++i == log.size()) {
+      state.PauseTiming();
+      i = 0;
+      out.seekp(0);
+      state.ResumeTiming();
+    }
+  }
+  ReportMemory(state, allocs);
+  state.SetItemsProcessed(state.iterations());
+
+  out.close();
+  unlink(path.c_str());
+}
+BENCHMARK(BM_DiskWriteSerialize)->Arg(0)->Arg(4096)->Arg(65536);
+
+static void BM_DiskWriteDeserialize(benchmark::State &state) {
+  const string path = MakeTempPath();
+  unsigned int log_size = 0;
+  {
+    DiskWriteArena arena;
+    const vector<disk_write> log = MakeSyntheticLog(LogShape(state.range(0)),
+        arena);
+    ofstream out(path, std::ios::binary);
+    for (const disk_write &dw : log) {
+      disk_write::serialize(out, dw);
+    }
+    log_size = log.size();
+  }
+
+  ifstream in(path, std::ios::binary);
+  unique_ptr<DiskWriteArena> arena(new DiskWriteArena());
+  unsigned int i = 0;
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    disk_write dw = disk_write::deserialize(in, *arena);
+    benchmark::DoNotOptimize(dw.get_data());
+    if (++i == log_size) {
+      // Start over with an empty arena so memory use doesn't keep growing.
+      state.PauseTiming();
+      i = 0;
+      in.seekg(0);
+      arena.reset(new DiskWriteArena());
+      state.ResumeTiming();
+    }
+  }
+  ReportMemory(state, allocs);
+  state.SetItemsProcessed(state.iterations());
+
+  in.close();
+  unlink(path.c_str());
+}
+BENCHMARK(BM_DiskWriteDeserialize)->Arg(0)->Arg(4096)->Arg(65536);
+
+/*
+ * Argument 0 is the amount of file data in the DiskMod, 0 for a mod without
+ * data. Argument 1 is whether that data is hashed instead of kept.
+ */
+static void BM_DiskModSerialize(benchmark::State &state) {
+  const uint64_t len = state.range(0);
+
+  DiskMod mod;
+  mod.path = "/mnt/snapshot/A/foo";
+  mod.mod_type = len > 0 ? DiskMod::kDataMetadataMod : DiskMod::kCreateMod;
+  mod.file_mod_len = len;
+  if (len > 0) {
+    shared_ptr<char> data(new char[len], [](char *c) {delete[] c;});
+    memset(data.get(), 'a', len);
+    if (state.range(1)) {
+      mod.SetDigests(data.get());
+    } else {
+      mod.file_mod_data = data;
+    }
+  }
+
+  const uint64_t allocs = GetNumAllocations();
+  for (auto _ : state) {
+    unsigned long long size = 0;
+    shared_ptr<char> res = DiskMod::Serialize(mod, &size);
+    benchmark::DoNotOptimize(res.get());
+  }
+  ReportMemory(state, allocs);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DiskModSerialize)
+  ->Args({0, 0})->Args({4096, 0})->Args({65536, 0})->Args({65536, 1});
+
+}  // namespace test
+}  // namespace fs_testing
+
+BENCHMARK_MAIN();
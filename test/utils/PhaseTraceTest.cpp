@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "../../code/utils/PhaseTrace.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::ifstream;
+using std::string;
+using std::stringstream;
+
+using fs_testing::utils::LatencyHistogram;
+using fs_testing::utils::PhaseTrace;
+
+namespace {
+
+string TempFile() {
+  char *temp_file = strdup("/tmp/phase_traceXXXXXX");
+  int temp_fd = mkstemp(temp_file);
+  EXPECT_TRUE(temp_fd > 0);
+  close(temp_fd);
+  string res(temp_file);
+  free(temp_file);
+  return res;
+}
+
+string ReadFile(const string &path) {
+  ifstream in(path);
+  stringstream res;
+  res << in.rdbuf();
+  return res.str();
+}
+
+unsigned int CountOf(const string &haystack, const string &needle) {
+  unsigned int res = 0;
+  for (size_t pos = haystack.find(needle); pos != string::npos;
+      pos = haystack.find(needle, pos + 1)) {
+    ++res;
+  }
+  return res;
+}
+
+}  // namespace
+
+TEST(LatencyHistogram, SmallValuesExact) {
+  LatencyHistogram histogram;
+  for (uint64_t i = 1; i <= 100; ++i) {
+    histogram.Record(i);
+  }
+  EXPECT_EQ(histogram.Count(), 100);
+  EXPECT_EQ(histogram.Min(), 1);
+  EXPECT_EQ(histogram.Max(), 100);
+  EXPECT_DOUBLE_EQ(histogram.Mean(), 50.5);
+  EXPECT_EQ(histogram.ValueAtPercentile(50), 50);
+  EXPECT_EQ(histogram.ValueAtPercentile(99), 99);
+  EXPECT_EQ(histogram.ValueAtPercentile(100), 100);
+}
+
+TEST(LatencyHistogram, LargeValuesWithinOnePercent) {
+  LatencyHistogram histogram;
+  // One slow outlier among many fast values, in ns.
+  for (unsigned int i = 0; i < 999; ++i) {
+    histogram.Record(1000000 + i * 1000);
+  }
+  histogram.Record(5000000000ULL);
+
+  const uint64_t median = histogram.ValueAtPercentile(50);
+  EXPECT_GE(median, 1499000);
+  EXPECT_LE(median, 1499000 * 1.01);
+  const uint64_t p99 = histogram.ValueAtPercentile(99);
+  EXPECT_GE(p99, 1989000);
+  EXPECT_LE(p99, 1989000 * 1.01);
+  EXPECT_EQ(histogram.ValueAtPercentile(100), 5000000000ULL);
+  EXPECT_EQ(histogram.Max(), 5000000000ULL);
+}
+
+TEST(LatencyHistogram, Reset) {
+  LatencyHistogram histogram;
+  histogram.Record(UINT64_MAX);
+  EXPECT_EQ(histogram.ValueAtPercentile(50), UINT64_MAX);
+  histogram.Reset();
+  EXPECT_EQ(histogram.Count(), 0);
+  EXPECT_EQ(histogram.Min(), 0);
+  EXPECT_EQ(histogram.ValueAtPercentile(50), 0);
+}
+
+TEST(LatencyHistogram, PrintPercentiles) {
+  LatencyHistogram histogram;
+  histogram.Record(1000);
+  histogram.Record(3000);
+  stringstream out;
+  histogram.PrintPercentiles(out, 1000);
+  const string res = out.str();
+  EXPECT_NE(res.find("Percentile"), string::npos);
+  EXPECT_NE(res.find("1.003 0.500000000000          1           2.00"),
+      string::npos);
+  EXPECT_NE(res.find("3.000 1.000000000000          2\n"), string::npos);
+  EXPECT_NE(res.find("Total count    =            2"), string::npos);
+}
+
+TEST(PhaseTrace, HistogramsWithoutSpans) {
+  PhaseTrace trace;
+  const steady_clock::time_point start = steady_clock::now();
+  trace.Record(PhaseTrace::kMount, 1, start, start + microseconds(20));
+  trace.Record(PhaseTrace::kMount, 2, start, start + microseconds(40));
+  trace.Record(PhaseTrace::kFsck, 2, start, start + microseconds(10));
+
+  EXPECT_EQ(trace.GetHistogram(PhaseTrace::kMount).Count(), 2);
+  EXPECT_EQ(trace.GetHistogram(PhaseTrace::kMount).Max(), 40000);
+  EXPECT_EQ(trace.GetHistogram(PhaseTrace::kFsck).Count(), 1);
+  EXPECT_EQ(trace.GetHistogram(PhaseTrace::kCheck).Count(), 0);
+  EXPECT_EQ(trace.NumSpans(), 0);
+  EXPECT_EQ(trace.NumDropped(), 0);
+}
+
+TEST(PhaseTrace, RingBufferKeepsNewestSpans) {
+  PhaseTrace trace;
+  trace.SetCapacity(4);
+  const steady_clock::time_point start = steady_clock::now();
+  for (unsigned int i = 1; i <= 6; ++i) {
+    trace.Record(PhaseTrace::kWrite, i, start + microseconds(i * 10),
+        start + microseconds(i * 10 + 5));
+  }
+  EXPECT_EQ(trace.NumSpans(), 4);
+  EXPECT_EQ(trace.NumDropped(), 2);
+  EXPECT_EQ(trace.GetHistogram(PhaseTrace::kWrite).Count(), 6);
+
+  const string path = TempFile();
+  ASSERT_EQ(trace.WriteChromeTrace(path), 0);
+  const string res = ReadFile(path);
+  unlink(path.c_str());
+
+  EXPECT_EQ(CountOf(res, "\"ph\":\"X\""), 4);
+  EXPECT_EQ(CountOf(res, "\"name\":\"write\""), 4);
+  EXPECT_NE(res.find("\"dropped_spans\":2"), string::npos);
+  EXPECT_NE(res.find("\"dur\":5.000"), string::npos);
+  EXPECT_EQ(res.find("\"crash_state\":2}"), string::npos);
+  // Oldest kept span comes first.
+  const size_t third = res.find("\"crash_state\":3}");
+  const size_t sixth = res.find("\"crash_state\":6}");
+  ASSERT_NE(third, string::npos);
+  ASSERT_NE(sixth, string::npos);
+  EXPECT_LT(third, sixth);
+}
+
+TEST(PhaseTrace, WriteHistograms) {
+  PhaseTrace trace;
+  const steady_clock::time_point start = steady_clock::now();
+  trace.Record(PhaseTrace::kGenerate, 1, start, start + microseconds(1500));
+
+  const string prefix = TempFile();
+  ASSERT_EQ(trace.WriteHistograms(prefix), 0);
+  for (unsigned int i = 0; i < PhaseTrace::kNumPhases; ++i) {
+    const string path = prefix + "." +
+      PhaseTrace::PhaseName((PhaseTrace::Phase) i) + ".hgrm";
+    const string res = ReadFile(path);
+    EXPECT_NE(res.find("Total count"), string::npos) << path;
+    if (i == PhaseTrace::kGenerate) {
+      EXPECT_NE(res.find("1.500 1.000000000000          1"), string::npos);
+    }
+    unlink(path.c_str());
+  }
+  unlink(prefix.c_str());
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -0,0 +1,322 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../code/disk_wrapper_ioctl.h"
+#include "../../code/utils/ProfileLog.h"
+#include "../../code/utils/utils.h"
+#include "gtest/gtest.h"
+
+namespace fs_testing {
+namespace test {
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+using fs_testing::utils::disk_write;
+using fs_testing::utils::DiskWriteArena;
+using fs_testing::utils::ProfileLog;
+
+namespace {
+
+disk_write MakeWrite(DiskWriteArena &arena, unsigned long sector,
+    unsigned int size, unsigned long long flags, char fill) {
+  disk_write dw;
+  dw.metadata.write_sector = sector;
+  dw.metadata.size = size;
+  dw.metadata.bi_flags = flags;
+  dw.metadata.bi_rw = flags;
+  dw.metadata.time_ns = sector * 10;
+  if (size > 0) {
+    vector<char> data(size, fill);
+    dw.set_data(arena, data.data());
+  }
+  return dw;
+}
+
+string TempFile() {
+  char *temp_file = strdup("/tmp/profile_logXXXXXX");
+  int temp_fd = mkstemp(temp_file);
+  EXPECT_TRUE(temp_fd > 0);
+  close(temp_fd);
+  string res(temp_file);
+  free(temp_file);
+  return res;
+}
+
+}  // namespace
+
+TEST(ProfileLog, SaveLoad) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 0, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(
+      MakeWrite(arena, 50, 8192, HWM_WRITE_FLAG | HWM_SYNC_FLAG, 0x20));
+  log.push_back(MakeWrite(arena, 1, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(
+      MakeWrite(arena, 70, 1024, HWM_WRITE_FLAG | HWM_FUA_FLAG, 0x0A));
+  log.push_back(MakeWrite(arena, 0, 0, HWM_FLUSH_FLAG, 0));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log));
+  EXPECT_TRUE(ProfileLog::IsProfileLog(path));
+
+  vector<disk_write> read;
+  vector<uint64_t> checkpoints;
+  ASSERT_EQ(0, ProfileLog::Load(path, arena, read, &checkpoints));
+  unlink(path.c_str());
+
+  ASSERT_EQ(log.size(), read.size());
+  for (unsigned int i = 0; i < log.size(); ++i) {
+    EXPECT_EQ(log.at(i).metadata.write_sector,
+        read.at(i).metadata.write_sector);
+    EXPECT_EQ(log.at(i).metadata.time_ns, read.at(i).metadata.time_ns);
+    EXPECT_TRUE(log.at(i) == read.at(i));
+  }
+  EXPECT_EQ(NULL, read.at(0).get_data());
+
+  // Data for back to back entries with data is contiguous in the mapping.
+  EXPECT_EQ(read.at(1).get_data() + 8192, read.at(3).get_data());
+
+  ASSERT_EQ(2, checkpoints.size());
+  EXPECT_EQ(0, checkpoints.at(0));
+  EXPECT_EQ(2, checkpoints.at(1));
+}
+
+TEST(ProfileLog, CompressedSaveLoad) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 0, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 50, 128 * 1024, HWM_WRITE_FLAG, 0));
+  log.push_back(
+      MakeWrite(arena, 70, 1024, HWM_WRITE_FLAG | HWM_FUA_FLAG, 0x0A));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log, true));
+  EXPECT_TRUE(ProfileLog::IsProfileLog(path));
+
+  vector<disk_write> read;
+  vector<uint64_t> checkpoints;
+  ASSERT_EQ(0, ProfileLog::Load(path, arena, read, &checkpoints));
+  unlink(path.c_str());
+
+  ASSERT_EQ(log.size(), read.size());
+  for (unsigned int i = 0; i < log.size(); ++i) {
+    EXPECT_TRUE(log.at(i) == read.at(i));
+  }
+  ASSERT_EQ(1, checkpoints.size());
+  EXPECT_EQ(0, checkpoints.at(0));
+}
+
+/*
+ * Test that a compressed profile claiming far more data than it could hold
+ * fails to load instead of trying to allocate all of it.
+ */
+TEST(ProfileLog, CompressedHugeSizeFails) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 0, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 50, 4096, HWM_WRITE_FLAG, 0x20));
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log, true));
+
+  // Size of the inflated profile in the chunked file header.
+  const int fd = open(path.c_str(), O_WRONLY);
+  ASSERT_LE(0, fd);
+  const uint64_t huge = htobe64(UINT64_MAX);
+  ASSERT_EQ(sizeof(huge), pwrite(fd, &huge, sizeof(huge), 16));
+  close(fd);
+
+  vector<disk_write> read;
+  EXPECT_GT(0, ProfileLog::Load(path, arena, read));
+  unlink(path.c_str());
+}
+
+TEST(ProfileLog, DataOutlivesLog) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 8, 4096, HWM_WRITE_FLAG, 0x55));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log));
+
+  disk_write kept;
+  {
+    vector<disk_write> read;
+    ASSERT_EQ(0, ProfileLog::Load(path, arena, read));
+    kept = read.at(0);
+  }
+  unlink(path.c_str());
+
+  // The arena keeps the mapping alive, so the data is still readable.
+  EXPECT_TRUE(kept == log.at(0));
+}
+
+TEST(ProfileLog, LoadRange) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 0, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 50, 4096, HWM_WRITE_FLAG, 0x20));
+  log.push_back(MakeWrite(arena, 1, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 60, 4096, HWM_WRITE_FLAG, 0x21));
+  log.push_back(MakeWrite(arena, 2, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 70, 4096, HWM_WRITE_FLAG, 0x22));
+  log.push_back(MakeWrite(arena, 3, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 80, 4096, HWM_WRITE_FLAG, 0x23));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log));
+
+  // Middle of the log.
+  vector<disk_write> prefix;
+  vector<disk_write> read;
+  ASSERT_EQ(0, ProfileLog::LoadRange(path, arena, 1, 2, prefix, read));
+  ASSERT_EQ(2, prefix.size());
+  EXPECT_TRUE(log.at(0) == prefix.at(0));
+  EXPECT_TRUE(log.at(1) == prefix.at(1));
+  ASSERT_EQ(4, read.size());
+  for (unsigned int i = 0; i < read.size(); ++i) {
+    EXPECT_TRUE(log.at(i + 2) == read.at(i));
+  }
+  EXPECT_TRUE(read.front().is_checkpoint());
+  EXPECT_EQ(1, read.front().metadata.write_sector);
+
+  // Through the end of the log.
+  prefix.clear();
+  read.clear();
+  ASSERT_EQ(0, ProfileLog::LoadRange(path, arena, 3, 100, prefix, read));
+  EXPECT_EQ(6, prefix.size());
+  ASSERT_EQ(2, read.size());
+  EXPECT_TRUE(log.at(7) == read.at(1));
+
+  // Start of the log has no prefix.
+  prefix.clear();
+  read.clear();
+  ASSERT_EQ(0, ProfileLog::LoadRange(path, arena, 0, 0, prefix, read));
+  EXPECT_TRUE(prefix.empty());
+  EXPECT_EQ(2, read.size());
+
+  // Checkpoints that aren't in the log.
+  EXPECT_GT(0, ProfileLog::LoadRange(path, arena, 4, 4, prefix, read));
+  EXPECT_GT(0, ProfileLog::LoadRange(path, arena, 2, 1, prefix, read));
+  unlink(path.c_str());
+}
+
+/*
+ * Loading a range of a compressed profile only inflates the data the range
+ * needs, so damage to chunks past the range goes unnoticed by it.
+ */
+TEST(ProfileLog, CompressedLoadRangeSkipsLaterData) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 0, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 50, 4096, HWM_WRITE_FLAG, 0x20));
+  log.push_back(MakeWrite(arena, 1, 0, HWM_CHECKPOINT_FLAG, 0));
+  log.push_back(MakeWrite(arena, 60, 256 * 1024, HWM_WRITE_FLAG, 0x21));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log, true));
+
+  // Zero the last chunk, found through the index at the end of the file.
+  const int fd = open(path.c_str(), O_RDWR);
+  ASSERT_LE(0, fd);
+  uint64_t be;
+  ASSERT_EQ((ssize_t) sizeof(be), pread(fd, &be, sizeof(be), 32));
+  const uint64_t index_offset = be64toh(be);
+  ASSERT_EQ((ssize_t) sizeof(be), pread(fd, &be, sizeof(be), 24));
+  const uint64_t num_chunks = be64toh(be);
+  ASSERT_LT(1, num_chunks);
+  const off_t last = index_offset + ((num_chunks - 1) * 16);
+  ASSERT_EQ((ssize_t) sizeof(be), pread(fd, &be, sizeof(be), last));
+  const uint64_t chunk_offset = be64toh(be);
+  uint32_t length;
+  ASSERT_EQ((ssize_t) sizeof(length),
+      pread(fd, &length, sizeof(length), last + 8));
+  const vector<char> zeros(be32toh(length), 0);
+  ASSERT_EQ((ssize_t) zeros.size(),
+      pwrite(fd, zeros.data(), zeros.size(), chunk_offset));
+  close(fd);
+
+  vector<disk_write> prefix;
+  vector<disk_write> read;
+  ASSERT_EQ(0, ProfileLog::LoadRange(path, arena, 0, 0, prefix, read));
+  ASSERT_EQ(2, read.size());
+  EXPECT_TRUE(log.at(1) == read.at(1));
+
+  read.clear();
+  EXPECT_GT(0, ProfileLog::Load(path, arena, read));
+  unlink(path.c_str());
+}
+
+TEST(ProfileLog, LegacyNotDetected) {
+  DiskWriteArena arena;
+  disk_write dw = MakeWrite(arena, 50, 512, HWM_WRITE_FLAG, 0x20);
+  const string path = TempFile();
+  {
+    ofstream output(path, std::ios::binary);
+    disk_write::serialize(output, dw);
+  }
+
+  EXPECT_FALSE(ProfileLog::IsProfileLog(path));
+  vector<disk_write> read;
+  EXPECT_GT(0, ProfileLog::Load(path, arena, read));
+  EXPECT_TRUE(read.empty());
+  unlink(path.c_str());
+}
+
+TEST(ProfileLog, TruncatedFails) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 50, 8192, HWM_WRITE_FLAG, 0x20));
+
+  const string path = TempFile();
+  ASSERT_EQ(0, ProfileLog::Save(path, log));
+  ASSERT_EQ(0, truncate(path.c_str(), ProfileLog::kDataAlignment + 512));
+
+  vector<disk_write> read;
+  EXPECT_GT(0, ProfileLog::Load(path, arena, read));
+  unlink(path.c_str());
+}
+
+TEST(ProfileLog, WrappingOffsetsFail) {
+  DiskWriteArena arena;
+  vector<disk_write> log;
+  log.push_back(MakeWrite(arena, 50, 8192, HWM_WRITE_FLAG, 0x20));
+
+  // Header fields (num_entries, data_offset) and the data position of the
+  // first metadata entry, each set to a value whose sum with its size wraps
+  // around to something that fits in the file.
+  const struct {
+    off_t offset;
+    uint64_t value;
+  } corruptions[] = {
+    {16, 0x0555555555555556ULL},
+    {48, UINT64_MAX - 100},
+    {ProfileLog::kHeaderSize + 40, UINT64_MAX - 10},
+  };
+  for (const auto &corruption : corruptions) {
+    const string path = TempFile();
+    ASSERT_EQ(0, ProfileLog::Save(path, log));
+    const int fd = open(path.c_str(), O_WRONLY);
+    ASSERT_LE(0, fd);
+    const uint64_t be = htobe64(corruption.value);
+    ASSERT_EQ((ssize_t) sizeof(be),
+        pwrite(fd, &be, sizeof(be), corruption.offset));
+    close(fd);
+
+    vector<disk_write> read;
+    EXPECT_GT(0, ProfileLog::Load(path, arena, read)) << corruption.offset;
+    unlink(path.c_str());
+  }
+}
+
+}  // namespace test
+}  // namespace fs_testing
@@ -16,7 +16,7 @@ sudo apt-get install -y git
 sudo apt-get install -y sshpass # to enter password for ssh non-interactively
 
 git clone https://github.com/utsaslab/crashmonkey
-sudo apt-get install -y btrfs-tools f2fs-tools xfsprogs libelf-dev
+sudo apt-get install -y btrfs-tools f2fs-tools xfsprogs libelf-dev zlib1g-dev
 
 cd ~/
 
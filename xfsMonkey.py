@@ -9,6 +9,10 @@ import stat
 import subprocess
 import argparse
 import time
+import json
+import pipes
+import threading
+import Queue
 
 
 class Log(object):
@@ -33,19 +37,136 @@ def build_parser():
     parser.add_argument('--iterations', '-s', default=10000, type=int, help='Number of random crash states to test on. Default = 1000')
     parser.add_argument('--test_dev', '-d', default='/dev/cow_ram0', help='Test device. Default = /dev/cow_ram0')
     parser.add_argument('--flag_dev', '-f', default='/dev/sda', help='Flag device. Default = /dev/sda')
+    parser.add_argument('--image_cache', '-i', default='', help='Directory to cache freshly formatted disk images in so tests with the same file system and disk size skip mkfs. Default = no cache')
+    parser.add_argument('--daemon', '-D', default=False, action='store_true', help='Run every test in one long-lived c_harness that keeps its kernel modules loaded. Default = one c_harness per test')
+    parser.add_argument('--workers', '-w', default='', help='File listing the machines to shard tests across, one [user@]host[:crashmonkey_dir] per line (e.g. VMs made with setup/create_vm.sh), or "local" for this machine. Default = run every test on this machine')
+    parser.add_argument('--durations', default='build/xfsMonkey_durations.json', help='File of per-test run times from earlier runs, used to start the longest tests first. Default = build/xfsMonkey_durations.json')
     
     #Requires changes to Makefile to place our xfstests into this folder by default.
     parser.add_argument('--test_path', '-u', default='build/xfsMonkeyTests/', help='Path to xfsMonkeyTests')
     return parser
 
-def cleanup():
+#Where CrashMonkey lives on a worker if its line in the workers file does not
+#say, relative to the home directory of the ssh user
+default_worker_dir = 'projects/crashmonkey'
+
+class Worker(object):
+	"""A machine that runs tests. Commands run in the CrashMonkey directory of
+	the worker, over ssh for remote workers."""
+	def __init__(self, index, spec):
+		self.name = spec
+		if spec == 'local':
+			self.host = None
+			self.dir = '.'
+			#c_harness leaves its diff files in build/
+			self.diff_dir = 'build'
+		else:
+			(self.host, _, self.dir) = spec.partition(':')
+			if not self.dir:
+				self.dir = default_worker_dir
+			#Diff files fetched from the worker are staged here
+			self.diff_dir = 'build/worker' + str(index)
+			subprocess.call('mkdir -p ' + self.diff_dir, shell=True)
+		self.tests = 0
+		self.busy = 0.0
+
+	def wrap(self, command):
+		if self.host is None:
+			return command
+		return ('ssh -n -o BatchMode=yes ' + self.host + ' ' +
+			pipes.quote('cd ' + self.dir + '; ' + command))
+
+	def run(self, command):
+		p = subprocess.Popen(self.wrap(command), stdout=subprocess.PIPE, shell=True)
+		(out, err) = p.communicate()
+		return (out, p.wait())
+
+	def call(self, command):
+		return subprocess.call(self.wrap(command), shell=True)
+
+	def exists(self, path):
+		if self.host is None:
+			return os.path.exists(path)
+		return self.run('test -e ' + path)[1] == 0
+
+	def size(self, path):
+		if self.host is None:
+			return os.path.getsize(path)
+		return int(self.run('stat -c %s ' + path)[0])
+
+	def read_from(self, path, start):
+		if self.host is None:
+			with open(path) as f:
+				f.seek(start)
+				return f.read()
+		return self.run('tail -c +' + str(start + 1) + ' ' + path)[0]
+
+	def copy_test(self, test_file):
+		#Remote workers get the test from this machine before running it
+		if self.host is None:
+			return
+		remote = self.dir + '/build/' + test_file
+		self.call('mkdir -p ' + os.path.dirname('build/' + test_file))
+		subprocess.call('scp -q -o BatchMode=yes build/' + test_file + ' ' +
+			self.host + ':' + remote, shell=True)
+
+	def fetch_diff(self):
+		#Stage the last diff file of a remote worker where the local one would
+		#have left it
+		if self.host is None:
+			return
+		subprocess.call('rm -f ' + self.diff_dir + '/diff*', shell=True)
+		name = self.run('ls build/ | grep diff | tail -n -1')[0].strip()
+		if name:
+			with open(self.diff_dir + '/diff', 'w') as f:
+				f.write(self.run('cat build/' + name)[0])
+		self.call('rm -f build/diff*')
+
+def read_workers(path):
+	if not path:
+		return [Worker(0, 'local')]
+	with open(path) as f:
+		specs = [l.strip() for l in f if l.strip() and not l.startswith('#')]
+	#cow_brd, the wrapper module and the harness sockets are global to a
+	#machine, so it can only run one test at a time
+	if specs.count('local') > 1 or len(set(specs)) != len(specs):
+		print 'Each machine can only be listed once in', path
+		sys.exit(1)
+	return [Worker(i, spec) for i, spec in enumerate(specs)]
+
+def cleanup(worker):
 	#clean up umount and rmmod errors
 	command = 'umount /mnt/snapshot; rmmod ./build/disk_wrapper.ko; rmmod ./build/cow_brd.ko'
-	p=subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, shell=True)
-	(out, err) = p.communicate()
-	p.wait()
+	worker.run('(' + command + ') >/dev/null 2>&1')
 	#print 'Done cleaning up test harness'
 
+#Output of the c_harness daemon, relative to build/
+daemon_out = 'daemon.out'
+daemon_socket = '/tmp/crash_monkey_daemon'
+
+def start_daemon(worker, args):
+	cleanup(worker)
+	worker.run('rm -f ' + daemon_socket)
+	p = subprocess.Popen(worker.wrap('cd build; exec ./c_harness -D ' + args + ' > ' + daemon_out + ' 2>&1'), shell=True)
+	#Wait for the daemon to load its modules and start listening
+	for i in range(600):
+		if worker.exists(daemon_socket) or p.poll() is not None:
+			break
+		time.sleep(0.1)
+	return p
+
+def stop_daemon(worker, p):
+	worker.call('cd build; ./user_tools/end_daemon')
+	p.wait()
+
+def run_queued_test(worker, test_file):
+	#The daemon runs one test at a time, so everything it prints for this test
+	#ends up after the current end of its output
+	out_file = 'build/' + daemon_out
+	start = worker.size(out_file)
+	p_status = worker.call('cd build; ./user_tools/queue_test ' + test_file)
+	return (worker.read_from(out_file, start), p_status)
+
 def get_current_epoch_micros():
     return int(time.time() * 1000)
 
@@ -72,8 +193,119 @@ def print_setup(parsed_args):
 	print '{0:20}  {1}'.format('Test device', parsed_args.test_dev)	
 	print '{0:20}  {1}'.format('Flags device', parsed_args.flag_dev)	
 	print '{0:20}  {1}'.format('Test path', parsed_args.test_path)	
+	print '{0:20}  {1}'.format('Workers', parsed_args.workers or 'local')
 	print '\n', '='*48, '\n'
 
+def run_test(worker, daemon, harness_args, test_file, test_name):
+	"""Run one test on worker, retrying if it fails to run. Returns what to put
+	in the log for it."""
+	#Build command to run c_harness 
+	command = ('cd build; ./c_harness ' + harness_args + ' ' + test_file + ' 2>&1')
+
+	#Cleanup errors due to prev runs if any. The daemon keeps its modules
+	#loaded between tests.
+	if daemon is None:
+		cleanup(worker)
+	worker.copy_test(test_file)
+
+	log = get_time_string() + 'Running test : ' + test_name + ' as Crashmonkey standalone on ' + worker.name + '\n'
+
+	#Sometimes we face an error connecting to socket. So let's retry one more time
+	#if CM throws a error for a particular test.
+	retry = 0
+	while True:
+		if daemon is not None:
+			(output, p_status) = run_queued_test(worker, test_file)
+		else:
+			(output, p_status) = worker.run(command)
+
+		# Printing the output on stdout seems too noisy. It's cleaner to have only the result
+		# of each test printed. However due to the long writeback delay, it seems as though
+		# the test case hung. 
+		# (TODO : Add a flag in c_harness to interactively print when we wait for writeback
+		# or start testing)
+		res = re.sub(r'(?s).*Reordering', '\nReordering', output, flags=re.I)
+		res_final = re.sub(r'==.*(?s)', '\n', res)
+
+		#print output
+		retry += 1
+		if (p_status == 0 or retry == 4):
+			if retry == 4 and p_status != 0 :
+				log += get_time_string() + 'Could not run test : ' + test_name
+			else:
+				log += res_final
+			break
+		else:
+			error = re.sub(r'(?s).*error', '\nError', output, flags=re.I)
+			log += get_time_string() +  error
+			#os.system('bash vm_scripts/cm_cleanup.sh')
+			if daemon is None:
+				cleanup(worker)
+			log += get_time_string() + 'Retry running ' + test_name + '\n' + get_time_string() + 'Running... '
+	worker.fetch_diff()
+	return log
+
+#Serializes writes to the log, the diff results and the bug counts
+report_lock = threading.Lock()
+
+def record_result(worker, test_num, test_name, log, log_file_handle):
+	with report_lock:
+		log_file_handle.write('\n' + '-'*20 + 'Test #' + `test_num` +  '-'*20 + '\n')
+		log_file_handle.write(log)
+		sys.stdout.write('Running test #' + str(test_num) + ' : ' + test_name)
+
+		#Get the last numbered diff file if present, and clean up diffs
+		subprocess.call('cat ' + worker.diff_dir + '/$(ls ' + worker.diff_dir + ' | grep diff | tail -n -1) > out 2>/dev/null', shell=True)
+		diff_command = './copy_diff.sh out ' + test_name + ' 1 ' + worker.diff_dir
+		subprocess.call(diff_command, shell=True)
+
+def run_worker(worker, tests, test_dir, harness_args, daemon_mode, durations, log_file_handle):
+	"""Run tests off the shared queue on worker until none are left. Each worker
+	takes the next test as soon as it is done with its last one."""
+	daemon = None
+	if daemon_mode:
+		daemon = start_daemon(worker, harness_args)
+	try:
+		while True:
+			try:
+				(test_num, filename) = tests.get_nowait()
+			except Queue.Empty:
+				break
+			test_name = filename.replace('.so', '')
+
+			#Get full test file path
+			test_file = test_dir + filename
+
+			start = time.time()
+			log = run_test(worker, daemon, harness_args, test_file, test_name)
+			duration = time.time() - start
+			record_result(worker, test_num, test_name, log, log_file_handle)
+
+			worker.tests += 1
+			worker.busy += duration
+			durations[test_name] = duration
+	finally:
+		if daemon is not None:
+			stop_daemon(worker, daemon)
+
+def load_durations(path):
+	try:
+		with open(path) as f:
+			return json.load(f)
+	except (IOError, ValueError):
+		return {}
+
+def save_durations(path, durations):
+	with open(path, 'w') as f:
+		json.dump(durations, f, indent=1, sort_keys=True)
+
+def schedule(filenames, durations):
+	#Start the longest tests first so the short ones fill in at the end of the
+	#run. Tests that have not been timed yet could be the longest of all.
+	def expected(filename):
+		return durations.get(filename.replace('.so', ''), float('inf'))
+	return sorted(sorted(filenames), key=expected, reverse=True)
+
 def main():
 
 	# Open the log file
@@ -87,9 +319,8 @@ def main():
 	#Print the test setup
 	print_setup(parsed_args)
 
-	#Assign a test num
-	test_num = 0
-	
+	workers = read_workers(parsed_args.workers)
+
 	#This is the directory that contains the bug reports from this xfsMonkey run
 	subprocess.call('mkdir diff_results', shell=True)
 	subprocess.call('echo 0 > missing; echo 0 > stat; echo 0 > bugs; echo 0 > others', shell=True)    
@@ -97,77 +328,47 @@ def main():
 	#Get the relative path to test directory
 	xfsMonkeyTestPath = './' + parsed_args.test_path
 
-	for filename in os.listdir(xfsMonkeyTestPath):
-		if filename.endswith('.so'): 
+	#c_harness runs from build/, so hand it an absolute path to the image cache
+	image_cache_arg = ''
+	if parsed_args.image_cache:
+		subprocess.call('mkdir -p ' + parsed_args.image_cache, shell=True)
+		image_cache_arg = ' -i ' + os.path.abspath(parsed_args.image_cache)
+		for worker in workers:
+			if worker.host is not None:
+				worker.call('mkdir -p ' + parsed_args.image_cache)
 
-			#Assign a snapshot file name for replay using CrashMonkey.
-			#If we have a large number of tests in the test suite, then this might blow 
-			#up space. (Feature not implemented yet).
-			snapshot = filename.replace('.so', '') + '_' + parsed_args.fs_type
+	harness_args = ('-v -c -P -f '+ parsed_args.flag_dev +' -d '+
+	parsed_args.test_dev +' -t ' + parsed_args.fs_type + ' -e ' +
+	str(parsed_args.disk_size) + image_cache_arg)
+
+	durations = load_durations(parsed_args.durations)
+	filenames = [f for f in os.listdir(xfsMonkeyTestPath) if f.endswith('.so')]
+	tests = Queue.Queue()
+	#Assign a test num
+	for test_num, filename in enumerate(schedule(filenames, durations), 1):
+		tests.put((test_num, filename))
+
+	start = time.time()
+	threads = []
+	for worker in workers:
+		t = threading.Thread(target=run_worker, args=(worker, tests,
+			xfsMonkeyTestPath.replace('./build/', ''), harness_args,
+			parsed_args.daemon, durations, log_file_handle))
+		t.daemon = True
+		t.start()
+		threads.append(t)
+	for t in threads:
+		#join with a timeout so Ctrl-C still reaches this thread
+		while t.is_alive():
+			t.join(1)
+	save_durations(parsed_args.durations, durations)
+
+	if len(workers) > 1:
+		log_file_handle.write('\n' + '='*20 + ' Workers ' + '='*20 + '\n')
+		for worker in workers:
+			log_file_handle.write('{0:30}  {1:5} tests  {2:10.1f}s busy\n'.format(worker.name, worker.tests, worker.busy))
+		log_file_handle.write('{0:30}  {1:5} tests  {2:10.1f}s wall\n'.format('Total', len(filenames), time.time() - start))
 
-			#Get full test file path
-			test_file = xfsMonkeyTestPath.replace('./build/', '') + filename
-
-			#Build command to run c_harness 
-			command = ('cd build; ./c_harness -v -c -P -f '+ parsed_args.flag_dev +' -d '+
-			parsed_args.test_dev +' -t ' + parsed_args.fs_type + ' -e ' + 
-			str(parsed_args.disk_size) + ' ' + test_file + ' 2>&1')
-	
-			#Cleanup errors due to prev runs if any
-			cleanup()
-
-
-			#Print the test number
-			test_num+=1
-			log = '\n' + '-'*20 + 'Test #' + `test_num` +  '-'*20 + '\n'
-			log_file_handle.write(log)
-
-			#Run the test now
-			log =  get_time_string() + 'Running test : '+ filename.replace('.so', '') + 'as Crashmonkey standalone \n'
-			log_file_handle.write(log)
-			sys.stdout.write('Running test #' + str(test_num) + ' : ' + filename.replace('.so', '')) 
-			#get_time_string(), 'Running...'
-			
-			#Sometimes we face an error connecting to socket. So let's retry one more time
-			#if CM throws a error for a particular test.
-			retry = 0
-			while True:
-				p=subprocess.Popen(command, stdout=subprocess.PIPE, shell=True)
-				(output,err)=p.communicate()
-				p_status=p.wait()
-
-				# Printing the output on stdout seems too noisy. It's cleaner to have only the result
-				# of each test printed. However due to the long writeback delay, it seems as though
-				# the test case hung. 
-				# (TODO : Add a flag in c_harness to interactively print when we wait for writeback
-				# or start testing)
-				res = re.sub(r'(?s).*Reordering', '\nReordering', output, flags=re.I)
-				res_final = re.sub(r'==.*(?s)', '\n', res)
-
-				#print output
-				retry += 1
-				if (p_status == 0 or retry == 4):
-					if retry == 4 and p_status != 0 :
-						log_file_handle.write(get_time_string() + 'Could not run test : ' + filename.replace('.so', ''))
-					else:
-						log_file_handle.write(res_final)	
-					break
-				else:
-					error = re.sub(r'(?s).*error', '\nError', output, flags=re.I)
-					log_file_handle.write(get_time_string() +  error)
-					#os.system('bash vm_scripts/cm_cleanup.sh')
-					cleanup()
-					log_file_handle.write(get_time_string() + 'Retry running ' + filename.replace('.so', '') + '\n' + get_time_string() + 'Running... ')	 
-			file = filename.replace('.so', '')			
-			#diff_command = 'tail -vn +1 build/diff* >> diff_results/' + file  + '; rm build/diff*' 
-			#subprocess.call('cat build/diff* > out', shell=True)
-            
-			#Get the last numbered diff file if present, and clean up diffs
-			subprocess.call('cat build/$(ls build/ | grep diff | tail -n -1) > out 2>/dev/null', shell=True)
-			diff_command = './copy_diff.sh out ' + file + ' 1'
-			#subprocess.call('tail -vn +1 build/diff*', shell=True)
-			subprocess.call(diff_command, shell=True)
-			
 	log_file_handle.write('\n'+ get_time_string() + ': Test completed. See ' + log_file + ' for test summary\n')
 	#Stop logging
 	sys.stdout = original